@@ -0,0 +1,113 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <lewis/ir.hpp>
+#include <lewis/pass-manager.hpp>
+#include <lewis/passes.hpp>
+
+namespace lewis {
+
+// The analyses in this file only understand the branches of generic IR.
+
+// Returns the distinct successors of a BasicBlock.
+std::vector<BasicBlock *> successors(BasicBlock *bb);
+
+//---------------------------------------------------------------------------------------
+// DominatorTree class.
+//---------------------------------------------------------------------------------------
+
+// Dominators of the BasicBlocks that are reachable from the entry block (i.e., the first
+// block of the Function). Computed by the iterative algorithm of Cooper, Harvey and Kennedy.
+struct DominatorTree : FunctionAnalysis {
+    static constexpr PassIdType passId = pass_ids::dominatorTree;
+
+    static std::unique_ptr<DominatorTree> compute(Function *fn, AnalysisManager *am);
+
+    bool isReachable(BasicBlock *bb) {
+        return _rpoIndices.count(bb);
+    }
+
+    // Returns nullptr for the entry block and for unreachable blocks.
+    BasicBlock *immediateDominator(BasicBlock *bb);
+
+    // Every reachable block dominates itself.
+    bool dominates(BasicBlock *a, BasicBlock *b);
+
+    // Reachable blocks only; the entry block comes first.
+    const std::vector<BasicBlock *> &reversePostOrder() {
+        return _rpo;
+    }
+
+    // Includes unreachable predecessors.
+    const std::vector<BasicBlock *> &predecessors(BasicBlock *bb) {
+        return _predecessors[bb];
+    }
+
+private:
+    std::vector<BasicBlock *> _rpo;
+    std::unordered_map<BasicBlock *, size_t> _rpoIndices;
+    // Indexed by reverse post-order.
+    std::vector<size_t> _idoms;
+    std::unordered_map<BasicBlock *, std::vector<BasicBlock *>> _predecessors;
+};
+
+//---------------------------------------------------------------------------------------
+// LoopInfo class.
+//---------------------------------------------------------------------------------------
+
+// Natural loop. Back-edges to the same header belong to the same Loop.
+struct Loop {
+    bool contains(BasicBlock *bb) {
+        return _blockSet.count(bb);
+    }
+
+    void addBlock(BasicBlock *bb) {
+        if (_blockSet.insert(bb).second)
+            blocks.push_back(bb);
+    }
+
+    BasicBlock *header = nullptr;
+    Loop *parent = nullptr;
+    std::vector<Loop *> children;
+    // Sources of the back-edges.
+    std::vector<BasicBlock *> latches;
+    // All blocks, including those of nested Loops. The header comes first.
+    std::vector<BasicBlock *> blocks;
+
+private:
+    std::unordered_set<BasicBlock *> _blockSet;
+};
+
+struct LoopInfo : FunctionAnalysis {
+    static constexpr PassIdType passId = pass_ids::loopInfo;
+
+    static std::unique_ptr<LoopInfo> compute(Function *fn, AnalysisManager *am);
+
+    // Innermost Loop that contains bb or nullptr.
+    Loop *loopFor(BasicBlock *bb) {
+        auto it = _innermost.find(bb);
+        if (it == _innermost.end())
+            return nullptr;
+        return it->second;
+    }
+
+    // Nested Loops come before the Loops that contain them.
+    std::vector<Loop *> loops() {
+        std::vector<Loop *> result;
+        for (auto &loop : _loops)
+            result.push_back(loop.get());
+        return result;
+    }
+
+private:
+    std::vector<std::unique_ptr<Loop>> _loops;
+    std::unordered_map<BasicBlock *, Loop *> _innermost;
+};
+
+} // namespace lewis
@@ -8,12 +8,23 @@
 namespace lewis::elf {
 
 struct FileEmitter {
+    // Builds the file in buffer.
     static std::unique_ptr<FileEmitter> create(Object *elf);
 
+    // Writes the file directly to fd (starting at offset zero) using pwritev().
+    // Only the headers are encoded in memory; the contents of ByteSections are never copied.
+    static std::unique_ptr<FileEmitter> createForFile(Object *elf, int fd);
+
     virtual ~FileEmitter() = default;
 
     virtual void run() = 0;
 
+    // Only writes the parts of the file that are listed in Object::modifiedRanges and
+    // Object::modifiedSymbols (to the file or to buffer). Requires that run() was called
+    // before and that the layout did not change since then.
+    virtual void update() = 0;
+
+    // Contents of the file. Stays empty for FileEmitters created by createForFile().
     std::vector<uint8_t> buffer;
 };
 
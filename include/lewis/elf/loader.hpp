@@ -0,0 +1,41 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace lewis::elf {
+
+// Returns the address of an undefined symbol of a LoadedImage or nullptr if it is unknown.
+using SymbolResolver = std::function<void *(const char *name)>;
+
+// ET_DYN file (as produced by FileEmitter) that is mapped into the current process.
+// In contrast to dlopen(), loading and unloading do not take any global locks
+// and the image is never added to the link map of the system dynamic linker.
+// Only the relocations that lewis emits (plus R_X86_64_64 and R_X86_64_RELATIVE)
+// are supported; there are no initializers, no TLS and no unwinding information
+// is registered. Throws std::runtime_error if the file cannot be loaded.
+// The image is unmapped on destruction.
+struct LoadedImage {
+    // Copies the segments out of the file that is stored in data.
+    static std::unique_ptr<LoadedImage> load(const uint8_t *data, size_t size,
+            const SymbolResolver &resolver);
+
+    // Maps the segments of the file directly from fd.
+    static std::unique_ptr<LoadedImage> loadFromFile(int fd, const SymbolResolver &resolver);
+
+    virtual ~LoadedImage() = default;
+
+    // Looks up a symbol through the GNU hash table (or the SysV hash table).
+    // Returns nullptr if the image does not define the symbol.
+    virtual void *lookup(const char *name) = 0;
+
+    // Address that corresponds to virtual address zero of the file.
+    virtual uint8_t *base() = 0;
+};
+
+} // namespace lewis::elf
@@ -6,6 +6,8 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <frg/list.hpp>
 #include <lewis/hierarchy.hpp>
@@ -14,6 +16,14 @@ namespace lewis::elf {
 
 using FragmentKindType = uint32_t;
 
+enum class FileType {
+    // ET_DYN image that can be loaded directly. Calls to external functions go through
+    // a PLT and GOT that are created by lewis.
+    sharedObject,
+    // ET_REL object that is meant to be linked by the system linker.
+    relocatable
+};
+
 namespace fragment_kinds {
     enum : FragmentKindType {
         null,
@@ -25,7 +35,9 @@ namespace fragment_kinds {
         stringTableSection,
         symbolTableSection,
         relocationSection,
-        hashSection
+        hashSection,
+        ehFrameHeaderSection,
+        gnuHashSection
     };
 }
 
@@ -104,6 +116,9 @@ public:
     FragmentUse sectionLink;
     std::optional<size_t> sectionInfo;
     std::optional<size_t> entrySize;
+    // Required alignment of fileOffset and virtualAddress (i.e. sh_addralign).
+    // Must be a power of two and at most the page size.
+    size_t alignment = 8;
 
 private:
     frg::intrusive_list<
@@ -157,6 +172,10 @@ struct StringTableSection : Fragment,
         CastableIfFragmentKind<StringTableSection, fragment_kinds::stringTableSection> {
     StringTableSection()
     : Fragment{fragment_kinds::stringTableSection} { }
+
+    // Strings that are written to the table, in order. Computed by the LayoutPass;
+    // all other strings are suffixes of these strings and share their bytes.
+    std::vector<String *> storedStrings;
 };
 
 struct String {
@@ -173,24 +192,104 @@ struct SymbolTableSection : Fragment,
     : Fragment{fragment_kinds::symbolTableSection} { }
 };
 
+struct Symbol;
+struct Relocation;
+
+// Represents the reference of a Relocation to a Symbol. Symbols keep track of all references
+// to them, so that only the affected Relocations need to be applied again if a Symbol moves.
+// For convenience, this class also has a Symbol pointer-like interface.
+struct SymbolUse {
+    friend struct Symbol;
+
+    SymbolUse(Relocation *owner)
+    : _owner{owner}, _ref{nullptr} { }
+
+    SymbolUse(const SymbolUse &) = delete;
+
+    ~SymbolUse() {
+        assign(nullptr);
+    }
+
+    SymbolUse &operator= (const SymbolUse &) = delete;
+
+    void assign(Symbol *s);
+
+    Symbol *get() {
+        return _ref;
+    }
+
+    // The Relocation that contains this SymbolUse.
+    Relocation *owner() {
+        return _owner;
+    }
+
+    // The following operators define the pointer-like interface.
+
+    SymbolUse &operator= (Symbol *s) {
+        assign(s);
+        return *this;
+    }
+
+    bool operator== (Symbol *s) { return _ref == s; }
+    bool operator!= (Symbol *s) { return _ref != s; }
+
+    explicit operator bool () { return _ref; }
+
+    Symbol &operator* () { return *_ref; }
+    Symbol *operator-> () { return _ref; }
+
+private:
+    Relocation *_owner;
+    Symbol *_ref;
+    frg::default_list_hook<SymbolUse> _useListHook;
+};
+
 struct Symbol {
+    friend struct SymbolUse;
+
+    // Calls fn(Relocation *) for each Relocation that refers to this Symbol.
+    template<typename F>
+    void forEachUse(F fn) {
+        for (auto use : _useList)
+            fn(use->owner());
+    }
+
     String *name = nullptr;
     FragmentUse section;
     size_t value = 0;
+    size_t size = 0;
+    // Local symbols are only visible inside of the file. They precede all global symbols.
+    bool local = false;
 
     std::optional<size_t> designatedIndex;
+
+private:
+    frg::intrusive_list<
+        SymbolUse,
+        frg::locate_member<
+            SymbolUse,
+            frg::default_list_hook<SymbolUse>,
+            &SymbolUse::_useListHook
+        >
+    > _useList;
 };
 
 struct RelocationSection : Fragment,
         CastableIfFragmentKind<RelocationSection, fragment_kinds::relocationSection> {
     RelocationSection()
     : Fragment{fragment_kinds::relocationSection} { }
+
+    // For relocatable files: the section that the internal relocations in this section
+    // apply to. Otherwise, the section contains the dynamic relocations.
+    FragmentUse appliesTo;
 };
 
 struct Relocation {
+    // R_X86_64_* relocation type.
+    uint32_t type = 0;
     FragmentUse section;
     ptrdiff_t offset = -1;
-    Symbol *symbol = nullptr;
+    SymbolUse symbol{this};
     std::optional<ptrdiff_t> addend;
 
     std::optional<size_t> designatedIndex;
@@ -205,7 +304,60 @@ struct HashSection : Fragment,
     std::vector<Symbol *> chains;
 };
 
+// DT_GNU_HASH table. Only defined symbols are hashed; the LayoutPass orders them by bucket
+// after all undefined symbols.
+struct GnuHashSection : Fragment,
+        CastableIfFragmentKind<GnuHashSection, fragment_kinds::gnuHashSection> {
+    GnuHashSection()
+    : Fragment{fragment_kinds::gnuHashSection} { }
+
+    // Index of the first hashed symbol.
+    size_t symbolOffset = 0;
+    size_t bloomShift = 26;
+    std::vector<uint64_t> bloom;
+    // First symbol of each bucket.
+    std::vector<Symbol *> buckets;
+    // Hash values of all hashed symbols; the lowest bit marks the end of each bucket.
+    std::vector<uint32_t> chains;
+};
+
+// .eh_frame_hdr: binary search table that maps functions to their FDEs in .eh_frame.
+struct EhFrameHeaderSection : Fragment,
+        CastableIfFragmentKind<EhFrameHeaderSection, fragment_kinds::ehFrameHeaderSection> {
+    EhFrameHeaderSection()
+    : Fragment{fragment_kinds::ehFrameHeaderSection} { }
+
+    struct Entry {
+        Symbol *function = nullptr;
+        // Offset of the FDE inside of the .eh_frame section.
+        size_t fdeOffset = 0;
+    };
+
+    FragmentUse ehFrame;
+    std::vector<Entry> entries;
+};
+
+// A PT_LOAD segment. Segments are computed by the LayoutPass from the section flags:
+// all Fragments with the same permissions are packed into a single segment.
+struct Segment {
+    uint32_t flags = 0; // PF_R, PF_W and PF_X.
+    uintptr_t fileOffset = 0;
+    uintptr_t virtualAddress = 0;
+    size_t fileSize = 0;
+    size_t memorySize = 0;
+};
+
+// Part of a Fragment that was modified after the file was emitted.
+struct ModifiedRange {
+    Fragment *fragment = nullptr;
+    size_t offset = 0;
+    size_t size = 0;
+};
+
 struct Object {
+    // Must be set before any code is emitted into the Object.
+    FileType fileType = FileType::sharedObject;
+
     // -------------------------------------------------------------------------------------
     // Fragment management.
     // -------------------------------------------------------------------------------------
@@ -279,6 +431,11 @@ struct Object {
     FragmentUse symbolTableFragment;
     FragmentUse pltRelocationFragment;
     FragmentUse hashFragment;
+    FragmentUse gnuHashFragment;
+    FragmentUse ehFrameHeaderFragment;
+
+    // Filled in by the LayoutPass, in the order of their virtual addresses.
+    std::vector<Segment> segments;
 
     // -------------------------------------------------------------------------------------
     // String management.
@@ -331,6 +488,9 @@ struct Object {
         return ptr;
     }
 
+    // Returns the String with the given contents. Only creates a new String if necessary.
+    String *internString(const std::string &buffer);
+
     StringRange strings() {
         return StringRange{this};
     }
@@ -476,9 +636,27 @@ struct Object {
         return InternalRelocationRange{this};
     }
 
+    // Takes time linear in the number of internal relocations.
+    void eraseInternalRelocation(Relocation *relocation);
+
+    // -------------------------------------------------------------------------------------
+    // Incremental updates (e.g. by MachineCodeEmitter::replace()).
+    // -------------------------------------------------------------------------------------
+
+    // Internal relocations that InternalLinkPass::update() needs to apply again.
+    std::vector<Relocation *> staleRelocations;
+
+    // Parts of the file that FileEmitter::update() needs to write again.
+    std::vector<ModifiedRange> modifiedRanges;
+
+    // Symbols whose symbol table entries FileEmitter::update() needs to write again.
+    std::vector<Symbol *> modifiedSymbols;
+
 private:
     std::vector<std::unique_ptr<Fragment>> _fragments;
     std::vector<std::unique_ptr<String>> _strings;
+    // Keys point into String::buffer.
+    std::unordered_map<std::string_view, String *> _stringPool;
     std::vector<std::unique_ptr<Symbol>> _symbols;
     std::vector<std::unique_ptr<Relocation>> _relocations;
     std::vector<std::unique_ptr<Relocation>> _internalRelocations;
@@ -16,9 +16,16 @@ struct ObjectPass {
 
 // The following passes are implemented using Pimpl.
 
-// Creates header fragments required for the desired file type.
+// Creates header fragments required for the file type of the Object.
 struct CreateHeadersPass : ObjectPass {
     static std::unique_ptr<CreateHeadersPass> create(Object *elf);
+
+    // Emit a SysV DT_HASH table (only for FileType::sharedObject).
+    bool sysvHash = true;
+
+    // Emit a DT_GNU_HASH table (only for FileType::sharedObject).
+    // At least one of the hash tables is required.
+    bool gnuHash = true;
 };
 
 // Layouts fragments in the file and in virtual memory.
@@ -26,9 +33,14 @@ struct LayoutPass : ObjectPass {
     static std::unique_ptr<LayoutPass> create(Object *elf);
 };
 
-// Perform internal linking.
+// Perform internal linking. Does nothing for FileType::relocatable; the internal
+// relocations are emitted as .rela sections instead.
 struct InternalLinkPass : ObjectPass {
     static std::unique_ptr<InternalLinkPass> create(Object *elf);
+
+    // Only applies the relocations in Object::staleRelocations and records the patched
+    // bytes in Object::modifiedRanges. The layout must not have changed since run().
+    virtual void update() = 0;
 };
 
 } // namespace lewis::elf
@@ -15,4 +15,14 @@ inline void encodeWord(util::ByteEncoder &enc, uint32_t v) { encode32(enc, v); }
 inline void encodeXword(util::ByteEncoder &enc, uint64_t v) { encode64(enc, v); }
 inline void encodeSxword(util::ByteEncoder &enc, int64_t v) { encode64(enc, v); }
 
+// Pointer encodings used by .eh_frame and .eh_frame_hdr (DW_EH_PE_* constants).
+namespace eh_pointer_encodings {
+    enum : uint8_t {
+        udata4 = 0x03,
+        sdata4 = 0x0B,
+        pcrel = 0x10,
+        datarel = 0x30
+    };
+}
+
 } // namespace lewis::elf
@@ -0,0 +1,57 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <lewis/ir.hpp>
+#include <lewis/util/byte-decode.hpp>
+#include <lewis/util/byte-encode.hpp>
+
+namespace lewis {
+
+// Compact binary serialization of generic IR.
+//
+// A stream starts with the magic "LWIR" and the format version. It is followed by any number
+// of Function records. All integers are LEB128 varints (signed integers are zig-zag encoded).
+// Each Function record consists of:
+//   * The name of the Function.
+//   * A type table that lists the typeKind of every Type used by the Function.
+//   * The number of blocks, followed by all blocks. Each block contains its phis,
+//     its instructions, its branch and the data-flow edges that originate in the block.
+// Values are referenced by the order of their definition (phis first, then instruction
+// results, block by block), blocks by their position and types by their index
+// into the type table. In all cases, zero denotes nullptr.
+
+constexpr uint32_t binaryIrVersion = 1;
+
+// Appends Functions to a byte buffer one at a time.
+struct BinaryIrWriter {
+    // Writes the stream header.
+    BinaryIrWriter(std::vector<uint8_t> *out);
+
+    void writeFunction(Function *fn);
+    void writeModule(Module *mod);
+
+private:
+    util::ByteEncoder _enc;
+};
+
+// Reconstructs Functions from a buffer that is owned by the caller.
+// The buffer is not copied. Throws std::runtime_error on malformed input.
+struct BinaryIrReader {
+    // Validates the stream header.
+    BinaryIrReader(const uint8_t *data, size_t size);
+
+    bool atEnd();
+
+    std::unique_ptr<Function> readFunction();
+    void readModule(Module *mod);
+
+private:
+    util::ByteDecoder _dec;
+};
+
+} // namespace lewis
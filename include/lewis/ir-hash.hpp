@@ -0,0 +1,32 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <lewis/ir.hpp>
+
+namespace lewis {
+
+// Canonical, structural description of a Function in generic IR.
+// Two Functions have the same key if and only if they consist of the same instructions,
+// constants, types and control flow. Names of Functions and addresses of IR objects
+// do not influence the key.
+struct IrKey {
+    bool operator== (const IrKey &other) const {
+        return hash == other.hash && bytes == other.bytes;
+    }
+    bool operator!= (const IrKey &other) const {
+        return !(*this == other);
+    }
+
+    // Canonical encoding of the Function.
+    std::vector<uint8_t> bytes;
+    // 64-bit FNV-1a hash of bytes.
+    uint64_t hash = 0;
+};
+
+IrKey computeIrKey(Function *fn);
+
+} // namespace lewis
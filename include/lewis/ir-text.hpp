@@ -0,0 +1,165 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <lewis/ir.hpp>
+
+namespace lewis {
+
+// Textual IR syntax. Example:
+//
+//   function "example" {
+//   b0:
+//       %0:pointer = argument
+//       %1:int32 = loadOffset %0, 8
+//       %2:int32 = const 4
+//       %3:int32 = add %1, %2
+//       %4:int32 = invoke "helper"(%0, %3)
+//       branch %4, b1, b2
+//       edge %5 <- %4
+//   b1:
+//       %5:int32 = phi
+//       return %5
+//   b2:
+//       jump b1
+//   }
+//
+// Values are defined as %<id>[:<type>][@<mode>(...)]. The mode is only used by target IR.
+// Data-flow edges are listed in their source block and refer to the value of the sink phi.
+// Comments start with ';' and extend to the end of the line.
+
+struct IrPrinter;
+struct IrParser;
+
+// Teaches IrPrinter and IrParser about target-specific IR.
+struct IrTextDialect {
+    virtual ~IrTextDialect() = default;
+
+    // Printer hooks. Return false if the object is unknown to the dialect.
+    virtual bool printInstruction(IrPrinter &printer, Instruction *inst) = 0;
+    virtual bool printBranch(IrPrinter &printer, Branch *branch) = 0;
+    // Prints the @<mode>(...) part of a definition.
+    virtual bool printValueMode(IrPrinter &printer, Value *v) = 0;
+
+    // Parser hooks. Return nullptr if the mnemonic is unknown to the dialect.
+    // Hooks are only allowed to consume input if they recognize the mnemonic.
+    virtual Instruction *parseInstruction(IrParser &parser, const std::string &mnemonic,
+            BasicBlock *bb) = 0;
+    virtual Branch *parseBranch(IrParser &parser, const std::string &mnemonic,
+            BasicBlock *bb) = 0;
+    virtual std::unique_ptr<Value> parseValueMode(IrParser &parser,
+            const std::string &mode) = 0;
+};
+
+struct IrPrinter {
+    IrPrinter(std::ostream &out, IrTextDialect *dialect = nullptr)
+    : _out{out}, _dialect{dialect} { }
+
+    void printFunction(Function *fn);
+    void printModule(Module *mod);
+
+    // Helpers for dialects.
+    std::ostream &stream() { return _out; }
+    void printDefinition(Value *v);
+    void printUse(Value *v);
+    void printBlock(BasicBlock *bb);
+    void printString(const std::string &s);
+
+private:
+    void _printInstruction(Instruction *inst);
+    void _printBranch(Branch *branch);
+
+    std::ostream &_out;
+    IrTextDialect *_dialect;
+    std::unordered_map<BasicBlock *, size_t> _blocks;
+    std::unordered_map<Value *, size_t> _values;
+};
+
+// Single-pass parser. Throws std::runtime_error on malformed input.
+// The input is not copied and must outlive the parser.
+struct IrParser {
+    IrParser(const char *text, size_t size, IrTextDialect *dialect = nullptr)
+    : _p{text}, _limit{text + size}, _dialect{dialect} { }
+
+    bool atEnd();
+
+    std::unique_ptr<Function> parseFunction();
+    void parseModule(Module *mod);
+
+    // Helpers for dialects.
+    [[noreturn]] void fail(const std::string &message);
+    bool peek(char c);
+    bool tryConsume(char c);
+    void expect(char c);
+    std::string parseIdentifier();
+    uint64_t parseUnsigned();
+    int64_t parseSigned();
+    std::string parseString();
+    Value *parseUse();
+    // Parses a parenthesized, comma-separated list of Values.
+    std::vector<Value *> parseUseList();
+    BasicBlock *parseBlock();
+
+    // Number of results on the left-hand side of the current instruction.
+    size_t numDefinitions() { return _definitions.size() - _numConsumed; }
+    // Attaches the next result of the current instruction to origin.
+    void define(ValueOrigin &origin);
+
+private:
+    struct Definition {
+        uint64_t id;
+        std::unique_ptr<Value> value;
+    };
+
+    struct PendingEdge {
+        BasicBlock *source;
+        uint64_t sink;
+        uint64_t alias;
+        size_t line;
+    };
+
+    struct ForwardValue {
+        std::unique_ptr<Value> placeholder;
+        // Line of the first use.
+        size_t line;
+    };
+
+    void _skipSpace();
+    bool _peekIdentifier();
+    Definition _parseDefinition();
+    Value *_lookup(uint64_t id);
+    BasicBlock *_getBlock(uint64_t id);
+    void _parseStatement(BasicBlock *bb);
+    bool _parseGenericInstruction(const std::string &mnemonic, BasicBlock *bb);
+    bool _parseGenericBranch(const std::string &mnemonic, BasicBlock *bb);
+
+    const char *_p;
+    const char *_limit;
+    size_t _line = 1;
+    IrTextDialect *_dialect;
+
+    // Per-Function state.
+    Function *_fn = nullptr;
+    std::unordered_map<uint64_t, BasicBlock *> _blocks;
+    // Blocks that are referenced before their label.
+    std::unordered_map<uint64_t, std::unique_ptr<BasicBlock>> _forwardBlocks;
+    std::unordered_map<uint64_t, Value *> _values;
+    // Values that are used before they are defined.
+    std::unordered_map<uint64_t, ForwardValue> _forwardValues;
+    // Values can only be used in the block that defines them (other blocks receive them
+    // through phis). For forward values, this is the block of the first use.
+    std::unordered_map<Value *, BasicBlock *> _valueBlocks;
+    BasicBlock *_currentBlock = nullptr;
+    std::unordered_map<Value *, DataFlowPhi *> _phis;
+    std::vector<PendingEdge> _edges;
+    std::vector<Definition> _definitions;
+    size_t _numConsumed = 0;
+};
+
+} // namespace lewis
@@ -33,7 +33,9 @@ namespace type_kinds {
         null,
         pointer,
         int32,
-        int64
+        int64,
+        int8,
+        int16
     };
 }
 
@@ -44,7 +46,11 @@ struct Type {
     const TypeKindType typeKind;
 };
 
+// Types are immutable. The global types are shared by all Functions;
+// it is safe to access them from multiple threads.
 Type *globalPointerType();
+Type *globalInt8Type();
+Type *globalInt16Type();
 Type *globalInt32Type();
 Type *globalInt64Type();
 
@@ -379,6 +385,9 @@ struct DataFlowEdge {
         return ptr;
     }
 
+    // Removes the edge from its source and its sink. The alias is not changed.
+    static std::unique_ptr<DataFlowEdge> detach(DataFlowEdge *edge);
+
     // TODO: Do not pass nullptr as an Instruction to the ValueUse.
     DataFlowEdge()
     : alias{nullptr}, _source{nullptr}, _sink{nullptr} { }
@@ -735,6 +744,14 @@ struct BasicBlock {
         _insts.remove(it._inst);
     }
 
+    // Removes the instruction from the BasicBlock without destructing it.
+    std::unique_ptr<Instruction> detachInstruction(InstructionIterator it) {
+        assert(it._inst->_bb == this);
+        _insts.remove(it._inst);
+        it._inst->_bb = nullptr;
+        return std::unique_ptr<Instruction>{it._inst};
+    }
+
     InstructionIterator replaceInstruction(InstructionIterator from,
             std::unique_ptr<Instruction> to) {
         assert(from._inst);
@@ -778,6 +795,8 @@ private:
 //---------------------------------------------------------------------------------------
 
 struct Function {
+    friend struct Module;
+
     using BlockList = frg::intrusive_list<
         BasicBlock,
         frg::locate_member<
@@ -814,12 +833,66 @@ struct Function {
         return ptr;
     }
 
+    BasicBlock *insertBlock(BasicBlock *before, std::unique_ptr<BasicBlock> block) {
+        auto ptr = block.get();
+        _blocks.insert(_blocks.iterator_to(before), block.release());
+        return ptr;
+    }
+
     std::string name;
 
 private:
+    frg::default_list_hook<Function> _functionListHook;
+
     BlockList _blocks;
 };
 
+//---------------------------------------------------------------------------------------
+// Module class.
+//---------------------------------------------------------------------------------------
+
+// A collection of Functions that are emitted into the same object file.
+struct Module {
+    using FunctionList = frg::intrusive_list<
+        Function,
+        frg::locate_member<
+            Function,
+            frg::default_list_hook<Function>,
+            &Function::_functionListHook
+        >
+    >;
+
+    using FunctionIterator = FunctionList::iterator;
+
+    struct FunctionRange {
+        FunctionRange(Module *mod)
+        : _mod{mod} { }
+
+        FunctionIterator begin() {
+            return _mod->_functions.begin();
+        }
+        FunctionIterator end() {
+            return _mod->_functions.end();
+        }
+
+    private:
+        Module *_mod;
+    };
+
+    FunctionRange functions() {
+        return FunctionRange{this};
+    }
+
+    Function *addFunction(std::unique_ptr<Function> fn) {
+        auto ptr = fn.get();
+        _functions.push_back(fn.release());
+        return ptr;
+    }
+
+private:
+    FunctionList _functions;
+};
+
 //---------------------------------------------------------------------------------------
 // Helper class to define instructions with a single result.
 //---------------------------------------------------------------------------------------
@@ -864,7 +937,12 @@ struct LoadOffsetInstruction
 
 enum class UnaryMathOpcode {
     null,
-    negate
+    negate,
+    bitwiseNot,
+    // Conversions between integer types. The result type determines the target width.
+    zeroExtend,
+    signExtend,
+    truncate
 };
 
 struct UnaryMathInstruction
@@ -883,9 +961,43 @@ struct UnaryMathInstruction
 enum class BinaryMathOpcode {
     null,
     add,
-    bitwiseAnd
+    bitwiseAnd,
+    // Comparisons produce an int32 that is 1 if the comparison holds and 0 otherwise.
+    equal,
+    notEqual,
+    signedLess,
+    signedLessEqual,
+    signedGreater,
+    signedGreaterEqual,
+    unsignedLess,
+    unsignedLessEqual,
+    unsignedGreater,
+    unsignedGreaterEqual,
+    // The values of the opcodes above are part of the binary IR format; new opcodes
+    // must be appended.
+    subtract,
+    bitwiseOr,
+    bitwiseXor,
+    // The low half of the product does not depend on the signedness.
+    multiply,
+    // Division by zero is undefined; so is signed division of the minimum value by -1.
+    unsignedDivide,
+    signedDivide,
+    unsignedRemainder,
+    signedRemainder,
+    // The shift count is taken modulo 32 (modulo 64 for 64-bit operands), as on x86.
+    shiftLeft,
+    logicalShiftRight,
+    arithmeticShiftRight,
+    rotateLeft,
+    rotateRight
 };
 
+inline bool isComparison(BinaryMathOpcode opcode) {
+    return opcode >= BinaryMathOpcode::equal
+            && opcode <= BinaryMathOpcode::unsignedGreaterEqual;
+}
+
 struct BinaryMathInstruction
 : Instruction,
         CastableIfInstructionKind<BinaryMathInstruction, instruction_kinds::binaryMath> {
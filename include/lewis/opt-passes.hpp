@@ -0,0 +1,24 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <memory>
+#include <lewis/pass-manager.hpp>
+#include <lewis/passes.hpp>
+
+namespace lewis {
+
+// The following passes are implemented using Pimpl.
+// They operate on generic IR, i.e., they run before lowering.
+
+// Hoists loop-invariant LoadConst, UnaryMath and BinaryMath instructions (except for
+// divisions) into the preheader of their loop. The preheader is created if the loop
+// does not have one.
+// Hoisted values reach their uses through a DataFlowPhi in each block of the loop.
+struct LoopInvariantCodeMotionPass : FunctionPass {
+    static std::unique_ptr<LoopInvariantCodeMotionPass> create(Function *fn,
+            AnalysisManager *am);
+};
+
+} // namespace lewis
@@ -0,0 +1,145 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <lewis/passes.hpp>
+
+namespace lewis {
+
+struct IrTextDialect;
+
+//---------------------------------------------------------------------------------------
+// AnalysisManager class.
+//---------------------------------------------------------------------------------------
+
+// Caches the results of FunctionAnalyses, keyed by Function and by pass ID.
+struct AnalysisManager {
+    template<typename A>
+    A *getResult(Function *fn) {
+        auto &results = _results[fn];
+        auto it = results.find(A::passId);
+        if (it != results.end())
+            return static_cast<A *>(it->second.get());
+
+        auto result = A::compute(fn, this);
+        auto ptr = result.get();
+        // Note that compute() might have inserted other analyses into the cache.
+        _results[fn].insert({A::passId, std::move(result)});
+        return ptr;
+    }
+
+    // Returns the cached result or nullptr if the analysis was not computed yet.
+    template<typename A>
+    A *getCachedResult(Function *fn) {
+        auto fnIt = _results.find(fn);
+        if (fnIt == _results.end())
+            return nullptr;
+        auto it = fnIt->second.find(A::passId);
+        if (it == fnIt->second.end())
+            return nullptr;
+        return static_cast<A *>(it->second.get());
+    }
+
+    // Discards all results for fn that are not preserved.
+    void invalidate(Function *fn, const PreservedAnalyses &preserved);
+
+    // Discards all results for fn.
+    void clear(Function *fn);
+
+private:
+    std::unordered_map<Function *,
+            std::unordered_map<PassIdType, std::unique_ptr<FunctionAnalysis>>> _results;
+};
+
+//---------------------------------------------------------------------------------------
+// PassManager class.
+//---------------------------------------------------------------------------------------
+
+// Statistics that the PassManager records for each pass in its pipeline.
+struct PassStatistics {
+    std::string name;
+    size_t numRuns = 0;
+    std::chrono::nanoseconds wallTime{0};
+    // Accumulated change of the IR size over all runs.
+    ptrdiff_t instructionDelta = 0;
+    ptrdiff_t blockDelta = 0;
+};
+
+// Sums up the statistics of multiple PassManagers, e.g., of PassManagers that compile
+// Functions on different threads. Passes are identified by their name. Thread-safe.
+struct PassStatisticsAccumulator {
+    void add(const std::vector<PassStatistics> &statistics);
+
+    // Statistics are ordered by the first occurrence of each pass.
+    std::vector<PassStatistics> get();
+
+private:
+    std::mutex _mutex;
+    std::vector<PassStatistics> _statistics;
+};
+
+void printPassStatistics(std::ostream &out, const std::vector<PassStatistics> &statistics);
+
+// Runs a pipeline of BasicBlockPasses and FunctionPasses on Functions.
+// BasicBlockPasses are run on each BasicBlock of the Function before the next pass runs.
+struct PassManager {
+    using BlockPassFactory = std::function<
+            std::unique_ptr<BasicBlockPass> (BasicBlock *)>;
+    using FunctionPassFactory = std::function<
+            std::unique_ptr<FunctionPass> (Function *, AnalysisManager *)>;
+    using SimpleFunctionPassFactory = std::function<
+            std::unique_ptr<FunctionPass> (Function *)>;
+
+    void addBlockPass(std::string name, BlockPassFactory factory);
+
+    void addFunctionPass(std::string name, FunctionPassFactory factory);
+
+    // Overload for passes that do not consume analyses.
+    void addFunctionPass(std::string name, SimpleFunctionPassFactory factory);
+
+    void run(Function *fn);
+
+    // Runs the pipeline on each Function of the Module.
+    void run(Module *mod);
+
+    AnalysisManager *analyses() {
+        return &_analyses;
+    }
+
+    // Statistics are ordered in the same way as the pipeline.
+    const std::vector<PassStatistics> &statistics() {
+        return _statistics;
+    }
+
+    void printStatistics(std::ostream &out);
+
+    // Prints the IR of each Function after each pass named passName.
+    // If passName is empty, the IR is printed after all passes.
+    void printAfter(std::ostream *out, IrTextDialect *dialect = nullptr,
+            std::string passName = {});
+
+private:
+    struct Entry {
+        BlockPassFactory blockFactory;
+        FunctionPassFactory functionFactory;
+    };
+
+    std::vector<Entry> _pipeline;
+    std::vector<PassStatistics> _statistics;
+    AnalysisManager _analyses;
+
+    std::ostream *_printOut = nullptr;
+    IrTextDialect *_printDialect = nullptr;
+    std::string _printPassName;
+};
+
+} // namespace lewis
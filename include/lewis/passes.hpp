@@ -3,20 +3,78 @@
 
 #pragma once
 
+#include <unordered_set>
 #include <lewis/ir.hpp>
 
 namespace lewis {
 
+// Defines an ID for each pass and each analysis.
+using PassIdType = uint32_t;
+
+namespace pass_ids {
+    enum : PassIdType {
+        null,
+        dominatorTree,
+        loopInfo,
+
+        // Give each architecture 16k passes; that should be enough.
+        kindsForX86 = 1 << 14
+    };
+}
+
+// Set of analyses that remain valid after a pass ran.
+struct PreservedAnalyses {
+    static PreservedAnalyses all() {
+        PreservedAnalyses result;
+        result._all = true;
+        return result;
+    }
+
+    static PreservedAnalyses none() {
+        return PreservedAnalyses{};
+    }
+
+    void preserve(PassIdType id) {
+        _ids.insert(id);
+    }
+
+    bool isPreserved(PassIdType id) const {
+        return _all || _ids.count(id);
+    }
+
+private:
+    bool _all = false;
+    std::unordered_set<PassIdType> _ids;
+};
+
 struct BasicBlockPass {
     virtual ~BasicBlockPass() = default;
 
     virtual void run() = 0;
+
+    // Returns the analyses that are not invalidated by run().
+    virtual PreservedAnalyses preservedAnalyses() {
+        return PreservedAnalyses::none();
+    }
 };
 
 struct FunctionPass {
     virtual ~FunctionPass() = default;
 
     virtual void run() = 0;
+
+    // Returns the analyses that are not invalidated by run().
+    virtual PreservedAnalyses preservedAnalyses() {
+        return PreservedAnalyses::none();
+    }
+};
+
+// Base class for results of analyses on Functions.
+// Each analysis A derives from this class and provides
+// - a static constexpr PassIdType member A::passId and
+// - a static std::unique_ptr<A> A::compute(Function *, AnalysisManager *) function.
+struct FunctionAnalysis {
+    virtual ~FunctionAnalysis() = default;
 };
 
-} // namespace lewis::elf
+} // namespace lewis
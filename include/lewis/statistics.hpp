@@ -0,0 +1,155 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <lewis/config.hpp>
+
+namespace lewis {
+
+constexpr bool statisticsEnabled = LEWIS_STATISTICS;
+
+struct TimerStatistic {
+    size_t numSamples = 0;
+    std::chrono::nanoseconds total{0};
+};
+
+// Sampled values (e.g. latencies or queue depths) that are reported as percentiles.
+// Samples are counted in buckets (eight per power of two), so the size does not depend
+// on the number of samples. Percentiles are rounded up by at most 1/8 of their value.
+// Negative samples count as zero.
+struct DistributionStatistic {
+    static constexpr int subBucketBits = 3;
+    static constexpr size_t numBuckets = (64 - subBucketBits) << subBucketBits;
+
+    void add(int64_t value);
+
+    void merge(const DistributionStatistic &other);
+
+    // Returns the nearest-rank percentile (0 to 100) or zero if there are no samples.
+    int64_t percentile(double p) const;
+
+    uint64_t numSamples = 0;
+    int64_t max = 0;
+    std::array<uint64_t, numBuckets> buckets{};
+};
+
+// A completed TraceScope. Times are relative to the creation of the StatisticsCollector.
+struct TraceEvent {
+    std::string group;
+    std::string name;
+    std::chrono::nanoseconds start{0};
+    std::chrono::nanoseconds duration{0};
+    // Small integer that identifies the thread that recorded the event.
+    uint32_t thread = 0;
+};
+
+// Collects counters, timers and trace events. Can be used from multiple threads.
+// Counters and timers are identified by a group (usually the name of a pass) and a name.
+struct StatisticsCollector {
+    using Key = std::pair<std::string, std::string>;
+
+    StatisticsCollector();
+
+    void addToCounter(const std::string &group, const std::string &name, int64_t value);
+
+    void addToTimer(const std::string &group, const std::string &name,
+            std::chrono::nanoseconds time);
+
+    void addToDistribution(const std::string &group, const std::string &name, int64_t value);
+    void addToDistribution(const std::string &group, const std::string &name,
+            const DistributionStatistic &distribution);
+
+    void addTraceEvent(TraceEvent event);
+
+    // Returns zero if the counter does not exist.
+    int64_t counter(const std::string &group, const std::string &name);
+
+    std::map<Key, int64_t> counters();
+
+    std::map<Key, TimerStatistic> timers();
+
+    std::map<Key, DistributionStatistic> distributions();
+
+    std::vector<TraceEvent> traceEvents();
+
+    // Time since the creation of the collector.
+    std::chrono::nanoseconds now();
+
+    void print(std::ostream &out);
+
+    // Writes all trace events in the JSON format of chrome://tracing.
+    // The final values of the counters are written as counter events at the end.
+    void writeChromeTrace(std::ostream &out);
+
+    // If false, only counters and timers are collected.
+    bool recordTraceEvents = true;
+
+private:
+    std::chrono::steady_clock::time_point _epoch;
+    std::mutex _mutex;
+    std::map<Key, int64_t> _counters;
+    std::map<Key, TimerStatistic> _timers;
+    std::map<Key, DistributionStatistic> _distributions;
+    std::vector<TraceEvent> _traceEvents;
+};
+
+// Sets the collector that receives the statistics of all threads.
+// If no collector is set, statistics are discarded at run time.
+void setStatisticsCollector(StatisticsCollector *collector);
+
+StatisticsCollector *statisticsCollector();
+
+inline void countStatistic(const char *group, const char *name, int64_t value = 1) {
+    if constexpr (statisticsEnabled) {
+        if (auto collector = statisticsCollector(); collector)
+            collector->addToCounter(group, name, value);
+    }
+}
+
+inline void sampleStatistic(const char *group, const char *name, int64_t value) {
+    if constexpr (statisticsEnabled) {
+        if (auto collector = statisticsCollector(); collector)
+            collector->addToDistribution(group, name, value);
+    }
+}
+
+#if LEWIS_STATISTICS
+
+// Measures the time until the end of the scope.
+// The time is added to the timer of the same name and recorded as a trace event.
+// The strings must outlive the TraceScope.
+struct TraceScope {
+    TraceScope(const char *group, const char *name);
+
+    TraceScope(const TraceScope &) = delete;
+
+    ~TraceScope();
+
+    TraceScope &operator= (const TraceScope &) = delete;
+
+private:
+    StatisticsCollector *_collector;
+    const char *_group;
+    const char *_name;
+    std::chrono::nanoseconds _start;
+};
+
+#else // LEWIS_STATISTICS
+
+struct TraceScope {
+    TraceScope(const char *, const char *) { }
+};
+
+#endif // LEWIS_STATISTICS
+
+} // namespace lewis
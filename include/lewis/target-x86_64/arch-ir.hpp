@@ -34,12 +34,34 @@ namespace arch_instruction_kinds {
         movMC,
         movMR,
         movRM,
+        movzxRM,
+        movsxRM,
+        // Zeroes a register via xor r32, r32. Unlike movMC, this clobbers the flags.
+        xorZero,
         // TODO: We certainly want to drop the "WithOffset" specialization.
         //       This should probably be done after we rewrite Values and make them more useful.
         defineOffset,
         negM,
+        notM,
         addMR,
         andMR,
+        subMR,
+        orMR,
+        xorMR,
+        imulRM,
+        // Shifts and rotates by CL.
+        shlM,
+        shrM,
+        sarM,
+        rolM,
+        rorM,
+        // Divide RDX:RAX (after extending RAX) by M.
+        divM,
+        idivM,
+        // lea r, [base + index].
+        leaBaseIndex,
+        // cmp M, R; setcc r8; movzx r32, r8.
+        cmpSetcc,
         call,
     };
 }
@@ -50,13 +72,31 @@ namespace arch_branch_kinds {
         ret,
         jmp,
         jnz,
+        jcc,
     };
 }
 
+// Values of byte and word size only define the low bits of their registers.
 enum OperandSize {
     null,
     dword,
-    qword
+    qword,
+    byte,
+    word
+};
+
+// Values are the condition encodings of jcc and setcc.
+enum class ConditionCode : uint8_t {
+    below = 0x2,
+    aboveEqual = 0x3,
+    equal = 0x4,
+    notEqual = 0x5,
+    belowEqual = 0x6,
+    above = 0x7,
+    less = 0xC,
+    greaterEqual = 0xD,
+    lessEqual = 0xE,
+    greater = 0xF
 };
 
 struct RegisterMode
@@ -146,7 +186,9 @@ struct UnaryMOverwriteInstruction
         CastableIfInstructionKind<UnaryMOverwriteInstruction,
                 arch_instruction_kinds::pseudoMoveSingle,
                 arch_instruction_kinds::movMR,
-                arch_instruction_kinds::movRM> {
+                arch_instruction_kinds::movRM,
+                arch_instruction_kinds::movzxRM,
+                arch_instruction_kinds::movsxRM> {
     UnaryMOverwriteInstruction(InstructionKindType kind, Value *operand_ = nullptr)
     : Instruction{kind}, result{this}, operand{this, operand_} { }
 
@@ -157,7 +199,9 @@ struct UnaryMOverwriteInstruction
 // Instruction that takes a single mode M operand and replaces it by the result.
 struct UnaryMInPlaceInstruction
 : Instruction,
-        CastableIfInstructionKind<UnaryMInPlaceInstruction, arch_instruction_kinds::negM> {
+        CastableIfInstructionKind<UnaryMInPlaceInstruction,
+                arch_instruction_kinds::negM,
+                arch_instruction_kinds::notM> {
     UnaryMInPlaceInstruction(InstructionKindType kind, Value *primary_ = nullptr)
     : Instruction{kind}, result{this}, primary{this, primary_} { }
 
@@ -168,7 +212,11 @@ struct UnaryMInPlaceInstruction
 struct BinaryMRInPlaceInstruction
 : Instruction, CastableIfInstructionKind<BinaryMRInPlaceInstruction,
         arch_instruction_kinds::addMR,
-        arch_instruction_kinds::andMR> {
+        arch_instruction_kinds::andMR,
+        arch_instruction_kinds::subMR,
+        arch_instruction_kinds::orMR,
+        arch_instruction_kinds::xorMR,
+        arch_instruction_kinds::imulRM> {
     BinaryMRInPlaceInstruction(InstructionKindType kind,
             Value *primary_ = nullptr, Value *secondary_ = nullptr)
     : Instruction{kind}, result{this},
@@ -179,6 +227,41 @@ struct BinaryMRInPlaceInstruction
     ValueUse secondary;
 };
 
+// Instruction that shifts or rotates a mode M operand in place. The count must be in RCX.
+struct ShiftMInPlaceInstruction
+: Instruction, CastableIfInstructionKind<ShiftMInPlaceInstruction,
+        arch_instruction_kinds::shlM,
+        arch_instruction_kinds::shrM,
+        arch_instruction_kinds::sarM,
+        arch_instruction_kinds::rolM,
+        arch_instruction_kinds::rorM> {
+    ShiftMInPlaceInstruction(InstructionKindType kind,
+            Value *primary_ = nullptr, Value *count_ = nullptr)
+    : Instruction{kind}, result{this},
+            primary{this, primary_}, count{this, count_} { }
+
+    ValueOrigin result;
+    ValueUse primary;
+    ValueUse count;
+};
+
+// The dividend must be in RAX. The result is either the quotient (in RAX) or the
+// remainder (in RDX); the other register is clobbered.
+struct DivideMInstruction
+: Instruction, CastableIfInstructionKind<DivideMInstruction,
+        arch_instruction_kinds::divM,
+        arch_instruction_kinds::idivM> {
+    DivideMInstruction(InstructionKindType kind, bool remainder_ = false,
+            Value *dividend_ = nullptr, Value *divisor_ = nullptr)
+    : Instruction{kind}, remainder{remainder_}, result{this},
+            dividend{this, dividend_}, divisor{this, divisor_} { }
+
+    bool remainder;
+    ValueOrigin result;
+    ValueUse dividend;
+    ValueUse divisor;
+};
+
 struct PseudoMoveSingleInstruction
 : UnaryMOverwriteInstruction,
         CastableIfInstructionKind<PseudoMoveSingleInstruction,
@@ -222,6 +305,44 @@ private:
     std::vector<std::unique_ptr<MovePair>> _pairs;
 };
 
+struct SubMRInstruction
+: BinaryMRInPlaceInstruction,
+        CastableIfInstructionKind<SubMRInstruction, arch_instruction_kinds::subMR> {
+    SubMRInstruction(Value *primary_ = nullptr, Value *secondary_ = nullptr)
+    : BinaryMRInPlaceInstruction{arch_instruction_kinds::subMR, primary_, secondary_} { }
+};
+
+struct OrMRInstruction
+: BinaryMRInPlaceInstruction,
+        CastableIfInstructionKind<OrMRInstruction, arch_instruction_kinds::orMR> {
+    OrMRInstruction(Value *primary_ = nullptr, Value *secondary_ = nullptr)
+    : BinaryMRInPlaceInstruction{arch_instruction_kinds::orMR, primary_, secondary_} { }
+};
+
+struct XorMRInstruction
+: BinaryMRInPlaceInstruction,
+        CastableIfInstructionKind<XorMRInstruction, arch_instruction_kinds::xorMR> {
+    XorMRInstruction(Value *primary_ = nullptr, Value *secondary_ = nullptr)
+    : BinaryMRInPlaceInstruction{arch_instruction_kinds::xorMR, primary_, secondary_} { }
+};
+
+// Note that the encoding of imul has the operands swapped (the primary operand is in R).
+struct ImulRMInstruction
+: BinaryMRInPlaceInstruction,
+        CastableIfInstructionKind<ImulRMInstruction, arch_instruction_kinds::imulRM> {
+    ImulRMInstruction(Value *primary_ = nullptr, Value *secondary_ = nullptr)
+    : BinaryMRInPlaceInstruction{arch_instruction_kinds::imulRM, primary_, secondary_} { }
+};
+
+struct XorZeroInstruction
+: Instruction,
+        CastableIfInstructionKind<XorZeroInstruction, arch_instruction_kinds::xorZero> {
+    XorZeroInstruction()
+    : Instruction{arch_instruction_kinds::xorZero}, result{this} { }
+
+    ValueOrigin result;
+};
+
 // TODO: Turn this into a UnaryMOverwriteInstruction.
 struct MovMCInstruction
 : Instruction,
@@ -247,6 +368,22 @@ struct MovMRInstruction
     : UnaryMOverwriteInstruction{arch_instruction_kinds::movMR, operand_} { }
 };
 
+// Zero-extends the operand to the size of the result.
+struct MovzxRMInstruction
+: UnaryMOverwriteInstruction,
+        CastableIfInstructionKind<MovzxRMInstruction, arch_instruction_kinds::movzxRM> {
+    MovzxRMInstruction(Value *operand_ = nullptr)
+    : UnaryMOverwriteInstruction{arch_instruction_kinds::movzxRM, operand_} { }
+};
+
+// Sign-extends the operand to the size of the result.
+struct MovsxRMInstruction
+: UnaryMOverwriteInstruction,
+        CastableIfInstructionKind<MovsxRMInstruction, arch_instruction_kinds::movsxRM> {
+    MovsxRMInstruction(Value *operand_ = nullptr)
+    : UnaryMOverwriteInstruction{arch_instruction_kinds::movsxRM, operand_} { }
+};
+
 struct XchgMRInstruction
 : Instruction,
         CastableIfInstructionKind<XchgMRInstruction, arch_instruction_kinds::xchgMR>{
@@ -268,6 +405,13 @@ struct NegMInstruction
     : UnaryMInPlaceInstruction{arch_instruction_kinds::negM, primary_} { }
 };
 
+struct NotMInstruction
+: UnaryMInPlaceInstruction,
+        CastableIfInstructionKind<NotMInstruction, arch_instruction_kinds::notM> {
+    NotMInstruction(Value *primary_ = nullptr)
+    : UnaryMInPlaceInstruction{arch_instruction_kinds::notM, primary_} { }
+};
+
 struct AddMRInstruction
 : BinaryMRInPlaceInstruction,
         CastableIfInstructionKind<AddMRInstruction, arch_instruction_kinds::addMR> {
@@ -282,6 +426,34 @@ struct AndMRInstruction
     : BinaryMRInPlaceInstruction{arch_instruction_kinds::andMR, primary_, secondary_} { }
 };
 
+struct LeaBaseIndexInstruction
+: Instruction,
+        CastableIfInstructionKind<LeaBaseIndexInstruction,
+                arch_instruction_kinds::leaBaseIndex> {
+    LeaBaseIndexInstruction(Value *base_ = nullptr, Value *index_ = nullptr)
+    : Instruction{arch_instruction_kinds::leaBaseIndex}, result{this},
+            base{this, base_}, index{this, index_} { }
+
+    ValueOrigin result;
+    ValueUse base;
+    ValueUse index;
+};
+
+// Materializes the result of a comparison as 0 or 1.
+struct CmpSetccInstruction
+: Instruction,
+        CastableIfInstructionKind<CmpSetccInstruction, arch_instruction_kinds::cmpSetcc> {
+    CmpSetccInstruction(ConditionCode code_ = ConditionCode::equal,
+            Value *primary_ = nullptr, Value *secondary_ = nullptr)
+    : Instruction{arch_instruction_kinds::cmpSetcc}, code{code_}, result{this},
+            primary{this, primary_}, secondary{this, secondary_} { }
+
+    ConditionCode code;
+    ValueOrigin result;
+    ValueUse primary;
+    ValueUse secondary;
+};
+
 struct CallInstruction
 : Instruction,
         CastableIfInstructionKind<CallInstruction, arch_instruction_kinds::call> {
@@ -345,6 +517,26 @@ struct JnzBranch
     BasicBlock *ifTarget;
     BasicBlock *elseTarget;
     ValueUse operand;
+    // Set if the flags already reflect the operand, i.e., no test instruction is needed.
+    bool reuseFlags = false;
+};
+
+// Emits cmp left, right; jcc. The comparison is part of the branch, such that nothing can
+// be scheduled between the cmp and the jcc (which allows the CPU to fuse them).
+struct JccBranch
+: Branch,
+        CastableIfBranchKind<JccBranch, arch_branch_kinds::jcc> {
+    JccBranch(ConditionCode code_ = ConditionCode::equal,
+            BasicBlock *ifTarget_ = nullptr, BasicBlock *elseTarget_ = nullptr)
+    : Branch{arch_branch_kinds::jcc}, code{code_}, ifTarget{ifTarget_},
+            elseTarget{elseTarget_}, left{nullptr}, right{nullptr} { }
+
+    ConditionCode code;
+    // TODO: Use a BlockLink class similar to ValueUse.
+    BasicBlock *ifTarget;
+    BasicBlock *elseTarget;
+    ValueUse left;
+    ValueUse right;
 };
 
 } // namespace lewis::targets::x86_64
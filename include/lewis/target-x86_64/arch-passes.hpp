@@ -4,10 +4,16 @@
 #pragma once
 
 #include <memory>
+#include <cstdint>
 #include <lewis/passes.hpp>
 
 namespace lewis::targets::x86_64 {
 
+// Version of the code that the passes below (and the MachineCodeEncoder) generate.
+// Cached machine code is only reused if it was generated by the same version.
+// Bump this whenever lowering, register allocation or encoding changes.
+constexpr uint32_t codegenVersion = 1;
+
 // The following passes are implemented using Pimpl.
 
 // Lower code from generic IR to x86 IR.
@@ -20,4 +26,9 @@ struct AllocateRegistersPass : FunctionPass {
     static std::unique_ptr<AllocateRegistersPass> create(Function *fn);
 };
 
+// Table-driven peephole optimizations on x86 IR. Runs after register allocation.
+struct PeepholePass : BasicBlockPass {
+    static std::unique_ptr<PeepholePass> create(BasicBlock *bb);
+};
+
 } // namespace lewis::targets::x86_64
@@ -0,0 +1,17 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <lewis/ir-text.hpp>
+
+namespace lewis::targets::x86_64 {
+
+// Textual syntax of x86 IR. Instructions and branches use the names of their kinds,
+// e.g. "%3@reg(dword, rax) = addMR %1, %2" or "jnz %3, b1, b2".
+// Value modes are written as @reg(<size>, <register>) and @mem(<size>, <base>, <disp>);
+// unallocated registers are written as "none".
+// The dialect is stateless and can be shared between threads.
+IrTextDialect *textDialect();
+
+} // namespace lewis::targets::x86_64
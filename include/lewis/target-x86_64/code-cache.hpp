@@ -0,0 +1,65 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <lewis/ir-hash.hpp>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+
+namespace lewis::targets::x86_64 {
+
+struct CodeCacheStatistics {
+    size_t numHits = 0;
+    // Subset of numHits that were served from the on-disk cache.
+    size_t numDiskHits = 0;
+    size_t numMisses = 0;
+    size_t numEvictions = 0;
+};
+
+// Content-addressed cache of FunctionCode, keyed by the IrKey of the generic IR and
+// by the name of the pipeline that compiled it (e.g., "basic" or "optimizing"); code is
+// never shared between pipelines, even if they use the same directory.
+// Keeps up to capacity entries in memory (with LRU replacement). If a directory is given,
+// entries are also written to and read from disk. Disk entries are ignored if they
+// were written by a different codegenVersion (see arch-passes.hpp).
+// All member functions are thread-safe.
+struct CodeCache {
+    CodeCache(size_t capacity, std::string directory = {});
+
+    // On success, the name of the returned FunctionCode is empty.
+    std::optional<FunctionCode> lookup(const IrKey &key, const std::string &pipeline);
+
+    void insert(const IrKey &key, const std::string &pipeline, const FunctionCode &code);
+
+    CodeCacheStatistics statistics();
+
+private:
+    struct Entry {
+        IrKey key;
+        std::string pipeline;
+        FunctionCode code;
+    };
+
+    void _insertIntoMemory(const IrKey &key, const std::string &pipeline,
+            const FunctionCode &code);
+    std::string _pathOf(const IrKey &key, const std::string &pipeline);
+    std::optional<FunctionCode> _readFromDisk(const IrKey &key, const std::string &pipeline);
+    void _writeToDisk(const IrKey &key, const std::string &pipeline, const FunctionCode &code);
+
+    size_t _capacity;
+    std::string _directory;
+
+    std::mutex _mutex;
+    // Most recently used entries are at the front.
+    std::list<Entry> _lru;
+    // Keyed by hashOf() the key and the pipeline.
+    std::unordered_multimap<uint64_t, std::list<Entry>::iterator> _map;
+    CodeCacheStatistics _statistics;
+};
+
+} // namespace lewis::targets::x86_64
@@ -0,0 +1,54 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <lewis/elf/object.hpp>
+#include <lewis/target-x86_64/code-cache.hpp>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+#include <lewis/target-x86_64/pipeline.hpp>
+
+namespace lewis::targets::x86_64 {
+
+// Compiles a batch of independent Functions on multiple threads.
+// The pipeline and the encoding of each Function run on a single worker thread.
+// Workers steal Functions from each other once they run out of work.
+// The resulting FunctionCode is emitted into a single .text section of the elf::Object
+// in the order in which the Functions were added; hence, the output does not depend
+// on the scheduling.
+struct CompileDriver {
+    // If numThreads is zero, the number of hardware threads is used.
+    CompileDriver(size_t numThreads = 0);
+
+    void addFunction(Function *fn);
+
+    void addModule(Module *mod);
+
+    void run(elf::Object *elf);
+
+    // Sum of the PassStatistics of all Functions that were compiled so far.
+    std::vector<PassStatistics> passStatistics() {
+        return _passStatistics.get();
+    }
+
+    PipelineBuilder pipeline = addBasicPipeline;
+    // Identifies the pipeline in the codeCache. Must be changed together with pipeline
+    // (e.g., to "optimizing" for addOptimizingPipeline).
+    std::string pipelineName = "basic";
+
+    // If set, Functions whose IrKey is found in the cache (for the same pipelineName)
+    // are not compiled at all.
+    CodeCache *codeCache = nullptr;
+
+private:
+    void _compile(size_t index);
+
+    size_t _numThreads;
+    std::vector<Function *> _functions;
+    std::vector<FunctionCode> _codes;
+    PassStatisticsAccumulator _passStatistics;
+};
+
+} // namespace lewis::targets::x86_64
@@ -0,0 +1,143 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <lewis/ir.hpp>
+#include <lewis/statistics.hpp>
+#include <lewis/util/bounded-queue.hpp>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+#include <lewis/target-x86_64/pipeline.hpp>
+
+namespace lewis::targets::x86_64 {
+
+enum class CompilePriority {
+    // Work that somebody waits for. Always runs before prefetch work.
+    interactive,
+    // Speculative work.
+    prefetch
+};
+
+struct CompileJob;
+
+using CompileCallback = std::function<void (CompileJob *job)>;
+
+// A Function that was submitted to a CompileService.
+struct CompileJob {
+    friend struct CompileService;
+
+    CompileJob(Function *fn, CompilePriority priority, CompileCallback callback);
+
+    // Succeeds only if no worker has picked up the job yet. In this case, the result
+    // holds an exception and the callback is not invoked.
+    bool cancel();
+
+    // Ready once the FunctionCode is encoded. Holds an exception if the job failed
+    // or was cancelled.
+    std::shared_future<FunctionCode> result;
+
+private:
+    enum class State {
+        queued,
+        running,
+        done,
+        cancelled
+    };
+
+    Function *_fn;
+    CompilePriority _priority;
+    CompileCallback _callback;
+    std::promise<FunctionCode> _promise;
+    std::atomic<State> _state{State::queued};
+    std::chrono::steady_clock::time_point _submitTime;
+};
+
+// Statistics of the jobs of one priority.
+struct CompileQueueStatistics {
+    // Number of jobs that are still queued when a worker starts a job.
+    DistributionStatistic queueDepth;
+    // Nanoseconds from submission to the start of each job.
+    DistributionStatistic waitTime;
+    // Nanoseconds from submission to the end of each job.
+    DistributionStatistic latency;
+};
+
+struct CompileServiceStatistics {
+    uint64_t numSubmitted = 0;
+    uint64_t numRejected = 0;
+    uint64_t numCompleted = 0;
+    CompileQueueStatistics interactive;
+    CompileQueueStatistics prefetch;
+};
+
+// Compiles Functions on a fixed pool of background threads.
+// submit() never blocks: jobs are passed to the workers through a lock-free queue per
+// priority (the workers only take a lock to sleep while both queues are empty).
+// Like CompileDriver, the pipeline and the encoding of a Function run on a single worker;
+// the Function is modified in place and must stay alive until its job is done or cancelled.
+//
+// The service keeps its own CompileServiceStatistics (the workers record them; submit() only
+// increments atomic counters) and adds them to the StatisticsCollector on destruction
+// (group "compile-service", e.g. "interactive-latency"). Nothing is recorded if
+// statistics are disabled.
+struct CompileService {
+    // If numThreads is zero, the number of hardware threads is used.
+    // Each priority can hold queueCapacity jobs (rounded up to a power of two).
+    CompileService(size_t numThreads = 0, size_t queueCapacity = 1024);
+
+    CompileService(const CompileService &) = delete;
+
+    // Finishes running jobs and cancels the jobs that did not start yet.
+    ~CompileService();
+
+    CompileService &operator= (const CompileService &) = delete;
+
+    // Returns nullptr if the queue of the given priority is full.
+    // If set, the callback is invoked on the worker thread once the result is ready.
+    std::shared_ptr<CompileJob> submit(Function *fn,
+            CompilePriority priority = CompilePriority::interactive,
+            CompileCallback callback = nullptr);
+
+    // Sum of the PassStatistics of all jobs that completed so far.
+    std::vector<PassStatistics> passStatistics() {
+        return _passStatistics.get();
+    }
+
+    CompileServiceStatistics statistics();
+
+    // Must be set before the first job is submitted.
+    PipelineBuilder pipeline = addBasicPipeline;
+
+private:
+    bool _take(std::shared_ptr<CompileJob> &job);
+    void _exportStatistics(StatisticsCollector *collector);
+    void _run(CompileJob *job);
+    void _work();
+
+    util::BoundedQueue<std::shared_ptr<CompileJob>> _interactiveQueue;
+    util::BoundedQueue<std::shared_ptr<CompileJob>> _prefetchQueue;
+
+    std::atomic<bool> _stopping{false};
+    std::atomic<size_t> _numSleeping{0};
+    std::mutex _sleepMutex;
+    std::condition_variable _sleepCv;
+    std::vector<std::thread> _threads;
+    PassStatisticsAccumulator _passStatistics;
+
+    std::atomic<uint64_t> _numSubmitted{0};
+    std::atomic<uint64_t> _numRejected{0};
+    // Protects _statistics, except for the atomic counters above.
+    std::mutex _statisticsMutex;
+    CompileServiceStatistics _statistics;
+};
+
+} // namespace lewis::targets::x86_64
@@ -0,0 +1,38 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+
+namespace lewis::targets::x86_64 {
+
+// Makes code that is loaded into the current process visible to perf.
+struct JitProfilingSink {
+    virtual ~JitProfilingSink() = default;
+
+    // Reports that the FunctionCode was copied to address (after relocation).
+    virtual void addCode(const void *address, const FunctionCode *code) = 0;
+
+    // If set, each BasicBlock gets its own symbol, named like the block symbols
+    // of MachineCodeEmitter (e.g. automate_irq.bb0). Otherwise, there is one symbol
+    // per Function.
+    bool blockSymbols = false;
+};
+
+// Writes /tmp/perf-<pid>.map. perf report picks this up automatically but it cannot
+// annotate the code.
+struct PerfMapSink : JitProfilingSink {
+    static std::unique_ptr<PerfMapSink> create();
+};
+
+// Writes <directory>/jit-<pid>.dump in perf's jitdump format, including the code bytes.
+// Run the process under "perf record -k mono" and merge the profile with "perf inject --jit"
+// to make the code available to perf report and perf annotate.
+struct JitDumpSink : JitProfilingSink {
+    static std::unique_ptr<JitDumpSink> create(std::string directory = "/tmp");
+};
+
+} // namespace lewis::targets::x86_64
@@ -4,7 +4,9 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <lewis/elf/object.hpp>
 #include <lewis/target-x86_64/arch-ir.hpp>
@@ -12,20 +14,147 @@
 
 namespace lewis::targets::x86_64 {
 
-// TODO: This should probably also use pimpl.
-struct MachineCodeEmitter {
-    MachineCodeEmitter(Function *fn, elf::Object *elf);
+enum class CodeRelocationKind {
+    null,
+    // PC-relative reference to the start of a BasicBlock of the same function.
+    block,
+    // PC-relative call to an external function.
+    call
+};
+
+struct CodeRelocation {
+    CodeRelocationKind kind = CodeRelocationKind::null;
+    // Offset of the 32-bit displacement inside of FunctionCode::text.
+    size_t offset = 0;
+    // Index of the target BasicBlock (for CodeRelocationKind::block).
+    size_t block = 0;
+    // Name of the called function (for CodeRelocationKind::call).
+    std::string function;
+};
+
+// State of the stack frame from a given offset of FunctionCode::text onwards.
+struct UnwindRow {
+    size_t offset = 0;
+    // The canonical frame address (i.e. the value of rsp before the call) is rsp + cfaOffset.
+    ptrdiff_t cfaOffset = 8;
+    // Pairs of registers (x86 numbering) and the offsets of their save slots
+    // relative to the canonical frame address.
+    std::vector<std::pair<int, ptrdiff_t>> savedRegisters;
+};
+
+// Machine code of a single Function that is not yet placed into an elf::Object.
+struct FunctionCode {
+    std::string name;
+    std::vector<uint8_t> text;
+    // Offset of each BasicBlock, in the order of Function::blocks().
+    std::vector<size_t> blockOffsets;
+    std::vector<CodeRelocation> relocations;
+    // Sorted by offset. The first row describes the frame on entry.
+    std::vector<UnwindRow> unwindRows;
+    // Alignment that the code expects of its start address (e.g. for aligned loop headers).
+    size_t alignment = 1;
+};
+
+// Encodes the x86 IR of a single Function into relocatable machine code.
+// Does not touch any state outside of the Function; hence, encoders for different
+// Functions can run concurrently.
+struct MachineCodeEncoder {
+    MachineCodeEncoder(Function *fn);
 
     void run();
 
+    // Alignment of BasicBlocks that are targets of backward jumps.
+    // Padding is inserted as NOPs. Zero or one disables the alignment.
+    size_t loopAlignment = 16;
+
+    FunctionCode code;
+
 private:
-    void _emitBlock(BasicBlock *bb, elf::ByteSection *textSection);
+    void _emitBlock(BasicBlock *bb);
+    void _updateFrame(UnwindRow row);
 
     Function *_fn;
+    std::unordered_map<BasicBlock *, size_t> _bbIndices;
+    // Frame after the prologue. All BasicBlocks except for the entry block start with it.
+    UnwindRow _bodyFrame;
+    UnwindRow _currentFrame;
+};
+
+// Emits machine code into an elf::Object.
+// All Functions that are emitted through the same MachineCodeEmitter share a single
+// .text section as well as the GOT and PLT entries of external functions.
+// If the elf::Object is relocatable, calls refer to function symbols directly and
+// the GOT, PLT and .eh_frame_hdr are left to the system linker.
+// TODO: This should probably also use pimpl.
+struct MachineCodeEmitter {
+    MachineCodeEmitter(elf::Object *elf);
+
+    // Encodes fn and emits it.
+    void emit(Function *fn);
+
+    // Encodes and emits all Functions of the Module.
+    void emit(Module *mod);
+
+    // Emits code that was already encoded by a MachineCodeEncoder.
+    void emit(const FunctionCode *code);
+
+    // Replaces the code of a Function that was emitted before, without changing the layout
+    // of the elf::Object. The new code overwrites the old code if it fits (see functionSlack)
+    // and is moved to the reserve at the end of .text otherwise (see textReserve).
+    // Relocations that need to be applied again are added to elf::Object::staleRelocations
+    // and modified bytes are recorded in the elf::Object; InternalLinkPass::update() and
+    // FileEmitter::update() then write the changes.
+    // Returns false (without changing anything) if there is not enough space or if the code
+    // calls a function that was never called before, since that requires a new PLT entry.
+    // Only supported for elf::FileType::sharedObject.
+    bool replace(const FunctionCode *code);
+
+    // Alignment of function entry points. Functions that need a stricter alignment
+    // (see FunctionCode::alignment) are aligned accordingly.
+    size_t functionAlignment = 16;
+
+    // Space that is reserved after the code and after the FDE of each function
+    // (in percent of their size). Allows replace() to update functions in place.
+    size_t functionSlack = 0;
+
+    // Space (in bytes) that is reserved at the end of .text for replace().
+    size_t textReserve = 0;
+
+private:
+    // A function that was emitted into .text.
+    struct EmittedFunction {
+        elf::Symbol *symbol = nullptr;
+        // Size of the space that belongs to the function (including slack).
+        size_t capacity = 0;
+        size_t fdeOffset = 0;
+        size_t fdeCapacity = 0;
+        std::vector<elf::Symbol *> blockSymbols;
+        // Internal relocations that apply to the code of the function.
+        std::vector<elf::Relocation *> relocations;
+    };
+
+    void _createSections();
+    size_t _withSlack(size_t size);
+    void _setupRelocation(elf::Relocation *relocation, const FunctionCode *code,
+            const CodeRelocation &source, size_t base, EmittedFunction *function);
+    std::vector<uint8_t> _encodeFrameDescription(const FunctionCode *code, size_t fdeOffset,
+            size_t minSize);
+    void _emitFrameDescription(const FunctionCode *code, EmittedFunction *function);
+    elf::Symbol *_getCallTarget(const std::string &function);
+
     elf::Object *_elf;
+    elf::ByteSection *_textSection = nullptr;
     elf::ByteSection *_gotSection = nullptr;
     elf::ByteSection *_pltSection = nullptr;
-    std::unordered_map<BasicBlock *, elf::Symbol *> _bbSymbols;
+    elf::ByteSection *_ehFrameSection = nullptr;
+    elf::EhFrameHeaderSection *_ehFrameHeader = nullptr;
+    // Maps names of external functions to their PLT stubs.
+    std::unordered_map<std::string, elf::Symbol *> _pltSymbols;
+    // For relocatable files: maps names of functions to their (possibly undefined) symbols.
+    std::unordered_map<std::string, elf::Symbol *> _functionSymbols;
+    std::unordered_map<std::string, EmittedFunction> _emittedFunctions;
+    // Size of .text without the textReserve.
+    size_t _textUsed = 0;
 };
 
 } // namespace lewis::targets::x86_64
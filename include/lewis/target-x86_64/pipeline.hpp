@@ -0,0 +1,27 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <functional>
+#include <lewis/ir.hpp>
+#include <lewis/pass-manager.hpp>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+
+namespace lewis::targets::x86_64 {
+
+// Adds the passes that turn generic IR into allocated x86_64 IR to a PassManager.
+using PipelineBuilder = std::function<void (PassManager *)>;
+
+// Lowering and register allocation.
+void addBasicPipeline(PassManager *pm);
+
+// Optimizations on generic IR, the basic pipeline and peephole optimizations.
+void addOptimizingPipeline(PassManager *pm);
+
+// Runs the pipeline on fn (which is modified in place) and encodes the result.
+// If statistics is set, the PassStatistics of the pipeline are added to it.
+FunctionCode compileFunction(Function *fn, const PipelineBuilder &pipeline,
+        PassStatisticsAccumulator *statistics = nullptr);
+
+} // namespace lewis::targets::x86_64
@@ -0,0 +1,131 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <lewis/ir.hpp>
+#include <lewis/pass-manager.hpp>
+#include <lewis/elf/loader.hpp>
+#include <lewis/target-x86_64/jit-profiling.hpp>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+#include <lewis/target-x86_64/pipeline.hpp>
+
+namespace lewis::targets::x86_64 {
+
+// Runs Functions in the current process and recompiles them once they become hot.
+//
+// Each Function has an entry stub that jumps through an 8-byte slot (similar to a GOT entry);
+// the stub is the address that entry() returns and that all calls between Functions
+// of the runtime refer to. Functions are first compiled by tier0Pipeline
+// (addBasicPipeline by default). Tier-0 code starts with an instruction that increments
+// the call counter of the Function. A background thread polls the counters and recompiles
+// Functions that reach hotThreshold by tier1Pipeline (addOptimizingPipeline).
+// The new code replaces the old code by an atomic store to the slot.
+//
+// Code is never freed before the runtime is destructed since other threads might
+// still execute it. The runtime must not be destructed while its code is running.
+struct TieredRuntime {
+    using PipelineBuilder = x86_64::PipelineBuilder;
+
+    // Resolves calls to functions that are not part of the runtime.
+    TieredRuntime(elf::SymbolResolver resolver);
+
+    TieredRuntime(const TieredRuntime &) = delete;
+
+    ~TieredRuntime();
+
+    TieredRuntime &operator= (const TieredRuntime &) = delete;
+
+    // Compiles fn at tier 0 and returns its entry stub. fn itself is not modified;
+    // the runtime keeps a serialized copy of the IR for recompilation.
+    // Throws std::runtime_error if the Function calls an unknown function; in that case,
+    // the Function is not added and its name can be used again.
+    void *addFunction(Function *fn);
+
+    // Same as addFunction() but the Functions of the Module can call each other.
+    // Either all Functions of the Module are added or none of them.
+    void addModule(Module *mod);
+
+    // Returns nullptr if there is no Function with the given name.
+    void *entry(const std::string &name);
+
+    // Queues the recompilation of a Function at tier 1, regardless of its call count.
+    void requestRecompile(const std::string &name);
+
+    // Waits until the recompilation queue is empty.
+    void drain();
+
+    // Returns 0 or 1.
+    int tier(const std::string &name);
+
+    // Number of calls of the tier-0 code. Increments from concurrent calls may be lost.
+    uint64_t callCount(const std::string &name);
+
+    // Options. They must be set before the first Function is added.
+    PipelineBuilder tier0Pipeline = addBasicPipeline;
+    PipelineBuilder tier1Pipeline = addOptimizingPipeline;
+    uint64_t hotThreshold = 1000;
+    std::chrono::microseconds pollInterval{1000};
+    // Size of the address range that holds all code, stubs and slots. All code must be
+    // placed within 2 GiB of the stubs, so the range is reserved up front.
+    size_t codeRegionSize = size_t(64) << 20;
+    // If set, all code (of both tiers) is reported to the sink.
+    JitProfilingSink *profilingSink = nullptr;
+
+private:
+    struct TieredFunction {
+        std::string name;
+        std::vector<uint8_t> ir;
+        uint8_t *stub = nullptr;
+        uint64_t *slot = nullptr;
+        uint64_t *counter = nullptr;
+        int tier = 0;
+        bool queued = false;
+    };
+
+    // Functions that are compiled at tier 0 but not yet visible through _byName.
+    using Batch = std::unordered_map<std::string, TieredFunction *>;
+
+    void _start();
+    void _addBatch(const std::vector<Function *> &fns);
+    std::unique_ptr<TieredFunction> _declare(Function *fn);
+    void _compile(TieredFunction *tf, int tier, const Batch *batch = nullptr);
+    uint8_t *_load(const FunctionCode *code, uint64_t *counter, const Batch *batch);
+    uint8_t *_allocatePages(size_t size);
+    void _work();
+
+    elf::SymbolResolver _resolver;
+    uint8_t *_region = nullptr;
+    size_t _regionSize = 0;
+
+    std::mutex _regionMutex;
+    size_t _regionUsed = 0;
+
+    // Protects all members below.
+    std::mutex _mutex;
+    std::condition_variable _workCv;
+    std::condition_variable _idleCv;
+    // Only Functions whose tier-0 code is loaded.
+    std::vector<std::unique_ptr<TieredFunction>> _functions;
+    std::unordered_map<std::string, TieredFunction *> _byName;
+    // Page of stubs that is followed by a page of slots and counters.
+    uint8_t *_stubPage = nullptr;
+    size_t _stubsUsed = 0;
+    std::deque<TieredFunction *> _queue;
+    bool _busy = false;
+    bool _stopping = false;
+    std::thread _worker;
+};
+
+} // namespace lewis::targets::x86_64
@@ -0,0 +1,96 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace lewis::util {
+
+// Bounded multi-producer multi-consumer queue that never takes a lock.
+// This follows Dmitry Vyukov's design: each cell carries a sequence number that tells
+// producers and consumers whether the cell is free or full in the current lap.
+// push() and pop() fail instead of waiting if the queue is full or empty.
+template<typename T>
+struct BoundedQueue {
+    // The capacity is rounded up to a power of two.
+    BoundedQueue(size_t capacity) {
+        size_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        _cells = std::make_unique<Cell[]>(n);
+        _mask = n - 1;
+        for (size_t i = 0; i < n; ++i)
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+
+    BoundedQueue &operator= (const BoundedQueue &) = delete;
+
+    // Leaves value untouched if the queue is full.
+    bool push(T &value) {
+        auto pos = _pushPos.load(std::memory_order_relaxed);
+        while (true) {
+            auto cell = &_cells[pos & _mask];
+            auto sequence = cell->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (!diff) {
+                if (_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell->value = std::move(value);
+                    cell->sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _pushPos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T &value) {
+        auto pos = _popPos.load(std::memory_order_relaxed);
+        while (true) {
+            auto cell = &_cells[pos & _mask];
+            auto sequence = cell->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (!diff) {
+                if (_popPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell->value);
+                    cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _popPos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only approximate while other threads push or pop.
+    size_t size() {
+        auto popPos = _popPos.load(std::memory_order_relaxed);
+        auto pushPos = _pushPos.load(std::memory_order_relaxed);
+        return pushPos > popPos ? pushPos - popPos : 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    // Producers and consumers touch different cache lines.
+    alignas(64) std::atomic<size_t> _pushPos{0};
+    alignas(64) std::atomic<size_t> _popPos{0};
+};
+
+} // namespace lewis::util
@@ -0,0 +1,93 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace lewis::util {
+
+// Reads from a buffer that is owned by the caller; never copies the input.
+// Reading past the end of the buffer does not fail immediately. Instead, zero is returned
+// and the decoder enters a failed state that callers check via ok().
+struct ByteDecoder {
+    ByteDecoder(const uint8_t *data, size_t size)
+    : _p{data}, _limit{data + size} { }
+
+private:
+    template<typename T>
+    T _peel() {
+        T v{};
+        if (static_cast<size_t>(_limit - _p) < sizeof(T)) {
+            _failed = true;
+            _p = _limit;
+            return v;
+        }
+        memcpy(&v, _p, sizeof(T));
+        _p += sizeof(T);
+        return v;
+    }
+
+public:
+    bool ok() {
+        return !_failed;
+    }
+
+    bool atEnd() {
+        return _p == _limit;
+    }
+
+    // Number of bytes that have not been read yet.
+    size_t remaining() {
+        return _limit - _p;
+    }
+
+    // Returns a pointer to the next n bytes and skips them.
+    const uint8_t *skip(size_t n) {
+        if (static_cast<size_t>(_limit - _p) < n) {
+            _failed = true;
+            _p = _limit;
+            return nullptr;
+        }
+        auto p = _p;
+        _p += n;
+        return p;
+    }
+
+    friend uint8_t decode8(ByteDecoder &d) { return d._peel<uint8_t>(); }
+    friend uint16_t decode16(ByteDecoder &d) { return d._peel<uint16_t>(); }
+    friend uint32_t decode32(ByteDecoder &d) { return d._peel<uint32_t>(); }
+    friend uint64_t decode64(ByteDecoder &d) { return d._peel<uint64_t>(); }
+
+    friend uint64_t decodeUleb128(ByteDecoder &d) {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            auto b = d._peel<uint8_t>();
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                return v;
+        }
+        d._failed = true;
+        return 0;
+    }
+    friend int64_t decodeZigZag(ByteDecoder &d) {
+        auto v = decodeUleb128(d);
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+
+    friend std::string decodeChars(ByteDecoder &d, size_t n) {
+        auto p = d.skip(n);
+        if (!p)
+            return {};
+        return std::string{reinterpret_cast<const char *>(p), n};
+    }
+
+private:
+    const uint8_t *_p;
+    const uint8_t *_limit;
+    bool _failed = false;
+};
+
+} // namespace lewis::util
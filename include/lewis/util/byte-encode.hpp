@@ -3,7 +3,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cstring>
+#include <vector>
 
 namespace lewis::util {
 
@@ -33,6 +35,20 @@ public:
     friend void encode32(ByteEncoder &e, uint32_t v) { e._poke<uint32_t>(v); }
     friend void encode64(ByteEncoder &e, uint64_t v) { e._poke<uint64_t>(v); }
 
+    // Variable-length encodings (unsigned LEB128 and zig-zag encoded signed LEB128).
+    friend void encodeUleb128(ByteEncoder &e, uint64_t v) {
+        do {
+            uint8_t b = v & 0x7F;
+            v >>= 7;
+            if (v)
+                b |= 0x80;
+            e._poke<uint8_t>(b);
+        } while (v);
+    }
+    friend void encodeZigZag(ByteEncoder &e, int64_t v) {
+        encodeUleb128(e, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+    }
+
 private:
     std::vector<uint8_t> *_out;
 };
@@ -0,0 +1,175 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <cassert>
+#include <lewis/analyses.hpp>
+
+namespace lewis {
+
+std::vector<BasicBlock *> successors(BasicBlock *bb) {
+    std::vector<BasicBlock *> result;
+    auto branch = bb->branch();
+    if (!branch)
+        return result;
+    if (auto unconditional = hierarchy_cast<UnconditionalBranch *>(branch); unconditional) {
+        result.push_back(unconditional->target);
+    } else if (auto conditional = hierarchy_cast<ConditionalBranch *>(branch); conditional) {
+        result.push_back(conditional->ifTarget);
+        if (conditional->elseTarget != conditional->ifTarget)
+            result.push_back(conditional->elseTarget);
+    } else {
+        assert(hierarchy_cast<FunctionReturnBranch *>(branch)
+                && "Analyses only support generic IR");
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------------------------
+// DominatorTree class.
+//---------------------------------------------------------------------------------------
+
+std::unique_ptr<DominatorTree> DominatorTree::compute(Function *fn, AnalysisManager *) {
+    auto tree = std::make_unique<DominatorTree>();
+    auto entry = *fn->blocks().begin();
+    for (auto bb : fn->blocks()) {
+        for (auto successor : successors(bb))
+            tree->_predecessors[successor].push_back(bb);
+    }
+
+    // Iterative DFS that records the post-order.
+    std::vector<BasicBlock *> postOrder;
+    std::unordered_set<BasicBlock *> visited;
+    std::vector<std::pair<BasicBlock *, size_t>> stack;
+    visited.insert(entry);
+    stack.push_back({entry, 0});
+    while (!stack.empty()) {
+        auto &[bb, index] = stack.back();
+        auto succs = successors(bb);
+        if (index < succs.size()) {
+            auto successor = succs[index++];
+            if (visited.insert(successor).second)
+                stack.push_back({successor, 0});
+        } else {
+            postOrder.push_back(bb);
+            stack.pop_back();
+        }
+    }
+
+    tree->_rpo.assign(postOrder.rbegin(), postOrder.rend());
+    for (size_t i = 0; i < tree->_rpo.size(); ++i)
+        tree->_rpoIndices.insert({tree->_rpo[i], i});
+
+    // Unprocessed entries are marked by SIZE_MAX; the entry block is its own idom here.
+    auto &idoms = tree->_idoms;
+    idoms.assign(tree->_rpo.size(), SIZE_MAX);
+    idoms[0] = 0;
+    auto intersect = [&] (size_t a, size_t b) {
+        while (a != b) {
+            while (a > b)
+                a = idoms[a];
+            while (b > a)
+                b = idoms[b];
+        }
+        return a;
+    };
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < tree->_rpo.size(); ++i) {
+            auto newIdom = SIZE_MAX;
+            for (auto predecessor : tree->_predecessors[tree->_rpo[i]]) {
+                auto it = tree->_rpoIndices.find(predecessor);
+                if (it == tree->_rpoIndices.end() || idoms[it->second] == SIZE_MAX)
+                    continue;
+                newIdom = (newIdom == SIZE_MAX) ? it->second : intersect(it->second, newIdom);
+            }
+            if (idoms[i] != newIdom) {
+                idoms[i] = newIdom;
+                changed = true;
+            }
+        }
+    }
+    return tree;
+}
+
+BasicBlock *DominatorTree::immediateDominator(BasicBlock *bb) {
+    auto it = _rpoIndices.find(bb);
+    if (it == _rpoIndices.end() || !it->second)
+        return nullptr;
+    return _rpo[_idoms[it->second]];
+}
+
+bool DominatorTree::dominates(BasicBlock *a, BasicBlock *b) {
+    auto aIt = _rpoIndices.find(a);
+    auto bIt = _rpoIndices.find(b);
+    if (aIt == _rpoIndices.end() || bIt == _rpoIndices.end())
+        return false;
+    // Dominators always precede the blocks that they dominate in reverse post-order.
+    auto index = bIt->second;
+    while (index > aIt->second)
+        index = _idoms[index];
+    return index == aIt->second;
+}
+
+//---------------------------------------------------------------------------------------
+// LoopInfo class.
+//---------------------------------------------------------------------------------------
+
+std::unique_ptr<LoopInfo> LoopInfo::compute(Function *fn, AnalysisManager *am) {
+    auto info = std::make_unique<LoopInfo>();
+    auto domTree = am->getResult<DominatorTree>(fn);
+    auto &rpo = domTree->reversePostOrder();
+
+    // Visit headers in post-order, so that nested Loops are discovered first.
+    for (auto it = rpo.rbegin(); it != rpo.rend(); ++it) {
+        auto header = *it;
+        std::vector<BasicBlock *> worklist;
+        for (auto predecessor : domTree->predecessors(header)) {
+            if (domTree->dominates(header, predecessor))
+                worklist.push_back(predecessor);
+        }
+        if (worklist.empty())
+            continue;
+
+        auto loop = std::make_unique<Loop>();
+        loop->header = header;
+        loop->latches = worklist;
+        info->_innermost[header] = loop.get();
+
+        // Walk backwards from the latches to the header.
+        while (!worklist.empty()) {
+            auto bb = worklist.back();
+            worklist.pop_back();
+            if (!domTree->isReachable(bb))
+                continue;
+
+            auto inner = info->loopFor(bb);
+            if (!inner) {
+                info->_innermost[bb] = loop.get();
+            } else {
+                while (inner->parent)
+                    inner = inner->parent;
+                if (inner == loop.get())
+                    continue;
+                // Skip the body of the nested Loop and continue at its header.
+                inner->parent = loop.get();
+                loop->children.push_back(inner);
+                bb = inner->header;
+            }
+            for (auto predecessor : domTree->predecessors(bb))
+                worklist.push_back(predecessor);
+        }
+        info->_loops.push_back(std::move(loop));
+    }
+
+    // Headers precede the other blocks of their Loops in reverse post-order.
+    for (auto bb : rpo) {
+        for (auto loop = info->loopFor(bb); loop; loop = loop->parent)
+            loop->addBlock(bb);
+    }
+    return info;
+}
+
+} // namespace lewis
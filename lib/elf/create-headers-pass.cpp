@@ -1,9 +1,12 @@
 // Copyright the lewis authors (AUTHORS.md) 2018
 // SPDX-License-Identifier: MIT
 
+#include <algorithm>
+#include <cassert>
 #include <elf.h>
 #include <lewis/elf/passes.hpp>
 #include <lewis/elf/utils.hpp>
+#include <lewis/statistics.hpp>
 
 namespace lewis::elf {
 
@@ -14,11 +17,19 @@ struct CreateHeadersPassImpl : CreateHeadersPass {
     void run() override;
 
 private:
+    void _createRelocatableHeaders();
+
     Object *_elf;
 };
 
 void CreateHeadersPassImpl::run() {
-    auto dynamicString = _elf->addString(std::make_unique<String>(".dynamic"));
+    TraceScope scope{"elf", "create-headers"};
+    if (_elf->fileType == FileType::relocatable) {
+        _createRelocatableHeaders();
+        return;
+    }
+
+    auto dynamicString = _elf->internString(".dynamic");
 
     auto phdrs = _elf->insertFragment(std::make_unique<PhdrsFragment>());
     _elf->phdrsFragment = phdrs;
@@ -29,13 +40,14 @@ void CreateHeadersPassImpl::run() {
     auto dynamic = _elf->insertFragment(std::make_unique<DynamicSection>());
     dynamic->name = dynamicString;
     dynamic->type = SHT_DYNAMIC;
-    dynamic->flags = SHF_ALLOC;
+    dynamic->flags = SHF_ALLOC | SHF_WRITE;
     _elf->dynamicFragment = dynamic;
 
     auto strtab = _elf->insertFragment(std::make_unique<StringTableSection>());
     strtab->type = SHT_STRTAB;
     strtab->flags = SHF_ALLOC;
     _elf->stringTableFragment = strtab;
+    dynamic->sectionLink = strtab;
 
     auto symtab = _elf->insertFragment(std::make_unique<SymbolTableSection>());
     symtab->type = SHT_SYMTAB;
@@ -53,11 +65,67 @@ void CreateHeadersPassImpl::run() {
     pltrel->entrySize = sizeof(Elf64_Rela);
     _elf->pltRelocationFragment = pltrel;
 
-    auto hashtab = _elf->insertFragment(std::make_unique<HashSection>());
-    hashtab->type = SHT_HASH;
-    hashtab->flags = SHF_ALLOC;
-    hashtab->sectionLink = symtab;
-    _elf->hashFragment = hashtab;
+    assert(sysvHash || gnuHash);
+    if (sysvHash) {
+        auto hashtab = _elf->insertFragment(std::make_unique<HashSection>());
+        hashtab->type = SHT_HASH;
+        hashtab->flags = SHF_ALLOC;
+        hashtab->sectionLink = symtab;
+        _elf->hashFragment = hashtab;
+    }
+
+    if (gnuHash) {
+        auto gnuHashtab = _elf->insertFragment(std::make_unique<GnuHashSection>());
+        gnuHashtab->type = SHT_GNU_HASH;
+        gnuHashtab->flags = SHF_ALLOC;
+        gnuHashtab->sectionLink = symtab;
+        _elf->gnuHashFragment = gnuHashtab;
+    }
+}
+
+// Relocatable files have no PHDRs and no dynamic sections. Instead, each section that has
+// internal relocations gets a .rela section that the system linker applies.
+void CreateHeadersPassImpl::_createRelocatableHeaders() {
+    std::vector<Fragment *> relocatedSections;
+    for (auto relocation : _elf->internalRelocations()) {
+        auto section = relocation->section.get();
+        if (std::find(relocatedSections.begin(), relocatedSections.end(), section)
+                == relocatedSections.end())
+            relocatedSections.push_back(section);
+    }
+
+    auto shdrs = _elf->insertFragment(std::make_unique<ShdrsFragment>());
+    _elf->shdrsFragment = shdrs;
+
+    auto strtab = _elf->insertFragment(std::make_unique<StringTableSection>());
+    strtab->name = _elf->internString(".strtab");
+    strtab->type = SHT_STRTAB;
+    _elf->stringTableFragment = strtab;
+
+    auto symtab = _elf->insertFragment(std::make_unique<SymbolTableSection>());
+    symtab->name = _elf->internString(".symtab");
+    symtab->type = SHT_SYMTAB;
+    symtab->sectionLink = strtab;
+    symtab->sectionInfo = 1;
+    symtab->entrySize = sizeof(Elf64_Sym);
+    _elf->symbolTableFragment = symtab;
+
+    for (auto section : relocatedSections) {
+        assert(section->name && "Relocated sections need a name");
+        auto rela = _elf->insertFragment(std::make_unique<RelocationSection>());
+        rela->name = _elf->internString(".rela" + section->name->buffer);
+        rela->type = SHT_RELA;
+        rela->flags = SHF_INFO_LINK;
+        rela->sectionLink = symtab;
+        rela->entrySize = sizeof(Elf64_Rela);
+        rela->appliesTo = section;
+    }
+
+    // Tell the linker that the code does not need an executable stack.
+    auto noteStack = _elf->insertFragment(std::make_unique<ByteSection>());
+    noteStack->name = _elf->internString(".note.GNU-stack");
+    noteStack->type = SHT_PROGBITS;
+    noteStack->alignment = 1;
 }
 
 std::unique_ptr<CreateHeadersPass> CreateHeadersPass::create(Object *elf) {
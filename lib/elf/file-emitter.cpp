@@ -1,35 +1,69 @@
 // Copyright the lewis authors (AUTHORS.md) 2018
 // SPDX-License-Identifier: MIT
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include <unordered_map>
 #include <elf.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <lewis/elf/file-emitter.hpp>
 #include <lewis/elf/passes.hpp>
 #include <lewis/elf/utils.hpp>
+#include <lewis/statistics.hpp>
 
 namespace lewis::elf {
 
 struct FileEmitterImpl : FileEmitter {
-    FileEmitterImpl(Object *elf)
-    : _elf{elf} { }
+    FileEmitterImpl(Object *elf, int fd)
+    : _elf{elf}, _fd{fd} { }
 
     void run() override;
 
+    void update() override;
+
 private:
+    // A contiguous range of the file. Header records are encoded into _staging,
+    // the contents of ByteSections are taken from their own buffers.
+    struct Chunk {
+        uintptr_t fileOffset;
+        const uint8_t *data;
+        size_t stagingOffset;
+        size_t size;
+    };
+
+    void _writeToBuffer(size_t fileSize);
+    void _writeToFile(size_t fileSize);
+    void _writeVectors(std::vector<iovec> &iovs, size_t offset);
+
+    void _emitFragment(Fragment *fragment);
+
     void _emitPhdrs(PhdrsFragment *phdrs);
     void _emitShdrs(ShdrsFragment *shdrs);
     void _emitDynamic(DynamicSection *dynamic);
     void _emitStringTable(StringTableSection *strtab);
     void _emitSymbolTable(SymbolTableSection *symtab);
+    void _encodeSymbol(util::ByteEncoder &section, Symbol *symbol);
     void _emitRela(RelocationSection *rel);
     void _emitHash(HashSection *hash);
+    void _emitGnuHash(GnuHashSection *gnuHash);
+    void _emitEhFrameHeader(EhFrameHeaderSection *ehFrameHeader);
 
     Object *_elf;
+    int _fd;
+    std::vector<uint8_t> _staging;
+    std::vector<Chunk> _chunks;
 };
 
 void FileEmitterImpl::run() {
-    util::ByteEncoder ehdr{&buffer};
+    TraceScope scope{"elf", "file-emitter"};
+    _staging.clear();
+    _chunks.clear();
+    util::ByteEncoder ehdr{&_staging};
 
     // Write the EHDR.e_ident field.
     encode8(ehdr, 0x7F);
@@ -43,85 +77,261 @@ void FileEmitterImpl::run() {
         encode8(ehdr, 0);
 
     // Write the remaining EHDR fields.
-    assert(_elf->phdrsFragment);
+    bool relocatable = _elf->fileType == FileType::relocatable;
+    assert(relocatable || _elf->phdrsFragment);
     assert(_elf->shdrsFragment);
     assert(_elf->stringTableFragment);
-    encodeHalf(ehdr, ET_DYN); // e_type
+    auto phdrs = _elf->phdrsFragment.get();
+    encodeHalf(ehdr, relocatable ? ET_REL : ET_DYN); // e_type
     encodeHalf(ehdr, EM_X86_64); // e_machine
     encodeWord(ehdr, 1); // e_version
     encodeAddr(ehdr, 0); // e_entry
-    encodeOff(ehdr, _elf->phdrsFragment->fileOffset.value()); // e_phoff
+    encodeOff(ehdr, phdrs ? phdrs->fileOffset.value() : 0); // e_phoff
     encodeOff(ehdr, _elf->shdrsFragment->fileOffset.value()); // e_shoff
     encodeWord(ehdr, 0); // e_flags
     // TODO: Do not hardcode this size.
     encodeHalf(ehdr, 64); // e_ehsize
-    encodeHalf(ehdr, sizeof(Elf64_Phdr)); // e_phentsize
-    // TODO: # of PHDRs should be independent of # of sections.
-    encodeHalf(ehdr, _elf->numberOfFragments() + 1); // e_phnum
+    encodeHalf(ehdr, phdrs ? sizeof(Elf64_Phdr) : 0); // e_phentsize
+    encodeHalf(ehdr, phdrs ? phdrs->computedSize.value() / sizeof(Elf64_Phdr) : 0); // e_phnum
     encodeHalf(ehdr, sizeof(Elf64_Shdr)); // e_shentsize
     encodeHalf(ehdr, 1 + _elf->numberOfSections()); // e_shnum
     encodeHalf(ehdr, _elf->stringTableFragment->designatedIndex.value()); // e_shstrndx
 
-    for (auto fragment : _elf->fragments()) {
-        // Make sure that sections are at least 8-byte aligned.
-        // TODO: Support arbitrary alignment.
-        while(buffer.size() & size_t(7))
-            buffer.push_back(0);
-
-        // Make sure that the fragment ends up at the correct address.
-        assert(fragment->fileOffset.value() == buffer.size());
-
-        if (auto phdrs = hierarchy_cast<PhdrsFragment *>(fragment); phdrs) {
-            _emitPhdrs(phdrs);
-        } else if (auto shdrs = hierarchy_cast<ShdrsFragment *>(fragment); shdrs) {
-            _emitShdrs(shdrs);
-        } else if (auto dynamic = hierarchy_cast<DynamicSection *>(fragment); dynamic) {
-            _emitDynamic(dynamic);
-        } else if (auto strtab = hierarchy_cast<StringTableSection *>(fragment); strtab) {
-            _emitStringTable(strtab);
-        } else if (auto symtab = hierarchy_cast<SymbolTableSection *>(fragment); symtab) {
-            _emitSymbolTable(symtab);
-        } else if (auto rel = hierarchy_cast<RelocationSection *>(fragment); rel) {
-            _emitRela(rel);
-        } else if (auto hash = hierarchy_cast<HashSection *>(fragment); hash) {
-            _emitHash(hash);
-        } else {
-            auto section = hierarchy_cast<ByteSection *>(fragment);
-            assert(section && "Unexpected Fragment for FileEmitter");
-            buffer.insert(buffer.end(), section->buffer.begin(), section->buffer.end());
+    // The LayoutPass groups fragments by segment, so the file order differs from
+    // the order of _elf->fragments().
+    std::vector<Fragment *> fileOrder;
+    for (auto fragment : _elf->fragments())
+        fileOrder.push_back(fragment);
+    std::sort(fileOrder.begin(), fileOrder.end(), [] (Fragment *a, Fragment *b) {
+        return a->fileOffset.value() < b->fileOffset.value();
+    });
+
+    _chunks.push_back({0, nullptr, 0, _staging.size()});
+    size_t fileSize = _staging.size();
+
+    for (auto fragment : fileOrder) {
+        assert(fragment->fileOffset.value() >= fileSize && "Fragments must not overlap");
+        fileSize = fragment->fileOffset.value() + fragment->computedSize.value();
+
+        // ByteSections are never copied into the staging buffer.
+        if (auto section = hierarchy_cast<ByteSection *>(fragment); section) {
+            assert(section->buffer.size() == fragment->computedSize.value());
+            _chunks.push_back({fragment->fileOffset.value(), section->buffer.data(),
+                    0, section->buffer.size()});
+            continue;
+        }
+
+        auto stagingOffset = _staging.size();
+        _emitFragment(fragment);
+        assert(_staging.size() - stagingOffset == fragment->computedSize.value());
+        _chunks.push_back({fragment->fileOffset.value(), nullptr, stagingOffset,
+                _staging.size() - stagingOffset});
+    }
+
+    if (_fd >= 0) {
+        _writeToFile(fileSize);
+    } else {
+        _writeToBuffer(fileSize);
+    }
+    countStatistic("file-emitter", "bytes", fileSize);
+    countStatistic("file-emitter", "staged-bytes", _staging.size());
+}
+
+void FileEmitterImpl::update() {
+    TraceScope scope{"elf", "file-emitter-update"};
+    _staging.clear();
+    _chunks.clear();
+
+    // Fragments other than ByteSections are encoded again as a whole,
+    // but only the modified bytes are written.
+    std::unordered_map<Fragment *, size_t> stagingOffsets;
+    for (auto &range : _elf->modifiedRanges) {
+        auto fragment = range.fragment;
+        assert(range.offset + range.size <= fragment->computedSize.value());
+        auto fileOffset = fragment->fileOffset.value() + range.offset;
+        if (auto section = hierarchy_cast<ByteSection *>(fragment); section) {
+            assert(section->buffer.size() == fragment->computedSize.value()
+                    && "Layout must not change before FileEmitter::update()");
+            _chunks.push_back({fileOffset, section->buffer.data() + range.offset,
+                    0, range.size});
+            continue;
+        }
+
+        auto it = stagingOffsets.find(fragment);
+        if (it == stagingOffsets.end()) {
+            it = stagingOffsets.insert({fragment, _staging.size()}).first;
+            _emitFragment(fragment);
+        }
+        _chunks.push_back({fileOffset, nullptr, it->second + range.offset, range.size});
+    }
+
+    // Symbol table entries are encoded individually.
+    for (auto symbol : _elf->modifiedSymbols) {
+        auto symtab = _elf->symbolTableFragment.get();
+        auto stagingOffset = _staging.size();
+        util::ByteEncoder section{&_staging};
+        _encodeSymbol(section, symbol);
+        _chunks.push_back({symtab->fileOffset.value()
+                + symbol->designatedIndex.value() * sizeof(Elf64_Sym),
+                nullptr, stagingOffset, sizeof(Elf64_Sym)});
+    }
+
+    if (_fd >= 0) {
+        // Overlapping and adjacent chunks are written by a single pwritev().
+        std::sort(_chunks.begin(), _chunks.end(), [] (const Chunk &a, const Chunk &b) {
+            return a.fileOffset < b.fileOffset;
+        });
+        size_t n = 0;
+        while (n < _chunks.size()) {
+            std::vector<iovec> iovs;
+            auto offset = _chunks[n].fileOffset;
+            auto end = offset;
+            for (; n < _chunks.size() && _chunks[n].fileOffset <= end; ++n) {
+                auto &chunk = _chunks[n];
+                auto data = chunk.data ? chunk.data : _staging.data() + chunk.stagingOffset;
+                auto overlap = end - chunk.fileOffset;
+                if (chunk.size <= overlap)
+                    continue;
+                iovs.push_back({const_cast<uint8_t *>(data + overlap), chunk.size - overlap});
+                end = chunk.fileOffset + chunk.size;
+            }
+            _writeVectors(iovs, offset);
+        }
+    } else {
+        for (auto &chunk : _chunks) {
+            auto data = chunk.data ? chunk.data : _staging.data() + chunk.stagingOffset;
+            assert(chunk.fileOffset + chunk.size <= buffer.size());
+            memcpy(buffer.data() + chunk.fileOffset, data, chunk.size);
+        }
+    }
+    countStatistic("file-emitter", "updated-ranges", _chunks.size());
+
+    _elf->modifiedRanges.clear();
+    _elf->modifiedSymbols.clear();
+}
+
+// Encodes a Fragment other than a ByteSection into _staging.
+void FileEmitterImpl::_emitFragment(Fragment *fragment) {
+    if (auto phdrs = hierarchy_cast<PhdrsFragment *>(fragment); phdrs) {
+        _emitPhdrs(phdrs);
+    } else if (auto shdrs = hierarchy_cast<ShdrsFragment *>(fragment); shdrs) {
+        _emitShdrs(shdrs);
+    } else if (auto dynamic = hierarchy_cast<DynamicSection *>(fragment); dynamic) {
+        _emitDynamic(dynamic);
+    } else if (auto strtab = hierarchy_cast<StringTableSection *>(fragment); strtab) {
+        _emitStringTable(strtab);
+    } else if (auto symtab = hierarchy_cast<SymbolTableSection *>(fragment); symtab) {
+        _emitSymbolTable(symtab);
+    } else if (auto rel = hierarchy_cast<RelocationSection *>(fragment); rel) {
+        _emitRela(rel);
+    } else if (auto hash = hierarchy_cast<HashSection *>(fragment); hash) {
+        _emitHash(hash);
+    } else if (auto gnuHash = hierarchy_cast<GnuHashSection *>(fragment); gnuHash) {
+        _emitGnuHash(gnuHash);
+    } else if (auto ehFrameHeader = hierarchy_cast<EhFrameHeaderSection *>(fragment);
+            ehFrameHeader) {
+        _emitEhFrameHeader(ehFrameHeader);
+    } else {
+        assert(!"Unexpected Fragment for FileEmitter");
+    }
+}
+
+void FileEmitterImpl::_writeToBuffer(size_t fileSize) {
+    buffer.assign(fileSize, 0);
+    for (auto &chunk : _chunks) {
+        auto data = chunk.data ? chunk.data : _staging.data() + chunk.stagingOffset;
+        memcpy(buffer.data() + chunk.fileOffset, data, chunk.size);
+    }
+}
+
+// Writes the whole file with as few pwritev() calls as possible. Padding between
+// the chunks is written from a static page of zeros.
+void FileEmitterImpl::_writeToFile(size_t fileSize) {
+    static const uint8_t zeros[0x1000] = {};
+
+    std::vector<iovec> iovs;
+    size_t offset = 0;
+    for (auto &chunk : _chunks) {
+        while (offset < chunk.fileOffset) {
+            auto padding = std::min(chunk.fileOffset - offset, sizeof(zeros));
+            iovs.push_back({const_cast<uint8_t *>(zeros), padding});
+            offset += padding;
+        }
+        auto data = chunk.data ? chunk.data : _staging.data() + chunk.stagingOffset;
+        if (chunk.size)
+            iovs.push_back({const_cast<uint8_t *>(data), chunk.size});
+        offset += chunk.size;
+    }
+    assert(offset == fileSize);
+    _writeVectors(iovs, 0);
+
+    // The file might have been larger before.
+    if (ftruncate(_fd, fileSize))
+        throw std::runtime_error("lewis: Could not resize ELF file");
+}
+
+// Writes the iovecs to consecutive bytes of the file, starting at offset.
+// Takes care of IOV_MAX and partial writes.
+void FileEmitterImpl::_writeVectors(std::vector<iovec> &iovs, size_t offset) {
+    size_t n = 0;
+    while (n < iovs.size()) {
+        auto count = std::min(iovs.size() - n, size_t{IOV_MAX});
+        auto written = pwritev(_fd, iovs.data() + n, count, offset);
+        if (written < 0)
+            throw std::runtime_error("lewis: Could not write ELF file");
+        countStatistic("file-emitter", "writes");
+        offset += written;
+
+        // Skip all iovecs that were written completely and adjust a partially written one.
+        size_t remaining = written;
+        while (n < iovs.size() && remaining >= iovs[n].iov_len)
+            remaining -= iovs[n++].iov_len;
+        if (remaining) {
+            iovs[n].iov_base = static_cast<uint8_t *>(iovs[n].iov_base) + remaining;
+            iovs[n].iov_len -= remaining;
         }
     }
 }
 
 void FileEmitterImpl::_emitPhdrs(PhdrsFragment *phdrs) {
-    util::ByteEncoder section{&buffer};
+    util::ByteEncoder section{&_staging};
 
-    for (auto fragment : _elf->fragments()) {
-        // TODO: p_type and p_flags are only fillers.
+    for (auto &segment : _elf->segments) {
         encodeWord(section, PT_LOAD); // p_type
-        encodeWord(section, PF_R | PF_X); // p_flags
-        encodeOff(section, fragment->fileOffset.value()); // p_offset
-        encodeAddr(section, fragment->virtualAddress.value()); // p_vaddr
-        encodeAddr(section, fragment->virtualAddress.value()); // p_paddr
-        // TODO: p_filesz and p_memsz need not match.
-        encodeXword(section, fragment->computedSize.value()); // p_filesz
-        encodeXword(section, fragment->computedSize.value()); // p_memsz
-        encodeXword(section, 0); // p_align
+        encodeWord(section, segment.flags); // p_flags
+        encodeOff(section, segment.fileOffset); // p_offset
+        encodeAddr(section, segment.virtualAddress); // p_vaddr
+        encodeAddr(section, segment.virtualAddress); // p_paddr
+        encodeXword(section, segment.fileSize); // p_filesz
+        encodeXword(section, segment.memorySize); // p_memsz
+        encodeXword(section, 0x1000); // p_align
     }
 
     // Emit the PT_DYNAMIC segment.
     encodeWord(section, PT_DYNAMIC); // p_type
-    encodeWord(section, PF_R); // p_flags
+    encodeWord(section, PF_R | PF_W); // p_flags
     encodeOff(section, _elf->dynamicFragment->fileOffset.value()); // p_offset
     encodeAddr(section, _elf->dynamicFragment->virtualAddress.value()); // p_vaddr
     encodeAddr(section, _elf->dynamicFragment->virtualAddress.value()); // p_paddr
     encodeXword(section, _elf->dynamicFragment->computedSize.value()); // p_filesz
     encodeXword(section, _elf->dynamicFragment->computedSize.value()); // p_memsz
-    encodeXword(section, 0); // p_align
+    encodeXword(section, 8); // p_align
+
+    // Emit the PT_GNU_EH_FRAME segment that unwinders use to find .eh_frame_hdr.
+    if (auto ehFrameHeader = _elf->ehFrameHeaderFragment.get(); ehFrameHeader) {
+        encodeWord(section, PT_GNU_EH_FRAME); // p_type
+        encodeWord(section, PF_R); // p_flags
+        encodeOff(section, ehFrameHeader->fileOffset.value()); // p_offset
+        encodeAddr(section, ehFrameHeader->virtualAddress.value()); // p_vaddr
+        encodeAddr(section, ehFrameHeader->virtualAddress.value()); // p_paddr
+        encodeXword(section, ehFrameHeader->computedSize.value()); // p_filesz
+        encodeXword(section, ehFrameHeader->computedSize.value()); // p_memsz
+        encodeXword(section, 4); // p_align
+    }
 }
 
 void FileEmitterImpl::_emitShdrs(ShdrsFragment *shdrs) {
-    util::ByteEncoder section{&buffer};
+    util::ByteEncoder section{&_staging};
 
     // Emit the SHN_UNDEF section. Specified in the ELF base specification.
     encodeWord(section, 0); // sh_name
@@ -154,6 +364,14 @@ void FileEmitterImpl::_emitShdrs(ShdrsFragment *shdrs) {
             linkIndex = fragment->sectionLink->designatedIndex.value();
         }
 
+        // sh_info of relocation sections refers to the section that they apply to.
+        size_t infoIndex = fragment->sectionInfo.value_or(0);
+        if (auto rel = hierarchy_cast<RelocationSection *>(fragment); rel && rel->appliesTo) {
+            assert(rel->appliesTo->designatedIndex.has_value()
+                    && "Section layout must be fixed for FileEmitter");
+            infoIndex = rel->appliesTo->designatedIndex.value();
+        }
+
         encodeWord(section, nameIndex); // sh_name
         encodeWord(section, fragment->type); // sh_type
         encodeXword(section, fragment->flags); // sh_flags
@@ -161,41 +379,54 @@ void FileEmitterImpl::_emitShdrs(ShdrsFragment *shdrs) {
         encodeOff(section, fragment->fileOffset.value()); // sh_offset
         encodeXword(section, fragment->computedSize.value()); // sh_size
         encodeWord(section, linkIndex); // sh_link
-        encodeWord(section, fragment->sectionInfo.value_or(0)); // sh_info
-        encodeXword(section, 0); // sh_addralign
+        encodeWord(section, infoIndex); // sh_info
+        encodeXword(section, fragment->alignment); // sh_addralign
         encodeXword(section, fragment->entrySize.value_or(0)); // sh_entsize
     }
 }
 
 void FileEmitterImpl::_emitDynamic(DynamicSection *dynamic) {
-    util::ByteEncoder section{&buffer};
+    util::ByteEncoder section{&_staging};
 
     encodeSxword(section, DT_STRTAB);
     encodeXword(section, _elf->stringTableFragment->virtualAddress.value());
+    encodeSxword(section, DT_STRSZ);
+    encodeXword(section, _elf->stringTableFragment->computedSize.value());
     encodeSxword(section, DT_SYMTAB);
     encodeXword(section, _elf->symbolTableFragment->virtualAddress.value());
-    encodeSxword(section, DT_HASH);
-    encodeXword(section, _elf->hashFragment->virtualAddress.value());
+    encodeSxword(section, DT_SYMENT);
+    encodeXword(section, sizeof(Elf64_Sym));
+    if (_elf->hashFragment) {
+        encodeSxword(section, DT_HASH);
+        encodeXword(section, _elf->hashFragment->virtualAddress.value());
+    }
+    if (_elf->gnuHashFragment) {
+        encodeSxword(section, DT_GNU_HASH);
+        encodeXword(section, _elf->gnuHashFragment->virtualAddress.value());
+    }
     encodeSxword(section, DT_JMPREL);
     encodeXword(section, _elf->pltRelocationFragment->virtualAddress.value());
     encodeSxword(section, DT_PLTRELSZ);
     encodeXword(section, _elf->pltRelocationFragment->computedSize.value());
+    // ld.so ignores DT_JMPREL unless DT_PLTREL is present.
+    encodeSxword(section, DT_PLTREL);
+    encodeXword(section, DT_RELA);
     encodeSxword(section, DT_NULL);
     encodeXword(section, 0);
 }
 
 void FileEmitterImpl::_emitStringTable(StringTableSection *strtab) {
-    util::ByteEncoder section{&buffer};
+    util::ByteEncoder section{&_staging};
 
     encode8(section, 0); // ELF uses index zero for non-existent strings.
-    for (auto string : _elf->strings()) {
+    for (auto string : strtab->storedStrings) {
         encodeChars(section, string->buffer.c_str());
         encode8(section, 0);
     }
 }
 
 void FileEmitterImpl::_emitSymbolTable(SymbolTableSection *symtab) {
-    util::ByteEncoder section{&buffer};
+    util::ByteEncoder section{&_staging};
 
     // Encode the null symbol.
     encodeWord(section, 0); // st_name
@@ -205,40 +436,57 @@ void FileEmitterImpl::_emitSymbolTable(SymbolTableSection *symtab) {
     encodeAddr(section, 0); // st_value
     encodeXword(section, 0); // st_size
 
-    // Encode all "real" symbols.
+    // Encode all "real" symbols, in the order that was chosen by the LayoutPass.
+    std::vector<Symbol *> order(_elf->symbols().size());
     for (auto symbol : _elf->symbols()) {
-        size_t nameIndex = 0;
-        if (symbol->name) {
-            assert(symbol->name->designatedOffset.has_value()
-                    && "String table layout must be fixed for FileEmitter");
-            nameIndex = symbol->name->designatedOffset.value();
-        }
+        assert(symbol->designatedIndex.has_value()
+                && "Symbol layout must be fixed for FileEmitter");
+        order[symbol->designatedIndex.value() - 1] = symbol;
+    }
+    for (auto symbol : order)
+        _encodeSymbol(section, symbol);
+}
 
-        size_t sectionIndex = 0;
-        uint64_t virtualAddress = 0;
-        if (symbol->section) {
-            assert(symbol->section->designatedIndex.has_value()
-                    && "Section layout must be fixed for FileEmitter");
-            assert(symbol->section->virtualAddress.has_value()
-                    && "Section layout must be fixed for FileEmitter");
-            sectionIndex = symbol->section->designatedIndex.value();
-            virtualAddress = symbol->section->virtualAddress.value() + symbol->value;
-        }
+void FileEmitterImpl::_encodeSymbol(util::ByteEncoder &section, Symbol *symbol) {
+    size_t nameIndex = 0;
+    if (symbol->name) {
+        assert(symbol->name->designatedOffset.has_value()
+                && "String table layout must be fixed for FileEmitter");
+        nameIndex = symbol->name->designatedOffset.value();
+    }
+
+    size_t sectionIndex = 0;
+    uint64_t virtualAddress = 0;
+    if (symbol->section) {
+        assert(symbol->section->designatedIndex.has_value()
+                && "Section layout must be fixed for FileEmitter");
+        assert(symbol->section->virtualAddress.has_value()
+                && "Section layout must be fixed for FileEmitter");
+        sectionIndex = symbol->section->designatedIndex.value();
+        virtualAddress = symbol->section->virtualAddress.value() + symbol->value;
+    }
+
+    // Local symbols only label BasicBlocks.
+    auto info = symbol->local ? ELF64_ST_INFO(STB_LOCAL, STT_NOTYPE)
+            : ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
 
-        encodeWord(section, nameIndex); // st_name
-        encode8(section, ELF64_ST_INFO(STB_GLOBAL, STT_FUNC)); // st_info
-        encode8(section, 0); // st_other
-        encodeHalf(section, sectionIndex); // st_shndx
-        // TODO: Use symbol->value in object files.
+    encodeWord(section, nameIndex); // st_name
+    encode8(section, info); // st_info
+    encode8(section, 0); // st_other
+    encodeHalf(section, sectionIndex); // st_shndx
+    // In relocatable files, st_value is relative to the section.
+    if (_elf->fileType == FileType::relocatable) {
+        encodeAddr(section, symbol->value); // st_value
+    } else {
         encodeAddr(section, virtualAddress); // st_value
-        encodeXword(section, 0); // st_size
     }
+    encodeXword(section, symbol->size); // st_size
 }
 
 void FileEmitterImpl::_emitRela(RelocationSection *rel) {
-    util::ByteEncoder section{&buffer};
+    util::ByteEncoder section{&_staging};
 
-    for (auto relocation : _elf->relocations()) {
+    auto emitRelocation = [&] (Relocation *relocation) {
         assert(relocation->offset >= 0);
 
         assert(relocation->section && "Section layout must be fixed for FileEmitter");
@@ -253,14 +501,29 @@ void FileEmitterImpl::_emitRela(RelocationSection *rel) {
             symbolIndex = relocation->symbol->designatedIndex.value();
         }
 
-        encodeAddr(section, sectionAddress + relocation->offset);
-        encodeXword(section, (symbolIndex << 32) | R_X86_64_JUMP_SLOT);
-        encodeSxword(section, 0);
+        // Static relocations use offsets relative to the section, dynamic ones use addresses.
+        if (rel->appliesTo) {
+            encodeAddr(section, relocation->offset);
+        } else {
+            encodeAddr(section, sectionAddress + relocation->offset);
+        }
+        encodeXword(section, (symbolIndex << 32) | relocation->type);
+        encodeSxword(section, relocation->addend.value_or(0));
+    };
+
+    if (rel->appliesTo) {
+        for (auto relocation : _elf->internalRelocations()) {
+            if (relocation->section == rel->appliesTo.get())
+                emitRelocation(relocation);
+        }
+    } else {
+        for (auto relocation : _elf->relocations())
+            emitRelocation(relocation);
     }
 }
 
 void FileEmitterImpl::_emitHash(HashSection *hash) {
-    util::ByteEncoder section{&buffer};
+    util::ByteEncoder section{&_staging};
 
     encodeWord(section, hash->buckets.size());
     encodeWord(section, hash->chains.size());
@@ -282,8 +545,68 @@ void FileEmitterImpl::_emitHash(HashSection *hash) {
     }
 }
 
+void FileEmitterImpl::_emitGnuHash(GnuHashSection *gnuHash) {
+    util::ByteEncoder section{&_staging};
+
+    encodeWord(section, gnuHash->buckets.size());
+    encodeWord(section, gnuHash->symbolOffset);
+    encodeWord(section, gnuHash->bloom.size());
+    encodeWord(section, gnuHash->bloomShift);
+
+    for (auto word : gnuHash->bloom)
+        encodeXword(section, word);
+
+    for (auto symbol : gnuHash->buckets) {
+        if (symbol) {
+            encodeWord(section, symbol->designatedIndex.value());
+        }else{
+            encodeWord(section, 0);
+        }
+    }
+
+    for (auto value : gnuHash->chains)
+        encodeWord(section, value);
+}
+
+void FileEmitterImpl::_emitEhFrameHeader(EhFrameHeaderSection *ehFrameHeader) {
+    util::ByteEncoder section{&_staging};
+    namespace pe = eh_pointer_encodings;
+
+    assert(ehFrameHeader->ehFrame);
+    auto headerAddress = ehFrameHeader->virtualAddress.value();
+    auto ehFrameAddress = ehFrameHeader->ehFrame->virtualAddress.value();
+
+    encode8(section, 1); // Version.
+    encode8(section, pe::pcrel | pe::sdata4); // Encoding of eh_frame_ptr.
+    encode8(section, pe::udata4); // Encoding of fde_count.
+    encode8(section, pe::datarel | pe::sdata4); // Encoding of the table entries.
+    encodeWord(section, ehFrameAddress - (headerAddress + 4)); // eh_frame_ptr
+    encodeWord(section, ehFrameHeader->entries.size()); // fde_count
+
+    // The table is searched by binary search, so it needs to be sorted by address.
+    std::vector<std::pair<uint64_t, uint64_t>> table;
+    for (auto &entry : ehFrameHeader->entries) {
+        auto symbol = entry.function;
+        assert(symbol->section && symbol->section->virtualAddress.has_value()
+                && "Section layout must be fixed for FileEmitter");
+        table.push_back({symbol->section->virtualAddress.value() + symbol->value,
+                ehFrameAddress + entry.fdeOffset});
+    }
+    std::sort(table.begin(), table.end());
+
+    for (auto &[functionAddress, fdeAddress] : table) {
+        encodeWord(section, functionAddress - headerAddress);
+        encodeWord(section, fdeAddress - headerAddress);
+    }
+}
+
 std::unique_ptr<FileEmitter> FileEmitter::create(Object *elf) {
-    return std::make_unique<FileEmitterImpl>(elf);
+    return std::make_unique<FileEmitterImpl>(elf, -1);
+}
+
+std::unique_ptr<FileEmitter> FileEmitter::createForFile(Object *elf, int fd) {
+    assert(fd >= 0);
+    return std::make_unique<FileEmitterImpl>(elf, fd);
 }
 
 } // namespace lewis::elf
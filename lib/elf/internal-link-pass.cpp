@@ -1,17 +1,16 @@
 // Copyright the lewis authors (AUTHORS.md) 2018
 // SPDX-License-Identifier: MIT
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
-#include <iostream>
 #include <elf.h>
 #include <lewis/elf/passes.hpp>
+#include <lewis/statistics.hpp>
 
 namespace lewis::elf {
 
 namespace {
-    constexpr bool verbose = false;
-
     void put32(uint8_t *p, uint32_t v) {
         memcpy(p, &v, sizeof(uint32_t));
     }
@@ -23,32 +22,64 @@ struct InternalLinkPassImpl : InternalLinkPass {
 
     void run() override;
 
+    void update() override;
+
 private:
+    void _apply(Relocation *relocation);
+
     Object *_elf;
 };
 
 void InternalLinkPassImpl::run() {
-    if(verbose)
-        std::cout << "Running InternalLinkPass" << std::endl;
+    if (_elf->fileType == FileType::relocatable)
+        return;
+
+    TraceScope scope{"elf", "internal-link"};
+    int64_t numRelocations = 0;
     for (auto relocation : _elf->internalRelocations()) {
-        assert(relocation->offset >= 0);
-
-        assert(relocation->section);
-        assert(relocation->section->virtualAddress.has_value()
-                && "Section layout must be fixed for InternalLinkPass");
-        auto relocationAddress = relocation->section->virtualAddress.value() + relocation->offset;
-
-        auto symbol = relocation->symbol;
-        assert(symbol->section);
-        assert(symbol->section->virtualAddress.has_value()
-                && "Section layout must be fixed for InternalLinkPass");
-        auto symbolAddress = symbol->section->virtualAddress.value() + symbol->value;
-
-        // Here, we emit a R_X86_64_PC32 relocation. TODO: Support other types of relocations.
-        auto byteSection = hierarchy_cast<ByteSection *>(relocation->section.get());
-        auto value = symbolAddress - relocationAddress + relocation->addend.value_or(0);
-        put32(byteSection->buffer.data() + relocation->offset, value);
+        _apply(relocation);
+        numRelocations++;
     }
+    _elf->staleRelocations.clear();
+    countStatistic("internal-link", "relocations", numRelocations);
+}
+
+void InternalLinkPassImpl::update() {
+    assert(_elf->fileType == FileType::sharedObject);
+
+    TraceScope scope{"elf", "internal-link-update"};
+    auto &stale = _elf->staleRelocations;
+    std::sort(stale.begin(), stale.end());
+    stale.erase(std::unique(stale.begin(), stale.end()), stale.end());
+    for (auto relocation : stale) {
+        _apply(relocation);
+        _elf->modifiedRanges.push_back({relocation->section.get(),
+                size_t(relocation->offset), 4});
+    }
+    countStatistic("internal-link", "updated-relocations", stale.size());
+    stale.clear();
+}
+
+void InternalLinkPassImpl::_apply(Relocation *relocation) {
+    assert(relocation->offset >= 0);
+
+    assert(relocation->section);
+    assert(relocation->section->virtualAddress.has_value()
+            && "Section layout must be fixed for InternalLinkPass");
+    auto relocationAddress = relocation->section->virtualAddress.value() + relocation->offset;
+
+    auto symbol = relocation->symbol.get();
+    assert(symbol->section);
+    assert(symbol->section->virtualAddress.has_value()
+            && "Section layout must be fixed for InternalLinkPass");
+    auto symbolAddress = symbol->section->virtualAddress.value() + symbol->value;
+
+    // Without an actual PLT, R_X86_64_PLT32 is computed like R_X86_64_PC32.
+    // TODO: Support other types of relocations.
+    assert(relocation->type == R_X86_64_PC32 || relocation->type == R_X86_64_PLT32);
+    auto byteSection = hierarchy_cast<ByteSection *>(relocation->section.get());
+    auto value = symbolAddress - relocationAddress + relocation->addend.value_or(0);
+    put32(byteSection->buffer.data() + relocation->offset, value);
 }
 
 std::unique_ptr<InternalLinkPass> InternalLinkPass::create(Object *elf) {
@@ -1,12 +1,14 @@
 // Copyright the lewis authors (AUTHORS.md) 2018
 // SPDX-License-Identifier: MIT
 
+#include <algorithm>
 #include <cassert>
 #include <climits>
 #include <iostream>
 #include <elf.h>
 #include <lewis/elf/passes.hpp>
 #include <lewis/elf/utils.hpp>
+#include <lewis/statistics.hpp>
 
 namespace {
     constexpr bool verbose = false;
@@ -32,6 +34,34 @@ namespace {
         }
         return h;
     }
+
+    // The hash function of DT_GNU_HASH (dl_new_hash in glibc).
+    uint32_t dlNewHash(const std::string &s) {
+        uint32_t h = 5381;
+        for (size_t i = 0; i < s.size(); ++i)
+            h = (h << 5) + h + (uint8_t)s[i];
+        return h;
+    }
+
+    constexpr size_t pageSize = 0x1000;
+
+    // Segments are laid out in this order: read-only data, code, writable data.
+    constexpr uint32_t segmentOrder[] = {PF_R, PF_R | PF_X, PF_R | PF_W, PF_R | PF_W | PF_X};
+
+    // Returns the PF_* flags of the segment that contains the fragment
+    // or zero if the fragment is not loaded into memory.
+    uint32_t segmentFlags(lewis::elf::Fragment *fragment) {
+        if (lewis::hierarchy_cast<lewis::elf::PhdrsFragment *>(fragment))
+            return PF_R;
+        if (!(fragment->flags & SHF_ALLOC))
+            return 0;
+        uint32_t flags = PF_R;
+        if (fragment->flags & SHF_WRITE)
+            flags |= PF_W;
+        if (fragment->flags & SHF_EXECINSTR)
+            flags |= PF_X;
+        return flags;
+    }
 }
 
 namespace lewis::elf {
@@ -43,42 +73,172 @@ struct LayoutPassImpl : LayoutPass {
     void run() override;
 
 private:
+    uint32_t _segmentFlags(Fragment *fragment);
+    void _orderSymbols();
+    void _buildGnuHash(GnuHashSection *gnuHash);
+
     Object *_elf;
 };
 
+// Relocatable files are not loaded, so they have no segments.
+uint32_t LayoutPassImpl::_segmentFlags(Fragment *fragment) {
+    if (_elf->fileType == FileType::relocatable)
+        return 0;
+    return segmentFlags(fragment);
+}
+
+// Assigns the symbol table indices. ELF requires local symbols to come first.
+// DT_GNU_HASH requires that hashed symbols are sorted by bucket and that they
+// follow all unhashed (i.e. undefined) symbols.
+void LayoutPassImpl::_orderSymbols() {
+    std::vector<Symbol *> order;
+    for (auto symbol : _elf->symbols())
+        order.push_back(symbol);
+
+    auto localEnd = std::stable_partition(order.begin(), order.end(),
+            [] (Symbol *symbol) { return symbol->local; });
+    if (_elf->symbolTableFragment)
+        _elf->symbolTableFragment->sectionInfo = 1 + (localEnd - order.begin());
+
+    if (auto gnuHash = hierarchy_cast<GnuHashSection *>(_elf->gnuHashFragment.get());
+            gnuHash) {
+        auto undefinedEnd = std::stable_partition(localEnd, order.end(),
+                [] (Symbol *symbol) { return !symbol->section; });
+        size_t numHashed = order.end() - undefinedEnd;
+        size_t numBuckets = std::max(size_t{1}, numHashed / 4);
+        std::stable_sort(undefinedEnd, order.end(), [&] (Symbol *a, Symbol *b) {
+            return dlNewHash(a->name->buffer) % numBuckets
+                    < dlNewHash(b->name->buffer) % numBuckets;
+        });
+        gnuHash->symbolOffset = 1 + (undefinedEnd - order.begin());
+        gnuHash->buckets.assign(numBuckets, nullptr);
+    }
+
+    size_t numEntries = 1; // ELF uses index zero for non-existent symbols.
+    for (auto symbol : order)
+        symbol->designatedIndex = numEntries++;
+}
+
+void LayoutPassImpl::_buildGnuHash(GnuHashSection *gnuHash) {
+    std::vector<Symbol *> hashed;
+    for (auto symbol : _elf->symbols()) {
+        assert(symbol->designatedIndex.has_value() && "Symbol layout needs to be fixed"
+                " before hash table is realized.");
+        if (symbol->designatedIndex.value() >= gnuHash->symbolOffset)
+            hashed.push_back(symbol);
+    }
+    std::sort(hashed.begin(), hashed.end(), [] (Symbol *a, Symbol *b) {
+        return a->designatedIndex.value() < b->designatedIndex.value();
+    });
+
+    // Use roughly 12 bits of bloom filter per symbol; each symbol sets two of them.
+    size_t numBloomWords = ceil2Power(std::max(size_t{1}, (hashed.size() * 12 + 63) / 64));
+    gnuHash->bloom.assign(numBloomWords, 0);
+    gnuHash->chains.resize(hashed.size());
+
+    auto numBuckets = gnuHash->buckets.size();
+    for (size_t i = 0; i < hashed.size(); ++i) {
+        auto h = dlNewHash(hashed[i]->name->buffer);
+        auto &word = gnuHash->bloom[(h / 64) & (numBloomWords - 1)];
+        word |= uint64_t{1} << (h % 64);
+        word |= uint64_t{1} << ((h >> gnuHash->bloomShift) % 64);
+
+        auto b = h % numBuckets;
+        if (!gnuHash->buckets[b])
+            gnuHash->buckets[b] = hashed[i];
+        bool last = i + 1 == hashed.size()
+                || dlNewHash(hashed[i + 1]->name->buffer) % numBuckets != b;
+        gnuHash->chains[i] = (h & ~uint32_t{1}) | (last ? 1 : 0);
+    }
+
+    countStatistic("layout", "gnu-hash-buckets", numBuckets);
+    countStatistic("layout", "gnu-hash-bloom-words", numBloomWords);
+}
+
 void LayoutPassImpl::run() {
+    TraceScope scope{"elf", "layout"};
+
+    // Determine which segments exist. Their order is also the order in memory.
+    _elf->segments.clear();
+    for (auto flags : segmentOrder) {
+        for (auto fragment : _elf->fragments()) {
+            if (_segmentFlags(fragment) != flags)
+                continue;
+            Segment segment;
+            segment.flags = flags;
+            _elf->segments.push_back(segment);
+            break;
+        }
+    }
+
+    _orderSymbols();
+
+    // Compute the sizes of all fragments.
     size_t sectionIndex = 1;
-    size_t offset = 64; // Size of EHDR.
-    size_t address = 0x1000;
-    if(verbose)
-        std::cout << "Running LayoutPass" << std::endl;
     for (auto fragment : _elf->fragments()) {
         size_t size;
         if (auto phdrs = hierarchy_cast<PhdrsFragment *>(fragment); phdrs) {
-            // TODO: # of PHDRs should be independent of # of sections.
-            size = (_elf->numberOfFragments() + 1) * sizeof(Elf64_Phdr);
+            // PT_LOADs, followed by PT_DYNAMIC and PT_GNU_EH_FRAME.
+            size = (_elf->segments.size() + 1 + (_elf->ehFrameHeaderFragment ? 1 : 0))
+                    * sizeof(Elf64_Phdr);
         } else if (auto shdrs = hierarchy_cast<ShdrsFragment *>(fragment); shdrs) {
             size = (1 + _elf->numberOfSections()) * sizeof(Elf64_Shdr);
         } else if (auto dynamic = hierarchy_cast<DynamicSection *>(fragment); dynamic) {
-            size = 6 * 16;
+            // DT_STRTAB, DT_STRSZ, DT_SYMTAB, DT_SYMENT, DT_JMPREL, DT_PLTRELSZ, DT_PLTREL,
+            // DT_NULL and the hash tables.
+            size = (8 + (_elf->hashFragment ? 1 : 0) + (_elf->gnuHashFragment ? 1 : 0)) * 16;
         } else if (auto strtab = hierarchy_cast<StringTableSection *>(fragment); strtab) {
+            // Sort by reversed contents. Afterwards, each string that is a suffix of
+            // another string directly precedes a string that it is a suffix of.
+            std::vector<String *> order;
+            for (auto string : _elf->strings())
+                order.push_back(string);
+            std::sort(order.begin(), order.end(), [] (String *a, String *b) {
+                return std::lexicographical_compare(a->buffer.rbegin(), a->buffer.rend(),
+                        b->buffer.rbegin(), b->buffer.rend());
+            });
+
             size = 1; // ELF uses index zero for non-existent strings.
-            for (auto string : _elf->strings()) {
-                string->designatedOffset = size;
-                size += string->buffer.size() + 1;
+            size_t numMerged = 0;
+            String *previous = nullptr;
+            strtab->storedStrings.clear();
+            for (auto it = order.rbegin(); it != order.rend(); ++it) {
+                auto string = *it;
+                auto length = string->buffer.size();
+                if (previous && previous->buffer.size() >= length
+                        && !previous->buffer.compare(previous->buffer.size() - length,
+                                length, string->buffer)) {
+                    // Tail-merge the string into the previous one.
+                    string->designatedOffset = previous->designatedOffset.value()
+                            + previous->buffer.size() - length;
+                    numMerged++;
+                } else {
+                    string->designatedOffset = size;
+                    size += length + 1;
+                    strtab->storedStrings.push_back(string);
+                }
+                previous = string;
             }
+
+            countStatistic("layout", "strtab-merged-strings", numMerged);
+            countStatistic("layout", "strtab-bytes", size);
         } else if (auto symtab = hierarchy_cast<SymbolTableSection *>(fragment); symtab) {
-            size_t numEntries = 1; // ELF uses index zero for non-existent symbols.
-            for (auto symbol : _elf->symbols()) {
-                symbol->designatedIndex = numEntries;
-                numEntries++;
-            }
-            size = sizeof(Elf64_Sym) * numEntries;
+            // ELF uses index zero for non-existent symbols.
+            size = sizeof(Elf64_Sym) * (1 + _elf->symbols().size());
         } else if (auto rel = hierarchy_cast<RelocationSection *>(fragment); rel) {
             size_t numEntries = 0;
-            for (auto relocation : _elf->relocations()) {
-                relocation->designatedIndex = numEntries;
-                numEntries++;
+            if (rel->appliesTo) {
+                for (auto relocation : _elf->internalRelocations()) {
+                    if (relocation->section != rel->appliesTo.get())
+                        continue;
+                    relocation->designatedIndex = numEntries;
+                    numEntries++;
+                }
+            } else {
+                for (auto relocation : _elf->relocations()) {
+                    relocation->designatedIndex = numEntries;
+                    numEntries++;
+                }
             }
             size = sizeof(Elf64_Rela) * numEntries;
         } else if (auto hash = hierarchy_cast<HashSection *>(fragment); hash) {
@@ -94,7 +254,7 @@ void LayoutPassImpl::run() {
             std::vector<BucketData> bucketData;
             bucketData.resize(tableSize, BucketData{0, 0});
 
-            size_t maxCollisions = 0;
+            size_t numCollisions = 0;
             for (auto symbol : _elf->symbols()) {
                 assert(symbol->designatedIndex.has_value() && "Symbol layout needs to be fixed"
                         " before hash table is realized.");
@@ -107,41 +267,87 @@ void LayoutPassImpl::run() {
                     hash->chains[t] = symbol;
                     bucketData[b].tail = symbol->designatedIndex.value();
                     bucketData[b].collisions++;
-                    maxCollisions = std::max(maxCollisions, bucketData[b].collisions);
+                    numCollisions++;
                 }
             }
 
-            if(verbose)
-                std::cout << "ELF hash table of size " << tableSize
-                        << " contains " << _elf->symbols().size()
-                        << " symbols; there are at most " << maxCollisions
-                        << " collisions" << std::endl;
+            countStatistic("layout", "hash-buckets", tableSize);
+            countStatistic("layout", "hash-symbols", _elf->symbols().size());
+            countStatistic("layout", "hash-collisions", numCollisions);
+
+            // nbucket and nchain, followed by the buckets and chains.
+            size = 8 + 4 * (hash->buckets.size() + hash->chains.size());
+        } else if (auto gnuHash = hierarchy_cast<GnuHashSection *>(fragment); gnuHash) {
+            _buildGnuHash(gnuHash);
+            // nbuckets, symoffset, bloom_size and bloom_shift, followed by the tables.
+            size = 16 + 8 * gnuHash->bloom.size() + 4 * gnuHash->buckets.size()
+                    + 4 * gnuHash->chains.size();
+        } else if (auto ehFrameHeader = hierarchy_cast<EhFrameHeaderSection *>(fragment);
+                ehFrameHeader) {
+            // Header, followed by a pair of 32-bit offsets per FDE.
+            size = 12 + 8 * ehFrameHeader->entries.size();
         } else {
             auto section = hierarchy_cast<ByteSection *>(fragment);
             assert(section && "Unexpected ELF fragment");
             size = section->buffer.size();
         }
 
-        if(verbose)
-            std::cout << "Laying out fragment " << fragment << " at " << (void *)offset
-                    << ", size: " << (void *)size << std::endl;
         if (fragment->isSection())
             fragment->designatedIndex = sectionIndex++;
+        fragment->computedSize = size;
+    }
 
-        // Make sure that sections are at least 8-byte aligned.
-        // TODO: Support arbitrary alignment.
-        offset = (offset + 7) & ~size_t(7);
-
-        // TODO: Perform virtualAddress allocation per segment and not per section.
-        // Make sure each segment starts on it's own page.
-        address = (address + 0xFFF) & ~size_t{0xFFF};
-        // Make sure virtualAddress and fileOffset match modulo page size.
-        address += offset & 0xFFF;
+    // Pack the fragments into their segments. Fragments that are not part of any segment
+    // (e.g. the SHDRs) go to the end of the file.
+    size_t offset = 64; // Size of EHDR.
+    size_t address = 0;
+    auto place = [&] (Fragment *fragment) {
+        // Since virtualAddress and fileOffset match modulo the page size,
+        // aligning the offset also aligns the address.
+        auto alignment = fragment->alignment;
+        assert(alignment && !(alignment & (alignment - 1)) && alignment <= pageSize);
+        auto padding = ((offset + alignment - 1) & ~(alignment - 1)) - offset;
+        offset += padding;
+        address += padding;
 
+        if(verbose)
+            std::cout << "Laying out fragment " << fragment << " at " << (void *)offset
+                    << ", size: " << (void *)fragment->computedSize.value() << std::endl;
         fragment->fileOffset = offset;
         fragment->virtualAddress = address;
-        fragment->computedSize = size;
-        offset += size;
+        offset += fragment->computedSize.value();
+        address += fragment->computedSize.value();
+    };
+
+    for (auto &segment : _elf->segments) {
+        // The first segment also maps the EHDR.
+        segment.fileOffset = (&segment == &_elf->segments.front()) ? 0 : offset;
+        // Make sure each segment starts on it's own page. The virtual address needs to match
+        // the file offset modulo the page size, so that the segment can be mmap()ed.
+        address = ((address + pageSize - 1) & ~(pageSize - 1))
+                + (segment.fileOffset & (pageSize - 1));
+        segment.virtualAddress = address;
+        address += offset - segment.fileOffset;
+
+        // Loaders expect the PHDRs right after the EHDR.
+        auto phdrs = _elf->phdrsFragment.get();
+        if (phdrs && _segmentFlags(phdrs) == segment.flags)
+            place(phdrs);
+        for (auto fragment : _elf->fragments()) {
+            if (fragment != phdrs && _segmentFlags(fragment) == segment.flags)
+                place(fragment);
+        }
+
+        segment.fileSize = offset - segment.fileOffset;
+        segment.memorySize = segment.fileSize;
+    }
+
+    for (auto fragment : _elf->fragments()) {
+        if (_segmentFlags(fragment))
+            continue;
+        address = 0;
+        place(fragment);
+        fragment->virtualAddress = 0;
     }
 }
 
@@ -0,0 +1,403 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <lewis/statistics.hpp>
+#include <lewis/elf/loader.hpp>
+
+namespace lewis::elf {
+
+namespace {
+    // Hash function of DT_HASH.
+    uint32_t elf64Hash(const char *s) {
+        uint32_t h = 0;
+        for (; *s; ++s) {
+            h = (h << 4) + (uint8_t)*s;
+            uint32_t g = h & 0xF0000000;
+            if (g)
+                h ^= g >> 24;
+            h &= 0x0FFFFFFF;
+        }
+        return h;
+    }
+
+    // Hash function of DT_GNU_HASH.
+    uint32_t dlNewHash(const char *s) {
+        uint32_t h = 5381;
+        for (; *s; ++s)
+            h = (h << 5) + h + (uint8_t)*s;
+        return h;
+    }
+
+    constexpr size_t pageSize = 0x1000;
+
+    size_t pageDown(size_t x) {
+        return x & ~(pageSize - 1);
+    }
+
+    size_t pageUp(size_t x) {
+        return (x + pageSize - 1) & ~(pageSize - 1);
+    }
+
+    int protectionOf(uint32_t flags) {
+        int prot = 0;
+        if (flags & PF_R)
+            prot |= PROT_READ;
+        if (flags & PF_W)
+            prot |= PROT_WRITE;
+        if (flags & PF_X)
+            prot |= PROT_EXEC;
+        return prot;
+    }
+}
+
+struct LoadedImageImpl : LoadedImage {
+    LoadedImageImpl() = default;
+
+    LoadedImageImpl(const LoadedImageImpl &) = delete;
+
+    ~LoadedImageImpl() override;
+
+    LoadedImageImpl &operator= (const LoadedImageImpl &) = delete;
+
+    void *lookup(const char *name) override;
+
+    uint8_t *base() override {
+        return _base;
+    }
+
+    void readHeaders(const uint8_t *data, size_t size);
+    void mapFromBuffer(const uint8_t *data, size_t size);
+    void mapFromFile(int fd, size_t size);
+    void link(const SymbolResolver &resolver);
+
+private:
+    void _reserve(size_t fileSize, int prot);
+    void _parseDynamic();
+    void _applyRelocations(uint64_t address, size_t size, const SymbolResolver &resolver);
+    const Elf64_Sym *_lookupGnu(const char *name);
+    const Elf64_Sym *_lookupSysv(const char *name);
+
+    // Translates a virtual address of the file; throws if it is out of bounds.
+    template<typename T>
+    T *_at(uint64_t address, size_t size = sizeof(T)) {
+        if (address > _size || size > _size - address)
+            throw std::runtime_error("ELF image refers to unmapped memory");
+        return reinterpret_cast<T *>(_base + address);
+    }
+
+    std::vector<Elf64_Phdr> _phdrs;
+    uint8_t *_base = nullptr;
+    size_t _size = 0;
+
+    const char *_strtab = nullptr;
+    size_t _strtabSize = 0;
+    const Elf64_Sym *_symtab = nullptr;
+    const uint32_t *_hash = nullptr;
+    const uint32_t *_gnuHash = nullptr;
+    uint64_t _pltRelocations = 0;
+    size_t _pltRelocationsSize = 0;
+    uint64_t _relocations = 0;
+    size_t _relocationsSize = 0;
+};
+
+LoadedImageImpl::~LoadedImageImpl() {
+    if (_base)
+        munmap(_base, _size);
+}
+
+void LoadedImageImpl::readHeaders(const uint8_t *data, size_t size) {
+    Elf64_Ehdr ehdr;
+    if (size < sizeof(Elf64_Ehdr))
+        throw std::runtime_error("ELF image is truncated");
+    memcpy(&ehdr, data, sizeof(Elf64_Ehdr));
+    if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG)
+            || ehdr.e_ident[EI_CLASS] != ELFCLASS64
+            || ehdr.e_ident[EI_DATA] != ELFDATA2LSB)
+        throw std::runtime_error("Not a little-endian ELF64 file");
+    if (ehdr.e_type != ET_DYN || ehdr.e_machine != EM_X86_64)
+        throw std::runtime_error("Not an x86_64 shared object");
+    if (ehdr.e_phentsize != sizeof(Elf64_Phdr)
+            || ehdr.e_phoff > size
+            || ehdr.e_phnum * sizeof(Elf64_Phdr) > size - ehdr.e_phoff)
+        throw std::runtime_error("ELF image has invalid PHDRs");
+
+    _phdrs.resize(ehdr.e_phnum);
+    memcpy(_phdrs.data(), data + ehdr.e_phoff, ehdr.e_phnum * sizeof(Elf64_Phdr));
+}
+
+// Reserves address space for all PT_LOAD segments.
+void LoadedImageImpl::_reserve(size_t fileSize, int prot) {
+    size_t end = 0;
+    for (auto &phdr : _phdrs) {
+        if (phdr.p_type != PT_LOAD)
+            continue;
+        if (phdr.p_filesz > phdr.p_memsz
+                || phdr.p_offset > fileSize || phdr.p_filesz > fileSize - phdr.p_offset)
+            throw std::runtime_error("ELF image has an invalid PT_LOAD");
+        end = std::max(end, size_t(phdr.p_vaddr + phdr.p_memsz));
+    }
+    if (!end)
+        throw std::runtime_error("ELF image has no PT_LOAD");
+
+    _size = pageUp(end);
+    void *mapping = mmap(nullptr, _size, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        _size = 0;
+        throw std::runtime_error("Could not reserve memory for ELF image");
+    }
+    _base = static_cast<uint8_t *>(mapping);
+}
+
+void LoadedImageImpl::mapFromBuffer(const uint8_t *data, size_t size) {
+    // Everything stays writable until link() is done. Anonymous memory is already zeroed.
+    _reserve(size, PROT_READ | PROT_WRITE);
+    for (auto &phdr : _phdrs) {
+        if (phdr.p_type != PT_LOAD)
+            continue;
+        memcpy(_base + phdr.p_vaddr, data + phdr.p_offset, phdr.p_filesz);
+    }
+}
+
+void LoadedImageImpl::mapFromFile(int fd, size_t size) {
+    _reserve(size, PROT_NONE);
+    for (auto &phdr : _phdrs) {
+        if (phdr.p_type != PT_LOAD)
+            continue;
+        if ((phdr.p_vaddr - phdr.p_offset) & (pageSize - 1))
+            throw std::runtime_error("ELF segment is not congruent to its file offset");
+
+        // Map the file pages privately, so that relocations do not modify the file.
+        auto misalignment = phdr.p_vaddr & (pageSize - 1);
+        auto begin = pageDown(phdr.p_vaddr);
+        if (phdr.p_filesz) {
+            if (mmap(_base + begin, misalignment + phdr.p_filesz, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED, fd, phdr.p_offset - misalignment) == MAP_FAILED)
+                throw std::runtime_error("Could not map ELF segment");
+        }
+
+        // The remainder of the segment is backed by the anonymous reservation.
+        if (phdr.p_memsz > phdr.p_filesz) {
+            auto fileEnd = phdr.p_vaddr + phdr.p_filesz;
+            auto end = pageUp(phdr.p_vaddr + phdr.p_memsz);
+            if (mprotect(_base + pageUp(fileEnd), end - pageUp(fileEnd),
+                    PROT_READ | PROT_WRITE))
+                throw std::runtime_error("Could not map ELF segment");
+            memset(_base + fileEnd, 0, pageUp(fileEnd) - fileEnd);
+        }
+    }
+}
+
+void LoadedImageImpl::_parseDynamic() {
+    const Elf64_Phdr *dynamicPhdr = nullptr;
+    for (auto &phdr : _phdrs) {
+        if (phdr.p_type == PT_DYNAMIC)
+            dynamicPhdr = &phdr;
+    }
+    if (!dynamicPhdr)
+        throw std::runtime_error("ELF image has no PT_DYNAMIC");
+
+    auto dynamic = _at<Elf64_Dyn>(dynamicPhdr->p_vaddr, dynamicPhdr->p_memsz);
+    uint64_t strtab = 0;
+    uint64_t symtab = 0;
+    uint64_t hash = 0;
+    uint64_t gnuHash = 0;
+    for (size_t i = 0; i < dynamicPhdr->p_memsz / sizeof(Elf64_Dyn); ++i) {
+        auto &entry = dynamic[i];
+        if (entry.d_tag == DT_NULL)
+            break;
+        switch (entry.d_tag) {
+        case DT_STRTAB: strtab = entry.d_un.d_ptr; break;
+        case DT_STRSZ: _strtabSize = entry.d_un.d_val; break;
+        case DT_SYMTAB: symtab = entry.d_un.d_ptr; break;
+        case DT_HASH: hash = entry.d_un.d_ptr; break;
+        case DT_GNU_HASH: gnuHash = entry.d_un.d_ptr; break;
+        case DT_JMPREL: _pltRelocations = entry.d_un.d_ptr; break;
+        case DT_PLTRELSZ: _pltRelocationsSize = entry.d_un.d_val; break;
+        case DT_RELA: _relocations = entry.d_un.d_ptr; break;
+        case DT_RELASZ: _relocationsSize = entry.d_un.d_val; break;
+        case DT_PLTREL:
+            if (entry.d_un.d_val != DT_RELA)
+                throw std::runtime_error("ELF image uses REL instead of RELA");
+            break;
+        case DT_SYMENT:
+            if (entry.d_un.d_val != sizeof(Elf64_Sym))
+                throw std::runtime_error("ELF image has an invalid DT_SYMENT");
+            break;
+        case DT_NEEDED:
+        case DT_INIT:
+        case DT_INIT_ARRAY:
+        case DT_TEXTREL:
+            throw std::runtime_error("ELF image requires unsupported dynamic features");
+        }
+    }
+    if (!strtab || !symtab || (!hash && !gnuHash))
+        throw std::runtime_error("ELF image lacks a symbol or hash table");
+
+    _strtab = _at<const char>(strtab, _strtabSize);
+    _symtab = _at<const Elf64_Sym>(symtab);
+    if (hash)
+        _hash = _at<const uint32_t>(hash, 8);
+    if (gnuHash)
+        _gnuHash = _at<const uint32_t>(gnuHash, 16);
+}
+
+void LoadedImageImpl::_applyRelocations(uint64_t address, size_t size,
+        const SymbolResolver &resolver) {
+    auto relocations = _at<const Elf64_Rela>(address, size);
+    for (size_t i = 0; i < size / sizeof(Elf64_Rela); ++i) {
+        auto &rela = relocations[i];
+        auto type = ELF64_R_TYPE(rela.r_info);
+        if (type == R_X86_64_NONE)
+            continue;
+
+        uint64_t value = 0;
+        if (auto index = ELF64_R_SYM(rela.r_info); index) {
+            auto &symbol = _symtab[index];
+            if (symbol.st_name >= _strtabSize)
+                throw std::runtime_error("ELF symbol has an invalid name");
+            auto name = _strtab + symbol.st_name;
+            if (symbol.st_shndx != SHN_UNDEF) {
+                value = reinterpret_cast<uint64_t>(_base + symbol.st_value);
+            } else if (auto resolved = resolver ? resolver(name) : nullptr; resolved) {
+                value = reinterpret_cast<uint64_t>(resolved);
+            } else {
+                throw std::runtime_error(std::string{"Unresolved symbol "} + name);
+            }
+        }
+
+        auto site = _at<uint64_t>(rela.r_offset);
+        switch (type) {
+        case R_X86_64_JUMP_SLOT:
+        case R_X86_64_GLOB_DAT:
+            *site = value;
+            break;
+        case R_X86_64_64:
+            *site = value + rela.r_addend;
+            break;
+        case R_X86_64_RELATIVE:
+            *site = reinterpret_cast<uint64_t>(_base) + rela.r_addend;
+            break;
+        default:
+            throw std::runtime_error("Unsupported relocation type "
+                    + std::to_string(type));
+        }
+    }
+    countStatistic("elf-loader", "relocations", size / sizeof(Elf64_Rela));
+}
+
+void LoadedImageImpl::link(const SymbolResolver &resolver) {
+    _parseDynamic();
+    if (_relocations)
+        _applyRelocations(_relocations, _relocationsSize, resolver);
+    if (_pltRelocations)
+        _applyRelocations(_pltRelocations, _pltRelocationsSize, resolver);
+
+    // Relocations are resolved eagerly; hence, we can drop the write permissions now.
+    for (auto &phdr : _phdrs) {
+        if (phdr.p_type != PT_LOAD)
+            continue;
+        auto begin = pageDown(phdr.p_vaddr);
+        if (mprotect(_base + begin, pageUp(phdr.p_vaddr + phdr.p_memsz) - begin,
+                protectionOf(phdr.p_flags)))
+            throw std::runtime_error("Could not protect ELF segment");
+    }
+}
+
+const Elf64_Sym *LoadedImageImpl::_lookupGnu(const char *name) {
+    auto numBuckets = _gnuHash[0];
+    auto symbolOffset = _gnuHash[1];
+    auto bloomSize = _gnuHash[2];
+    auto bloomShift = _gnuHash[3];
+    if (!numBuckets || !bloomSize)
+        return nullptr;
+    auto bloom = reinterpret_cast<const uint64_t *>(_gnuHash + 4);
+    auto buckets = reinterpret_cast<const uint32_t *>(bloom + bloomSize);
+    auto chains = buckets + numBuckets;
+
+    // The bloom filter rejects most symbols that are not defined by the image.
+    auto h = dlNewHash(name);
+    auto word = bloom[(h / 64) % bloomSize];
+    auto mask = (uint64_t(1) << (h % 64)) | (uint64_t(1) << ((h >> bloomShift) % 64));
+    if ((word & mask) != mask)
+        return nullptr;
+
+    auto index = buckets[h % numBuckets];
+    if (index < symbolOffset)
+        return nullptr;
+    while (true) {
+        auto chainHash = chains[index - symbolOffset];
+        auto symbol = &_symtab[index];
+        if ((chainHash | 1) == (h | 1) && symbol->st_name < _strtabSize
+                && !strcmp(name, _strtab + symbol->st_name))
+            return symbol;
+        if (chainHash & 1)
+            return nullptr;
+        index++;
+    }
+}
+
+const Elf64_Sym *LoadedImageImpl::_lookupSysv(const char *name) {
+    auto numBuckets = _hash[0];
+    if (!numBuckets)
+        return nullptr;
+    auto buckets = _hash + 2;
+    auto chains = buckets + numBuckets;
+
+    for (auto index = buckets[elf64Hash(name) % numBuckets]; index; index = chains[index]) {
+        auto symbol = &_symtab[index];
+        if (symbol->st_name < _strtabSize && !strcmp(name, _strtab + symbol->st_name))
+            return symbol;
+    }
+    return nullptr;
+}
+
+void *LoadedImageImpl::lookup(const char *name) {
+    auto symbol = _gnuHash ? _lookupGnu(name) : _lookupSysv(name);
+    if (!symbol || symbol->st_shndx == SHN_UNDEF)
+        return nullptr;
+    return _base + symbol->st_value;
+}
+
+std::unique_ptr<LoadedImage> LoadedImage::load(const uint8_t *data, size_t size,
+        const SymbolResolver &resolver) {
+    TraceScope scope{"elf", "loader"};
+    auto image = std::make_unique<LoadedImageImpl>();
+    image->readHeaders(data, size);
+    image->mapFromBuffer(data, size);
+    image->link(resolver);
+    countStatistic("elf-loader", "images");
+    return image;
+}
+
+std::unique_ptr<LoadedImage> LoadedImage::loadFromFile(int fd,
+        const SymbolResolver &resolver) {
+    TraceScope scope{"elf", "loader"};
+    struct stat st;
+    if (fstat(fd, &st))
+        throw std::runtime_error("Could not stat ELF file");
+    size_t size = st.st_size;
+
+    // The EHDR and the PHDRs are always at the start of the files that lewis emits.
+    std::vector<uint8_t> headers(std::min(size, pageSize));
+    auto chunk = pread(fd, headers.data(), headers.size(), 0);
+    if (chunk < 0 || size_t(chunk) != headers.size())
+        throw std::runtime_error("Could not read ELF headers");
+
+    auto image = std::make_unique<LoadedImageImpl>();
+    image->readHeaders(headers.data(), headers.size());
+    image->mapFromFile(fd, size);
+    image->link(resolver);
+    countStatistic("elf-loader", "images");
+    return image;
+}
+
+} // namespace lewis::elf
@@ -1,6 +1,7 @@
 // Copyright the lewis authors (AUTHORS.md) 2018
 // SPDX-License-Identifier: MIT
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <elf.h>
@@ -24,6 +25,21 @@ void FragmentUse::assign(Fragment *f) {
     _ref = f;
 }
 
+// --------------------------------------------------------------------------------------
+// SymbolUse class
+// --------------------------------------------------------------------------------------
+
+void SymbolUse::assign(Symbol *s) {
+    if (_ref) {
+        auto it = _ref->_useList.iterator_to(this);
+        _ref->_useList.erase(it);
+    }
+
+    if (s)
+        s->_useList.push_back(this);
+    _ref = s;
+}
+
 // --------------------------------------------------------------------------------------
 // Fragment class
 // --------------------------------------------------------------------------------------
@@ -47,9 +63,16 @@ void Object::doInsertFragment(std::unique_ptr<Fragment> fragment) {
 }
 
 void Object::doAddString(std::unique_ptr<String> string) {
+    _stringPool.insert({string->buffer, string.get()});
     _strings.push_back(std::move(string));
 }
 
+String *Object::internString(const std::string &buffer) {
+    if (auto it = _stringPool.find(buffer); it != _stringPool.end())
+        return it->second;
+    return addString(std::make_unique<String>(buffer));
+}
+
 void Object::doAddSymbol(std::unique_ptr<Symbol> symbol) {
     _symbols.push_back(std::move(symbol));
 }
@@ -62,6 +85,20 @@ void Object::doAddInternalRelocation(std::unique_ptr<Relocation> relocation) {
     _internalRelocations.push_back(std::move(relocation));
 }
 
+void Object::eraseInternalRelocation(Relocation *relocation) {
+    staleRelocations.erase(std::remove(staleRelocations.begin(), staleRelocations.end(),
+            relocation), staleRelocations.end());
+
+    for (auto &slot : _internalRelocations) {
+        if (slot.get() != relocation) continue;
+        slot = std::move(_internalRelocations.back());
+        _internalRelocations.pop_back();
+        return;
+    }
+
+    assert(!"eraseInternalRelocation(): Relocation does not exist");
+}
+
 void Object::replaceFragment(Fragment *from, std::unique_ptr<Fragment> to) {
     assert((from->isSection() && to->isSection())
             || (!from->isSection() && !to->isSection()));
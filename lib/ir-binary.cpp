@@ -0,0 +1,498 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <cassert>
+#include <stdexcept>
+#include <unordered_map>
+#include <lewis/ir-binary.hpp>
+
+namespace lewis {
+
+namespace {
+    constexpr uint8_t binaryIrMagic[4] = {'L', 'W', 'I', 'R'};
+
+    struct FunctionWriter {
+        FunctionWriter(Function *fn, util::ByteEncoder &enc)
+        : _fn{fn}, _enc{enc} { }
+
+        void run();
+
+    private:
+        void _define(Value *v) {
+            assert(v);
+            if (!hierarchy_cast<LocalValue *>(v))
+                throw std::runtime_error("lewis: Binary IR only supports generic IR");
+            _values.insert({v, _values.size()});
+        }
+
+        void _encodeType(Value *v) {
+            auto type = v->getType();
+            if (!type) {
+                encodeUleb128(_enc, 0);
+                return;
+            }
+            auto it = _types.find(type->typeKind);
+            assert(it != _types.end());
+            encodeUleb128(_enc, it->second + 1);
+        }
+
+        void _encodeUse(Value *v) {
+            if (!v) {
+                encodeUleb128(_enc, 0);
+                return;
+            }
+            auto it = _values.find(v);
+            if (it == _values.end())
+                throw std::runtime_error("lewis: Value is not defined in the Function");
+            encodeUleb128(_enc, it->second + 1);
+        }
+
+        void _encodeBlock(BasicBlock *bb) {
+            encodeUleb128(_enc, bb ? _blocks.at(bb) + 1 : 0);
+        }
+
+        void _encodeString(const std::string &s) {
+            encodeUleb128(_enc, s.size());
+            encodeChars(_enc, s.c_str());
+        }
+
+        Function *_fn;
+        util::ByteEncoder &_enc;
+        std::unordered_map<BasicBlock *, size_t> _blocks;
+        std::unordered_map<PhiNode *, size_t> _phis;
+        std::unordered_map<Value *, size_t> _values;
+        std::unordered_map<TypeKindType, size_t> _types;
+        std::vector<TypeKindType> _typeTable;
+    };
+
+    void FunctionWriter::run() {
+        // Number all blocks, phis and values first; uses can refer to later definitions.
+        auto addType = [&] (Value *v) {
+            _define(v);
+            auto type = v->getType();
+            if (type && _types.insert({type->typeKind, _typeTable.size()}).second)
+                _typeTable.push_back(type->typeKind);
+        };
+
+        size_t numBlocks = 0;
+        for (auto bb : _fn->blocks()) {
+            _blocks.insert({bb, numBlocks++});
+            for (auto phi : bb->phis()) {
+                _phis.insert({phi, _phis.size()});
+                addType(phi->value.get());
+            }
+            for (auto inst : bb->instructions()) {
+                if (auto loadConst = hierarchy_cast<LoadConstInstruction *>(inst); loadConst) {
+                    addType(loadConst->result.get());
+                } else if (auto loadOffset = hierarchy_cast<LoadOffsetInstruction *>(inst);
+                        loadOffset) {
+                    addType(loadOffset->result.get());
+                } else if (auto unaryMath = hierarchy_cast<UnaryMathInstruction *>(inst);
+                        unaryMath) {
+                    addType(unaryMath->result.get());
+                } else if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(inst);
+                        binaryMath) {
+                    addType(binaryMath->result.get());
+                } else if (auto invoke = hierarchy_cast<InvokeInstruction *>(inst); invoke) {
+                    for (size_t i = 0; i < invoke->numResults(); ++i)
+                        addType(invoke->result(i).get());
+                } else {
+                    throw std::runtime_error("lewis: Binary IR only supports generic IR");
+                }
+            }
+        }
+
+        _encodeString(_fn->name);
+        encodeUleb128(_enc, _typeTable.size());
+        for (auto typeKind : _typeTable)
+            encodeUleb128(_enc, typeKind);
+
+        encodeUleb128(_enc, numBlocks);
+        for (auto bb : _fn->blocks()) {
+            size_t numPhis = 0;
+            for (auto phi : bb->phis()) {
+                (void)phi;
+                numPhis++;
+            }
+            encodeUleb128(_enc, numPhis);
+            for (auto phi : bb->phis()) {
+                encodeUleb128(_enc, phi->phiKind);
+                _encodeType(phi->value.get());
+            }
+
+            encodeUleb128(_enc, bb->indexOfInstruction(nullptr));
+            for (auto inst : bb->instructions()) {
+                encodeUleb128(_enc, inst->kind);
+                if (auto loadConst = hierarchy_cast<LoadConstInstruction *>(inst); loadConst) {
+                    _encodeType(loadConst->result.get());
+                    encodeUleb128(_enc, loadConst->value);
+                } else if (auto loadOffset = hierarchy_cast<LoadOffsetInstruction *>(inst);
+                        loadOffset) {
+                    _encodeType(loadOffset->result.get());
+                    _encodeUse(loadOffset->operand.get());
+                    encodeZigZag(_enc, loadOffset->offset);
+                } else if (auto unaryMath = hierarchy_cast<UnaryMathInstruction *>(inst);
+                        unaryMath) {
+                    encodeUleb128(_enc, static_cast<uint32_t>(unaryMath->opcode));
+                    _encodeType(unaryMath->result.get());
+                    _encodeUse(unaryMath->operand.get());
+                } else if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(inst);
+                        binaryMath) {
+                    encodeUleb128(_enc, static_cast<uint32_t>(binaryMath->opcode));
+                    _encodeType(binaryMath->result.get());
+                    _encodeUse(binaryMath->left.get());
+                    _encodeUse(binaryMath->right.get());
+                } else {
+                    auto invoke = hierarchy_cast<InvokeInstruction *>(inst);
+                    assert(invoke);
+                    _encodeString(invoke->function);
+                    encodeUleb128(_enc, invoke->numOperands());
+                    for (size_t i = 0; i < invoke->numOperands(); ++i)
+                        _encodeUse(invoke->operand(i).get());
+                    encodeUleb128(_enc, invoke->numResults());
+                    for (size_t i = 0; i < invoke->numResults(); ++i)
+                        _encodeType(invoke->result(i).get());
+                }
+            }
+
+            auto branch = bb->branch();
+            if (!branch) {
+                encodeUleb128(_enc, branch_kinds::null);
+            } else if (auto functionReturn = hierarchy_cast<FunctionReturnBranch *>(branch);
+                    functionReturn) {
+                encodeUleb128(_enc, branch->kind);
+                encodeUleb128(_enc, functionReturn->numOperands());
+                for (size_t i = 0; i < functionReturn->numOperands(); ++i)
+                    _encodeUse(functionReturn->operand(i).get());
+            } else if (auto unconditional = hierarchy_cast<UnconditionalBranch *>(branch);
+                    unconditional) {
+                encodeUleb128(_enc, branch->kind);
+                _encodeBlock(unconditional->target);
+            } else if (auto conditional = hierarchy_cast<ConditionalBranch *>(branch);
+                    conditional) {
+                encodeUleb128(_enc, branch->kind);
+                _encodeBlock(conditional->ifTarget);
+                _encodeBlock(conditional->elseTarget);
+                _encodeUse(conditional->operand.get());
+            } else {
+                throw std::runtime_error("lewis: Binary IR only supports generic IR");
+            }
+
+            size_t numEdges = 0;
+            for (auto edge : bb->source.edges()) {
+                (void)edge;
+                numEdges++;
+            }
+            encodeUleb128(_enc, numEdges);
+            for (auto edge : bb->source.edges()) {
+                encodeUleb128(_enc, _phis.at(edge->sink()->phiNode()));
+                _encodeUse(edge->alias.get());
+            }
+        }
+    }
+
+    struct FunctionReader {
+        FunctionReader(util::ByteDecoder &dec)
+        : _dec{dec} { }
+
+        std::unique_ptr<Function> run();
+
+    private:
+        [[noreturn]] void _fail() {
+            throw std::runtime_error("lewis: Malformed binary IR");
+        }
+
+        // Reads a count and rejects counts that cannot possibly fit into the remaining input.
+        // This works since each counted item (including the results of invokes, which store
+        // their type) takes at least one byte.
+        size_t _decodeCount() {
+            auto n = decodeUleb128(_dec);
+            if (!_dec.ok() || n > _dec.remaining())
+                _fail();
+            return n;
+        }
+
+        UnaryMathOpcode _decodeUnaryMathOpcode() {
+            auto opcode = decodeUleb128(_dec);
+            if (!opcode || opcode > static_cast<uint64_t>(UnaryMathOpcode::truncate))
+                _fail();
+            return static_cast<UnaryMathOpcode>(opcode);
+        }
+
+        BinaryMathOpcode _decodeBinaryMathOpcode() {
+            auto opcode = decodeUleb128(_dec);
+            if (!opcode || opcode > static_cast<uint64_t>(BinaryMathOpcode::rotateRight))
+                _fail();
+            return static_cast<BinaryMathOpcode>(opcode);
+        }
+
+        Type *_decodeType() {
+            auto index = decodeUleb128(_dec);
+            if (!index)
+                return nullptr;
+            if (index > _typeTable.size())
+                _fail();
+            return _typeTable[index - 1];
+        }
+
+        // Values may be used before they are defined. In that case, the Value is allocated
+        // on first use and attached to its ValueOrigin once the definition is read.
+        Value *_decodeUse() {
+            auto index = decodeUleb128(_dec);
+            if (!index)
+                return nullptr;
+            index--;
+            if (index >= _values.size()) {
+                // Each definition that is still to be read takes at least one byte.
+                if (index >= _numDefined + _dec.remaining())
+                    _fail();
+                _values.resize(index + 1);
+                _pending.resize(index + 1);
+            }
+            if (!_values[index]) {
+                _pending[index] = std::make_unique<LocalValue>();
+                _values[index] = _pending[index].get();
+            }
+            return _values[index];
+        }
+
+        void _define(ValueOrigin &origin) {
+            auto index = _numDefined++;
+            if (index >= _values.size()) {
+                _values.resize(index + 1);
+                _pending.resize(index + 1);
+            }
+            Value *v;
+            if (_pending[index]) {
+                v = origin.set(std::move(_pending[index]));
+            } else {
+                if (_values[index])
+                    _fail();
+                v = origin.setNew<LocalValue>();
+                _values[index] = v;
+            }
+            v->setType(_decodeType());
+        }
+
+        BasicBlock *_decodeBlock() {
+            auto index = decodeUleb128(_dec);
+            if (!index)
+                return nullptr;
+            if (index > _blocks.size())
+                _fail();
+            return _blocks[index - 1];
+        }
+
+        std::string _decodeString() {
+            auto n = _decodeCount();
+            auto s = decodeChars(_dec, n);
+            if (!_dec.ok())
+                _fail();
+            return s;
+        }
+
+        struct PendingEdge {
+            BasicBlock *source;
+            size_t phi;
+            Value *alias;
+        };
+
+        util::ByteDecoder &_dec;
+        std::vector<Type *> _typeTable;
+        std::vector<BasicBlock *> _blocks;
+        std::vector<PhiNode *> _phis;
+        std::vector<Value *> _values;
+        std::vector<std::unique_ptr<Value>> _pending;
+        size_t _numDefined = 0;
+        std::vector<PendingEdge> _edges;
+    };
+
+    std::unique_ptr<Function> FunctionReader::run() {
+        auto fn = std::make_unique<Function>();
+        fn->name = _decodeString();
+
+        auto numTypes = _decodeCount();
+        for (size_t i = 0; i < numTypes; ++i) {
+            switch (decodeUleb128(_dec)) {
+            case type_kinds::pointer: _typeTable.push_back(globalPointerType()); break;
+            case type_kinds::int32: _typeTable.push_back(globalInt32Type()); break;
+            case type_kinds::int64: _typeTable.push_back(globalInt64Type()); break;
+            case type_kinds::int8: _typeTable.push_back(globalInt8Type()); break;
+            case type_kinds::int16: _typeTable.push_back(globalInt16Type()); break;
+            default:
+                _fail();
+            }
+        }
+
+        // Create all blocks upfront such that branches can refer to later blocks.
+        auto numBlocks = _decodeCount();
+        for (size_t i = 0; i < numBlocks; ++i)
+            _blocks.push_back(fn->addBlock(std::make_unique<BasicBlock>()));
+
+        for (auto bb : _blocks) {
+            auto numPhis = _decodeCount();
+            for (size_t i = 0; i < numPhis; ++i) {
+                PhiNode *phi;
+                switch (decodeUleb128(_dec)) {
+                case phi_kinds::argument:
+                    phi = bb->attachPhi(std::make_unique<ArgumentPhi>());
+                    break;
+                case phi_kinds::dataFlow:
+                    phi = bb->attachPhi(std::make_unique<DataFlowPhi>());
+                    break;
+                default:
+                    _fail();
+                }
+                _phis.push_back(phi);
+                _define(phi->value);
+            }
+
+            auto numInstructions = _decodeCount();
+            for (size_t i = 0; i < numInstructions; ++i) {
+                switch (decodeUleb128(_dec)) {
+                case instruction_kinds::loadConst: {
+                    auto loadConst = bb->insertNewInstruction<LoadConstInstruction>();
+                    _define(loadConst->result);
+                    loadConst->value = decodeUleb128(_dec);
+                    break;
+                }
+                case instruction_kinds::loadOffset: {
+                    auto loadOffset = bb->insertNewInstruction<LoadOffsetInstruction>();
+                    _define(loadOffset->result);
+                    loadOffset->operand = _decodeUse();
+                    loadOffset->offset = decodeZigZag(_dec);
+                    break;
+                }
+                case instruction_kinds::unaryMath: {
+                    auto opcode = _decodeUnaryMathOpcode();
+                    auto unaryMath = bb->insertNewInstruction<UnaryMathInstruction>(opcode);
+                    _define(unaryMath->result);
+                    unaryMath->operand = _decodeUse();
+                    break;
+                }
+                case instruction_kinds::binaryMath: {
+                    auto opcode = _decodeBinaryMathOpcode();
+                    auto binaryMath = bb->insertNewInstruction<BinaryMathInstruction>(opcode);
+                    _define(binaryMath->result);
+                    binaryMath->left = _decodeUse();
+                    binaryMath->right = _decodeUse();
+                    break;
+                }
+                case instruction_kinds::invoke: {
+                    auto function = _decodeString();
+                    auto numOperands = _decodeCount();
+                    std::vector<Value *> operands;
+                    for (size_t j = 0; j < numOperands; ++j)
+                        operands.push_back(_decodeUse());
+                    auto numResults = _decodeCount();
+                    auto invoke = bb->insertNewInstruction<InvokeInstruction>(
+                            std::move(function), numOperands, numResults);
+                    for (size_t j = 0; j < numOperands; ++j)
+                        invoke->operand(j) = operands[j];
+                    for (size_t j = 0; j < numResults; ++j)
+                        _define(invoke->result(j));
+                    break;
+                }
+                default:
+                    _fail();
+                }
+            }
+
+            switch (decodeUleb128(_dec)) {
+            case branch_kinds::null:
+                break;
+            case branch_kinds::functionReturn: {
+                auto numOperands = _decodeCount();
+                auto functionReturn = bb->setBranch(
+                        std::make_unique<FunctionReturnBranch>(numOperands));
+                for (size_t j = 0; j < numOperands; ++j)
+                    functionReturn->operand(j) = _decodeUse();
+                break;
+            }
+            case branch_kinds::unconditional:
+                bb->setBranch(std::make_unique<UnconditionalBranch>(_decodeBlock()));
+                break;
+            case branch_kinds::conditional: {
+                auto ifTarget = _decodeBlock();
+                auto elseTarget = _decodeBlock();
+                auto conditional = bb->setBranch(
+                        std::make_unique<ConditionalBranch>(ifTarget, elseTarget));
+                conditional->operand = _decodeUse();
+                break;
+            }
+            default:
+                _fail();
+            }
+
+            // Edges can point to phis of later blocks; they are attached at the end.
+            auto numEdges = _decodeCount();
+            for (size_t j = 0; j < numEdges; ++j) {
+                auto phi = decodeUleb128(_dec);
+                auto alias = _decodeUse();
+                _edges.push_back({bb, phi, alias});
+            }
+
+            if (!_dec.ok())
+                _fail();
+        }
+
+        for (auto &pending : _edges) {
+            if (pending.phi >= _phis.size())
+                _fail();
+            auto phi = hierarchy_cast<DataFlowPhi *>(_phis[pending.phi]);
+            if (!phi)
+                _fail();
+            auto edge = DataFlowEdge::attach(std::make_unique<DataFlowEdge>(),
+                    pending.source->source, phi->sink);
+            edge->alias = pending.alias;
+        }
+
+        // Every Value that was used must also have been defined.
+        if (_numDefined != _values.size())
+            _fail();
+        return fn;
+    }
+}
+
+BinaryIrWriter::BinaryIrWriter(std::vector<uint8_t> *out)
+: _enc{out} {
+    for (auto b : binaryIrMagic)
+        encode8(_enc, b);
+    encodeUleb128(_enc, binaryIrVersion);
+}
+
+void BinaryIrWriter::writeFunction(Function *fn) {
+    FunctionWriter writer{fn, _enc};
+    writer.run();
+}
+
+void BinaryIrWriter::writeModule(Module *mod) {
+    for (auto fn : mod->functions())
+        writeFunction(fn);
+}
+
+BinaryIrReader::BinaryIrReader(const uint8_t *data, size_t size)
+: _dec{data, size} {
+    for (auto b : binaryIrMagic) {
+        if (decode8(_dec) != b)
+            throw std::runtime_error("lewis: Input is not binary IR");
+    }
+    if (decodeUleb128(_dec) != binaryIrVersion || !_dec.ok())
+        throw std::runtime_error("lewis: Unsupported binary IR version");
+}
+
+bool BinaryIrReader::atEnd() {
+    return _dec.atEnd();
+}
+
+std::unique_ptr<Function> BinaryIrReader::readFunction() {
+    FunctionReader reader{_dec};
+    return reader.run();
+}
+
+void BinaryIrReader::readModule(Module *mod) {
+    while (!atEnd())
+        mod->addFunction(readFunction());
+}
+
+} // namespace lewis
@@ -0,0 +1,187 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <cassert>
+#include <stdexcept>
+#include <unordered_map>
+#include <lewis/ir-hash.hpp>
+#include <lewis/util/byte-encode.hpp>
+
+namespace lewis {
+
+namespace {
+    uint64_t fnv1a(const std::vector<uint8_t> &bytes) {
+        uint64_t h = 0xCBF29CE484222325;
+        for (auto b : bytes) {
+            h ^= b;
+            h *= 0x100000001B3;
+        }
+        return h;
+    }
+
+    struct KeyEncoder {
+        KeyEncoder(Function *fn, std::vector<uint8_t> *out)
+        : _fn{fn}, _enc{out} { }
+
+        void run();
+
+    private:
+        // Values are numbered in the order of their definition.
+        void _define(Value *v) {
+            assert(v);
+            _values.insert({v, _values.size()});
+        }
+
+        void _encodeDefinition(Value *v) {
+            assert(v && v->getType());
+            encode32(_enc, v->getType()->typeKind);
+        }
+
+        void _encodeUse(Value *v) {
+            if (!v) {
+                encode32(_enc, 0);
+                return;
+            }
+            encode32(_enc, _values.at(v) + 1);
+        }
+
+        void _encodeBlock(BasicBlock *bb) {
+            encode32(_enc, bb ? _blocks.at(bb) + 1 : 0);
+        }
+
+        void _encodeString(const std::string &s) {
+            encode32(_enc, s.size());
+            encodeChars(_enc, s.c_str());
+        }
+
+        Function *_fn;
+        util::ByteEncoder _enc;
+        std::unordered_map<BasicBlock *, size_t> _blocks;
+        std::unordered_map<PhiNode *, size_t> _phis;
+        std::unordered_map<Value *, size_t> _values;
+    };
+
+    void KeyEncoder::run() {
+        // Number all blocks, phis and values first; uses can refer to later definitions.
+        for (auto bb : _fn->blocks()) {
+            _blocks.insert({bb, _blocks.size()});
+            for (auto phi : bb->phis()) {
+                _phis.insert({phi, _phis.size()});
+                _define(phi->value.get());
+            }
+            for (auto inst : bb->instructions()) {
+                if (auto loadConst = hierarchy_cast<LoadConstInstruction *>(inst); loadConst) {
+                    _define(loadConst->result.get());
+                } else if (auto loadOffset = hierarchy_cast<LoadOffsetInstruction *>(inst);
+                        loadOffset) {
+                    _define(loadOffset->result.get());
+                } else if (auto unaryMath = hierarchy_cast<UnaryMathInstruction *>(inst);
+                        unaryMath) {
+                    _define(unaryMath->result.get());
+                } else if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(inst);
+                        binaryMath) {
+                    _define(binaryMath->result.get());
+                } else if (auto invoke = hierarchy_cast<InvokeInstruction *>(inst); invoke) {
+                    for (size_t i = 0; i < invoke->numResults(); ++i)
+                        _define(invoke->result(i).get());
+                } else {
+                    throw std::runtime_error("lewis: IrKey only supports generic IR");
+                }
+            }
+        }
+
+        encode32(_enc, _blocks.size());
+        for (auto bb : _fn->blocks()) {
+            size_t numPhis = 0;
+            for (auto phi : bb->phis()) {
+                (void)phi;
+                numPhis++;
+            }
+            encode32(_enc, numPhis);
+            for (auto phi : bb->phis()) {
+                encode32(_enc, phi->phiKind);
+                _encodeDefinition(phi->value.get());
+            }
+
+            encode32(_enc, bb->indexOfInstruction(nullptr));
+            for (auto inst : bb->instructions()) {
+                encode32(_enc, inst->kind);
+                if (auto loadConst = hierarchy_cast<LoadConstInstruction *>(inst); loadConst) {
+                    _encodeDefinition(loadConst->result.get());
+                    encode64(_enc, loadConst->value);
+                } else if (auto loadOffset = hierarchy_cast<LoadOffsetInstruction *>(inst);
+                        loadOffset) {
+                    _encodeDefinition(loadOffset->result.get());
+                    _encodeUse(loadOffset->operand.get());
+                    encode64(_enc, loadOffset->offset);
+                } else if (auto unaryMath = hierarchy_cast<UnaryMathInstruction *>(inst);
+                        unaryMath) {
+                    encode32(_enc, static_cast<uint32_t>(unaryMath->opcode));
+                    _encodeDefinition(unaryMath->result.get());
+                    _encodeUse(unaryMath->operand.get());
+                } else if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(inst);
+                        binaryMath) {
+                    encode32(_enc, static_cast<uint32_t>(binaryMath->opcode));
+                    _encodeDefinition(binaryMath->result.get());
+                    _encodeUse(binaryMath->left.get());
+                    _encodeUse(binaryMath->right.get());
+                } else {
+                    auto invoke = hierarchy_cast<InvokeInstruction *>(inst);
+                    assert(invoke);
+                    _encodeString(invoke->function);
+                    encode32(_enc, invoke->numOperands());
+                    for (size_t i = 0; i < invoke->numOperands(); ++i)
+                        _encodeUse(invoke->operand(i).get());
+                    encode32(_enc, invoke->numResults());
+                    for (size_t i = 0; i < invoke->numResults(); ++i)
+                        _encodeDefinition(invoke->result(i).get());
+                }
+            }
+
+            auto branch = bb->branch();
+            if (!branch) {
+                encode32(_enc, branch_kinds::null);
+            } else if (auto functionReturn = hierarchy_cast<FunctionReturnBranch *>(branch);
+                    functionReturn) {
+                encode32(_enc, branch->kind);
+                encode32(_enc, functionReturn->numOperands());
+                for (size_t i = 0; i < functionReturn->numOperands(); ++i)
+                    _encodeUse(functionReturn->operand(i).get());
+            } else if (auto unconditional = hierarchy_cast<UnconditionalBranch *>(branch);
+                    unconditional) {
+                encode32(_enc, branch->kind);
+                _encodeBlock(unconditional->target);
+            } else if (auto conditional = hierarchy_cast<ConditionalBranch *>(branch);
+                    conditional) {
+                encode32(_enc, branch->kind);
+                _encodeBlock(conditional->ifTarget);
+                _encodeBlock(conditional->elseTarget);
+                _encodeUse(conditional->operand.get());
+            } else {
+                throw std::runtime_error("lewis: IrKey only supports generic IR");
+            }
+
+            // Encode the data-flow edges that originate in this block.
+            size_t numEdges = 0;
+            for (auto edge : bb->source.edges()) {
+                (void)edge;
+                numEdges++;
+            }
+            encode32(_enc, numEdges);
+            for (auto edge : bb->source.edges()) {
+                encode32(_enc, _phis.at(edge->sink()->phiNode()));
+                _encodeUse(edge->alias.get());
+            }
+        }
+    }
+}
+
+IrKey computeIrKey(Function *fn) {
+    IrKey key;
+    KeyEncoder encoder{fn, &key.bytes};
+    encoder.run();
+    key.hash = fnv1a(key.bytes);
+    return key;
+}
+
+} // namespace lewis
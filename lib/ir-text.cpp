@@ -0,0 +1,711 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <lewis/ir-text.hpp>
+
+namespace lewis {
+
+namespace {
+    template<typename T>
+    struct Mnemonic {
+        T value;
+        const char *name;
+    };
+
+    const Mnemonic<UnaryMathOpcode> unaryMathMnemonics[] = {
+        {UnaryMathOpcode::negate, "negate"},
+        {UnaryMathOpcode::bitwiseNot, "not"},
+        {UnaryMathOpcode::zeroExtend, "zext"},
+        {UnaryMathOpcode::signExtend, "sext"},
+        {UnaryMathOpcode::truncate, "trunc"}
+    };
+
+    const Mnemonic<BinaryMathOpcode> binaryMathMnemonics[] = {
+        {BinaryMathOpcode::add, "add"},
+        {BinaryMathOpcode::bitwiseAnd, "and"},
+        {BinaryMathOpcode::equal, "eq"},
+        {BinaryMathOpcode::notEqual, "ne"},
+        {BinaryMathOpcode::signedLess, "slt"},
+        {BinaryMathOpcode::signedLessEqual, "sle"},
+        {BinaryMathOpcode::signedGreater, "sgt"},
+        {BinaryMathOpcode::signedGreaterEqual, "sge"},
+        {BinaryMathOpcode::unsignedLess, "ult"},
+        {BinaryMathOpcode::unsignedLessEqual, "ule"},
+        {BinaryMathOpcode::unsignedGreater, "ugt"},
+        {BinaryMathOpcode::unsignedGreaterEqual, "uge"},
+        {BinaryMathOpcode::subtract, "sub"},
+        {BinaryMathOpcode::bitwiseOr, "or"},
+        {BinaryMathOpcode::bitwiseXor, "xor"},
+        {BinaryMathOpcode::multiply, "mul"},
+        {BinaryMathOpcode::unsignedDivide, "udiv"},
+        {BinaryMathOpcode::signedDivide, "sdiv"},
+        {BinaryMathOpcode::unsignedRemainder, "urem"},
+        {BinaryMathOpcode::signedRemainder, "srem"},
+        {BinaryMathOpcode::shiftLeft, "shl"},
+        {BinaryMathOpcode::logicalShiftRight, "lshr"},
+        {BinaryMathOpcode::arithmeticShiftRight, "ashr"},
+        {BinaryMathOpcode::rotateLeft, "rotl"},
+        {BinaryMathOpcode::rotateRight, "rotr"}
+    };
+
+    const Mnemonic<TypeKindType> typeMnemonics[] = {
+        {type_kinds::pointer, "pointer"},
+        {type_kinds::int32, "int32"},
+        {type_kinds::int64, "int64"},
+        {type_kinds::int8, "int8"},
+        {type_kinds::int16, "int16"}
+    };
+
+    template<typename T, size_t N>
+    const char *nameOf(const Mnemonic<T> (&table)[N], T value) {
+        for (auto &entry : table) {
+            if (entry.value == value)
+                return entry.name;
+        }
+        return nullptr;
+    }
+
+    template<typename T, size_t N>
+    const Mnemonic<T> *lookupName(const Mnemonic<T> (&table)[N], const std::string &name) {
+        for (auto &entry : table) {
+            if (name == entry.name)
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    Type *typeOfKind(TypeKindType typeKind) {
+        switch (typeKind) {
+        case type_kinds::pointer: return globalPointerType();
+        case type_kinds::int32: return globalInt32Type();
+        case type_kinds::int64: return globalInt64Type();
+        case type_kinds::int8: return globalInt8Type();
+        case type_kinds::int16: return globalInt16Type();
+        default:
+            return nullptr;
+        }
+    }
+
+    bool isIdentifierStart(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    }
+
+    bool isIdentifierChar(char c) {
+        return isIdentifierStart(c) || (c >= '0' && c <= '9') || c == '.';
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// IrPrinter class.
+//---------------------------------------------------------------------------------------
+
+void IrPrinter::printFunction(Function *fn) {
+    // Values are numbered on first sight; blocks by their position.
+    _blocks.clear();
+    _values.clear();
+    for (auto bb : fn->blocks())
+        _blocks.insert({bb, _blocks.size()});
+
+    _out << "function ";
+    printString(fn->name);
+    _out << " {\n";
+    for (auto bb : fn->blocks()) {
+        _out << "b" << _blocks.at(bb) << ":\n";
+        for (auto phi : bb->phis()) {
+            _out << "    ";
+            printDefinition(phi->value.get());
+            if (phi->phiKind == phi_kinds::argument) {
+                _out << " = argument\n";
+            } else {
+                assert(phi->phiKind == phi_kinds::dataFlow);
+                _out << " = phi\n";
+            }
+        }
+        for (auto inst : bb->instructions()) {
+            _out << "    ";
+            _printInstruction(inst);
+            _out << "\n";
+        }
+        if (bb->branch()) {
+            _out << "    ";
+            _printBranch(bb->branch());
+            _out << "\n";
+        }
+        for (auto edge : bb->source.edges()) {
+            _out << "    edge ";
+            printUse(edge->sink()->phiNode()->value.get());
+            _out << " <- ";
+            printUse(edge->alias.get());
+            _out << "\n";
+        }
+    }
+    _out << "}\n";
+}
+
+void IrPrinter::printModule(Module *mod) {
+    for (auto fn : mod->functions())
+        printFunction(fn);
+}
+
+void IrPrinter::printDefinition(Value *v) {
+    assert(v);
+    printUse(v);
+    if (auto type = v->getType(); type) {
+        auto name = nameOf(typeMnemonics, type->typeKind);
+        if (!name)
+            throw std::runtime_error("lewis: Cannot print unknown type");
+        _out << ":" << name;
+    }
+    if (!hierarchy_cast<LocalValue *>(v)) {
+        _out << "@";
+        if (!_dialect || !_dialect->printValueMode(*this, v))
+            throw std::runtime_error("lewis: Cannot print unknown value kind");
+    }
+}
+
+void IrPrinter::printUse(Value *v) {
+    if (!v) {
+        _out << "null";
+        return;
+    }
+    auto it = _values.insert({v, _values.size()}).first;
+    _out << "%" << it->second;
+}
+
+void IrPrinter::printBlock(BasicBlock *bb) {
+    if (!bb) {
+        _out << "null";
+        return;
+    }
+    _out << "b" << _blocks.at(bb);
+}
+
+void IrPrinter::printString(const std::string &s) {
+    const char *hex = "0123456789abcdef";
+    _out << '"';
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            _out << '\\' << c;
+        } else if (c < 0x20 || c >= 0x7F) {
+            _out << "\\x" << hex[c >> 4] << hex[c & 0xF];
+        } else {
+            _out << c;
+        }
+    }
+    _out << '"';
+}
+
+void IrPrinter::_printInstruction(Instruction *inst) {
+    if (auto loadConst = hierarchy_cast<LoadConstInstruction *>(inst); loadConst) {
+        printDefinition(loadConst->result.get());
+        _out << " = const " << loadConst->value;
+    } else if (auto loadOffset = hierarchy_cast<LoadOffsetInstruction *>(inst); loadOffset) {
+        printDefinition(loadOffset->result.get());
+        _out << " = loadOffset ";
+        printUse(loadOffset->operand.get());
+        _out << ", " << loadOffset->offset;
+    } else if (auto unaryMath = hierarchy_cast<UnaryMathInstruction *>(inst); unaryMath) {
+        auto name = nameOf(unaryMathMnemonics, unaryMath->opcode);
+        if (!name)
+            throw std::runtime_error("lewis: Cannot print unknown unary opcode");
+        printDefinition(unaryMath->result.get());
+        _out << " = " << name << " ";
+        printUse(unaryMath->operand.get());
+    } else if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(inst); binaryMath) {
+        auto name = nameOf(binaryMathMnemonics, binaryMath->opcode);
+        if (!name)
+            throw std::runtime_error("lewis: Cannot print unknown binary opcode");
+        printDefinition(binaryMath->result.get());
+        _out << " = " << name << " ";
+        printUse(binaryMath->left.get());
+        _out << ", ";
+        printUse(binaryMath->right.get());
+    } else if (auto invoke = hierarchy_cast<InvokeInstruction *>(inst); invoke) {
+        for (size_t i = 0; i < invoke->numResults(); ++i) {
+            if (i)
+                _out << ", ";
+            printDefinition(invoke->result(i).get());
+        }
+        if (invoke->numResults())
+            _out << " = ";
+        _out << "invoke ";
+        printString(invoke->function);
+        _out << "(";
+        for (size_t i = 0; i < invoke->numOperands(); ++i) {
+            if (i)
+                _out << ", ";
+            printUse(invoke->operand(i).get());
+        }
+        _out << ")";
+    } else if (!_dialect || !_dialect->printInstruction(*this, inst)) {
+        throw std::runtime_error("lewis: Cannot print unknown instruction kind");
+    }
+}
+
+void IrPrinter::_printBranch(Branch *branch) {
+    if (auto functionReturn = hierarchy_cast<FunctionReturnBranch *>(branch); functionReturn) {
+        _out << "return";
+        for (size_t i = 0; i < functionReturn->numOperands(); ++i) {
+            _out << (i ? ", " : " ");
+            printUse(functionReturn->operand(i).get());
+        }
+    } else if (auto unconditional = hierarchy_cast<UnconditionalBranch *>(branch);
+            unconditional) {
+        _out << "jump ";
+        printBlock(unconditional->target);
+    } else if (auto conditional = hierarchy_cast<ConditionalBranch *>(branch); conditional) {
+        _out << "branch ";
+        printUse(conditional->operand.get());
+        _out << ", ";
+        printBlock(conditional->ifTarget);
+        _out << ", ";
+        printBlock(conditional->elseTarget);
+    } else if (!_dialect || !_dialect->printBranch(*this, branch)) {
+        throw std::runtime_error("lewis: Cannot print unknown branch kind");
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// IrParser class.
+//---------------------------------------------------------------------------------------
+
+bool IrParser::atEnd() {
+    _skipSpace();
+    return _p == _limit;
+}
+
+std::unique_ptr<Function> IrParser::parseFunction() {
+    auto fn = std::make_unique<Function>();
+    _fn = fn.get();
+    _blocks.clear();
+    _forwardBlocks.clear();
+    _values.clear();
+    _forwardValues.clear();
+    _valueBlocks.clear();
+    _phis.clear();
+    _edges.clear();
+
+    if (parseIdentifier() != "function")
+        fail("expected function");
+    fn->name = parseString();
+    expect('{');
+
+    BasicBlock *bb = nullptr;
+    while (!tryConsume('}')) {
+        // Block labels look like mnemonics that are followed by a colon.
+        auto savedP = _p;
+        auto savedLine = _line;
+        if (_peekIdentifier()) {
+            auto label = parseIdentifier();
+            if (tryConsume(':')) {
+                if (label.size() < 2 || label[0] != 'b'
+                        || label.find_first_not_of("0123456789", 1) != std::string::npos)
+                    fail("invalid block label " + label);
+                auto id = std::stoull(label.substr(1));
+                auto it = _forwardBlocks.find(id);
+                if (it != _forwardBlocks.end()) {
+                    bb = fn->addBlock(std::move(it->second));
+                    _forwardBlocks.erase(it);
+                } else if (_blocks.count(id)) {
+                    fail("duplicate block " + label);
+                } else {
+                    bb = fn->addBlock(std::make_unique<BasicBlock>());
+                    _blocks.insert({id, bb});
+                }
+                continue;
+            }
+            _p = savedP;
+            _line = savedLine;
+        }
+
+        if (!bb)
+            fail("expected block label");
+        _parseStatement(bb);
+    }
+
+    if (!_forwardBlocks.empty())
+        fail("reference to undefined block b" + std::to_string(_forwardBlocks.begin()->first));
+    if (!_forwardValues.empty())
+        fail("reference to undefined value %" + std::to_string(_forwardValues.begin()->first));
+
+    for (auto &pending : _edges) {
+        _line = pending.line;
+        auto sinkIt = _values.find(pending.sink);
+        auto aliasIt = _values.find(pending.alias);
+        if (sinkIt == _values.end() || aliasIt == _values.end())
+            fail("edge refers to undefined value");
+        auto phiIt = _phis.find(sinkIt->second);
+        if (phiIt == _phis.end())
+            fail("edge sink %" + std::to_string(pending.sink) + " is not a phi");
+        if (_valueBlocks.at(aliasIt->second) != pending.source)
+            fail("edge alias %" + std::to_string(pending.alias)
+                    + " is not defined in the source block");
+        auto edge = DataFlowEdge::attach(std::make_unique<DataFlowEdge>(),
+                pending.source->source, phiIt->second->sink);
+        edge->alias = aliasIt->second;
+    }
+
+    _fn = nullptr;
+    return fn;
+}
+
+void IrParser::parseModule(Module *mod) {
+    while (!atEnd())
+        mod->addFunction(parseFunction());
+}
+
+void IrParser::fail(const std::string &message) {
+    throw std::runtime_error("lewis: IR parse error in line " + std::to_string(_line)
+            + ": " + message);
+}
+
+bool IrParser::peek(char c) {
+    _skipSpace();
+    return _p != _limit && *_p == c;
+}
+
+bool IrParser::tryConsume(char c) {
+    if (!peek(c))
+        return false;
+    _p++;
+    return true;
+}
+
+void IrParser::expect(char c) {
+    if (!tryConsume(c))
+        fail(std::string{"expected '"} + c + "'");
+}
+
+std::string IrParser::parseIdentifier() {
+    if (!_peekIdentifier())
+        fail("expected identifier");
+    auto start = _p;
+    while (_p != _limit && isIdentifierChar(*_p))
+        _p++;
+    return std::string{start, _p};
+}
+
+uint64_t IrParser::parseUnsigned() {
+    _skipSpace();
+    if (_p == _limit || *_p < '0' || *_p > '9')
+        fail("expected integer");
+    uint64_t v = 0;
+    while (_p != _limit && *_p >= '0' && *_p <= '9') {
+        uint64_t digit = *_p - '0';
+        if (v > (UINT64_MAX - digit) / 10)
+            fail("integer out of range");
+        v = v * 10 + digit;
+        _p++;
+    }
+    return v;
+}
+
+int64_t IrParser::parseSigned() {
+    bool negative = tryConsume('-');
+    auto v = parseUnsigned();
+    if (v > static_cast<uint64_t>(INT64_MAX) + (negative ? 1 : 0))
+        fail("integer out of range");
+    return negative ? static_cast<int64_t>(-v) : static_cast<int64_t>(v);
+}
+
+std::string IrParser::parseString() {
+    expect('"');
+    std::string s;
+    while (true) {
+        if (_p == _limit || *_p == '\n')
+            fail("unterminated string");
+        char c = *(_p++);
+        if (c == '"')
+            return s;
+        if (c != '\\') {
+            s.push_back(c);
+            continue;
+        }
+
+        if (_p == _limit)
+            fail("unterminated string");
+        c = *(_p++);
+        if (c == '"' || c == '\\') {
+            s.push_back(c);
+        } else if (c == 'x') {
+            int v = 0;
+            for (int i = 0; i < 2; ++i) {
+                if (_p == _limit)
+                    fail("unterminated string");
+                char h = *(_p++);
+                if (h >= '0' && h <= '9') {
+                    v = v * 16 + (h - '0');
+                } else if (h >= 'a' && h <= 'f') {
+                    v = v * 16 + (h - 'a' + 10);
+                } else if (h >= 'A' && h <= 'F') {
+                    v = v * 16 + (h - 'A' + 10);
+                } else {
+                    fail("invalid escape sequence");
+                }
+            }
+            s.push_back(static_cast<char>(v));
+        } else {
+            fail("invalid escape sequence");
+        }
+    }
+}
+
+Value *IrParser::parseUse() {
+    if (tryConsume('%'))
+        return _lookup(parseUnsigned());
+    if (parseIdentifier() != "null")
+        fail("expected value");
+    return nullptr;
+}
+
+std::vector<Value *> IrParser::parseUseList() {
+    std::vector<Value *> values;
+    expect('(');
+    if (tryConsume(')'))
+        return values;
+    do {
+        values.push_back(parseUse());
+    } while (tryConsume(','));
+    expect(')');
+    return values;
+}
+
+BasicBlock *IrParser::parseBlock() {
+    auto label = parseIdentifier();
+    if (label == "null")
+        return nullptr;
+    if (label.size() < 2 || label[0] != 'b'
+            || label.find_first_not_of("0123456789", 1) != std::string::npos)
+        fail("expected block");
+    return _getBlock(std::stoull(label.substr(1)));
+}
+
+void IrParser::define(ValueOrigin &origin) {
+    if (_numConsumed == _definitions.size())
+        fail("too few results");
+    auto &definition = _definitions[_numConsumed++];
+    auto v = origin.set(std::move(definition.value));
+
+    auto it = _values.find(definition.id);
+    if (it != _values.end()) {
+        auto forwardIt = _forwardValues.find(definition.id);
+        if (forwardIt == _forwardValues.end())
+            fail("redefinition of %" + std::to_string(definition.id));
+        auto placeholder = forwardIt->second.placeholder.get();
+        if (_valueBlocks.at(placeholder) != _currentBlock)
+            fail("%" + std::to_string(definition.id) + " is used in line "
+                    + std::to_string(forwardIt->second.line)
+                    + ", outside of the block that defines it");
+        placeholder->replaceAllUses(v);
+        _valueBlocks.erase(placeholder);
+        _forwardValues.erase(forwardIt);
+        it->second = v;
+    } else {
+        _values.insert({definition.id, v});
+    }
+    _valueBlocks.insert({v, _currentBlock});
+}
+
+void IrParser::_skipSpace() {
+    while (_p != _limit) {
+        if (*_p == '\n') {
+            _line++;
+        } else if (*_p == ';') {
+            while (_p != _limit && *_p != '\n')
+                _p++;
+            continue;
+        } else if (*_p != ' ' && *_p != '\t' && *_p != '\r') {
+            return;
+        }
+        _p++;
+    }
+}
+
+bool IrParser::_peekIdentifier() {
+    _skipSpace();
+    return _p != _limit && isIdentifierStart(*_p);
+}
+
+IrParser::Definition IrParser::_parseDefinition() {
+    Definition definition;
+    expect('%');
+    definition.id = parseUnsigned();
+
+    Type *type = nullptr;
+    if (tryConsume(':')) {
+        auto name = parseIdentifier();
+        auto entry = lookupName(typeMnemonics, name);
+        if (!entry)
+            fail("unknown type " + name);
+        type = typeOfKind(entry->value);
+    }
+
+    if (tryConsume('@')) {
+        auto mode = parseIdentifier();
+        if (_dialect)
+            definition.value = _dialect->parseValueMode(*this, mode);
+        if (!definition.value)
+            fail("unknown value mode " + mode);
+    } else {
+        definition.value = std::make_unique<LocalValue>();
+    }
+    definition.value->setType(type);
+    return definition;
+}
+
+Value *IrParser::_lookup(uint64_t id) {
+    auto it = _values.find(id);
+    if (it != _values.end()) {
+        if (_valueBlocks.at(it->second) != _currentBlock)
+            fail("%" + std::to_string(id) + " is used outside of the block that defines it");
+        return it->second;
+    }
+
+    // The value is defined later; use a placeholder until then.
+    auto placeholder = std::make_unique<LocalValue>();
+    auto v = placeholder.get();
+    _forwardValues.insert({id, ForwardValue{std::move(placeholder), _line}});
+    _values.insert({id, v});
+    _valueBlocks.insert({v, _currentBlock});
+    return v;
+}
+
+BasicBlock *IrParser::_getBlock(uint64_t id) {
+    auto it = _blocks.find(id);
+    if (it != _blocks.end())
+        return it->second;
+
+    auto block = std::make_unique<BasicBlock>();
+    auto bb = block.get();
+    _forwardBlocks.insert({id, std::move(block)});
+    _blocks.insert({id, bb});
+    return bb;
+}
+
+void IrParser::_parseStatement(BasicBlock *bb) {
+    _currentBlock = bb;
+    _definitions.clear();
+    _numConsumed = 0;
+    if (peek('%')) {
+        do {
+            _definitions.push_back(_parseDefinition());
+        } while (tryConsume(','));
+        expect('=');
+    }
+
+    auto mnemonic = parseIdentifier();
+    if (mnemonic == "edge") {
+        if (!_definitions.empty())
+            fail("edges do not have results");
+        expect('%');
+        auto sink = parseUnsigned();
+        expect('<');
+        expect('-');
+        expect('%');
+        auto alias = parseUnsigned();
+        _edges.push_back({bb, sink, alias, _line});
+        return;
+    }
+
+    if (bb->branch())
+        fail("only edges can follow the branch of a block");
+
+    if (mnemonic == "argument" || mnemonic == "phi") {
+        if (_definitions.size() != 1)
+            fail("phis have exactly one result");
+        if (mnemonic == "argument") {
+            auto phi = bb->attachPhi(std::make_unique<ArgumentPhi>());
+            define(phi->value);
+        } else {
+            auto phi = bb->attachPhi(std::make_unique<DataFlowPhi>());
+            define(phi->value);
+            _phis.insert({phi->value.get(), phi});
+        }
+        return;
+    }
+
+    if (_definitions.empty()) {
+        if (_parseGenericBranch(mnemonic, bb))
+            return;
+        if (_dialect && _dialect->parseBranch(*this, mnemonic, bb))
+            return;
+    }
+
+    if (!_parseGenericInstruction(mnemonic, bb)
+            && !(_dialect && _dialect->parseInstruction(*this, mnemonic, bb)))
+        fail("unknown mnemonic " + mnemonic);
+    if (numDefinitions())
+        fail("too many results");
+}
+
+bool IrParser::_parseGenericInstruction(const std::string &mnemonic, BasicBlock *bb) {
+    if (mnemonic == "const") {
+        auto loadConst = bb->insertNewInstruction<LoadConstInstruction>(parseUnsigned());
+        define(loadConst->result);
+    } else if (mnemonic == "loadOffset") {
+        auto operand = parseUse();
+        expect(',');
+        auto offset = parseSigned();
+        auto loadOffset = bb->insertNewInstruction<LoadOffsetInstruction>(operand, offset);
+        define(loadOffset->result);
+    } else if (auto unary = lookupName(unaryMathMnemonics, mnemonic); unary) {
+        auto operand = parseUse();
+        auto unaryMath = bb->insertNewInstruction<UnaryMathInstruction>(unary->value, operand);
+        define(unaryMath->result);
+    } else if (auto binary = lookupName(binaryMathMnemonics, mnemonic); binary) {
+        auto left = parseUse();
+        expect(',');
+        auto right = parseUse();
+        auto binaryMath = bb->insertNewInstruction<BinaryMathInstruction>(binary->value,
+                left, right);
+        define(binaryMath->result);
+    } else if (mnemonic == "invoke") {
+        auto function = parseString();
+        auto operands = parseUseList();
+        auto invoke = bb->insertNewInstruction<InvokeInstruction>(std::move(function),
+                operands.size(), numDefinitions());
+        for (size_t i = 0; i < operands.size(); ++i)
+            invoke->operand(i) = operands[i];
+        for (size_t i = 0; i < invoke->numResults(); ++i)
+            define(invoke->result(i));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool IrParser::_parseGenericBranch(const std::string &mnemonic, BasicBlock *bb) {
+    if (mnemonic == "return") {
+        // Operands follow on the same statement; the next statement cannot start with '%'.
+        std::vector<Value *> operands;
+        if (peek('%')) {
+            do {
+                operands.push_back(parseUse());
+            } while (tryConsume(','));
+        }
+        auto functionReturn = bb->setBranch(
+                std::make_unique<FunctionReturnBranch>(operands.size()));
+        for (size_t i = 0; i < operands.size(); ++i)
+            functionReturn->operand(i) = operands[i];
+    } else if (mnemonic == "jump") {
+        bb->setBranch(std::make_unique<UnconditionalBranch>(parseBlock()));
+    } else if (mnemonic == "branch") {
+        auto operand = parseUse();
+        expect(',');
+        auto ifTarget = parseBlock();
+        expect(',');
+        auto elseTarget = parseBlock();
+        auto conditional = bb->setBranch(
+                std::make_unique<ConditionalBranch>(ifTarget, elseTarget));
+        conditional->operand = operand;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+} // namespace lewis
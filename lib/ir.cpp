@@ -11,6 +11,16 @@ Type *globalPointerType() {
     return &singleton;
 }
 
+Type *globalInt8Type() {
+    static Type singleton{type_kinds::int8};
+    return &singleton;
+}
+
+Type *globalInt16Type() {
+    static Type singleton{type_kinds::int16};
+    return &singleton;
+}
+
 Type *globalInt32Type() {
     static Type singleton{type_kinds::int32};
     return &singleton;
@@ -67,4 +77,13 @@ void DataFlowEdge::doAttach(std::unique_ptr<DataFlowEdge> edge,
     edge.release();
 }
 
+std::unique_ptr<DataFlowEdge> DataFlowEdge::detach(DataFlowEdge *edge) {
+    assert(edge->_source && edge->_sink);
+    edge->_source->_edges.erase(edge->_source->_edges.iterator_to(edge));
+    edge->_sink->_edges.erase(edge->_sink->_edges.iterator_to(edge));
+    edge->_source = nullptr;
+    edge->_sink = nullptr;
+    return std::unique_ptr<DataFlowEdge>{edge};
+}
+
 } // namespace lewis
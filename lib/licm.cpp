@@ -0,0 +1,340 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <cassert>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <lewis/analyses.hpp>
+#include <lewis/opt-passes.hpp>
+#include <lewis/statistics.hpp>
+
+namespace lewis {
+
+namespace {
+    // Pure instructions that cannot trap. Hoisting executes them even if the loop body
+    // would not have reached them.
+    bool isSpeculatable(Instruction *inst) {
+        if (hierarchy_cast<UnaryMathInstruction *>(inst))
+            return true;
+        // Division traps on a zero divisor, so it must not be executed speculatively.
+        if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(inst); binaryMath)
+            return binaryMath->opcode < BinaryMathOpcode::unsignedDivide
+                    || binaryMath->opcode > BinaryMathOpcode::signedRemainder;
+        return hierarchy_cast<LoadConstInstruction *>(inst);
+    }
+
+    // Only supports the instructions that isSpeculatable() accepts.
+    std::vector<ValueUse *> operandsOf(Instruction *inst) {
+        if (auto unaryMath = hierarchy_cast<UnaryMathInstruction *>(inst); unaryMath)
+            return {&unaryMath->operand};
+        if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(inst); binaryMath)
+            return {&binaryMath->left, &binaryMath->right};
+        return {};
+    }
+
+    Value *resultOf(Instruction *inst) {
+        if (auto unaryMath = hierarchy_cast<UnaryMathInstruction *>(inst); unaryMath)
+            return unaryMath->result.get();
+        if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(inst); binaryMath)
+            return binaryMath->result.get();
+        auto loadConst = hierarchy_cast<LoadConstInstruction *>(inst);
+        assert(loadConst);
+        return loadConst->result.get();
+    }
+
+    void retarget(Branch *branch, BasicBlock *from, BasicBlock *to) {
+        if (auto unconditional = hierarchy_cast<UnconditionalBranch *>(branch); unconditional) {
+            assert(unconditional->target == from);
+            unconditional->target = to;
+        } else {
+            auto conditional = hierarchy_cast<ConditionalBranch *>(branch);
+            assert(conditional);
+            if (conditional->ifTarget == from)
+                conditional->ifTarget = to;
+            if (conditional->elseTarget == from)
+                conditional->elseTarget = to;
+        }
+    }
+
+    DataFlowEdge *connect(BasicBlock *source, DataFlowPhi *sink, Value *alias) {
+        auto edge = DataFlowEdge::attach(std::make_unique<DataFlowEdge>(),
+                source->source, sink->sink);
+        edge->alias = alias;
+        return edge;
+    }
+
+    DataFlowPhi *attachPhi(BasicBlock *bb, Type *type) {
+        auto phi = bb->attachPhi(std::make_unique<DataFlowPhi>());
+        phi->value.setNew<LocalValue>()->setType(type);
+        return phi;
+    }
+}
+
+struct LoopInvariantCodeMotionImpl : LoopInvariantCodeMotionPass {
+    LoopInvariantCodeMotionImpl(Function *fn, AnalysisManager *am)
+    : _fn{fn}, _am{am} { }
+
+    void run() override;
+
+    PreservedAnalyses preservedAnalyses() override {
+        if (_changed)
+            return PreservedAnalyses::none();
+        return PreservedAnalyses::all();
+    }
+
+private:
+    void _processLoop(Loop *loop);
+    std::unordered_map<Value *, DataFlowPhi *> _findInvariantPhis(Loop *loop);
+    BasicBlock *_ensurePreheader(Loop *loop);
+
+    Function *_fn;
+    AnalysisManager *_am;
+    bool _changed = false;
+    // Kept up to date while preheaders are created.
+    std::unordered_map<BasicBlock *, std::vector<BasicBlock *>> _predecessors;
+};
+
+void LoopInvariantCodeMotionImpl::run() {
+    auto domTree = _am->getResult<DominatorTree>(_fn);
+    auto loopInfo = _am->getResult<LoopInfo>(_fn);
+    for (auto bb : _fn->blocks())
+        _predecessors[bb] = domTree->predecessors(bb);
+
+    // Nested loops come first, so that outer loops can hoist instructions further
+    // out of the preheaders of nested loops.
+    for (auto loop : loopInfo->loops())
+        _processLoop(loop);
+}
+
+void LoopInvariantCodeMotionImpl::_processLoop(Loop *loop) {
+    // The entry block cannot be preceded by a preheader.
+    if (loop->header == *_fn->blocks().begin()) {
+        countStatistic("licm", "skipped-loops");
+        return;
+    }
+
+    auto invariantPhis = _findInvariantPhis(loop);
+
+    // Collect invariant instructions. Operands are either phis or results
+    // of earlier instructions of the same block.
+    std::vector<Instruction *> hoisted;
+    std::unordered_set<Instruction *> hoistedSet;
+    std::unordered_set<Value *> hoistedValues;
+    for (auto bb : loop->blocks) {
+        for (auto inst : bb->instructions()) {
+            if (!isSpeculatable(inst))
+                continue;
+            auto operands = operandsOf(inst);
+            if (!std::all_of(operands.begin(), operands.end(), [&] (ValueUse *operand) {
+                return invariantPhis.count(operand->get())
+                        || hoistedValues.count(operand->get());
+            }))
+                continue;
+            hoisted.push_back(inst);
+            hoistedSet.insert(inst);
+            hoistedValues.insert(resultOf(inst));
+        }
+    }
+    if (hoisted.empty())
+        return;
+
+    auto preheader = _ensurePreheader(loop);
+    _changed = true;
+
+    // Value that enters the loop through a header phi.
+    auto entryValue = [&] (DataFlowPhi *phi) -> Value * {
+        for (auto edge : phi->sink.edges()) {
+            if (edge->source() == &preheader->source)
+                return edge->alias.get();
+        }
+        assert(!"Preheader does not feed header phi");
+        return nullptr;
+    };
+
+    for (auto inst : hoisted) {
+        auto bb = inst->basicBlock();
+        auto result = resultOf(inst);
+
+        // All uses outside of the preheader belong to the original block
+        // (i.e., to instructions, the branch or outgoing data-flow edges).
+        std::vector<ValueUse *> loopUses;
+        for (auto use : result->uses()) {
+            if (!use->instruction() || !hoistedSet.count(use->instruction()))
+                loopUses.push_back(use);
+        }
+
+        preheader->doInsertInstruction(bb->detachInstruction(bb->iteratorTo(inst)));
+        for (auto operand : operandsOf(inst)) {
+            auto it = invariantPhis.find(operand->get());
+            if (it != invariantPhis.end())
+                operand->assign(entryValue(it->second));
+        }
+        countStatistic("licm", "hoisted-instructions");
+        if (loopUses.empty())
+            continue;
+
+        // Carry the value around the loop: each block of the loop gets a phi that is
+        // fed by the preheader (for the header) or by the phis of its predecessors.
+        std::unordered_map<BasicBlock *, DataFlowPhi *> phis;
+        for (auto loopBlock : loop->blocks)
+            phis[loopBlock] = attachPhi(loopBlock, result->getType());
+        for (auto use : loopUses)
+            use->assign(phis[bb]->value.get());
+        connect(preheader, phis[loop->header], result);
+        for (auto loopBlock : loop->blocks) {
+            for (auto successor : successors(loopBlock)) {
+                if (loop->contains(successor))
+                    connect(loopBlock, phis[successor], phis[loopBlock]->value.get());
+            }
+        }
+        countStatistic("licm", "threading-phis", loop->blocks.size());
+    }
+}
+
+// Determines which phis of the loop carry the same value on every iteration. Maps each
+// such phi to the header phi that it is equal to. Optimistically assumes that all header
+// phis are invariant and refines this assumption until a fixed point is reached.
+std::unordered_map<Value *, DataFlowPhi *>
+LoopInvariantCodeMotionImpl::_findInvariantPhis(Loop *loop) {
+    auto header = loop->header;
+
+    // Phis that are missing from the map are not analyzed yet; nullptr marks variant phis.
+    std::unordered_map<Value *, DataFlowPhi *> reps;
+    std::unordered_set<Value *> loopPhis;
+    for (auto bb : loop->blocks) {
+        for (auto phi : bb->phis())
+            loopPhis.insert(phi->value.get());
+    }
+    for (auto phi : header->phis()) {
+        auto dataFlow = hierarchy_cast<DataFlowPhi *>(phi);
+        reps[phi->value.get()] = dataFlow;
+    }
+
+    // Returns the header phi that v is equal to, nullptr if v is variant
+    // or std::nullopt if v is not analyzed yet.
+    auto repOf = [&] (Value *v) -> std::optional<DataFlowPhi *> {
+        auto it = reps.find(v);
+        if (it == reps.end()) {
+            if (loopPhis.count(v))
+                return std::nullopt;
+            return nullptr;
+        }
+        if (it->second && reps[it->second->value.get()] != it->second)
+            return nullptr;
+        return it->second;
+    };
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto bb : loop->blocks) {
+            for (auto phi : bb->phis()) {
+                auto dataFlow = hierarchy_cast<DataFlowPhi *>(phi);
+                auto it = reps.find(phi->value.get());
+                if (!dataFlow || (it != reps.end() && !it->second))
+                    continue;
+
+                std::optional<DataFlowPhi *> rep;
+                if (bb == header)
+                    rep = dataFlow;
+                bool variant = false;
+                bool unknown = false;
+                for (auto edge : dataFlow->sink.edges()) {
+                    if (!loop->contains(edge->source()->block())) {
+                        // Only the header is entered from outside of the loop.
+                        if (bb != header)
+                            variant = true;
+                        continue;
+                    }
+                    auto incoming = repOf(edge->alias.get());
+                    if (!incoming) {
+                        unknown = true;
+                    } else if (!*incoming || (rep && *rep != *incoming)) {
+                        variant = true;
+                    } else {
+                        rep = incoming;
+                    }
+                }
+
+                DataFlowPhi *newRep;
+                if (variant) {
+                    newRep = nullptr;
+                } else if (rep) {
+                    newRep = *rep;
+                } else {
+                    assert(unknown);
+                    continue;
+                }
+                if (it == reps.end() || it->second != newRep) {
+                    reps[phi->value.get()] = newRep;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::unordered_map<Value *, DataFlowPhi *> result;
+    for (auto &[v, rep] : reps) {
+        if (rep && reps[rep->value.get()] == rep)
+            result.insert({v, rep});
+    }
+    return result;
+}
+
+// Returns the block that branches to the header from outside of the loop.
+BasicBlock *LoopInvariantCodeMotionImpl::_ensurePreheader(Loop *loop) {
+    auto header = loop->header;
+    std::vector<BasicBlock *> outside;
+    for (auto predecessor : _predecessors[header]) {
+        if (!loop->contains(predecessor))
+            outside.push_back(predecessor);
+    }
+    assert(!outside.empty());
+    if (outside.size() == 1 && successors(outside.front()).size() == 1)
+        return outside.front();
+
+    auto preheader = _fn->insertBlock(header, std::make_unique<BasicBlock>());
+    preheader->setBranch(std::make_unique<UnconditionalBranch>(header));
+    for (auto predecessor : outside)
+        retarget(predecessor->branch(), header, preheader);
+
+    // Header phis take their entry values from a phi of the preheader instead.
+    for (auto phi : header->phis()) {
+        auto dataFlow = hierarchy_cast<DataFlowPhi *>(phi);
+        assert(dataFlow);
+        auto entryPhi = attachPhi(preheader, phi->value.get()->getType());
+        std::vector<DataFlowEdge *> entryEdges;
+        for (auto edge : dataFlow->sink.edges()) {
+            if (!loop->contains(edge->source()->block()))
+                entryEdges.push_back(edge);
+        }
+        for (auto edge : entryEdges) {
+            auto source = edge->source();
+            DataFlowEdge::attach(DataFlowEdge::detach(edge), *source, entryPhi->sink);
+        }
+        connect(preheader, dataFlow, entryPhi->value.get());
+    }
+
+    auto &headerPredecessors = _predecessors[header];
+    headerPredecessors.erase(std::remove_if(headerPredecessors.begin(),
+            headerPredecessors.end(), [&] (BasicBlock *bb) {
+        return !loop->contains(bb);
+    }), headerPredecessors.end());
+    headerPredecessors.push_back(preheader);
+    _predecessors[preheader] = outside;
+    for (auto parent = loop->parent; parent; parent = parent->parent)
+        parent->addBlock(preheader);
+
+    countStatistic("licm", "created-preheaders");
+    return preheader;
+}
+
+std::unique_ptr<LoopInvariantCodeMotionPass> LoopInvariantCodeMotionPass::create(Function *fn,
+        AnalysisManager *am) {
+    return std::make_unique<LoopInvariantCodeMotionImpl>(fn, am);
+}
+
+} // namespace lewis
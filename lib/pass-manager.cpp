@@ -0,0 +1,169 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+#include <lewis/ir-text.hpp>
+#include <lewis/pass-manager.hpp>
+#include <lewis/statistics.hpp>
+
+namespace lewis {
+
+namespace {
+    struct IrSize {
+        ptrdiff_t numInstructions = 0;
+        ptrdiff_t numBlocks = 0;
+    };
+
+    IrSize measureIr(Function *fn) {
+        IrSize size;
+        for (auto bb : fn->blocks()) {
+            // indexOfInstruction(nullptr) returns the number of instructions in O(1).
+            size.numInstructions += bb->indexOfInstruction(nullptr);
+            size.numBlocks++;
+        }
+        return size;
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// AnalysisManager class.
+//---------------------------------------------------------------------------------------
+
+void AnalysisManager::invalidate(Function *fn, const PreservedAnalyses &preserved) {
+    auto fnIt = _results.find(fn);
+    if (fnIt == _results.end())
+        return;
+
+    auto &results = fnIt->second;
+    auto it = results.begin();
+    while (it != results.end()) {
+        if (preserved.isPreserved(it->first)) {
+            ++it;
+        } else {
+            it = results.erase(it);
+        }
+    }
+}
+
+void AnalysisManager::clear(Function *fn) {
+    _results.erase(fn);
+}
+
+//---------------------------------------------------------------------------------------
+// PassStatisticsAccumulator class.
+//---------------------------------------------------------------------------------------
+
+void PassStatisticsAccumulator::add(const std::vector<PassStatistics> &statistics) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    for (auto &stats : statistics) {
+        auto it = std::find_if(_statistics.begin(), _statistics.end(),
+                [&] (const PassStatistics &other) { return other.name == stats.name; });
+        if (it == _statistics.end()) {
+            _statistics.push_back(stats);
+            continue;
+        }
+        it->numRuns += stats.numRuns;
+        it->wallTime += stats.wallTime;
+        it->instructionDelta += stats.instructionDelta;
+        it->blockDelta += stats.blockDelta;
+    }
+}
+
+std::vector<PassStatistics> PassStatisticsAccumulator::get() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _statistics;
+}
+
+void printPassStatistics(std::ostream &out, const std::vector<PassStatistics> &statistics) {
+    for (auto &stats : statistics) {
+        out << std::setw(24) << std::left << stats.name << std::right
+                << " runs: " << std::setw(6) << stats.numRuns
+                << " time: " << std::setw(10) << stats.wallTime.count() << " ns"
+                << " instructions: " << std::showpos << stats.instructionDelta
+                << " blocks: " << stats.blockDelta << std::noshowpos << std::endl;
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// PassManager class.
+//---------------------------------------------------------------------------------------
+
+void PassManager::addBlockPass(std::string name, BlockPassFactory factory) {
+    _pipeline.push_back(Entry{std::move(factory), nullptr});
+    _statistics.push_back(PassStatistics{std::move(name)});
+}
+
+void PassManager::addFunctionPass(std::string name, FunctionPassFactory factory) {
+    _pipeline.push_back(Entry{nullptr, std::move(factory)});
+    _statistics.push_back(PassStatistics{std::move(name)});
+}
+
+void PassManager::addFunctionPass(std::string name, SimpleFunctionPassFactory factory) {
+    addFunctionPass(std::move(name), [factory = std::move(factory)] (Function *fn,
+            AnalysisManager *) {
+        return factory(fn);
+    });
+}
+
+void PassManager::run(Function *fn) {
+    TraceScope functionScope{"function", fn->name.c_str()};
+    for (size_t i = 0; i < _pipeline.size(); ++i) {
+        auto &entry = _pipeline[i];
+        auto &stats = _statistics[i];
+
+        auto sizeBefore = measureIr(fn);
+        auto startTime = std::chrono::steady_clock::now();
+
+        {
+            TraceScope passScope{"pass", stats.name.c_str()};
+            if (entry.blockFactory) {
+                for (auto bb : fn->blocks()) {
+                    auto pass = entry.blockFactory(bb);
+                    pass->run();
+                    _analyses.invalidate(fn, pass->preservedAnalyses());
+                }
+            } else {
+                assert(entry.functionFactory);
+                auto pass = entry.functionFactory(fn, &_analyses);
+                pass->run();
+                _analyses.invalidate(fn, pass->preservedAnalyses());
+            }
+        }
+
+        auto endTime = std::chrono::steady_clock::now();
+        auto sizeAfter = measureIr(fn);
+
+        stats.numRuns++;
+        stats.wallTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                endTime - startTime);
+        stats.instructionDelta += sizeAfter.numInstructions - sizeBefore.numInstructions;
+        stats.blockDelta += sizeAfter.numBlocks - sizeBefore.numBlocks;
+
+        if (_printOut && (_printPassName.empty() || _printPassName == stats.name)) {
+            *_printOut << "; IR after " << stats.name << "\n";
+            IrPrinter printer{*_printOut, _printDialect};
+            printer.printFunction(fn);
+        }
+    }
+}
+
+void PassManager::run(Module *mod) {
+    for (auto fn : mod->functions())
+        run(fn);
+}
+
+void PassManager::printStatistics(std::ostream &out) {
+    printPassStatistics(out, _statistics);
+}
+
+void PassManager::printAfter(std::ostream *out, IrTextDialect *dialect,
+        std::string passName) {
+    _printOut = out;
+    _printDialect = dialect;
+    _printPassName = std::move(passName);
+}
+
+} // namespace lewis
@@ -0,0 +1,275 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <lewis/statistics.hpp>
+
+namespace lewis {
+
+namespace {
+    std::atomic<StatisticsCollector *> globalCollector{nullptr};
+
+#if LEWIS_STATISTICS
+    std::atomic<uint32_t> nextThreadIndex{0};
+
+    uint32_t currentThreadIndex() {
+        thread_local uint32_t index = nextThreadIndex++;
+        return index;
+    }
+#endif // LEWIS_STATISTICS
+
+    void writeJsonString(std::ostream &out, const std::string &s) {
+        out << '"';
+        for (auto c : s) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                        << static_cast<int>(c) << std::dec << std::setfill(' ');
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    // Chrome traces use microseconds as their time unit.
+    void writeMicroseconds(std::ostream &out, std::chrono::nanoseconds time) {
+        out << time.count() / 1000 << '.' << std::setw(3) << std::setfill('0')
+                << time.count() % 1000 << std::setfill(' ');
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// DistributionStatistic class.
+//---------------------------------------------------------------------------------------
+
+namespace {
+    constexpr int subBucketBits = DistributionStatistic::subBucketBits;
+
+    // Values below 2^subBucketBits get one bucket each. Above, each power of two
+    // is split into 2^subBucketBits buckets.
+    size_t bucketOf(uint64_t value) {
+        if (value < (uint64_t{1} << subBucketBits))
+            return value;
+        int exponent = 63 - __builtin_clzll(value);
+        int shift = exponent - subBucketBits;
+        return (static_cast<size_t>(shift + 1) << subBucketBits)
+                + ((value >> shift) & ((uint64_t{1} << subBucketBits) - 1));
+    }
+
+    // Largest value that falls into the bucket.
+    uint64_t bucketLimit(size_t bucket) {
+        if (bucket < (size_t{1} << subBucketBits))
+            return bucket;
+        int shift = static_cast<int>(bucket >> subBucketBits) - 1;
+        uint64_t lower = ((uint64_t{1} << subBucketBits)
+                + (bucket & ((size_t{1} << subBucketBits) - 1))) << shift;
+        return lower + ((uint64_t{1} << shift) - 1);
+    }
+}
+
+void DistributionStatistic::add(int64_t value) {
+    value = std::max(value, int64_t{0});
+    buckets[bucketOf(value)]++;
+    numSamples++;
+    max = std::max(max, value);
+}
+
+void DistributionStatistic::merge(const DistributionStatistic &other) {
+    for (size_t i = 0; i < numBuckets; ++i)
+        buckets[i] += other.buckets[i];
+    numSamples += other.numSamples;
+    max = std::max(max, other.max);
+}
+
+int64_t DistributionStatistic::percentile(double p) const {
+    if (!numSamples)
+        return 0;
+    auto rank = static_cast<uint64_t>(std::ceil(p / 100 * numSamples));
+    rank = std::clamp(rank, uint64_t{1}, numSamples);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < numBuckets; ++i) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(static_cast<int64_t>(bucketLimit(i)), max);
+    }
+    return max;
+}
+
+//---------------------------------------------------------------------------------------
+// StatisticsCollector class.
+//---------------------------------------------------------------------------------------
+
+StatisticsCollector::StatisticsCollector()
+: _epoch{std::chrono::steady_clock::now()} { }
+
+void StatisticsCollector::addToCounter(const std::string &group, const std::string &name,
+        int64_t value) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _counters[{group, name}] += value;
+}
+
+void StatisticsCollector::addToTimer(const std::string &group, const std::string &name,
+        std::chrono::nanoseconds time) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto &timer = _timers[{group, name}];
+    timer.numSamples++;
+    timer.total += time;
+}
+
+void StatisticsCollector::addToDistribution(const std::string &group,
+        const std::string &name, int64_t value) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _distributions[{group, name}].add(value);
+}
+
+void StatisticsCollector::addToDistribution(const std::string &group,
+        const std::string &name, const DistributionStatistic &distribution) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _distributions[{group, name}].merge(distribution);
+}
+
+void StatisticsCollector::addTraceEvent(TraceEvent event) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _traceEvents.push_back(std::move(event));
+}
+
+int64_t StatisticsCollector::counter(const std::string &group, const std::string &name) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto it = _counters.find({group, name});
+    if (it == _counters.end())
+        return 0;
+    return it->second;
+}
+
+std::map<StatisticsCollector::Key, int64_t> StatisticsCollector::counters() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _counters;
+}
+
+std::map<StatisticsCollector::Key, TimerStatistic> StatisticsCollector::timers() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _timers;
+}
+
+std::map<StatisticsCollector::Key, DistributionStatistic>
+StatisticsCollector::distributions() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _distributions;
+}
+
+std::vector<TraceEvent> StatisticsCollector::traceEvents() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _traceEvents;
+}
+
+std::chrono::nanoseconds StatisticsCollector::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - _epoch);
+}
+
+void StatisticsCollector::print(std::ostream &out) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    for (auto &[key, timer] : _timers) {
+        out << std::setw(40) << std::left << (key.first + "." + key.second) << std::right
+                << " samples: " << std::setw(6) << timer.numSamples
+                << " time: " << std::setw(10) << timer.total.count() << " ns" << std::endl;
+    }
+    for (auto &[key, value] : _counters) {
+        out << std::setw(40) << std::left << (key.first + "." + key.second) << std::right
+                << " count: " << std::setw(10) << value << std::endl;
+    }
+    for (auto &[key, distribution] : _distributions) {
+        out << std::setw(40) << std::left << (key.first + "." + key.second) << std::right
+                << " samples: " << std::setw(6) << distribution.numSamples
+                << " p50: " << std::setw(10) << distribution.percentile(50)
+                << " p90: " << std::setw(10) << distribution.percentile(90)
+                << " p99: " << std::setw(10) << distribution.percentile(99)
+                << " max: " << std::setw(10) << distribution.percentile(100) << std::endl;
+    }
+}
+
+void StatisticsCollector::writeChromeTrace(std::ostream &out) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    std::chrono::nanoseconds end{0};
+    bool first = true;
+    auto separate = [&] {
+        if (!first)
+            out << ",\n";
+        first = false;
+    };
+
+    out << "{\"traceEvents\":[\n";
+    for (auto &event : _traceEvents) {
+        separate();
+        out << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread << ",\"cat\":";
+        writeJsonString(out, event.group);
+        out << ",\"name\":";
+        writeJsonString(out, event.name);
+        out << ",\"ts\":";
+        writeMicroseconds(out, event.start);
+        out << ",\"dur\":";
+        writeMicroseconds(out, event.duration);
+        out << "}";
+        end = std::max(end, event.start + event.duration);
+    }
+
+    // Emit one counter event per group.
+    for (auto it = _counters.begin(); it != _counters.end(); ) {
+        auto &group = it->first.first;
+        separate();
+        out << "{\"ph\":\"C\",\"pid\":1,\"tid\":0,\"name\":";
+        writeJsonString(out, group);
+        out << ",\"ts\":";
+        writeMicroseconds(out, end);
+        out << ",\"args\":{";
+        for (bool firstArg = true; it != _counters.end() && it->first.first == group; ++it) {
+            if (!firstArg)
+                out << ",";
+            firstArg = false;
+            writeJsonString(out, it->first.second);
+            out << ":" << it->second;
+        }
+        out << "}}";
+    }
+    out << "\n]}" << std::endl;
+}
+
+void setStatisticsCollector(StatisticsCollector *collector) {
+    globalCollector.store(collector, std::memory_order_release);
+}
+
+StatisticsCollector *statisticsCollector() {
+    return globalCollector.load(std::memory_order_acquire);
+}
+
+//---------------------------------------------------------------------------------------
+// TraceScope class.
+//---------------------------------------------------------------------------------------
+
+#if LEWIS_STATISTICS
+
+TraceScope::TraceScope(const char *group, const char *name)
+: _collector{statisticsCollector()}, _group{group}, _name{name} {
+    if (_collector)
+        _start = _collector->now();
+}
+
+TraceScope::~TraceScope() {
+    if (!_collector)
+        return;
+    auto duration = _collector->now() - _start;
+    _collector->addToTimer(_group, _name, duration);
+    if (_collector->recordTraceEvents)
+        _collector->addTraceEvent(TraceEvent{_group, _name, _start, duration,
+                currentThreadIndex()});
+}
+
+#endif // LEWIS_STATISTICS
+
+} // namespace lewis
@@ -5,6 +5,7 @@
 #include <queue>
 #include <unordered_map>
 #include <frg/interval_tree.hpp>
+#include <lewis/statistics.hpp>
 #include <lewis/target-x86_64/arch-ir.hpp>
 #include <lewis/target-x86_64/arch-passes.hpp>
 
@@ -304,10 +305,8 @@ void AllocateRegistersImpl::run() {
     for (auto bb : _fn->blocks())
         _establishAllocation(bb);
 
-    if (verbose) {
-        std::cout << "Allocation cost is " << _achievedCost << " units" << std::endl;
-        std::cout << "Allocation requires " << _numRegisterMoves << " moves" << std::endl;
-    }
+    countStatistic("allocate-registers", "cost", _achievedCost);
+    countStatistic("allocate-registers", "register-moves", _numRegisterMoves);
 }
 
 void AllocateRegistersImpl::_allocateCompound(LiveCompound *compound) {
@@ -512,6 +511,20 @@ void AllocateRegistersImpl::_collectBlockIntervals(BasicBlock *bb) {
 
             intervalMap.insert({movMC->result.get(), interval});
             collected.push_back(compound);
+        } else if (auto cmpSetcc = hierarchy_cast<CmpSetccInstruction *>(*cit); cmpSetcc) {
+            // The operands are read before the result is written.
+            auto compound = new LiveCompound;
+            compound->possibleRegisters = gprMask;
+
+            auto resultInterval = new LiveInterval;
+            compound->intervals.push_back(resultInterval);
+            resultInterval->associatedValue = cmpSetcc->result.get();
+            resultInterval->compound = compound;
+            resultInterval->originPc = ProgramCounter{bb, inBlock, *cit, afterInstruction};
+            assert(resultInterval->associatedValue);
+
+            intervalMap.insert({cmpSetcc->result.get(), resultInterval});
+            collected.push_back(compound);
         } else if (auto unaryMOverwrite = hierarchy_cast<UnaryMOverwriteInstruction *>(*cit);
                 unaryMOverwrite) {
             auto compound = new LiveCompound;
@@ -580,6 +593,151 @@ void AllocateRegistersImpl::_collectBlockIntervals(BasicBlock *bb) {
             intervalMap.insert({binaryMRInPlace->result.get(), resultInterval});
             collected.push_back(compound);
             _penalties.push_back(Penalty{{intervalMap.at(originalPrimary)->compound, compound}});
+        } else if (auto shift = hierarchy_cast<ShiftMInPlaceInstruction *>(*cit); shift) {
+            // The count is copied to RCX first. The primary operand is then handled
+            // like the primary operand of BinaryMRInPlaceInstructions.
+            auto originalCount = shift->count.get();
+            auto countMove = bb->insertInstruction(cit,
+                    std::make_unique<PseudoMoveSingleInstruction>(originalCount));
+            auto countMoveResult = countMove->result.set(cloneModeValue(originalCount));
+            shift->count = countMoveResult;
+
+            auto countCompound = new LiveCompound;
+            countCompound->possibleRegisters = 0x02;
+
+            auto countInterval = new LiveInterval;
+            countCompound->intervals.push_back(countInterval);
+            countInterval->associatedValue = countMoveResult;
+            countInterval->compound = countCompound;
+            countInterval->originPc = ProgramCounter{bb, inBlock, countMove, afterInstruction};
+            countInterval->finalPc = ProgramCounter{bb, inBlock, *cit, beforeInstruction};
+
+            _restrictedQueue.push(countCompound);
+            _penalties.push_back(Penalty{{intervalMap.at(originalCount)->compound,
+                    countCompound}});
+
+            auto originalPrimary = shift->primary.get();
+            auto pseudoMove = bb->insertInstruction(cit,
+                    std::make_unique<PseudoMoveSingleInstruction>(originalPrimary));
+            auto pseudoMoveResult = pseudoMove->result.set(cloneModeValue(originalPrimary));
+            shift->primary = pseudoMoveResult;
+
+            auto compound = new LiveCompound;
+            compound->possibleRegisters = gprMask;
+
+            auto copyInterval = new LiveInterval;
+            compound->intervals.push_back(copyInterval);
+            copyInterval->associatedValue = pseudoMoveResult;
+            copyInterval->compound = compound;
+            copyInterval->originPc = ProgramCounter{bb, inBlock, pseudoMove, afterInstruction};
+
+            auto resultInterval = new LiveInterval;
+            compound->intervals.push_back(resultInterval);
+            resultInterval->associatedValue = shift->result.get();
+            resultInterval->compound = compound;
+            resultInterval->originPc = {bb, inBlock, *cit, afterInstruction};
+            assert(resultInterval->associatedValue);
+
+            intervalMap.insert({shift->result.get(), resultInterval});
+            collected.push_back(compound);
+            _penalties.push_back(Penalty{{intervalMap.at(originalPrimary)->compound, compound}});
+        } else if (auto divide = hierarchy_cast<DivideMInstruction *>(*cit); divide) {
+            // The dividend is copied to RAX. The emitted code extends it into RDX,
+            // hence the divisor must not live in either of these registers.
+            auto originalDividend = divide->dividend.get();
+            auto dividendMove = bb->insertInstruction(cit,
+                    std::make_unique<PseudoMoveSingleInstruction>(originalDividend));
+            auto dividendMoveResult = dividendMove->result.set(
+                    cloneModeValue(originalDividend));
+            divide->dividend = dividendMoveResult;
+
+            auto dividendCompound = new LiveCompound;
+            dividendCompound->possibleRegisters = 0x01;
+
+            auto dividendInterval = new LiveInterval;
+            dividendCompound->intervals.push_back(dividendInterval);
+            dividendInterval->associatedValue = dividendMoveResult;
+            dividendInterval->compound = dividendCompound;
+            dividendInterval->originPc = ProgramCounter{bb, inBlock,
+                    dividendMove, afterInstruction};
+            dividendInterval->finalPc = ProgramCounter{bb, inBlock, *cit, beforeInstruction};
+
+            _restrictedQueue.push(dividendCompound);
+            _penalties.push_back(Penalty{{intervalMap.at(originalDividend)->compound,
+                    dividendCompound}});
+
+            auto originalDivisor = divide->divisor.get();
+            auto divisorMove = bb->insertInstruction(cit,
+                    std::make_unique<PseudoMoveSingleInstruction>(originalDivisor));
+            auto divisorMoveResult = divisorMove->result.set(cloneModeValue(originalDivisor));
+            divide->divisor = divisorMoveResult;
+
+            auto divisorCompound = new LiveCompound;
+            divisorCompound->possibleRegisters = gprMask & ~uint64_t{0x05};
+
+            auto divisorInterval = new LiveInterval;
+            divisorCompound->intervals.push_back(divisorInterval);
+            divisorInterval->associatedValue = divisorMoveResult;
+            divisorInterval->compound = divisorCompound;
+            divisorInterval->originPc = ProgramCounter{bb, inBlock,
+                    divisorMove, afterInstruction};
+
+            collected.push_back(divisorCompound);
+            _penalties.push_back(Penalty{{intervalMap.at(originalDivisor)->compound,
+                    divisorCompound}});
+
+            // The result is copied out of RAX (or RDX) as for CallInstructions.
+            auto nit = it;
+            ++nit;
+            auto resultMove = bb->insertInstruction(nit,
+                    std::make_unique<PseudoMoveSingleInstruction>());
+            auto resultMoveResult
+                    = resultMove->result.set(cloneModeValue(divide->result.get()));
+            divide->result.get()->replaceAllUses(resultMoveResult);
+            resultMove->operand = divide->result.get();
+
+            auto resultCompound = new LiveCompound;
+            resultCompound->possibleRegisters = divide->remainder ? 0x04 : 0x01;
+
+            auto resultInterval = new LiveInterval;
+            resultCompound->intervals.push_back(resultInterval);
+            resultInterval->associatedValue = divide->result.get();
+            resultInterval->compound = resultCompound;
+            resultInterval->originPc = ProgramCounter{bb, inBlock, *cit, afterInstruction};
+            resultInterval->finalPc = ProgramCounter{bb, inBlock,
+                    resultMove, beforeInstruction};
+            assert(resultInterval->associatedValue);
+
+            auto copyCompound = new LiveCompound;
+            copyCompound->possibleRegisters = gprMask;
+
+            auto copyInterval = new LiveInterval;
+            copyCompound->intervals.push_back(copyInterval);
+            copyInterval->associatedValue = resultMoveResult;
+            copyInterval->compound = copyCompound;
+            copyInterval->originPc = ProgramCounter{bb, inBlock,
+                    resultMove, afterInstruction};
+
+            intervalMap.insert({resultMoveResult, copyInterval});
+            _restrictedQueue.push(resultCompound);
+            collected.push_back(copyCompound);
+            _penalties.push_back(Penalty{{resultCompound, copyCompound}});
+
+            // The other half of RDX:RAX is clobbered.
+            auto clobberCompound = new LiveCompound;
+            clobberCompound->possibleRegisters = divide->remainder ? 0x01 : 0x04;
+
+            auto clobberInterval = new LiveInterval;
+            clobberCompound->intervals.push_back(clobberInterval);
+            clobberInterval->compound = clobberCompound;
+            clobberInterval->originPc = ProgramCounter{bb, inBlock, *cit, atInstruction};
+            clobberInterval->finalPc = ProgramCounter{bb, inBlock, *cit, atInstruction};
+
+            _restrictedQueue.push(clobberCompound);
+
+            // Skip the PseudoMove instruction.
+            ++it;
+            assert(*it == resultMove);
         } else if (auto call = hierarchy_cast<CallInstruction *>(*cit); call) {
             std::array<int, 6> operandRegs{0x80, 0x40, 0x04, 0x02, 0x0100, 0x0200};
             std::array<int, 2> resultRegs{0x01, 0x04};
@@ -733,26 +891,39 @@ void AllocateRegistersImpl::_collectBlockIntervals(BasicBlock *bb) {
             _restrictedQueue.push(copyCompound);
             _penalties.push_back(Penalty{{intervalMap.at(originalOperand)->compound, copyCompound}});
         }
-    } else if (auto jnz = hierarchy_cast<JnzBranch *>(bb->branch()); jnz) {
-        auto originalOperand = jnz->operand.get();
-        auto pseudoMove = bb->insertNewInstruction<PseudoMoveSingleInstruction>();
-        pseudoMove->operand = originalOperand;
-        auto pseudoMoveResult = pseudoMove->result.set(cloneModeValue(originalOperand));
-        jnz->operand = pseudoMoveResult;
+    } else {
+        // Branch operands are copied at the end of the block. The copies stay alive until
+        // the branch reads them.
+        auto copyBranchOperand = [&] (ValueUse &operand) {
+            auto originalOperand = operand.get();
+            auto pseudoMove = bb->insertNewInstruction<PseudoMoveSingleInstruction>();
+            pseudoMove->operand = originalOperand;
+            auto pseudoMoveResult = pseudoMove->result.set(cloneModeValue(originalOperand));
+            operand = pseudoMoveResult;
 
-        auto copyCompound = new LiveCompound;
-        copyCompound->possibleRegisters = gprMask;
+            auto copyCompound = new LiveCompound;
+            copyCompound->possibleRegisters = gprMask;
 
-        auto copyInterval = new LiveInterval;
-        copyCompound->intervals.push_back(copyInterval);
-        copyInterval->equivalencePointer = intervalMap.at(originalOperand)->equivalencePointer;
-        copyInterval->associatedValue = pseudoMoveResult;
-        copyInterval->compound = copyCompound;
-        copyInterval->originPc = ProgramCounter{bb, inBlock, pseudoMove, afterInstruction};
-        copyInterval->finalPc = ProgramCounter{bb, afterBlock, nullptr, afterInstruction};
+            auto copyInterval = new LiveInterval;
+            copyCompound->intervals.push_back(copyInterval);
+            copyInterval->equivalencePointer
+                    = intervalMap.at(originalOperand)->equivalencePointer;
+            copyInterval->associatedValue = pseudoMoveResult;
+            copyInterval->compound = copyCompound;
+            copyInterval->originPc = ProgramCounter{bb, inBlock, pseudoMove, afterInstruction};
+            copyInterval->finalPc = ProgramCounter{bb, afterBlock, nullptr, afterInstruction};
+
+            _unrestrictedQueue.push(copyCompound);
+            _penalties.push_back(Penalty{{intervalMap.at(originalOperand)->compound,
+                    copyCompound}});
+        };
 
-        _unrestrictedQueue.push(copyCompound);
-        _penalties.push_back(Penalty{{intervalMap.at(originalOperand)->compound, copyCompound}});
+        if (auto jnz = hierarchy_cast<JnzBranch *>(bb->branch()); jnz) {
+            copyBranchOperand(jnz->operand);
+        } else if (auto jcc = hierarchy_cast<JccBranch *>(bb->branch()); jcc) {
+            copyBranchOperand(jcc->left);
+            copyBranchOperand(jcc->right);
+        }
     }
 
     // Post-process the generated intervals.
@@ -1101,14 +1272,15 @@ void AllocateRegistersImpl::_establishAllocation(BasicBlock *bb) {
     }
 
     // Generate the function epilogue.
+    // The frame sits below the saved registers, so it has to be released first.
     if (auto ret = hierarchy_cast<RetBranch *>(bb->branch()); ret) {
+        if (frameSpace)
+            bb->insertInstruction(std::make_unique<IncrementStackInstruction>(frameSpace));
         for (int i = 15; i >= 0; i--) {
             if (!(saveMask & (1 << i)))
                 continue;
             bb->insertInstruction(std::make_unique<PopRestoreInstruction>(i));
         }
-        if (frameSpace)
-            bb->insertInstruction(std::make_unique<IncrementStackInstruction>(frameSpace));
     }
 }
 
@@ -0,0 +1,564 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <cassert>
+#include <iostream>
+#include <lewis/target-x86_64/arch-ir.hpp>
+#include <lewis/target-x86_64/arch-text.hpp>
+
+namespace lewis::targets::x86_64 {
+
+namespace {
+    const char *registerNames[] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+    };
+
+    const char *operandSizeNames[] = {"none", "dword", "qword", "byte", "word"};
+
+    struct ConditionName {
+        ConditionCode code;
+        const char *name;
+    };
+
+    const ConditionName conditionNames[] = {
+        {ConditionCode::below, "b"},
+        {ConditionCode::aboveEqual, "ae"},
+        {ConditionCode::equal, "e"},
+        {ConditionCode::notEqual, "ne"},
+        {ConditionCode::belowEqual, "be"},
+        {ConditionCode::above, "a"},
+        {ConditionCode::less, "l"},
+        {ConditionCode::greaterEqual, "ge"},
+        {ConditionCode::lessEqual, "le"},
+        {ConditionCode::greater, "g"}
+    };
+
+    struct KindName {
+        InstructionKindType kind;
+        const char *name;
+    };
+
+    const KindName instructionNames[] = {
+        {arch_instruction_kinds::nop, "nop"},
+        {arch_instruction_kinds::pseudoMoveSingle, "pseudoMoveSingle"},
+        {arch_instruction_kinds::pseudoMoveMultiple, "pseudoMoveMultiple"},
+        {arch_instruction_kinds::pushSave, "pushSave"},
+        {arch_instruction_kinds::popRestore, "popRestore"},
+        {arch_instruction_kinds::decrementStack, "decrementStack"},
+        {arch_instruction_kinds::incrementStack, "incrementStack"},
+        {arch_instruction_kinds::xchgMR, "xchgMR"},
+        {arch_instruction_kinds::movMC, "movMC"},
+        {arch_instruction_kinds::movMR, "movMR"},
+        {arch_instruction_kinds::movRM, "movRM"},
+        {arch_instruction_kinds::movzxRM, "movzxRM"},
+        {arch_instruction_kinds::movsxRM, "movsxRM"},
+        {arch_instruction_kinds::xorZero, "xorZero"},
+        {arch_instruction_kinds::defineOffset, "defineOffset"},
+        {arch_instruction_kinds::negM, "negM"},
+        {arch_instruction_kinds::addMR, "addMR"},
+        {arch_instruction_kinds::andMR, "andMR"},
+        {arch_instruction_kinds::notM, "notM"},
+        {arch_instruction_kinds::subMR, "subMR"},
+        {arch_instruction_kinds::orMR, "orMR"},
+        {arch_instruction_kinds::xorMR, "xorMR"},
+        {arch_instruction_kinds::imulRM, "imulRM"},
+        {arch_instruction_kinds::shlM, "shlM"},
+        {arch_instruction_kinds::shrM, "shrM"},
+        {arch_instruction_kinds::sarM, "sarM"},
+        {arch_instruction_kinds::rolM, "rolM"},
+        {arch_instruction_kinds::rorM, "rorM"},
+        {arch_instruction_kinds::divM, "divM"},
+        {arch_instruction_kinds::idivM, "idivM"},
+        {arch_instruction_kinds::leaBaseIndex, "leaBaseIndex"},
+        {arch_instruction_kinds::cmpSetcc, "cmpSetcc"},
+        {arch_instruction_kinds::call, "call"}
+    };
+
+    const char *nameOfKind(InstructionKindType kind) {
+        for (auto &entry : instructionNames) {
+            if (entry.kind == kind)
+                return entry.name;
+        }
+        return nullptr;
+    }
+
+    InstructionKindType kindOfName(const std::string &name) {
+        for (auto &entry : instructionNames) {
+            if (name == entry.name)
+                return entry.kind;
+        }
+        return instruction_kinds::null;
+    }
+
+    void printRegister(IrPrinter &printer, int reg) {
+        if (reg < 0) {
+            printer.stream() << "none";
+        } else {
+            printer.stream() << registerNames[reg];
+        }
+    }
+
+    int parseRegister(IrParser &parser) {
+        auto name = parser.parseIdentifier();
+        if (name == "none")
+            return -1;
+        for (int i = 0; i < 16; ++i) {
+            if (name == registerNames[i])
+                return i;
+        }
+        parser.fail("unknown register " + name);
+    }
+
+    const char *nameOfCondition(ConditionCode code) {
+        for (auto &entry : conditionNames) {
+            if (entry.code == code)
+                return entry.name;
+        }
+        assert(!"Unexpected condition code");
+        return nullptr;
+    }
+
+    ConditionCode parseCondition(IrParser &parser) {
+        auto name = parser.parseIdentifier();
+        for (auto &entry : conditionNames) {
+            if (name == entry.name)
+                return entry.code;
+        }
+        parser.fail("unknown condition code " + name);
+    }
+
+    OperandSize parseOperandSize(IrParser &parser) {
+        auto name = parser.parseIdentifier();
+        for (int i = 0; i < 5; ++i) {
+            if (name == operandSizeNames[i])
+                return static_cast<OperandSize>(i);
+        }
+        parser.fail("unknown operand size " + name);
+    }
+
+    struct ArchTextDialect : IrTextDialect {
+        bool printInstruction(IrPrinter &printer, Instruction *inst) override;
+        bool printBranch(IrPrinter &printer, Branch *branch) override;
+        bool printValueMode(IrPrinter &printer, Value *v) override;
+
+        Instruction *parseInstruction(IrParser &parser, const std::string &mnemonic,
+                BasicBlock *bb) override;
+        Branch *parseBranch(IrParser &parser, const std::string &mnemonic,
+                BasicBlock *bb) override;
+        std::unique_ptr<Value> parseValueMode(IrParser &parser,
+                const std::string &mode) override;
+    };
+
+    bool ArchTextDialect::printInstruction(IrPrinter &printer, Instruction *inst) {
+        auto name = nameOfKind(inst->kind);
+        if (!name)
+            return false;
+        auto &out = printer.stream();
+
+        if (auto unaryOverwrite = hierarchy_cast<UnaryMOverwriteInstruction *>(inst);
+                unaryOverwrite) {
+            printer.printDefinition(unaryOverwrite->result.get());
+            out << " = " << name << " ";
+            printer.printUse(unaryOverwrite->operand.get());
+        } else if (auto unaryInPlace = hierarchy_cast<UnaryMInPlaceInstruction *>(inst);
+                unaryInPlace) {
+            printer.printDefinition(unaryInPlace->result.get());
+            out << " = " << name << " ";
+            printer.printUse(unaryInPlace->primary.get());
+        } else if (auto binaryInPlace = hierarchy_cast<BinaryMRInPlaceInstruction *>(inst);
+                binaryInPlace) {
+            printer.printDefinition(binaryInPlace->result.get());
+            out << " = " << name << " ";
+            printer.printUse(binaryInPlace->primary.get());
+            out << ", ";
+            printer.printUse(binaryInPlace->secondary.get());
+        } else if (auto shift = hierarchy_cast<ShiftMInPlaceInstruction *>(inst); shift) {
+            printer.printDefinition(shift->result.get());
+            out << " = " << name << " ";
+            printer.printUse(shift->primary.get());
+            out << ", ";
+            printer.printUse(shift->count.get());
+        } else if (auto divide = hierarchy_cast<DivideMInstruction *>(inst); divide) {
+            printer.printDefinition(divide->result.get());
+            out << " = " << name << (divide->remainder ? " remainder " : " quotient ");
+            printer.printUse(divide->dividend.get());
+            out << ", ";
+            printer.printUse(divide->divisor.get());
+        } else if (auto defineOffset = hierarchy_cast<DefineOffsetInstruction *>(inst);
+                defineOffset) {
+            printer.printDefinition(defineOffset->result.get());
+            out << " = " << name << " ";
+            printer.printUse(defineOffset->operand.get());
+        } else if (auto movMC = hierarchy_cast<MovMCInstruction *>(inst); movMC) {
+            printer.printDefinition(movMC->result.get());
+            out << " = " << name << " " << movMC->value;
+        } else if (auto xorZero = hierarchy_cast<XorZeroInstruction *>(inst); xorZero) {
+            printer.printDefinition(xorZero->result.get());
+            out << " = " << name;
+        } else if (auto cmpSetcc = hierarchy_cast<CmpSetccInstruction *>(inst); cmpSetcc) {
+            printer.printDefinition(cmpSetcc->result.get());
+            out << " = " << name << " " << nameOfCondition(cmpSetcc->code) << " ";
+            printer.printUse(cmpSetcc->primary.get());
+            out << ", ";
+            printer.printUse(cmpSetcc->secondary.get());
+        } else if (auto lea = hierarchy_cast<LeaBaseIndexInstruction *>(inst); lea) {
+            printer.printDefinition(lea->result.get());
+            out << " = " << name << " ";
+            printer.printUse(lea->base.get());
+            out << ", ";
+            printer.printUse(lea->index.get());
+        } else if (auto pseudoMoveMultiple = hierarchy_cast<PseudoMoveMultipleInstruction *>(
+                inst); pseudoMoveMultiple) {
+            for (size_t i = 0; i < pseudoMoveMultiple->arity(); ++i) {
+                if (i)
+                    out << ", ";
+                printer.printDefinition(pseudoMoveMultiple->result(i).get());
+            }
+            if (pseudoMoveMultiple->arity())
+                out << " = ";
+            out << name;
+            for (size_t i = 0; i < pseudoMoveMultiple->arity(); ++i) {
+                out << (i ? ", " : " ");
+                printer.printUse(pseudoMoveMultiple->operand(i).get());
+            }
+        } else if (auto xchg = hierarchy_cast<XchgMRInstruction *>(inst); xchg) {
+            printer.printDefinition(xchg->firstResult.get());
+            out << ", ";
+            printer.printDefinition(xchg->secondResult.get());
+            out << " = " << name << " ";
+            printer.printUse(xchg->firstOperand.get());
+            out << ", ";
+            printer.printUse(xchg->secondOperand.get());
+        } else if (auto pushSave = hierarchy_cast<PushSaveInstruction *>(inst); pushSave) {
+            out << name << " ";
+            printRegister(printer, pushSave->operandRegister);
+        } else if (auto popRestore = hierarchy_cast<PopRestoreInstruction *>(inst); popRestore) {
+            out << name << " ";
+            printRegister(printer, popRestore->operandRegister);
+        } else if (auto decrementStack = hierarchy_cast<DecrementStackInstruction *>(inst);
+                decrementStack) {
+            out << name << " " << decrementStack->value;
+        } else if (auto incrementStack = hierarchy_cast<IncrementStackInstruction *>(inst);
+                incrementStack) {
+            out << name << " " << incrementStack->value;
+        } else if (auto call = hierarchy_cast<CallInstruction *>(inst); call) {
+            for (size_t i = 0; i < call->numResults(); ++i) {
+                if (i)
+                    out << ", ";
+                printer.printDefinition(call->result(i).get());
+            }
+            if (call->numResults())
+                out << " = ";
+            out << name << " ";
+            printer.printString(call->function);
+            out << "(";
+            for (size_t i = 0; i < call->numOperands(); ++i) {
+                if (i)
+                    out << ", ";
+                printer.printUse(call->operand(i).get());
+            }
+            out << ")";
+        } else {
+            assert(inst->kind == arch_instruction_kinds::nop);
+            out << name;
+        }
+        return true;
+    }
+
+    bool ArchTextDialect::printBranch(IrPrinter &printer, Branch *branch) {
+        auto &out = printer.stream();
+        if (auto ret = hierarchy_cast<RetBranch *>(branch); ret) {
+            out << "ret";
+            for (size_t i = 0; i < ret->numOperands(); ++i) {
+                out << (i ? ", " : " ");
+                printer.printUse(ret->operand(i).get());
+            }
+        } else if (auto jmp = hierarchy_cast<JmpBranch *>(branch); jmp) {
+            out << "jmp ";
+            printer.printBlock(jmp->target);
+        } else if (auto jnz = hierarchy_cast<JnzBranch *>(branch); jnz) {
+            out << (jnz->reuseFlags ? "jnzFlags " : "jnz ");
+            printer.printUse(jnz->operand.get());
+            out << ", ";
+            printer.printBlock(jnz->ifTarget);
+            out << ", ";
+            printer.printBlock(jnz->elseTarget);
+        } else if (auto jcc = hierarchy_cast<JccBranch *>(branch); jcc) {
+            out << "jcc " << nameOfCondition(jcc->code) << " ";
+            printer.printUse(jcc->left.get());
+            out << ", ";
+            printer.printUse(jcc->right.get());
+            out << ", ";
+            printer.printBlock(jcc->ifTarget);
+            out << ", ";
+            printer.printBlock(jcc->elseTarget);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool ArchTextDialect::printValueMode(IrPrinter &printer, Value *v) {
+        auto &out = printer.stream();
+        if (auto registerMode = hierarchy_cast<RegisterMode *>(v); registerMode) {
+            out << "reg(" << operandSizeNames[registerMode->operandSize] << ", ";
+            printRegister(printer, registerMode->modeRegister);
+            out << ")";
+        } else if (auto memoryMode = hierarchy_cast<BaseDispMemoryMode *>(v); memoryMode) {
+            out << "mem(" << operandSizeNames[memoryMode->operandSize] << ", ";
+            printRegister(printer, memoryMode->baseRegister);
+            out << ", " << memoryMode->disp << ")";
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    Instruction *ArchTextDialect::parseInstruction(IrParser &parser,
+            const std::string &mnemonic, BasicBlock *bb) {
+        auto kind = kindOfName(mnemonic);
+        switch (kind) {
+        case instruction_kinds::null:
+            return nullptr;
+        case arch_instruction_kinds::nop:
+            return bb->insertNewInstruction<NopInstruction>();
+        case arch_instruction_kinds::pseudoMoveSingle:
+        case arch_instruction_kinds::movMR:
+        case arch_instruction_kinds::movRM:
+        case arch_instruction_kinds::movzxRM:
+        case arch_instruction_kinds::movsxRM: {
+            std::unique_ptr<UnaryMOverwriteInstruction> inst;
+            if (kind == arch_instruction_kinds::pseudoMoveSingle) {
+                inst = std::make_unique<PseudoMoveSingleInstruction>(parser.parseUse());
+            } else if (kind == arch_instruction_kinds::movMR) {
+                inst = std::make_unique<MovMRInstruction>(parser.parseUse());
+            } else if (kind == arch_instruction_kinds::movzxRM) {
+                inst = std::make_unique<MovzxRMInstruction>(parser.parseUse());
+            } else if (kind == arch_instruction_kinds::movsxRM) {
+                inst = std::make_unique<MovsxRMInstruction>(parser.parseUse());
+            } else {
+                inst = std::make_unique<MovRMInstruction>(parser.parseUse());
+            }
+            auto ptr = bb->insertInstruction(std::move(inst));
+            parser.define(ptr->result);
+            return ptr;
+        }
+        case arch_instruction_kinds::pseudoMoveMultiple: {
+            auto arity = parser.numDefinitions();
+            std::vector<Value *> operands;
+            for (size_t i = 0; i < arity; ++i) {
+                if (i)
+                    parser.expect(',');
+                operands.push_back(parser.parseUse());
+            }
+            auto inst = bb->insertNewInstruction<PseudoMoveMultipleInstruction>(arity);
+            for (size_t i = 0; i < arity; ++i) {
+                inst->operand(i) = operands[i];
+                parser.define(inst->result(i));
+            }
+            return inst;
+        }
+        case arch_instruction_kinds::pushSave:
+            return bb->insertNewInstruction<PushSaveInstruction>(parseRegister(parser));
+        case arch_instruction_kinds::popRestore:
+            return bb->insertNewInstruction<PopRestoreInstruction>(parseRegister(parser));
+        case arch_instruction_kinds::decrementStack:
+            return bb->insertNewInstruction<DecrementStackInstruction>(parser.parseSigned());
+        case arch_instruction_kinds::incrementStack:
+            return bb->insertNewInstruction<IncrementStackInstruction>(parser.parseSigned());
+        case arch_instruction_kinds::xchgMR: {
+            auto first = parser.parseUse();
+            parser.expect(',');
+            auto second = parser.parseUse();
+            auto inst = bb->insertNewInstruction<XchgMRInstruction>(first, second);
+            parser.define(inst->firstResult);
+            parser.define(inst->secondResult);
+            return inst;
+        }
+        case arch_instruction_kinds::movMC: {
+            auto inst = bb->insertNewInstruction<MovMCInstruction>();
+            inst->value = parser.parseUnsigned();
+            parser.define(inst->result);
+            return inst;
+        }
+        case arch_instruction_kinds::xorZero: {
+            auto inst = bb->insertNewInstruction<XorZeroInstruction>();
+            parser.define(inst->result);
+            return inst;
+        }
+        case arch_instruction_kinds::defineOffset: {
+            auto inst = bb->insertNewInstruction<DefineOffsetInstruction>(parser.parseUse());
+            parser.define(inst->result);
+            return inst;
+        }
+        case arch_instruction_kinds::negM: {
+            auto inst = bb->insertNewInstruction<NegMInstruction>(parser.parseUse());
+            parser.define(inst->result);
+            return inst;
+        }
+        case arch_instruction_kinds::notM: {
+            auto inst = bb->insertNewInstruction<NotMInstruction>(parser.parseUse());
+            parser.define(inst->result);
+            return inst;
+        }
+        case arch_instruction_kinds::addMR:
+        case arch_instruction_kinds::andMR:
+        case arch_instruction_kinds::subMR:
+        case arch_instruction_kinds::orMR:
+        case arch_instruction_kinds::xorMR:
+        case arch_instruction_kinds::imulRM: {
+            auto primary = parser.parseUse();
+            parser.expect(',');
+            auto secondary = parser.parseUse();
+            BinaryMRInPlaceInstruction *inst;
+            if (kind == arch_instruction_kinds::addMR) {
+                inst = bb->insertNewInstruction<AddMRInstruction>(primary, secondary);
+            } else if (kind == arch_instruction_kinds::andMR) {
+                inst = bb->insertNewInstruction<AndMRInstruction>(primary, secondary);
+            } else if (kind == arch_instruction_kinds::subMR) {
+                inst = bb->insertNewInstruction<SubMRInstruction>(primary, secondary);
+            } else if (kind == arch_instruction_kinds::orMR) {
+                inst = bb->insertNewInstruction<OrMRInstruction>(primary, secondary);
+            } else if (kind == arch_instruction_kinds::xorMR) {
+                inst = bb->insertNewInstruction<XorMRInstruction>(primary, secondary);
+            } else {
+                inst = bb->insertNewInstruction<ImulRMInstruction>(primary, secondary);
+            }
+            parser.define(inst->result);
+            return inst;
+        }
+        case arch_instruction_kinds::shlM:
+        case arch_instruction_kinds::shrM:
+        case arch_instruction_kinds::sarM:
+        case arch_instruction_kinds::rolM:
+        case arch_instruction_kinds::rorM: {
+            auto primary = parser.parseUse();
+            parser.expect(',');
+            auto count = parser.parseUse();
+            auto inst = bb->insertNewInstruction<ShiftMInPlaceInstruction>(kind,
+                    primary, count);
+            parser.define(inst->result);
+            return inst;
+        }
+        case arch_instruction_kinds::divM:
+        case arch_instruction_kinds::idivM: {
+            auto part = parser.parseIdentifier();
+            if (part != "quotient" && part != "remainder")
+                parser.fail("expected quotient or remainder");
+            auto dividend = parser.parseUse();
+            parser.expect(',');
+            auto divisor = parser.parseUse();
+            auto inst = bb->insertNewInstruction<DivideMInstruction>(kind,
+                    part == "remainder", dividend, divisor);
+            parser.define(inst->result);
+            return inst;
+        }
+        case arch_instruction_kinds::leaBaseIndex: {
+            auto base = parser.parseUse();
+            parser.expect(',');
+            auto index = parser.parseUse();
+            auto inst = bb->insertNewInstruction<LeaBaseIndexInstruction>(base, index);
+            parser.define(inst->result);
+            return inst;
+        }
+        case arch_instruction_kinds::cmpSetcc: {
+            auto code = parseCondition(parser);
+            auto primary = parser.parseUse();
+            parser.expect(',');
+            auto secondary = parser.parseUse();
+            auto inst = bb->insertNewInstruction<CmpSetccInstruction>(code, primary, secondary);
+            parser.define(inst->result);
+            return inst;
+        }
+        case arch_instruction_kinds::call: {
+            auto function = parser.parseString();
+            auto operands = parser.parseUseList();
+            auto inst = bb->insertNewInstruction<CallInstruction>(operands.size(),
+                    parser.numDefinitions());
+            inst->function = std::move(function);
+            for (size_t i = 0; i < operands.size(); ++i)
+                inst->operand(i) = operands[i];
+            for (size_t i = 0; i < inst->numResults(); ++i)
+                parser.define(inst->result(i));
+            return inst;
+        }
+        default:
+            assert(!"Unexpected x86 instruction kind");
+            return nullptr;
+        }
+    }
+
+    Branch *ArchTextDialect::parseBranch(IrParser &parser, const std::string &mnemonic,
+            BasicBlock *bb) {
+        if (mnemonic == "ret") {
+            std::vector<Value *> operands;
+            if (parser.peek('%')) {
+                do {
+                    operands.push_back(parser.parseUse());
+                } while (parser.tryConsume(','));
+            }
+            auto ret = bb->setBranch(std::make_unique<RetBranch>(operands.size()));
+            for (size_t i = 0; i < operands.size(); ++i)
+                ret->operand(i) = operands[i];
+            return ret;
+        } else if (mnemonic == "jmp") {
+            return bb->setBranch(std::make_unique<JmpBranch>(parser.parseBlock()));
+        } else if (mnemonic == "jnz" || mnemonic == "jnzFlags") {
+            auto operand = parser.parseUse();
+            parser.expect(',');
+            auto ifTarget = parser.parseBlock();
+            parser.expect(',');
+            auto elseTarget = parser.parseBlock();
+            auto jnz = bb->setBranch(std::make_unique<JnzBranch>(ifTarget, elseTarget));
+            jnz->operand = operand;
+            jnz->reuseFlags = mnemonic == "jnzFlags";
+            return jnz;
+        } else if (mnemonic == "jcc") {
+            auto code = parseCondition(parser);
+            auto left = parser.parseUse();
+            parser.expect(',');
+            auto right = parser.parseUse();
+            parser.expect(',');
+            auto ifTarget = parser.parseBlock();
+            parser.expect(',');
+            auto elseTarget = parser.parseBlock();
+            auto jcc = bb->setBranch(std::make_unique<JccBranch>(code, ifTarget, elseTarget));
+            jcc->left = left;
+            jcc->right = right;
+            return jcc;
+        }
+        return nullptr;
+    }
+
+    std::unique_ptr<Value> ArchTextDialect::parseValueMode(IrParser &parser,
+            const std::string &mode) {
+        if (mode == "reg") {
+            auto registerMode = std::make_unique<RegisterMode>();
+            parser.expect('(');
+            registerMode->operandSize = parseOperandSize(parser);
+            parser.expect(',');
+            registerMode->modeRegister = parseRegister(parser);
+            parser.expect(')');
+            return registerMode;
+        } else if (mode == "mem") {
+            auto memoryMode = std::make_unique<BaseDispMemoryMode>();
+            parser.expect('(');
+            memoryMode->operandSize = parseOperandSize(parser);
+            parser.expect(',');
+            memoryMode->baseRegister = parseRegister(parser);
+            parser.expect(',');
+            memoryMode->disp = parser.parseSigned();
+            parser.expect(')');
+            return memoryMode;
+        }
+        return nullptr;
+    }
+}
+
+IrTextDialect *textDialect() {
+    static ArchTextDialect dialect;
+    return &dialect;
+}
+
+} // namespace lewis::targets::x86_64
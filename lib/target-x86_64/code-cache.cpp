@@ -0,0 +1,237 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <lewis/target-x86_64/arch-passes.hpp>
+#include <lewis/target-x86_64/code-cache.hpp>
+#include <lewis/util/byte-decode.hpp>
+#include <lewis/util/byte-encode.hpp>
+
+namespace lewis::targets::x86_64 {
+
+namespace {
+    // Bump this whenever the encoding of FunctionCode changes.
+    // Changes to the generated code itself are tracked by codegenVersion.
+    constexpr uint32_t diskFormatVersion = 5;
+
+    // Continues the FNV-1a hash of the IrKey over the name of the pipeline.
+    uint64_t hashOf(const IrKey &key, const std::string &pipeline) {
+        auto hash = key.hash;
+        for (auto c : pipeline) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 0x100000001B3;
+        }
+        return hash;
+    }
+}
+
+CodeCache::CodeCache(size_t capacity, std::string directory)
+: _capacity{capacity}, _directory{std::move(directory)} { }
+
+std::optional<FunctionCode> CodeCache::lookup(const IrKey &key, const std::string &pipeline) {
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto range = _map.equal_range(hashOf(key, pipeline));
+        for (auto it = range.first; it != range.second; ++it) {
+            auto entry = it->second;
+            if (entry->key != key || entry->pipeline != pipeline)
+                continue;
+            _lru.splice(_lru.begin(), _lru, entry);
+            _statistics.numHits++;
+            return entry->code;
+        }
+    }
+
+    if (!_directory.empty()) {
+        auto code = _readFromDisk(key, pipeline);
+        if (code) {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _insertIntoMemory(key, pipeline, *code);
+            _statistics.numHits++;
+            _statistics.numDiskHits++;
+            return code;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    _statistics.numMisses++;
+    return std::nullopt;
+}
+
+void CodeCache::insert(const IrKey &key, const std::string &pipeline,
+        const FunctionCode &code) {
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _insertIntoMemory(key, pipeline, code);
+    }
+
+    if (!_directory.empty())
+        _writeToDisk(key, pipeline, code);
+}
+
+CodeCacheStatistics CodeCache::statistics() {
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _statistics;
+}
+
+// Must be called with _mutex held.
+void CodeCache::_insertIntoMemory(const IrKey &key, const std::string &pipeline,
+        const FunctionCode &code) {
+    if (!_capacity)
+        return;
+
+    // Replace existing entries for the same key.
+    auto hash = hashOf(key, pipeline);
+    auto range = _map.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->key != key || it->second->pipeline != pipeline)
+            continue;
+        _lru.erase(it->second);
+        _map.erase(it);
+        break;
+    }
+
+    _lru.push_front(Entry{key, pipeline, code});
+    _lru.front().code.name.clear();
+    _map.insert({hash, _lru.begin()});
+
+    while (_lru.size() > _capacity) {
+        auto victim = std::prev(_lru.end());
+        auto victimRange = _map.equal_range(hashOf(victim->key, victim->pipeline));
+        for (auto it = victimRange.first; it != victimRange.second; ++it) {
+            if (it->second != victim)
+                continue;
+            _map.erase(it);
+            break;
+        }
+        _lru.erase(victim);
+        _statistics.numEvictions++;
+    }
+}
+
+std::string CodeCache::_pathOf(const IrKey &key, const std::string &pipeline) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016lx", static_cast<unsigned long>(hashOf(key, pipeline)));
+    return _directory + "/" + hex + ".lewis-code";
+}
+
+// On-disk format: format version, codegen version, pipeline name, key bytes, text,
+// alignment, block offsets, relocations and unwind rows.
+// Since only the hash is part of the file name, the pipeline and the full key are stored
+// and compared.
+std::optional<FunctionCode> CodeCache::_readFromDisk(const IrKey &key,
+        const std::string &pipeline) {
+    auto file = fopen(_pathOf(key, pipeline).c_str(), "rb");
+    if (!file)
+        return std::nullopt;
+
+    std::vector<uint8_t> in;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)))
+        in.insert(in.end(), chunk, chunk + n);
+    fclose(file);
+
+    util::ByteDecoder dec{in.data(), in.size()};
+    if (decode32(dec) != diskFormatVersion || decode32(dec) != codegenVersion)
+        return std::nullopt;
+    auto pipelineSize = decode64(dec);
+    if (!dec.ok() || pipelineSize != pipeline.size()
+            || decodeChars(dec, pipelineSize) != pipeline)
+        return std::nullopt;
+    auto keySize = decode64(dec);
+    auto keyBytes = dec.skip(keySize);
+    if (!dec.ok() || keySize != key.bytes.size()
+            || memcmp(keyBytes, key.bytes.data(), keySize))
+        return std::nullopt;
+
+    FunctionCode code;
+    auto textSize = decode64(dec);
+    if (auto text = dec.skip(textSize); text)
+        code.text.assign(text, text + textSize);
+    code.alignment = decode64(dec);
+    auto numBlocks = decode64(dec);
+    for (uint64_t i = 0; dec.ok() && i < numBlocks; ++i)
+        code.blockOffsets.push_back(decode64(dec));
+    auto numRelocations = decode64(dec);
+    for (uint64_t i = 0; dec.ok() && i < numRelocations; ++i) {
+        CodeRelocation relocation;
+        relocation.kind = static_cast<CodeRelocationKind>(decode32(dec));
+        relocation.offset = decode64(dec);
+        relocation.block = decode64(dec);
+        relocation.function = decodeChars(dec, decode64(dec));
+        code.relocations.push_back(std::move(relocation));
+    }
+    auto numRows = decode64(dec);
+    for (uint64_t i = 0; dec.ok() && i < numRows; ++i) {
+        UnwindRow row;
+        row.offset = decode64(dec);
+        row.cfaOffset = decodeZigZag(dec);
+        auto numSaved = decode64(dec);
+        for (uint64_t j = 0; dec.ok() && j < numSaved; ++j) {
+            auto reg = static_cast<int>(decode32(dec));
+            row.savedRegisters.push_back({reg, decodeZigZag(dec)});
+        }
+        code.unwindRows.push_back(std::move(row));
+    }
+    if (!dec.ok())
+        return std::nullopt;
+    return code;
+}
+
+void CodeCache::_writeToDisk(const IrKey &key, const std::string &pipeline,
+        const FunctionCode &code) {
+    std::vector<uint8_t> out;
+    util::ByteEncoder enc{&out};
+    encode32(enc, diskFormatVersion);
+    encode32(enc, codegenVersion);
+    encode64(enc, pipeline.size());
+    encodeChars(enc, pipeline.c_str());
+    encode64(enc, key.bytes.size());
+    out.insert(out.end(), key.bytes.begin(), key.bytes.end());
+    encode64(enc, code.text.size());
+    out.insert(out.end(), code.text.begin(), code.text.end());
+    encode64(enc, code.alignment);
+    encode64(enc, code.blockOffsets.size());
+    for (auto offset : code.blockOffsets)
+        encode64(enc, offset);
+    encode64(enc, code.relocations.size());
+    for (auto &relocation : code.relocations) {
+        encode32(enc, static_cast<uint32_t>(relocation.kind));
+        encode64(enc, relocation.offset);
+        encode64(enc, relocation.block);
+        encode64(enc, relocation.function.size());
+        encodeChars(enc, relocation.function.c_str());
+    }
+    encode64(enc, code.unwindRows.size());
+    for (auto &row : code.unwindRows) {
+        encode64(enc, row.offset);
+        encodeZigZag(enc, row.cfaOffset);
+        encode64(enc, row.savedRegisters.size());
+        for (auto &[reg, offset] : row.savedRegisters) {
+            encode32(enc, reg);
+            encodeZigZag(enc, offset);
+        }
+    }
+
+    // Write to a temporary file first such that readers never observe partial files.
+    auto path = _pathOf(key, pipeline);
+    auto tempPath = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(
+            std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    auto file = fopen(tempPath.c_str(), "wb");
+    if (!file)
+        return;
+    auto written = fwrite(out.data(), 1, out.size(), file);
+    if (fclose(file) || written != out.size()) {
+        remove(tempPath.c_str());
+        return;
+    }
+    if (rename(tempPath.c_str(), path.c_str()))
+        remove(tempPath.c_str());
+}
+
+} // namespace lewis::targets::x86_64
@@ -0,0 +1,142 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <lewis/statistics.hpp>
+#include <lewis/target-x86_64/compile-driver.hpp>
+
+namespace lewis::targets::x86_64 {
+
+namespace {
+    // Queue of Function indices owned by a single worker.
+    // The owner takes work from the front, thieves take work from the back.
+    struct WorkQueue {
+        std::optional<size_t> take() {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (indices.empty())
+                return std::nullopt;
+            auto index = indices.front();
+            indices.pop_front();
+            return index;
+        }
+
+        std::optional<size_t> steal() {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (indices.empty())
+                return std::nullopt;
+            auto index = indices.back();
+            indices.pop_back();
+            return index;
+        }
+
+        std::mutex mutex;
+        std::deque<size_t> indices;
+    };
+}
+
+CompileDriver::CompileDriver(size_t numThreads)
+: _numThreads{numThreads} {
+    if (!_numThreads)
+        _numThreads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+void CompileDriver::addFunction(Function *fn) {
+    _functions.push_back(fn);
+}
+
+void CompileDriver::addModule(Module *mod) {
+    for (auto fn : mod->functions())
+        _functions.push_back(fn);
+}
+
+void CompileDriver::run(elf::Object *elf) {
+    auto n = _functions.size();
+    auto numWorkers = std::min(_numThreads, n);
+    _codes.clear();
+    _codes.resize(n);
+
+    std::vector<std::exception_ptr> errors;
+    errors.resize(n);
+
+    auto compileOrCapture = [&] (size_t index) {
+        try {
+            _compile(index);
+        } catch (...) {
+            errors[index] = std::current_exception();
+        }
+    };
+
+    if (numWorkers <= 1) {
+        for (size_t i = 0; i < n; ++i)
+            compileOrCapture(i);
+    } else {
+        // Distribute contiguous ranges of Functions to the workers.
+        std::vector<WorkQueue> queues(numWorkers);
+        for (size_t w = 0; w < numWorkers; ++w) {
+            for (size_t i = w * n / numWorkers; i < (w + 1) * n / numWorkers; ++i)
+                queues[w].indices.push_back(i);
+        }
+
+        auto work = [&] (size_t w) {
+            while (true) {
+                auto index = queues[w].take();
+                // Try to steal from the other workers. Since no new work is generated
+                // while the workers run, we are done once all queues are empty.
+                for (size_t k = 1; !index && k < numWorkers; ++k)
+                    index = queues[(w + k) % numWorkers].steal();
+                if (!index)
+                    return;
+                compileOrCapture(*index);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t w = 1; w < numWorkers; ++w)
+            threads.emplace_back(work, w);
+        work(0);
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    // Report the error of the first Function that failed to compile.
+    for (auto &error : errors) {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // Merge the results in a deterministic order.
+    MachineCodeEmitter mce{elf};
+    for (auto &code : _codes)
+        mce.emit(&code);
+}
+
+// Called on worker threads. Only touches the Function with the given index.
+void CompileDriver::_compile(size_t index) {
+    auto fn = _functions[index];
+
+    // The key must be computed on the generic IR, i.e., before lowering.
+    std::optional<IrKey> key;
+    if (codeCache) {
+        key = computeIrKey(fn);
+        if (auto code = codeCache->lookup(*key, pipelineName); code) {
+            countStatistic("code-cache", "hits");
+            code->name = fn->name;
+            _codes[index] = std::move(*code);
+            return;
+        }
+        countStatistic("code-cache", "misses");
+    }
+
+    auto code = compileFunction(fn, pipeline, &_passStatistics);
+    if (codeCache)
+        codeCache->insert(*key, pipelineName, code);
+    _codes[index] = std::move(code);
+}
+
+} // namespace lewis::targets::x86_64
@@ -0,0 +1,182 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <lewis/statistics.hpp>
+#include <lewis/target-x86_64/compile-service.hpp>
+
+namespace lewis::targets::x86_64 {
+
+namespace {
+    int64_t nanosecondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// CompileJob class.
+//---------------------------------------------------------------------------------------
+
+CompileJob::CompileJob(Function *fn, CompilePriority priority, CompileCallback callback)
+: _fn{fn}, _priority{priority}, _callback{std::move(callback)},
+        _submitTime{std::chrono::steady_clock::now()} {
+    result = _promise.get_future().share();
+}
+
+bool CompileJob::cancel() {
+    auto expected = State::queued;
+    if (!_state.compare_exchange_strong(expected, State::cancelled))
+        return false;
+    _promise.set_exception(std::make_exception_ptr(
+            std::runtime_error("Compilation of " + _fn->name + " was cancelled")));
+    countStatistic("compile-service", "cancelled");
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+// CompileService class.
+//---------------------------------------------------------------------------------------
+
+CompileService::CompileService(size_t numThreads, size_t queueCapacity)
+: _interactiveQueue{queueCapacity}, _prefetchQueue{queueCapacity} {
+    if (!numThreads)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < numThreads; ++i)
+        _threads.emplace_back(&CompileService::_work, this);
+}
+
+CompileService::~CompileService() {
+    {
+        std::lock_guard<std::mutex> lock{_sleepMutex};
+        _stopping = true;
+    }
+    _sleepCv.notify_all();
+    for (auto &thread : _threads)
+        thread.join();
+
+    std::shared_ptr<CompileJob> job;
+    while (_take(job))
+        job->cancel();
+
+    if constexpr (statisticsEnabled) {
+        if (auto collector = statisticsCollector(); collector)
+            _exportStatistics(collector);
+    }
+}
+
+std::shared_ptr<CompileJob> CompileService::submit(Function *fn, CompilePriority priority,
+        CompileCallback callback) {
+    auto job = std::make_shared<CompileJob>(fn, priority, std::move(callback));
+    auto queue = (priority == CompilePriority::interactive)
+            ? &_interactiveQueue : &_prefetchQueue;
+    auto queued = job;
+    if (!queue->push(queued)) {
+        if constexpr (statisticsEnabled)
+            _numRejected.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if constexpr (statisticsEnabled)
+        _numSubmitted.fetch_add(1, std::memory_order_relaxed);
+
+    // Pairs with the increment of _numSleeping in _work(): either the worker sees
+    // the new job or we see the sleeping worker.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_numSleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock{_sleepMutex};
+        _sleepCv.notify_one();
+    }
+    return job;
+}
+
+CompileServiceStatistics CompileService::statistics() {
+    CompileServiceStatistics result;
+    {
+        std::lock_guard<std::mutex> lock{_statisticsMutex};
+        result = _statistics;
+    }
+    result.numSubmitted = _numSubmitted.load(std::memory_order_relaxed);
+    result.numRejected = _numRejected.load(std::memory_order_relaxed);
+    return result;
+}
+
+bool CompileService::_take(std::shared_ptr<CompileJob> &job) {
+    return _interactiveQueue.pop(job) || _prefetchQueue.pop(job);
+}
+
+void CompileService::_exportStatistics(StatisticsCollector *collector) {
+    auto stats = statistics();
+    auto exportQueue = [&] (const std::string &prefix, const CompileQueueStatistics &queue) {
+        collector->addToDistribution("compile-service", prefix + "-queue-depth",
+                queue.queueDepth);
+        collector->addToDistribution("compile-service", prefix + "-wait-time",
+                queue.waitTime);
+        collector->addToDistribution("compile-service", prefix + "-latency",
+                queue.latency);
+    };
+    collector->addToCounter("compile-service", "submitted", stats.numSubmitted);
+    collector->addToCounter("compile-service", "rejected", stats.numRejected);
+    collector->addToCounter("compile-service", "completed", stats.numCompleted);
+    exportQueue("interactive", stats.interactive);
+    exportQueue("prefetch", stats.prefetch);
+}
+
+// Called on worker threads.
+void CompileService::_run(CompileJob *job) {
+    auto expected = CompileJob::State::queued;
+    if (!job->_state.compare_exchange_strong(expected, CompileJob::State::running))
+        return;
+    auto interactive = job->_priority == CompilePriority::interactive;
+    auto queueDepth = interactive ? _interactiveQueue.size() : _prefetchQueue.size();
+    auto waitTime = nanosecondsSince(job->_submitTime);
+
+    auto fn = job->_fn;
+    try {
+        job->_promise.set_value(compileFunction(fn, pipeline, &_passStatistics));
+    } catch (...) {
+        job->_promise.set_exception(std::current_exception());
+    }
+    job->_state = CompileJob::State::done;
+
+    if constexpr (statisticsEnabled) {
+        auto latency = nanosecondsSince(job->_submitTime);
+        std::lock_guard<std::mutex> lock{_statisticsMutex};
+        auto &queue = interactive ? _statistics.interactive : _statistics.prefetch;
+        queue.queueDepth.add(queueDepth);
+        queue.waitTime.add(waitTime);
+        queue.latency.add(latency);
+        _statistics.numCompleted++;
+    }
+    if (job->_callback)
+        job->_callback(job);
+}
+
+void CompileService::_work() {
+    std::shared_ptr<CompileJob> job;
+    while (!_stopping.load(std::memory_order_relaxed)) {
+        if (_take(job)) {
+            _run(job.get());
+            job = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock{_sleepMutex};
+        if (_stopping)
+            return;
+        _numSleeping.fetch_add(1, std::memory_order_seq_cst);
+        if (_take(job)) {
+            _numSleeping.fetch_sub(1, std::memory_order_relaxed);
+            lock.unlock();
+            _run(job.get());
+            job = nullptr;
+            continue;
+        }
+        _sleepCv.wait(lock);
+        _numSleeping.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+} // namespace lewis::targets::x86_64
@@ -0,0 +1,203 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <lewis/target-x86_64/jit-profiling.hpp>
+#include <lewis/util/byte-encode.hpp>
+
+namespace lewis::targets::x86_64 {
+
+namespace {
+    // A range of code that receives its own symbol.
+    struct CodeRange {
+        std::string name;
+        size_t offset;
+        size_t size;
+    };
+
+    std::vector<CodeRange> collectRanges(const FunctionCode *code, bool blockSymbols) {
+        std::vector<CodeRange> ranges;
+        if (!blockSymbols || code->blockOffsets.empty()) {
+            ranges.push_back({code->name, 0, code->text.size()});
+            return ranges;
+        }
+        for (size_t i = 0; i < code->blockOffsets.size(); i++) {
+            auto end = (i + 1 < code->blockOffsets.size())
+                    ? code->blockOffsets[i + 1] : code->text.size();
+            ranges.push_back({code->name + ".bb" + std::to_string(i),
+                    code->blockOffsets[i], end - code->blockOffsets[i]});
+        }
+        return ranges;
+    }
+
+    // jitdump timestamps have to match the clock of "perf record -k mono".
+    uint64_t monotonicTimestamp() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    void writeAll(int fd, const uint8_t *data, size_t size) {
+        while (size) {
+            auto chunk = write(fd, data, size);
+            if (chunk < 0)
+                throw std::runtime_error("Could not write jitdump file");
+            data += chunk;
+            size -= chunk;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// PerfMapSink class.
+//---------------------------------------------------------------------------------------
+
+struct PerfMapSinkImpl : PerfMapSink {
+    PerfMapSinkImpl() {
+        auto path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+        _file = fopen(path.c_str(), "w");
+        if (!_file)
+            throw std::runtime_error("Could not open " + path);
+    }
+
+    ~PerfMapSinkImpl() override {
+        fclose(_file);
+    }
+
+    void addCode(const void *address, const FunctionCode *code) override;
+
+private:
+    std::mutex _mutex;
+    FILE *_file;
+};
+
+void PerfMapSinkImpl::addCode(const void *address, const FunctionCode *code) {
+    auto base = reinterpret_cast<uintptr_t>(address);
+    std::lock_guard<std::mutex> lock{_mutex};
+    for (auto &range : collectRanges(code, blockSymbols)) {
+        if (!range.size)
+            continue;
+        fprintf(_file, "%lx %zx %s\n", static_cast<unsigned long>(base + range.offset),
+                range.size, range.name.c_str());
+    }
+    // perf may read the file while we are still running.
+    fflush(_file);
+}
+
+std::unique_ptr<PerfMapSink> PerfMapSink::create() {
+    return std::make_unique<PerfMapSinkImpl>();
+}
+
+//---------------------------------------------------------------------------------------
+// JitDumpSink class.
+//---------------------------------------------------------------------------------------
+
+namespace {
+    constexpr uint32_t jitDumpMagic = 0x4A695444; // "JiTD".
+    constexpr uint32_t jitDumpVersion = 1;
+    constexpr uint32_t jitDumpHeaderSize = 40;
+
+    // Record IDs.
+    constexpr uint32_t jitCodeLoad = 0;
+    constexpr uint32_t jitCodeClose = 3;
+}
+
+struct JitDumpSinkImpl : JitDumpSink {
+    JitDumpSinkImpl(std::string directory);
+
+    ~JitDumpSinkImpl() override;
+
+    void addCode(const void *address, const FunctionCode *code) override;
+
+private:
+    void _writeRecordHeader(util::ByteEncoder &enc, uint32_t id, uint32_t totalSize);
+
+    std::mutex _mutex;
+    int _fd = -1;
+    void *_marker = nullptr;
+    size_t _markerSize = 0;
+    uint64_t _codeIndex = 0;
+};
+
+JitDumpSinkImpl::JitDumpSinkImpl(std::string directory) {
+    auto path = directory + "/jit-" + std::to_string(getpid()) + ".dump";
+    _fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (_fd < 0)
+        throw std::runtime_error("Could not open " + path);
+
+    // perf record only finds the file through an executable mapping of it.
+    _markerSize = sysconf(_SC_PAGESIZE);
+    _marker = mmap(nullptr, _markerSize, PROT_READ | PROT_EXEC, MAP_PRIVATE, _fd, 0);
+    if (_marker == MAP_FAILED) {
+        close(_fd);
+        throw std::runtime_error("Could not map " + path);
+    }
+
+    std::vector<uint8_t> buffer;
+    util::ByteEncoder enc{&buffer};
+    encode32(enc, jitDumpMagic);
+    encode32(enc, jitDumpVersion);
+    encode32(enc, jitDumpHeaderSize);
+    encode32(enc, EM_X86_64);
+    encode32(enc, 0); // Padding.
+    encode32(enc, getpid());
+    encode64(enc, monotonicTimestamp());
+    encode64(enc, 0); // Flags.
+    writeAll(_fd, buffer.data(), buffer.size());
+}
+
+JitDumpSinkImpl::~JitDumpSinkImpl() {
+    std::vector<uint8_t> buffer;
+    util::ByteEncoder enc{&buffer};
+    _writeRecordHeader(enc, jitCodeClose, 16);
+    write(_fd, buffer.data(), buffer.size());
+
+    munmap(_marker, _markerSize);
+    close(_fd);
+}
+
+void JitDumpSinkImpl::_writeRecordHeader(util::ByteEncoder &enc, uint32_t id,
+        uint32_t totalSize) {
+    encode32(enc, id);
+    encode32(enc, totalSize);
+    encode64(enc, monotonicTimestamp());
+}
+
+void JitDumpSinkImpl::addCode(const void *address, const FunctionCode *code) {
+    auto base = reinterpret_cast<uintptr_t>(address);
+    auto tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    std::lock_guard<std::mutex> lock{_mutex};
+    for (auto &range : collectRanges(code, blockSymbols)) {
+        if (!range.size)
+            continue;
+        std::vector<uint8_t> buffer;
+        util::ByteEncoder enc{&buffer};
+        _writeRecordHeader(enc, jitCodeLoad, 16 + 40 + range.name.size() + 1 + range.size);
+        encode32(enc, getpid());
+        encode32(enc, tid);
+        encode64(enc, base + range.offset); // Virtual address.
+        encode64(enc, base + range.offset); // Code address.
+        encode64(enc, range.size);
+        encode64(enc, _codeIndex++);
+        encodeChars(enc, range.name.c_str());
+        encode8(enc, 0);
+        buffer.insert(buffer.end(), code->text.begin() + range.offset,
+                code->text.begin() + range.offset + range.size);
+        writeAll(_fd, buffer.data(), buffer.size());
+    }
+}
+
+std::unique_ptr<JitDumpSink> JitDumpSink::create(std::string directory) {
+    return std::make_unique<JitDumpSinkImpl>(std::move(directory));
+}
+
+} // namespace lewis::targets::x86_64
@@ -8,6 +8,38 @@
 
 namespace lewis::targets::x86_64 {
 
+namespace {
+    ConditionCode conditionOf(BinaryMathOpcode opcode) {
+        switch (opcode) {
+        case BinaryMathOpcode::equal: return ConditionCode::equal;
+        case BinaryMathOpcode::notEqual: return ConditionCode::notEqual;
+        case BinaryMathOpcode::signedLess: return ConditionCode::less;
+        case BinaryMathOpcode::signedLessEqual: return ConditionCode::lessEqual;
+        case BinaryMathOpcode::signedGreater: return ConditionCode::greater;
+        case BinaryMathOpcode::signedGreaterEqual: return ConditionCode::greaterEqual;
+        case BinaryMathOpcode::unsignedLess: return ConditionCode::below;
+        case BinaryMathOpcode::unsignedLessEqual: return ConditionCode::belowEqual;
+        case BinaryMathOpcode::unsignedGreater: return ConditionCode::above;
+        case BinaryMathOpcode::unsignedGreaterEqual: return ConditionCode::aboveEqual;
+        default:
+            assert(!"Unexpected comparison opcode");
+            abort();
+        }
+    }
+
+    OperandSize sizeOfType(Type *type) {
+        switch (type->typeKind) {
+        case type_kinds::int8: return OperandSize::byte;
+        case type_kinds::int16: return OperandSize::word;
+        case type_kinds::int32: return OperandSize::dword;
+        case type_kinds::int64: return OperandSize::qword;
+        default:
+            assert(!"Unexpected type kind");
+            abort();
+        }
+    }
+}
+
 struct LowerCodeImpl : LowerCodePass {
     LowerCodeImpl(BasicBlock *bb)
     : _bb{bb} { }
@@ -25,12 +57,8 @@ void LowerCodeImpl::run() {
         auto lower = std::make_unique<RegisterMode>();
         if (localValue->getType()->typeKind == type_kinds::pointer) {
             lower->operandSize = OperandSize::qword;
-        } else if (localValue->getType()->typeKind == type_kinds::int32) {
-            lower->operandSize = OperandSize::dword;
-        } else if (localValue->getType()->typeKind == type_kinds::int64) {
-            lower->operandSize = OperandSize::qword;
         } else {
-            assert(!"Unexpected type kind");
+            lower->operandSize = sizeOfType(localValue->getType());
         }
         return lower;
     };
@@ -41,12 +69,8 @@ void LowerCodeImpl::run() {
         auto lower = std::make_unique<BaseDispMemoryMode>();
         if (localValue->getType()->typeKind == type_kinds::pointer) {
             lower->operandSize = OperandSize::qword;
-        } else if (localValue->getType()->typeKind == type_kinds::int32) {
-            lower->operandSize = OperandSize::dword;
-        } else if (localValue->getType()->typeKind == type_kinds::int64) {
-            lower->operandSize = OperandSize::qword;
         } else {
-            assert(!"Unexpected type kind");
+            lower->operandSize = sizeOfType(localValue->getType());
         }
         lower->disp = offset;
         return lower;
@@ -58,6 +82,30 @@ void LowerCodeImpl::run() {
         (*it)->value.set(std::move(lowerPhi));
     }
 
+    // A comparison whose only use is the ConditionalBranch is fused into a JccBranch.
+    // In this case, the comparison is not materialized. Lowering the operands later on
+    // also replaces their uses in the JccBranch.
+    std::unique_ptr<JccBranch> fusedBranch;
+    if (auto conditional = hierarchy_cast<ConditionalBranch *>(_bb->branch()); conditional) {
+        auto condition = conditional->operand.get();
+        auto origin = condition->origin();
+        auto compare = hierarchy_cast<BinaryMathInstruction *>(
+                origin ? origin->instruction() : nullptr);
+        auto useIt = condition->uses().begin();
+        ++useIt;
+        if (compare && isComparison(compare->opcode) && compare->basicBlock() == _bb
+                && !(useIt != condition->uses().end())) {
+            fusedBranch = std::make_unique<JccBranch>(conditionOf(compare->opcode),
+                    conditional->ifTarget, conditional->elseTarget);
+            fusedBranch->left = compare->left.get();
+            fusedBranch->right = compare->right.get();
+            compare->left = nullptr;
+            compare->right = nullptr;
+            conditional->operand = nullptr;
+            _bb->eraseInstruction(_bb->iteratorTo(compare));
+        }
+    }
+
     for (auto it = _bb->instructions().begin(); it != _bb->instructions().end(); ++it) {
         if (auto loadConst = hierarchy_cast<LoadConstInstruction *>(*it); loadConst) {
             auto lower = std::make_unique<MovMCInstruction>();
@@ -81,12 +129,32 @@ void LowerCodeImpl::run() {
             ++nit;
             _bb->insertInstruction(nit, std::move(lowerMov));
             ++it;
+        } else if (auto unaryMath = hierarchy_cast<UnaryMathInstruction *>(*it);
+                unaryMath && unaryMath->opcode != UnaryMathOpcode::negate
+                && unaryMath->opcode != UnaryMathOpcode::bitwiseNot) {
+            // Conversions. Truncation is a plain move of the low bits.
+            std::unique_ptr<UnaryMOverwriteInstruction> lower;
+            if (unaryMath->opcode == UnaryMathOpcode::zeroExtend) {
+                lower = std::make_unique<MovzxRMInstruction>();
+            } else if (unaryMath->opcode == UnaryMathOpcode::signExtend) {
+                lower = std::make_unique<MovsxRMInstruction>();
+            } else if (unaryMath->opcode == UnaryMathOpcode::truncate) {
+                lower = std::make_unique<MovMRInstruction>();
+            } else {
+                assert(!"Unexpected unary math opcode");
+            }
+            auto lowerResult = lower->result.set(lowerValue(unaryMath->result.get()));
+            lower->operand = unaryMath->operand.get();
+            unaryMath->result.get()->replaceAllUses(lowerResult);
+
+            unaryMath->operand = nullptr;
+            it = _bb->replaceInstruction(it, std::move(lower));
         } else if (auto unaryMath = hierarchy_cast<UnaryMathInstruction *>(*it); unaryMath) {
             std::unique_ptr<UnaryMInPlaceInstruction> lower;
             if (unaryMath->opcode == UnaryMathOpcode::negate) {
                 lower = std::make_unique<NegMInstruction>();
             } else {
-                assert(!"Unexpected unary math opcode");
+                lower = std::make_unique<NotMInstruction>();
             }
             auto lowerResult = lower->result.set(lowerValue(unaryMath->result.get()));
             lower->primary = unaryMath->operand.get();
@@ -94,12 +162,67 @@ void LowerCodeImpl::run() {
 
             unaryMath->operand = nullptr;
             it = _bb->replaceInstruction(it, std::move(lower));
+        } else if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(*it);
+                binaryMath && isComparison(binaryMath->opcode)) {
+            auto lower = std::make_unique<CmpSetccInstruction>(conditionOf(binaryMath->opcode),
+                    binaryMath->left.get(), binaryMath->right.get());
+            auto lowerResult = lower->result.set(lowerValue(binaryMath->result.get()));
+            binaryMath->result.get()->replaceAllUses(lowerResult);
+
+            binaryMath->left = nullptr;
+            binaryMath->right = nullptr;
+            it = _bb->replaceInstruction(it, std::move(lower));
+        } else if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(*it);
+                binaryMath && binaryMath->opcode >= BinaryMathOpcode::shiftLeft
+                && binaryMath->opcode <= BinaryMathOpcode::rotateRight) {
+            InstructionKindType kind;
+            switch (binaryMath->opcode) {
+            case BinaryMathOpcode::shiftLeft: kind = arch_instruction_kinds::shlM; break;
+            case BinaryMathOpcode::logicalShiftRight: kind = arch_instruction_kinds::shrM; break;
+            case BinaryMathOpcode::arithmeticShiftRight:
+                kind = arch_instruction_kinds::sarM;
+                break;
+            case BinaryMathOpcode::rotateLeft: kind = arch_instruction_kinds::rolM; break;
+            default: kind = arch_instruction_kinds::rorM;
+            }
+            auto lower = std::make_unique<ShiftMInPlaceInstruction>(kind,
+                    binaryMath->left.get(), binaryMath->right.get());
+            auto lowerResult = lower->result.set(lowerValue(binaryMath->result.get()));
+            binaryMath->result.get()->replaceAllUses(lowerResult);
+
+            binaryMath->left = nullptr;
+            binaryMath->right = nullptr;
+            it = _bb->replaceInstruction(it, std::move(lower));
+        } else if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(*it);
+                binaryMath && binaryMath->opcode >= BinaryMathOpcode::unsignedDivide
+                && binaryMath->opcode <= BinaryMathOpcode::signedRemainder) {
+            bool isSigned = binaryMath->opcode == BinaryMathOpcode::signedDivide
+                    || binaryMath->opcode == BinaryMathOpcode::signedRemainder;
+            bool remainder = binaryMath->opcode == BinaryMathOpcode::unsignedRemainder
+                    || binaryMath->opcode == BinaryMathOpcode::signedRemainder;
+            auto lower = std::make_unique<DivideMInstruction>(isSigned
+                            ? arch_instruction_kinds::idivM : arch_instruction_kinds::divM,
+                    remainder, binaryMath->left.get(), binaryMath->right.get());
+            auto lowerResult = lower->result.set(lowerValue(binaryMath->result.get()));
+            binaryMath->result.get()->replaceAllUses(lowerResult);
+
+            binaryMath->left = nullptr;
+            binaryMath->right = nullptr;
+            it = _bb->replaceInstruction(it, std::move(lower));
         } else if (auto binaryMath = hierarchy_cast<BinaryMathInstruction *>(*it); binaryMath) {
             std::unique_ptr<BinaryMRInPlaceInstruction> lower;
             if (binaryMath->opcode == BinaryMathOpcode::add) {
                 lower = std::make_unique<AddMRInstruction>();
             } else if (binaryMath->opcode == BinaryMathOpcode::bitwiseAnd) {
                 lower = std::make_unique<AndMRInstruction>();
+            } else if (binaryMath->opcode == BinaryMathOpcode::subtract) {
+                lower = std::make_unique<SubMRInstruction>();
+            } else if (binaryMath->opcode == BinaryMathOpcode::bitwiseOr) {
+                lower = std::make_unique<OrMRInstruction>();
+            } else if (binaryMath->opcode == BinaryMathOpcode::bitwiseXor) {
+                lower = std::make_unique<XorMRInstruction>();
+            } else if (binaryMath->opcode == BinaryMathOpcode::multiply) {
+                lower = std::make_unique<ImulRMInstruction>();
             } else {
                 assert(!"Unexpected binary math opcode");
             }
@@ -146,6 +269,8 @@ void LowerCodeImpl::run() {
     }else if (auto unconditional = hierarchy_cast<UnconditionalBranch *>(branch); unconditional) {
         auto lower = std::make_unique<JmpBranch>(unconditional->target);
         _bb->setBranch(std::move(lower));
+    } else if (fusedBranch) {
+        _bb->setBranch(std::move(fusedBranch));
     }else if (auto conditional = hierarchy_cast<ConditionalBranch *>(branch); conditional) {
         auto lower = std::make_unique<JnzBranch>(conditional->ifTarget, conditional->elseTarget);
 
@@ -1,15 +1,56 @@
 // Copyright the lewis authors (AUTHORS.md) 2018
 // SPDX-License-Identifier: MIT
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
+#include <unordered_set>
 #include <elf.h>
+#include <lewis/elf/utils.hpp>
+#include <lewis/statistics.hpp>
 #include <lewis/target-x86_64/mc-emitter.hpp>
 
 namespace lewis::targets::x86_64 {
 
-MachineCodeEmitter::MachineCodeEmitter(Function *fn, elf::Object *elf)
-: _fn{fn}, _elf{elf} { }
+namespace {
+    // DWARF call frame instructions.
+    enum : uint8_t {
+        cfaNop = 0x00,
+        cfaAdvanceLoc1 = 0x02,
+        cfaAdvanceLoc2 = 0x03,
+        cfaAdvanceLoc4 = 0x04,
+        cfaDefCfa = 0x0C,
+        cfaDefCfaOffset = 0x0E,
+        // The following opcodes encode their first operand in the low six bits.
+        cfaAdvanceLoc = 0x40,
+        cfaOffset = 0x80,
+        cfaRestore = 0xC0
+    };
+
+    // DWARF numbers of the x86 registers (in the order of the x86 encoding).
+    const uint8_t dwarfRegisters[16] = {0, 2, 1, 3, 7, 6, 4, 5, 8, 9, 10, 11, 12, 13, 14, 15};
+    constexpr uint8_t dwarfReturnAddress = 16;
+
+    void patch32(std::vector<uint8_t> &buffer, size_t offset, uint32_t v) {
+        memcpy(buffer.data() + offset, &v, sizeof(uint32_t));
+    }
+
+    void encodeAdvance(util::ByteEncoder &enc, size_t delta) {
+        if (delta < 0x40) {
+            encode8(enc, cfaAdvanceLoc | delta);
+        } else if (delta <= 0xFF) {
+            encode8(enc, cfaAdvanceLoc1);
+            encode8(enc, delta);
+        } else if (delta <= 0xFFFF) {
+            encode8(enc, cfaAdvanceLoc2);
+            encode16(enc, delta);
+        } else {
+            encode8(enc, cfaAdvanceLoc4);
+            encode32(enc, delta);
+        }
+    }
+}
 
 OperandSize getOperandSize(Value *v) {
     if (auto registerMode = hierarchy_cast<RegisterMode *>(v); registerMode) {
@@ -21,6 +62,42 @@ OperandSize getOperandSize(Value *v) {
     }
 }
 
+// Emits size bytes of NOPs, using the multi-byte forms recommended by Intel.
+void encodeNops(util::ByteEncoder &enc, size_t size) {
+    static const uint8_t nops[9][9] = {
+        {0x90},
+        {0x66, 0x90},
+        {0x0F, 0x1F, 0x00},
+        {0x0F, 0x1F, 0x40, 0x00},
+        {0x0F, 0x1F, 0x44, 0x00, 0x00},
+        {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+        {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+        {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+        {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00}
+    };
+    while (size) {
+        auto chunk = std::min(size, size_t{9});
+        for (size_t i = 0; i < chunk; i++)
+            encode8(enc, nops[chunk - 1][i]);
+        size -= chunk;
+    }
+}
+
+// Byte and word values only define the low bits of their registers. Most arithmetic
+// on them can be done in 32 bits, which avoids partial register writes and prefixes.
+OperandSize widenedSize(OperandSize os) {
+    if (os == OperandSize::byte || os == OperandSize::word)
+        return OperandSize::dword;
+    return os;
+}
+
+// Most instructions encode their byte form by clearing the low bit of the opcode.
+uint8_t sizedOpcode(OperandSize os, uint8_t opcode) {
+    if (os == OperandSize::byte)
+        return opcode & ~1;
+    return opcode;
+}
+
 int getRegister(Value *v) {
     if (auto registerMode = hierarchy_cast<RegisterMode *>(v); registerMode) {
         return registerMode->modeRegister;
@@ -38,6 +115,13 @@ void encodeRawRex(util::ByteEncoder &enc, OperandSize os, int r, int x, int b) {
         encode8(enc, 0x40 | (w << 3) | (r << 2) | (x << 1) | b);
 }
 
+// Variant of encodeRawRex() for instructions whose M operand is a byte register.
+// SPL, BPL, SIL and DIL can only be encoded with a REX prefix (otherwise, they mean AH etc.).
+void encodeByteRegisterRex(util::ByteEncoder &enc, int r, int b) {
+    if (r >= 8 || b >= 4)
+        encode8(enc, 0x40 | ((r >= 8) << 2) | (b >= 8));
+}
+
 // mod: Value of the 'mod' field.
 // m: Value of the 'M' field.
 // x: Value of the 'R' field (also used as extra bit for the opcode).
@@ -67,6 +151,13 @@ struct ModRmEncoding {
         auto os = getOperandSize(_mv);
         if (_rv)
             assert(os == getOperandSize(_rv));
+        encodeRex(enc, os);
+    }
+
+    // Emits the prefixes for an operation of size os (regardless of the operand sizes).
+    void encodeRex(util::ByteEncoder &enc, OperandSize os) {
+        if (os == OperandSize::word)
+            encode8(enc, 0x66);
 
         int b;
         if (auto registerMode = hierarchy_cast<RegisterMode *>(_mv); registerMode) {
@@ -80,7 +171,19 @@ struct ModRmEncoding {
             abort();
         }
 
-        encodeRawRex(enc, os, _x() >= 8, 0, b);
+        // SPL, BPL, SIL and DIL can only be encoded with a REX prefix.
+        auto isHighByteRegister = [] (Value *v) {
+            auto registerMode = hierarchy_cast<RegisterMode *>(v);
+            return registerMode && registerMode->modeRegister >= 4
+                    && registerMode->modeRegister < 8;
+        };
+        int r = _x() >= 8;
+        if (os == OperandSize::byte && !r && !b
+                && (isHighByteRegister(_mv) || (_rv && isHighByteRegister(_rv)))) {
+            encode8(enc, 0x40);
+        } else {
+            encodeRawRex(enc, os, r, 0, b);
+        }
     }
 
     void encodeModRmSib(util::ByteEncoder &enc) {
@@ -127,54 +230,105 @@ private:
     int _xop;
 };
 
-void MachineCodeEmitter::run() {
-    auto textString = _elf->addString(std::make_unique<elf::String>(".text"));
-    auto gotString = _elf->addString(std::make_unique<elf::String>(".got"));
-    auto pltString = _elf->addString(std::make_unique<elf::String>(".plt"));
-    auto symbolString = _elf->addString(std::make_unique<elf::String>(_fn->name));
+MachineCodeEncoder::MachineCodeEncoder(Function *fn)
+: _fn{fn} { }
 
-    auto textSection = _elf->insertFragment(std::make_unique<elf::ByteSection>());
-    textSection->name = textString;
-    textSection->type = SHT_PROGBITS;
-    textSection->flags = SHF_ALLOC | SHF_EXECINSTR;
+void MachineCodeEncoder::run() {
+    TraceScope scope{"x86_64", "encode"};
+    code.name = _fn->name;
 
-    auto symbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
-    symbol->name = symbolString;
-    symbol->section = textSection;
+    size_t i = 0;
+    for (auto bb : _fn->blocks())
+        _bbIndices.insert({bb, i++});
+
+    // Only the entry block has a prologue (see AllocateRegistersPass).
+    // It determines the frame in the remaining blocks.
+    _bodyFrame = UnwindRow{};
+    for (auto bb : _fn->blocks()) {
+        for (auto inst : bb->instructions()) {
+            if (auto pushSave = hierarchy_cast<PushSaveInstruction *>(inst); pushSave) {
+                _bodyFrame.cfaOffset += 8;
+                _bodyFrame.savedRegisters.push_back({pushSave->operandRegister,
+                        -_bodyFrame.cfaOffset});
+            } else if (auto decrementStack = hierarchy_cast<DecrementStackInstruction *>(inst);
+                    decrementStack) {
+                _bodyFrame.cfaOffset += decrementStack->value;
+            } else {
+                break;
+            }
+        }
+        break;
+    }
 
-    _gotSection = _elf->insertFragment(std::make_unique<elf::ByteSection>());
-    _gotSection->name = gotString;
-    _gotSection->type = SHT_PROGBITS;
-    _gotSection->flags = SHF_ALLOC;
+    // Loop headers are BasicBlocks that are the target of a backward jump.
+    // Note that we never fall through to the next BasicBlock, so the padding in front of
+    // loop headers is never executed.
+    std::unordered_set<BasicBlock *> loopHeaders;
+    if (loopAlignment > 1) {
+        assert(!(loopAlignment & (loopAlignment - 1)));
+        auto checkEdge = [&] (BasicBlock *source, BasicBlock *target) {
+            if (_bbIndices.at(target) <= _bbIndices.at(source))
+                loopHeaders.insert(target);
+        };
+        for (auto bb : _fn->blocks()) {
+            auto branch = bb->branch();
+            if (auto jmp = hierarchy_cast<JmpBranch *>(branch); jmp) {
+                checkEdge(bb, jmp->target);
+            } else if (auto jnz = hierarchy_cast<JnzBranch *>(branch); jnz) {
+                checkEdge(bb, jnz->ifTarget);
+                checkEdge(bb, jnz->elseTarget);
+            } else if (auto jcc = hierarchy_cast<JccBranch *>(branch); jcc) {
+                checkEdge(bb, jcc->ifTarget);
+                checkEdge(bb, jcc->elseTarget);
+            }
+        }
+    }
 
-    _pltSection = _elf->insertFragment(std::make_unique<elf::ByteSection>());
-    _pltSection->name = pltString;
-    _pltSection->type = SHT_PROGBITS;
-    _pltSection->flags = SHF_ALLOC | SHF_EXECINSTR;
+    _currentFrame = UnwindRow{};
+    code.unwindRows.push_back(_currentFrame);
 
-    // Generate a symbol for each basic block.
-    size_t i = 0;
     for (auto bb : _fn->blocks()) {
-        auto bbString = _elf->addString(std::make_unique<elf::String>(_fn->name
-                + ".bb" + std::to_string(i)));
-        auto bbSymbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
-        bbSymbol->name = bbString;
-        bbSymbol->section = textSection;
-        _bbSymbols.insert({bb, bbSymbol});
-        i++;
+        if (loopHeaders.count(bb)) {
+            util::ByteEncoder text{&code.text};
+            auto padding = (loopAlignment - (code.text.size() & (loopAlignment - 1)))
+                    & (loopAlignment - 1);
+            encodeNops(text, padding);
+            code.alignment = std::max(code.alignment, loopAlignment);
+        }
+        code.blockOffsets.push_back(code.text.size());
+        if (code.blockOffsets.size() > 1)
+            _updateFrame(_bodyFrame);
+        _emitBlock(bb);
     }
+}
 
-    for (auto bb : _fn->blocks()) {
-        auto bbSymbol = _bbSymbols.at(bb);
-        bbSymbol->value = textSection->buffer.size();
-        _emitBlock(bb, textSection);
+// Records that the frame changes to row at the current end of the code.
+void MachineCodeEncoder::_updateFrame(UnwindRow row) {
+    row.offset = code.text.size();
+    _currentFrame = row;
+
+    auto &last = code.unwindRows.back();
+    if (last.cfaOffset == row.cfaOffset && last.savedRegisters == row.savedRegisters)
+        return;
+    if (last.offset == row.offset) {
+        last = std::move(row);
+    } else {
+        code.unwindRows.push_back(std::move(row));
     }
 }
 
-void MachineCodeEmitter::_emitBlock(BasicBlock *bb, elf::ByteSection *textSection) {
-    util::ByteEncoder text{&textSection->buffer};
-    util::ByteEncoder got{&_gotSection->buffer};
-    util::ByteEncoder plt{&_pltSection->buffer};
+void MachineCodeEncoder::_emitBlock(BasicBlock *bb) {
+    util::ByteEncoder text{&code.text};
+
+    // Helper function to emit a 32-bit displacement that is relocated to a BasicBlock.
+    auto encodeBlockDisplacement = [&] (BasicBlock *target) {
+        CodeRelocation relocation;
+        relocation.kind = CodeRelocationKind::block;
+        relocation.offset = text.offset();
+        relocation.block = _bbIndices.at(target);
+        code.relocations.push_back(std::move(relocation));
+        encode32(text, 0);
+    };
 
     for (auto inst : bb->instructions()) {
         if (auto nop = hierarchy_cast<NopInstruction *>(inst); nop) {
@@ -190,6 +344,11 @@ void MachineCodeEmitter::_emitBlock(BasicBlock *bb, elf::ByteSection *textSectio
                 encode8(text, 0xFF);
                 encodeRawModRm(text, 3, pushSave->operandRegister & 7, 6);
             }
+
+            auto frame = _currentFrame;
+            frame.cfaOffset += 8;
+            frame.savedRegisters.push_back({pushSave->operandRegister, -frame.cfaOffset});
+            _updateFrame(std::move(frame));
         } else if (auto popRestore = hierarchy_cast<PopRestoreInstruction *>(inst); popRestore) {
             assert(popRestore->operandRegister >= 0);
             if (popRestore->operandRegister < 8) {
@@ -199,6 +358,14 @@ void MachineCodeEmitter::_emitBlock(BasicBlock *bb, elf::ByteSection *textSectio
                 encode8(text, 0x8F);
                 encodeRawModRm(text, 3, popRestore->operandRegister & 7, 0);
             }
+
+            auto frame = _currentFrame;
+            frame.cfaOffset -= 8;
+            auto &saved = frame.savedRegisters;
+            saved.erase(std::remove_if(saved.begin(), saved.end(), [&] (auto &entry) {
+                return entry.first == popRestore->operandRegister;
+            }), saved.end());
+            _updateFrame(std::move(frame));
         } else if (auto decrementStack = hierarchy_cast<DecrementStackInstruction *>(inst);
                 decrementStack) {
             assert(decrementStack->value >= 0 && decrementStack->value <= 127);
@@ -206,6 +373,10 @@ void MachineCodeEmitter::_emitBlock(BasicBlock *bb, elf::ByteSection *textSectio
             encode8(text, 0x83);
             encodeRawModRm(text, 3, 4, 5);
             encode8(text, decrementStack->value);
+
+            auto frame = _currentFrame;
+            frame.cfaOffset += decrementStack->value;
+            _updateFrame(std::move(frame));
         } else if (auto incrementStack = hierarchy_cast<IncrementStackInstruction *>(inst);
                 incrementStack) {
             assert(incrementStack->value >= 0 && incrementStack->value <= 127);
@@ -213,97 +384,221 @@ void MachineCodeEmitter::_emitBlock(BasicBlock *bb, elf::ByteSection *textSectio
             encode8(text, 0x83);
             encodeRawModRm(text, 3, 4, 0);
             encode8(text, incrementStack->value);
+
+            auto frame = _currentFrame;
+            frame.cfaOffset -= incrementStack->value;
+            _updateFrame(std::move(frame));
         } else if (auto movMC = hierarchy_cast<MovMCInstruction *>(inst); movMC) {
+            // The 32-bit form zero-extends; larger constants need the 64-bit immediate.
             auto rr = getRegister(movMC->result.get());
             assert(rr >= 0);
-            if (rr < 8) {
-                encode8(text, 0xB8 + rr);
+            if (getOperandSize(movMC->result.get()) == OperandSize::qword
+                    && movMC->value > 0xFFFFFFFF) {
+                encodeRawRex(text, OperandSize::qword, 0, 0, rr >= 8);
+                encode8(text, 0xB8 + (rr & 7));
+                encode64(text, movMC->value);
             } else {
-                ModRmEncoding modRm{movMC->result.get(), 0};
-                modRm.encodeRex(text);
-                encode8(text, 0xC7);
-                modRm.encodeModRmSib(text);
+                encodeRawRex(text, OperandSize::dword, 0, 0, rr >= 8);
+                encode8(text, 0xB8 + (rr & 7));
+                encode32(text, movMC->value);
             }
-            encode32(text, movMC->value);
+        } else if (auto xorZero = hierarchy_cast<XorZeroInstruction *>(inst); xorZero) {
+            // The 32-bit form also clears the upper half of the register.
+            auto rr = getRegister(xorZero->result.get());
+            assert(rr >= 0);
+            encodeRawRex(text, OperandSize::dword, rr >= 8, 0, rr >= 8);
+            encode8(text, 0x31);
+            encodeRawModRm(text, 3, rr & 7, rr & 7);
         } else if (auto movMR = hierarchy_cast<MovMRInstruction *>(inst); movMR) {
+            // Register moves copy at least 32 bits. This also implements truncation.
+            auto os = getOperandSize(movMR->result.get());
+            assert(hierarchy_cast<RegisterMode *>(movMR->result.get()));
             ModRmEncoding modRm{movMR->result.get(), movMR->operand.get()};
-            modRm.encodeRex(text);
+            modRm.encodeRex(text, os == OperandSize::qword ? os : OperandSize::dword);
             encode8(text, 0x89);
             modRm.encodeModRmSib(text);
         } else if (auto movRM = hierarchy_cast<MovRMInstruction *>(inst); movRM) {
+            // Byte and word loads use movzx to avoid partial register writes.
+            auto os = getOperandSize(movRM->operand.get());
             ModRmEncoding modRm{movRM->operand.get(), movRM->result.get()};
-            modRm.encodeRex(text);
-            encode8(text, 0x8B);
+            if (os == OperandSize::byte || os == OperandSize::word) {
+                modRm.encodeRex(text, OperandSize::dword);
+                encode8(text, 0x0F);
+                encode8(text, os == OperandSize::byte ? 0xB6 : 0xB7);
+            } else {
+                modRm.encodeRex(text);
+                encode8(text, 0x8B);
+            }
+            modRm.encodeModRmSib(text);
+        } else if (auto movzxRM = hierarchy_cast<MovzxRMInstruction *>(inst); movzxRM) {
+            // Writing the 32-bit register clears the upper half.
+            auto os = getOperandSize(movzxRM->operand.get());
+            ModRmEncoding modRm{movzxRM->operand.get(), movzxRM->result.get()};
+            if (os == OperandSize::byte || os == OperandSize::word) {
+                modRm.encodeRex(text, os == OperandSize::byte ? os : OperandSize::dword);
+                encode8(text, 0x0F);
+                encode8(text, os == OperandSize::byte ? 0xB6 : 0xB7);
+            } else {
+                assert(os == OperandSize::dword);
+                modRm.encodeRex(text, OperandSize::dword);
+                encode8(text, 0x8B);
+            }
+            modRm.encodeModRmSib(text);
+        } else if (auto movsxRM = hierarchy_cast<MovsxRMInstruction *>(inst); movsxRM) {
+            auto os = getOperandSize(movsxRM->operand.get());
+            auto resultSize = getOperandSize(movsxRM->result.get()) == OperandSize::qword
+                    ? OperandSize::qword : OperandSize::dword;
+            ModRmEncoding modRm{movsxRM->operand.get(), movsxRM->result.get()};
+            if (os == OperandSize::byte || os == OperandSize::word) {
+                modRm.encodeRex(text, (os == OperandSize::byte && resultSize != OperandSize::qword)
+                        ? os : resultSize);
+                encode8(text, 0x0F);
+                encode8(text, os == OperandSize::byte ? 0xBE : 0xBF);
+            } else {
+                assert(os == OperandSize::dword && resultSize == OperandSize::qword);
+                modRm.encodeRex(text, OperandSize::qword);
+                encode8(text, 0x63);
+            }
             modRm.encodeModRmSib(text);
         } else if (auto xchgMR = hierarchy_cast<XchgMRInstruction *>(inst); xchgMR) {
+            // Exchange at least 32 bits, such that the operands may differ in size.
+            auto os = getOperandSize(xchgMR->firstResult.get());
+            if (getOperandSize(xchgMR->secondResult.get()) == OperandSize::qword)
+                os = OperandSize::qword;
             ModRmEncoding modRm{xchgMR->firstResult.get(), xchgMR->secondResult.get()};
-            modRm.encodeRex(text);
+            modRm.encodeRex(text, widenedSize(os));
             encode8(text, 0x87);
             modRm.encodeModRmSib(text);
-        } else if (auto negM = hierarchy_cast<NegMInstruction *>(inst); negM) {
-            ModRmEncoding modRm{negM->result.get(), 3};
-            modRm.encodeRex(text);
+        } else if (auto unaryMInPlace = hierarchy_cast<UnaryMInPlaceInstruction *>(inst);
+                unaryMInPlace) {
+            auto os = widenedSize(getOperandSize(unaryMInPlace->result.get()));
+            ModRmEncoding modRm{unaryMInPlace->result.get(),
+                    unaryMInPlace->kind == arch_instruction_kinds::negM ? 3 : 2};
+            modRm.encodeRex(text, os);
             encode8(text, 0xF7);
             modRm.encodeModRmSib(text);
-        } else if (auto addMR = hierarchy_cast<AddMRInstruction *>(inst); addMR) {
-            ModRmEncoding modRm{addMR->result.get(), addMR->secondary.get()};
-            modRm.encodeRex(text);
-            encode8(text, 0x01);
+        } else if (auto imulRM = hierarchy_cast<ImulRMInstruction *>(inst); imulRM) {
+            auto os = widenedSize(getOperandSize(imulRM->result.get()));
+            ModRmEncoding modRm{imulRM->secondary.get(), imulRM->result.get()};
+            modRm.encodeRex(text, os);
+            encode8(text, 0x0F);
+            encode8(text, 0xAF);
+            modRm.encodeModRmSib(text);
+        } else if (auto binaryMRInPlace = hierarchy_cast<BinaryMRInPlaceInstruction *>(inst);
+                binaryMRInPlace) {
+            uint8_t opcode;
+            switch (binaryMRInPlace->kind) {
+            case arch_instruction_kinds::addMR: opcode = 0x01; break;
+            case arch_instruction_kinds::orMR: opcode = 0x09; break;
+            case arch_instruction_kinds::andMR: opcode = 0x21; break;
+            case arch_instruction_kinds::subMR: opcode = 0x29; break;
+            case arch_instruction_kinds::xorMR: opcode = 0x31; break;
+            default:
+                assert(!"Unexpected BinaryMRInPlaceInstruction");
+                abort();
+            }
+            auto os = widenedSize(getOperandSize(binaryMRInPlace->result.get()));
+            ModRmEncoding modRm{binaryMRInPlace->result.get(),
+                    binaryMRInPlace->secondary.get()};
+            modRm.encodeRex(text, os);
+            encode8(text, opcode);
+            modRm.encodeModRmSib(text);
+        } else if (auto shift = hierarchy_cast<ShiftMInPlaceInstruction *>(inst); shift) {
+            // Right shifts and rotates depend on the upper bits, so we use the exact size.
+            assert(getRegister(shift->count.get()) == 1);
+            int xop;
+            switch (shift->kind) {
+            case arch_instruction_kinds::rolM: xop = 0; break;
+            case arch_instruction_kinds::rorM: xop = 1; break;
+            case arch_instruction_kinds::shlM: xop = 4; break;
+            case arch_instruction_kinds::shrM: xop = 5; break;
+            case arch_instruction_kinds::sarM: xop = 7; break;
+            default:
+                assert(!"Unexpected ShiftMInPlaceInstruction");
+                abort();
+            }
+            auto os = getOperandSize(shift->result.get());
+            ModRmEncoding modRm{shift->result.get(), xop};
+            modRm.encodeRex(text, os);
+            encode8(text, sizedOpcode(os, 0xD3));
+            modRm.encodeModRmSib(text);
+        } else if (auto divide = hierarchy_cast<DivideMInstruction *>(inst); divide) {
+            // Byte and word operands are extended to 32 bits first. This avoids the
+            // special case of 8-bit division that returns the remainder in AH.
+            bool isSigned = divide->kind == arch_instruction_kinds::idivM;
+            auto os = getOperandSize(divide->divisor.get());
+            assert(getRegister(divide->dividend.get()) == 0);
+            assert(getRegister(divide->divisor.get()) != 0
+                    && getRegister(divide->divisor.get()) != 2);
+            if (os == OperandSize::byte || os == OperandSize::word) {
+                for (auto v : {divide->dividend.get(), divide->divisor.get()}) {
+                    ModRmEncoding modRm{v, v};
+                    modRm.encodeRex(text, os == OperandSize::byte ? os : OperandSize::dword);
+                    encode8(text, 0x0F);
+                    encode8(text, (isSigned ? 0xBE : 0xB6) | (os == OperandSize::word));
+                    modRm.encodeModRmSib(text);
+                }
+                os = OperandSize::dword;
+            }
+
+            if (isSigned) {
+                // cdq or cqo.
+                encodeRawRex(text, os, 0, 0, 0);
+                encode8(text, 0x99);
+            } else {
+                encode8(text, 0x31);
+                encodeRawModRm(text, 3, 2, 2);
+            }
+
+            ModRmEncoding modRm{divide->divisor.get(), isSigned ? 7 : 6};
+            modRm.encodeRex(text, os);
+            encode8(text, 0xF7);
             modRm.encodeModRmSib(text);
-        } else if (auto andMR = hierarchy_cast<AndMRInstruction *>(inst); andMR) {
-            ModRmEncoding modRm{andMR->result.get(), andMR->secondary.get()};
+        } else if (auto lea = hierarchy_cast<LeaBaseIndexInstruction *>(inst); lea) {
+            auto rr = getRegister(lea->result.get());
+            auto base = getRegister(lea->base.get());
+            auto index = getRegister(lea->index.get());
+            assert(rr >= 0 && base >= 0 && index >= 0);
+            assert(index != 4 && "RSP cannot be used as an index");
+            encodeRawRex(text, getOperandSize(lea->result.get()), rr >= 8, index >= 8, base >= 8);
+            encode8(text, 0x8D);
+            // RBP/R13 as base require a displacement.
+            if ((base & 7) == 5) {
+                encodeRawModRm(text, 1, 4, rr & 7);
+                encodeRawSib(text, base & 7, index & 7, 0);
+                encode8(text, 0);
+            } else {
+                encodeRawModRm(text, 0, 4, rr & 7);
+                encodeRawSib(text, base & 7, index & 7, 0);
+            }
+        } else if (auto cmpSetcc = hierarchy_cast<CmpSetccInstruction *>(inst); cmpSetcc) {
+            auto os = getOperandSize(cmpSetcc->primary.get());
+            ModRmEncoding modRm{cmpSetcc->primary.get(), cmpSetcc->secondary.get()};
             modRm.encodeRex(text);
-            encode8(text, 0x21);
+            encode8(text, sizedOpcode(os, 0x39));
             modRm.encodeModRmSib(text);
-        }else if (auto call = hierarchy_cast<CallInstruction *>(inst); call) {
-            auto string = _elf->addString(std::make_unique<elf::String>(call->function));
-            auto symbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
-            symbol->name = string;
-
-            // Add a GOT entry for the function.
-            // TODO: Create the "special" GOT entries.
-            // TODO: Move GOT creation into the InternalLinkPass.
-            auto gotString = _elf->addString(std::make_unique<elf::String>(call->function + "@got"));
-            auto gotSymbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
-            gotSymbol->name = gotString;
-            gotSymbol->section = _gotSection;
-            gotSymbol->value = got.offset();
-
-            auto jumpSlot = _elf->addRelocation(std::make_unique<elf::Relocation>());
-            jumpSlot->section = _gotSection;
-            jumpSlot->offset = got.offset();
-            jumpSlot->symbol = symbol;
-            encode64(got, 0);
-
-            // Add a PLT stub for the entry.
-            // TODO: Create the PLT header (and correct entries) for dynamic binding.
-            // TODO: Properly align PLT entries as in the ABI supplement.
-            // TODO: Move PLT creation into the InternalLinkPass.
-            auto pltString = _elf->addString(std::make_unique<elf::String>(call->function + "@plt"));
-            auto pltSymbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
-            pltSymbol->name = pltString;
-            pltSymbol->section = _pltSection;
-            pltSymbol->value = plt.offset();
-
-            auto jumpThroughGot = _elf->addInternalRelocation(std::make_unique<elf::Relocation>());
-            jumpThroughGot->section = _pltSection;
-            jumpThroughGot->offset = plt.offset() + 2;
-            jumpThroughGot->symbol = gotSymbol;
-            jumpThroughGot->addend = -4;
-
-            encode8(plt, 0xFF);
-            encode8(plt, 0x25); // TODO: Use encodeRawModRm().
-            encode32(plt, 0);
-
-            // Add the actual jump to the .text section.
-            auto jumpToPlt = _elf->addInternalRelocation(std::make_unique<elf::Relocation>());
-            jumpToPlt->section = textSection;
-            jumpToPlt->offset = text.offset() + 1;
-            jumpToPlt->symbol = pltSymbol;
-            jumpToPlt->addend = -4;
 
+            // setcc only writes the low byte; movzx clears the rest of the register.
+            auto rr = getRegister(cmpSetcc->result.get());
+            assert(rr >= 0);
+            encodeByteRegisterRex(text, 0, rr);
+            encode8(text, 0x0F);
+            encode8(text, 0x90 | static_cast<uint8_t>(cmpSetcc->code));
+            encodeRawModRm(text, 3, rr & 7, 0);
+
+            encodeByteRegisterRex(text, rr, rr);
+            encode8(text, 0x0F);
+            encode8(text, 0xB6);
+            encodeRawModRm(text, 3, rr & 7, rr & 7);
+        }else if (auto call = hierarchy_cast<CallInstruction *>(inst); call) {
             encode8(text, 0xE8);
-            encode32(text, 0); // Relocation points here.
+
+            CodeRelocation relocation;
+            relocation.kind = CodeRelocationKind::call;
+            relocation.offset = text.offset();
+            relocation.function = call->function;
+            code.relocations.push_back(std::move(relocation));
+            encode32(text, 0);
         } else {
             assert(!"Unexpected x86_64 IR instruction");
         }
@@ -313,41 +608,447 @@ void MachineCodeEmitter::_emitBlock(BasicBlock *bb, elf::ByteSection *textSectio
     if (auto ret = hierarchy_cast<RetBranch *>(branch); ret) {
         encode8(text, 0xC3);
     } else if (auto jmp = hierarchy_cast<JmpBranch *>(branch); jmp) {
-        auto jump = _elf->addInternalRelocation(std::make_unique<elf::Relocation>());
-        jump->section = textSection;
-        jump->offset = text.offset() + 1;
-        jump->symbol = _bbSymbols.at(jmp->target);
-        jump->addend = -4;
-
         encode8(text, 0xE9);
-        encode32(text, 0);
+        encodeBlockDisplacement(jmp->target);
     } else if (auto jnz = hierarchy_cast<JnzBranch *>(branch); jnz) {
-        ModRmEncoding modRm{jnz->operand.get(), jnz->operand.get()};
-        modRm.encodeRex(text);
-        encode8(text, 0x85);
-        modRm.encodeModRmSib(text);
-
-        auto ifJump = _elf->addInternalRelocation(std::make_unique<elf::Relocation>());
-        ifJump->section = textSection;
-        ifJump->offset = text.offset() + 2;
-        ifJump->symbol = _bbSymbols.at(jnz->ifTarget);
-        ifJump->addend = -4;
+        if (!jnz->reuseFlags) {
+            auto os = getOperandSize(jnz->operand.get());
+            ModRmEncoding modRm{jnz->operand.get(), jnz->operand.get()};
+            modRm.encodeRex(text);
+            encode8(text, sizedOpcode(os, 0x85));
+            modRm.encodeModRmSib(text);
+        }
 
         encode8(text, 0x0F);
         encode8(text, 0x85);
-        encode32(text, 0);
+        encodeBlockDisplacement(jnz->ifTarget);
 
-        auto elseJump = _elf->addInternalRelocation(std::make_unique<elf::Relocation>());
-        elseJump->section = textSection;
-        elseJump->offset = text.offset() + 1;
-        elseJump->symbol = _bbSymbols.at(jnz->elseTarget);
-        elseJump->addend = -4;
+        encode8(text, 0xE9);
+        encodeBlockDisplacement(jnz->elseTarget);
+    } else if (auto jcc = hierarchy_cast<JccBranch *>(branch); jcc) {
+        // Keep the cmp directly in front of the jcc, such that the CPU can fuse them.
+        auto os = getOperandSize(jcc->left.get());
+        ModRmEncoding modRm{jcc->left.get(), jcc->right.get()};
+        modRm.encodeRex(text);
+        encode8(text, sizedOpcode(os, 0x39));
+        modRm.encodeModRmSib(text);
+
+        encode8(text, 0x0F);
+        encode8(text, 0x80 | static_cast<uint8_t>(jcc->code));
+        encodeBlockDisplacement(jcc->ifTarget);
 
         encode8(text, 0xE9);
-        encode32(text, 0);
+        encodeBlockDisplacement(jcc->elseTarget);
     } else {
         assert(!"Unexpected x86_64 IR branch");
     }
 }
 
+MachineCodeEmitter::MachineCodeEmitter(elf::Object *elf)
+: _elf{elf} { }
+
+void MachineCodeEmitter::emit(Function *fn) {
+    MachineCodeEncoder encoder{fn};
+    encoder.run();
+    emit(&encoder.code);
+}
+
+void MachineCodeEmitter::emit(Module *mod) {
+    for (auto fn : mod->functions())
+        emit(fn);
+}
+
+void MachineCodeEmitter::emit(const FunctionCode *code) {
+    if (!_textSection)
+        _createSections();
+
+    // Drop the reserve; it is appended again after the function.
+    auto &text = _textSection->buffer;
+    text.resize(_textUsed);
+
+    // Pad the previous function with int3 instructions.
+    auto alignment = std::max(functionAlignment, code->alignment);
+    _textSection->alignment = std::max(_textSection->alignment, alignment);
+    while (text.size() & (alignment - 1))
+        text.push_back(0xCC);
+    auto base = text.size();
+    text.insert(text.end(), code->text.begin(), code->text.end());
+    text.resize(base + _withSlack(code->text.size()), 0xCC);
+    _textUsed = text.size();
+    text.resize(_textUsed + textReserve, 0xCC);
+
+    bool relocatable = _elf->fileType == elf::FileType::relocatable;
+
+    // In relocatable files, earlier calls might already refer to the (undefined) symbol.
+    elf::Symbol *symbol;
+    if (auto it = _functionSymbols.find(code->name); relocatable && it != _functionSymbols.end()) {
+        symbol = it->second;
+        assert(!symbol->section && "Function is defined twice");
+    } else {
+        symbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
+        symbol->name = _elf->internString(code->name);
+        if (relocatable)
+            _functionSymbols.insert({code->name, symbol});
+    }
+    symbol->section = _textSection;
+    symbol->value = base;
+    symbol->size = code->text.size();
+
+    auto &function = _emittedFunctions[code->name];
+    assert(!function.symbol && "Function is defined twice");
+    function.symbol = symbol;
+    function.capacity = _textUsed - base;
+    _emitFrameDescription(code, &function);
+
+    // Generate a symbol for each basic block.
+    for (size_t i = 0; i < code->blockOffsets.size(); i++) {
+        auto bbString = _elf->internString(code->name + ".bb" + std::to_string(i));
+        auto bbSymbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
+        bbSymbol->name = bbString;
+        bbSymbol->section = _textSection;
+        bbSymbol->value = base + code->blockOffsets[i];
+        bbSymbol->local = relocatable;
+        function.blockSymbols.push_back(bbSymbol);
+    }
+
+    for (auto &relocation : code->relocations) {
+        auto jump = _elf->addInternalRelocation(std::make_unique<elf::Relocation>());
+        jump->section = _textSection;
+        _setupRelocation(jump, code, relocation, base, &function);
+        function.relocations.push_back(jump);
+    }
+}
+
+bool MachineCodeEmitter::replace(const FunctionCode *code) {
+    assert(_elf->fileType == elf::FileType::sharedObject);
+    auto it = _emittedFunctions.find(code->name);
+    assert(it != _emittedFunctions.end() && "Function was never emitted");
+    auto &function = it->second;
+    auto symbol = function.symbol;
+    auto &text = _textSection->buffer;
+
+    for (auto &relocation : code->relocations) {
+        if (relocation.kind == CodeRelocationKind::call
+                && !_pltSymbols.count(relocation.function))
+            return false;
+    }
+
+    // The alignment of .text is already fixed.
+    auto alignment = std::max(functionAlignment, code->alignment);
+    if (alignment > _textSection->alignment)
+        return false;
+
+    // Try to keep the function in place. Otherwise, move it to the reserve.
+    auto base = symbol->value;
+    auto capacity = function.capacity;
+    bool moved = false;
+    if (code->text.size() > capacity || (base & (alignment - 1))) {
+        base = (_textUsed + alignment - 1) & ~(alignment - 1);
+        if (base + code->text.size() > text.size())
+            return false;
+        capacity = std::min(_withSlack(code->text.size()), text.size() - base);
+        moved = true;
+    }
+
+    // FDEs always stay in place.
+    auto fde = _encodeFrameDescription(code, function.fdeOffset, function.fdeCapacity);
+    if (fde.size() > function.fdeCapacity)
+        return false;
+
+    if (moved) {
+        std::fill(text.begin() + symbol->value,
+                text.begin() + symbol->value + function.capacity, 0xCC);
+        _elf->modifiedRanges.push_back({_textSection, symbol->value, function.capacity});
+        _textUsed = base + capacity;
+        function.capacity = capacity;
+        symbol->value = base;
+
+        // Relocations that refer to the function (e.g. from .eh_frame) need to be applied
+        // again. .eh_frame_hdr is sorted by address; it is rewritten completely.
+        symbol->forEachUse([&] (elf::Relocation *use) {
+            _elf->staleRelocations.push_back(use);
+        });
+        if (_ehFrameHeader)
+            _elf->modifiedRanges.push_back({_ehFrameHeader, 0,
+                    _ehFrameHeader->computedSize.value()});
+    }
+    std::copy(code->text.begin(), code->text.end(), text.begin() + base);
+    std::fill(text.begin() + base + code->text.size(), text.begin() + base + capacity, 0xCC);
+    _elf->modifiedRanges.push_back({_textSection, base, capacity});
+    symbol->size = code->text.size();
+    _elf->modifiedSymbols.push_back(symbol);
+
+    // Keep the (already relocated) PC begin field unless the function moved.
+    auto &ehFrame = _ehFrameSection->buffer;
+    if (!moved)
+        memcpy(fde.data() + 8, ehFrame.data() + function.fdeOffset + 8, 4);
+    std::copy(fde.begin(), fde.end(), ehFrame.begin() + function.fdeOffset);
+    _elf->modifiedRanges.push_back({_ehFrameSection, function.fdeOffset, fde.size()});
+
+    // Blocks that exceed the existing symbols are addressed relative to the function;
+    // symbols of blocks that no longer exist alias the entry point.
+    for (size_t i = 0; i < function.blockSymbols.size(); i++) {
+        auto bbSymbol = function.blockSymbols[i];
+        if (i < code->blockOffsets.size()) {
+            bbSymbol->value = base + code->blockOffsets[i];
+        } else {
+            bbSymbol->value = base;
+        }
+        _elf->modifiedSymbols.push_back(bbSymbol);
+        bbSymbol->forEachUse([&] (elf::Relocation *use) {
+            _elf->staleRelocations.push_back(use);
+        });
+    }
+
+    // Reuse the existing Relocation objects where possible.
+    for (size_t i = 0; i < code->relocations.size(); i++) {
+        if (i == function.relocations.size()) {
+            auto jump = _elf->addInternalRelocation(std::make_unique<elf::Relocation>());
+            jump->section = _textSection;
+            function.relocations.push_back(jump);
+        }
+        _setupRelocation(function.relocations[i], code, code->relocations[i], base,
+                &function);
+        _elf->staleRelocations.push_back(function.relocations[i]);
+    }
+    while (function.relocations.size() > code->relocations.size()) {
+        _elf->eraseInternalRelocation(function.relocations.back());
+        function.relocations.pop_back();
+    }
+    countStatistic("mc-emitter", "replaced-functions");
+    if (moved)
+        countStatistic("mc-emitter", "moved-functions");
+    return true;
+}
+
+size_t MachineCodeEmitter::_withSlack(size_t size) {
+    return size + (size * functionSlack + 99) / 100;
+}
+
+void MachineCodeEmitter::_setupRelocation(elf::Relocation *relocation,
+        const FunctionCode *code, const CodeRelocation &source, size_t base,
+        EmittedFunction *function) {
+    relocation->offset = base + source.offset;
+    relocation->addend = -4;
+    if (source.kind == CodeRelocationKind::block) {
+        relocation->type = R_X86_64_PC32;
+        if (source.block < function->blockSymbols.size()) {
+            relocation->symbol = function->blockSymbols[source.block];
+        } else {
+            relocation->symbol = function->symbol;
+            relocation->addend = ptrdiff_t(code->blockOffsets.at(source.block)) - 4;
+        }
+    } else if (source.kind == CodeRelocationKind::call) {
+        relocation->type = R_X86_64_PLT32;
+        relocation->symbol = _getCallTarget(source.function);
+    } else {
+        assert(!"Unexpected CodeRelocationKind");
+    }
+}
+
+// Encodes the FDE of a function that starts at fdeOffset of .eh_frame. The PC begin field
+// is left as zero. The FDE is padded to a multiple of 8 bytes and to at least minSize bytes.
+std::vector<uint8_t> MachineCodeEmitter::_encodeFrameDescription(const FunctionCode *code,
+        size_t fdeOffset, size_t minSize) {
+    std::vector<uint8_t> buffer;
+    util::ByteEncoder eh{&buffer};
+
+    encode32(eh, 0); // Length (patched below).
+    encode32(eh, fdeOffset + 4); // Distance to the CIE at offset zero.
+    encode32(eh, 0); // PC begin.
+    encode32(eh, code->text.size()); // PC range.
+    encodeUleb128(eh, 0); // Augmentation data length.
+
+    // The initial row matches the CIE. Translate the differences between rows
+    // into call frame instructions.
+    UnwindRow previous;
+    for (auto &row : code->unwindRows) {
+        if (row.offset > previous.offset)
+            encodeAdvance(eh, row.offset - previous.offset);
+        if (row.cfaOffset != previous.cfaOffset) {
+            encode8(eh, cfaDefCfaOffset);
+            encodeUleb128(eh, row.cfaOffset);
+        }
+        for (auto &entry : row.savedRegisters) {
+            auto &prev = previous.savedRegisters;
+            if (std::find(prev.begin(), prev.end(), entry) != prev.end())
+                continue;
+            assert(!(entry.second % 8) && entry.second < 0);
+            encode8(eh, cfaOffset | dwarfRegisters[entry.first]);
+            encodeUleb128(eh, -entry.second / 8);
+        }
+        for (auto &entry : previous.savedRegisters) {
+            auto &saved = row.savedRegisters;
+            if (std::find_if(saved.begin(), saved.end(), [&] (auto &other) {
+                        return other.first == entry.first; }) != saved.end())
+                continue;
+            encode8(eh, cfaRestore | dwarfRegisters[entry.first]);
+        }
+        previous = row;
+    }
+
+    while ((buffer.size() & 7) || buffer.size() < minSize)
+        encode8(eh, cfaNop);
+    patch32(buffer, 0, buffer.size() - 4);
+    return buffer;
+}
+
+// Appends an FDE for the function to .eh_frame and registers it in .eh_frame_hdr.
+void MachineCodeEmitter::_emitFrameDescription(const FunctionCode *code,
+        EmittedFunction *function) {
+    // Strip the terminator; it is appended again after the FDE.
+    auto &buffer = _ehFrameSection->buffer;
+    if (_ehFrameHeader)
+        buffer.resize(buffer.size() - 4);
+
+    auto fdeOffset = buffer.size();
+    auto fde = _encodeFrameDescription(code, fdeOffset, 0);
+    if (functionSlack)
+        fde = _encodeFrameDescription(code, fdeOffset, _withSlack(fde.size()));
+    buffer.insert(buffer.end(), fde.begin(), fde.end());
+    function->fdeOffset = fdeOffset;
+    function->fdeCapacity = fde.size();
+
+    auto pcBegin = _elf->addInternalRelocation(std::make_unique<elf::Relocation>());
+    pcBegin->type = R_X86_64_PC32;
+    pcBegin->section = _ehFrameSection;
+    pcBegin->offset = fdeOffset + 8;
+    pcBegin->symbol = function->symbol;
+    pcBegin->addend = 0;
+
+    if (_ehFrameHeader) {
+        util::ByteEncoder eh{&buffer};
+        encode32(eh, 0); // Terminator.
+        _ehFrameHeader->entries.push_back({function->symbol, fdeOffset});
+    }
+}
+
+void MachineCodeEmitter::_createSections() {
+    assert(!(functionAlignment & (functionAlignment - 1)));
+
+    // For relocatable files, the system linker creates the GOT, the PLT and .eh_frame_hdr.
+    bool relocatable = _elf->fileType == elf::FileType::relocatable;
+
+    _textSection = _elf->insertFragment(std::make_unique<elf::ByteSection>());
+    _textSection->name = _elf->internString(".text");
+    _textSection->type = SHT_PROGBITS;
+    _textSection->flags = SHF_ALLOC | SHF_EXECINSTR;
+    _textSection->alignment = functionAlignment;
+
+    if (!relocatable) {
+        _gotSection = _elf->insertFragment(std::make_unique<elf::ByteSection>());
+        _gotSection->name = _elf->internString(".got");
+        _gotSection->type = SHT_PROGBITS;
+        _gotSection->flags = SHF_ALLOC | SHF_WRITE;
+
+        _pltSection = _elf->insertFragment(std::make_unique<elf::ByteSection>());
+        _pltSection->name = _elf->internString(".plt");
+        _pltSection->type = SHT_PROGBITS;
+        _pltSection->flags = SHF_ALLOC | SHF_EXECINSTR;
+    }
+
+    _ehFrameSection = _elf->insertFragment(std::make_unique<elf::ByteSection>());
+    _ehFrameSection->name = _elf->internString(".eh_frame");
+    _ehFrameSection->type = SHT_PROGBITS;
+    _ehFrameSection->flags = SHF_ALLOC;
+
+    if (!relocatable) {
+        _ehFrameHeader = _elf->insertFragment(std::make_unique<elf::EhFrameHeaderSection>());
+        _ehFrameHeader->name = _elf->internString(".eh_frame_hdr");
+        _ehFrameHeader->type = SHT_PROGBITS;
+        _ehFrameHeader->flags = SHF_ALLOC;
+        _ehFrameHeader->ehFrame = _ehFrameSection;
+        _elf->ehFrameHeaderFragment = _ehFrameHeader;
+    }
+
+    // Emit the CIE that is shared by all FDEs. It describes the frame on function entry:
+    // the CFA is rsp + 8 and the return address is stored right below the CFA.
+    auto &buffer = _ehFrameSection->buffer;
+    util::ByteEncoder eh{&buffer};
+    encode32(eh, 0); // Length (patched below).
+    encode32(eh, 0); // CIE ID.
+    encode8(eh, 1); // Version.
+    encodeChars(eh, "zR");
+    encode8(eh, 0);
+    encodeUleb128(eh, 1); // Code alignment factor.
+    encode8(eh, 0x78); // Data alignment factor (-8 in SLEB128).
+    encode8(eh, dwarfReturnAddress);
+    encodeUleb128(eh, 1); // Augmentation data length.
+    encode8(eh, elf::eh_pointer_encodings::pcrel | elf::eh_pointer_encodings::sdata4);
+    encode8(eh, cfaDefCfa);
+    encodeUleb128(eh, dwarfRegisters[4]);
+    encodeUleb128(eh, 8);
+    encode8(eh, cfaOffset | dwarfReturnAddress);
+    encodeUleb128(eh, 1);
+    while (buffer.size() & 7)
+        encode8(eh, cfaNop);
+    patch32(buffer, 0, buffer.size() - 4);
+    if (_ehFrameHeader)
+        encode32(eh, 0); // Terminator.
+}
+
+// Returns the symbol that calls to the function refer to. For relocatable files, this is
+// the symbol of the function itself; the system linker creates PLT entries if necessary.
+// Otherwise, it is the PLT stub of the function. Creates the GOT and PLT entries on first use.
+elf::Symbol *MachineCodeEmitter::_getCallTarget(const std::string &function) {
+    if (_elf->fileType == elf::FileType::relocatable) {
+        if (auto it = _functionSymbols.find(function); it != _functionSymbols.end())
+            return it->second;
+        auto symbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
+        symbol->name = _elf->internString(function);
+        _functionSymbols.insert({function, symbol});
+        return symbol;
+    }
+
+    if (auto it = _pltSymbols.find(function); it != _pltSymbols.end())
+        return it->second;
+
+    util::ByteEncoder got{&_gotSection->buffer};
+    util::ByteEncoder plt{&_pltSection->buffer};
+
+    auto string = _elf->internString(function);
+    auto symbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
+    symbol->name = string;
+
+    // Add a GOT entry for the function.
+    // TODO: Create the "special" GOT entries.
+    // TODO: Move GOT creation into the InternalLinkPass.
+    auto gotString = _elf->internString(function + "@got");
+    auto gotSymbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
+    gotSymbol->name = gotString;
+    gotSymbol->section = _gotSection;
+    gotSymbol->value = got.offset();
+
+    auto jumpSlot = _elf->addRelocation(std::make_unique<elf::Relocation>());
+    jumpSlot->type = R_X86_64_JUMP_SLOT;
+    jumpSlot->section = _gotSection;
+    jumpSlot->offset = got.offset();
+    jumpSlot->symbol = symbol;
+    encode64(got, 0);
+
+    // Add a PLT stub for the entry.
+    // TODO: Create the PLT header (and correct entries) for dynamic binding.
+    // TODO: Properly align PLT entries as in the ABI supplement.
+    // TODO: Move PLT creation into the InternalLinkPass.
+    auto pltString = _elf->internString(function + "@plt");
+    auto pltSymbol = _elf->addSymbol(std::make_unique<elf::Symbol>());
+    pltSymbol->name = pltString;
+    pltSymbol->section = _pltSection;
+    pltSymbol->value = plt.offset();
+
+    auto jumpThroughGot = _elf->addInternalRelocation(std::make_unique<elf::Relocation>());
+    jumpThroughGot->type = R_X86_64_PC32;
+    jumpThroughGot->section = _pltSection;
+    jumpThroughGot->offset = plt.offset() + 2;
+    jumpThroughGot->symbol = gotSymbol;
+    jumpThroughGot->addend = -4;
+
+    encode8(plt, 0xFF);
+    encode8(plt, 0x25); // TODO: Use encodeRawModRm().
+    encode32(plt, 0);
+
+    _pltSymbols.insert({function, pltSymbol});
+    return pltSymbol;
+}
+
 } // namespace lewis::targets::x86_64
@@ -0,0 +1,227 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include <lewis/statistics.hpp>
+#include <lewis/target-x86_64/arch-ir.hpp>
+#include <lewis/target-x86_64/arch-passes.hpp>
+
+namespace lewis::targets::x86_64 {
+
+namespace {
+    // Returns -1 if the Value is not in RegisterMode.
+    int registerOf(Value *v) {
+        if (auto registerMode = hierarchy_cast<RegisterMode *>(v); registerMode)
+            return registerMode->modeRegister;
+        return -1;
+    }
+
+    bool sameRegister(Value *a, Value *b) {
+        auto ra = hierarchy_cast<RegisterMode *>(a);
+        auto rb = hierarchy_cast<RegisterMode *>(b);
+        return ra && rb && ra->modeRegister >= 0
+                && ra->modeRegister == rb->modeRegister
+                && ra->operandSize == rb->operandSize;
+    }
+
+    bool hasUses(Value *v) {
+        return v->uses().begin() != v->uses().end();
+    }
+
+    bool hasSingleUse(Value *v) {
+        auto it = v->uses().begin();
+        if (it == v->uses().end())
+            return false;
+        ++it;
+        return it == v->uses().end();
+    }
+
+    // Returns the next instruction that emits code (or nullptr at the end of the block).
+    Instruction *nextInstruction(BasicBlock *bb, Instruction *inst) {
+        auto it = bb->iteratorTo(inst);
+        ++it;
+        while (it != bb->instructions().end()) {
+            if (!hierarchy_cast<NopInstruction *>(*it)
+                    && !hierarchy_cast<DefineOffsetInstruction *>(*it))
+                return *it;
+            ++it;
+        }
+        return nullptr;
+    }
+
+    // Removes a MovMR whose result lives in the same register as its operand.
+    void eraseMove(BasicBlock *bb, MovMRInstruction *move) {
+        move->result.get()->replaceAllUses(move->operand.get());
+        move->operand = nullptr;
+        bb->eraseInstruction(bb->iteratorTo(move));
+    }
+
+    // The rules below are tried in order at each instruction. They only rewrite the
+    // given instruction and the instructions that follow it.
+
+    // mov r, r
+    bool removeSelfMove(BasicBlock *bb, Instruction *inst) {
+        auto move = hierarchy_cast<MovMRInstruction *>(inst);
+        if (!move || !sameRegister(move->result.get(), move->operand.get()))
+            return false;
+        eraseMove(bb, move);
+        return true;
+    }
+
+    // mov b, a; mov a, b. The second move is redundant; the first one might be dead.
+    bool removeCancellingMoves(BasicBlock *bb, Instruction *inst) {
+        auto first = hierarchy_cast<MovMRInstruction *>(inst);
+        if (!first)
+            return false;
+        auto second = hierarchy_cast<MovMRInstruction *>(nextInstruction(bb, first));
+        if (!second || second->operand != first->result.get()
+                || !sameRegister(second->result.get(), first->operand.get()))
+            return false;
+
+        second->result.get()->replaceAllUses(first->operand.get());
+        second->operand = nullptr;
+        bb->eraseInstruction(bb->iteratorTo(second));
+        if (!hasUses(first->result.get())) {
+            first->operand = nullptr;
+            bb->eraseInstruction(bb->iteratorTo(first));
+        }
+        return true;
+    }
+
+    // mov c, a; add c, b -> lea c, [a + b]
+    bool fuseMoveAdd(BasicBlock *bb, Instruction *inst) {
+        auto move = hierarchy_cast<MovMRInstruction *>(inst);
+        if (!move || registerOf(move->operand.get()) < 0
+                || registerOf(move->result.get()) < 0)
+            return false;
+        auto add = hierarchy_cast<AddMRInstruction *>(nextInstruction(bb, move));
+        if (!add || add->primary != move->result.get()
+                || !hasSingleUse(move->result.get())
+                || registerOf(add->secondary.get()) < 0)
+            return false;
+        if (!sameRegister(add->result.get(), move->result.get()))
+            return false;
+
+        auto lea = std::make_unique<LeaBaseIndexInstruction>(move->operand.get(),
+                add->secondary.get());
+        lea->result.set(add->result.reset());
+        move->operand = nullptr;
+        add->primary = nullptr;
+        add->secondary = nullptr;
+        bb->insertInstruction(bb->iteratorTo(move), std::move(lea));
+        bb->eraseInstruction(bb->iteratorTo(add));
+        bb->eraseInstruction(bb->iteratorTo(move));
+        return true;
+    }
+
+    // and a, b; ...; test a, a; jnz -> and a, b; ...; jnz
+    bool reuseAndFlags(BasicBlock *bb, Instruction *inst) {
+        auto bitwiseAnd = hierarchy_cast<AndMRInstruction *>(inst);
+        if (!bitwiseAnd)
+            return false;
+        // Byte and word operations are done in 32 bits; the flags include the upper bits.
+        auto registerMode = hierarchy_cast<RegisterMode *>(bitwiseAnd->result.get());
+        if (!registerMode || (registerMode->operandSize != OperandSize::dword
+                && registerMode->operandSize != OperandSize::qword))
+            return false;
+        // Only skip instructions that do not modify the flags.
+        // Copies of the result are described by the same flags.
+        std::vector<Value *> copies{bitwiseAnd->result.get()};
+        auto isCopy = [&] (Value *v) {
+            return std::find(copies.begin(), copies.end(), v) != copies.end();
+        };
+        auto next = nextInstruction(bb, bitwiseAnd);
+        while (next) {
+            if (auto move = hierarchy_cast<MovMRInstruction *>(next); move) {
+                // Truncations are moves, too, but their flags differ from those of the and.
+                auto moveMode = hierarchy_cast<RegisterMode *>(move->result.get());
+                if (isCopy(move->operand.get()) && moveMode
+                        && moveMode->operandSize == registerMode->operandSize)
+                    copies.push_back(move->result.get());
+            } else if (!hierarchy_cast<MovRMInstruction *>(next)
+                    && !hierarchy_cast<XchgMRInstruction *>(next)) {
+                return false;
+            }
+            next = nextInstruction(bb, next);
+        }
+
+        auto jnz = hierarchy_cast<JnzBranch *>(bb->branch());
+        if (!jnz || jnz->reuseFlags || !isCopy(jnz->operand.get()))
+            return false;
+        jnz->reuseFlags = true;
+        return true;
+    }
+
+    // mov r, 0 -> xor r32, r32
+    bool useZeroIdiom(BasicBlock *bb, Instruction *inst) {
+        auto movMC = hierarchy_cast<MovMCInstruction *>(inst);
+        if (!movMC || movMC->value || registerOf(movMC->result.get()) < 0)
+            return false;
+
+        auto zero = std::make_unique<XorZeroInstruction>();
+        zero->result.set(movMC->result.reset());
+        bb->replaceInstruction(bb->iteratorTo(movMC), std::move(zero));
+        return true;
+    }
+
+    struct PeepholeRule {
+        const char *name;
+        bool (*apply)(BasicBlock *bb, Instruction *inst);
+    };
+
+    const PeepholeRule rules[] = {
+        {"self-move", removeSelfMove},
+        {"cancelling-moves", removeCancellingMoves},
+        {"move-add-to-lea", fuseMoveAdd},
+        {"and-flags-for-jnz", reuseAndFlags},
+        {"zero-idiom", useZeroIdiom}
+    };
+}
+
+struct PeepholeImpl : PeepholePass {
+    PeepholeImpl(BasicBlock *bb)
+    : _bb{bb} { }
+
+    void run() override;
+
+private:
+    BasicBlock *_bb;
+};
+
+void PeepholeImpl::run() {
+    // Rules never touch instructions before the current one. After a rule applies,
+    // we resume behind the last instruction that was not rewritten.
+    Instruction *previous = nullptr;
+    auto it = _bb->instructions().begin();
+    while (it != _bb->instructions().end()) {
+        auto inst = *it;
+        bool applied = false;
+        for (auto &rule : rules) {
+            if (rule.apply(_bb, inst)) {
+                countStatistic("peephole", rule.name);
+                applied = true;
+                break;
+            }
+        }
+
+        if (applied) {
+            if (previous) {
+                it = _bb->iteratorTo(previous);
+                ++it;
+            } else {
+                it = _bb->instructions().begin();
+            }
+        } else {
+            previous = inst;
+            ++it;
+        }
+    }
+}
+
+std::unique_ptr<PeepholePass> PeepholePass::create(BasicBlock *bb) {
+    return std::make_unique<PeepholeImpl>(bb);
+}
+
+} // namespace lewis::targets::x86_64
@@ -0,0 +1,34 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <lewis/opt-passes.hpp>
+#include <lewis/target-x86_64/arch-passes.hpp>
+#include <lewis/target-x86_64/pipeline.hpp>
+
+namespace lewis::targets::x86_64 {
+
+void addBasicPipeline(PassManager *pm) {
+    pm->addBlockPass("lower-code", LowerCodePass::create);
+    pm->addFunctionPass("allocate-registers", AllocateRegistersPass::create);
+}
+
+void addOptimizingPipeline(PassManager *pm) {
+    pm->addFunctionPass("licm", LoopInvariantCodeMotionPass::create);
+    addBasicPipeline(pm);
+    pm->addBlockPass("peephole", PeepholePass::create);
+}
+
+FunctionCode compileFunction(Function *fn, const PipelineBuilder &pipeline,
+        PassStatisticsAccumulator *statistics) {
+    PassManager pm;
+    pipeline(&pm);
+    pm.run(fn);
+    if (statistics)
+        statistics->add(pm.statistics());
+
+    MachineCodeEncoder encoder{fn};
+    encoder.run();
+    return std::move(encoder.code);
+}
+
+} // namespace lewis::targets::x86_64
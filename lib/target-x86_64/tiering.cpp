@@ -0,0 +1,352 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <lewis/ir-binary.hpp>
+#include <lewis/statistics.hpp>
+#include <lewis/target-x86_64/tiering.hpp>
+
+namespace lewis::targets::x86_64 {
+
+namespace {
+    constexpr size_t pageSize = 4096;
+    // Each stub is a jmp *slot(%rip), padded to 16 bytes.
+    constexpr size_t stubSize = 16;
+    constexpr size_t stubsPerPage = pageSize / stubSize;
+    // Slots and counters share the page that follows the stubs.
+    constexpr size_t countersOffset = stubsPerPage * sizeof(uint64_t);
+    static_assert(2 * countersOffset <= pageSize);
+    // incq counter(%rip).
+    constexpr size_t prologueSize = 7;
+    // jmp *0(%rip) followed by the absolute address of an external function.
+    constexpr size_t trampolineSize = 16;
+
+    size_t alignUp(size_t offset, size_t alignment) {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+
+    int32_t displacement(const uint8_t *target, const uint8_t *next) {
+        auto disp = target - next;
+        assert(disp >= INT32_MIN && disp <= INT32_MAX);
+        return static_cast<int32_t>(disp);
+    }
+}
+
+TieredRuntime::TieredRuntime(elf::SymbolResolver resolver)
+: _resolver{std::move(resolver)} { }
+
+TieredRuntime::~TieredRuntime() {
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _stopping = true;
+    }
+    _workCv.notify_all();
+    if (_worker.joinable())
+        _worker.join();
+    if (_region)
+        munmap(_region, _regionSize);
+}
+
+void *TieredRuntime::addFunction(Function *fn) {
+    _addBatch({fn});
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _byName.at(fn->name)->stub;
+}
+
+void TieredRuntime::addModule(Module *mod) {
+    std::vector<Function *> fns;
+    for (auto fn : mod->functions())
+        fns.push_back(fn);
+    _addBatch(fns);
+}
+
+void *TieredRuntime::entry(const std::string &name) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto it = _byName.find(name);
+    if (it == _byName.end())
+        return nullptr;
+    return it->second->stub;
+}
+
+void TieredRuntime::requestRecompile(const std::string &name) {
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto it = _byName.find(name);
+        if (it == _byName.end())
+            throw std::runtime_error("No tiered function named " + name);
+        auto tf = it->second;
+        if (tf->tier || tf->queued)
+            return;
+        tf->queued = true;
+        _queue.push_back(tf);
+    }
+    _workCv.notify_all();
+}
+
+void TieredRuntime::drain() {
+    std::unique_lock<std::mutex> lock{_mutex};
+    _idleCv.wait(lock, [&] { return _queue.empty() && !_busy; });
+}
+
+int TieredRuntime::tier(const std::string &name) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto it = _byName.find(name);
+    if (it == _byName.end())
+        throw std::runtime_error("No tiered function named " + name);
+    return it->second->tier;
+}
+
+uint64_t TieredRuntime::callCount(const std::string &name) {
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto it = _byName.find(name);
+    if (it == _byName.end())
+        throw std::runtime_error("No tiered function named " + name);
+    return __atomic_load_n(it->second->counter, __ATOMIC_RELAXED);
+}
+
+// Called with _mutex held. Reserves the code region and starts the worker on first use.
+void TieredRuntime::_start() {
+    if (_region)
+        return;
+    if (codeRegionSize > (size_t(1) << 31))
+        throw std::runtime_error("Code region of tiered runtime exceeds 2 GiB");
+    _regionSize = alignUp(codeRegionSize, pageSize);
+    void *mapping = mmap(nullptr, _regionSize, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Could not reserve code region of tiered runtime");
+    _region = static_cast<uint8_t *>(mapping);
+    _worker = std::thread{&TieredRuntime::_work, this};
+}
+
+// Declares all Functions first, so that calls between them resolve to their stubs.
+// The Functions only become visible once all of them are compiled at tier 0. If that fails,
+// their stubs are leaked (but never reachable) and the names can be added again.
+void TieredRuntime::_addBatch(const std::vector<Function *> &fns) {
+    std::vector<std::unique_ptr<TieredFunction>> tfs;
+    Batch batch;
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _start();
+        for (auto fn : fns) {
+            if (batch.count(fn->name))
+                throw std::runtime_error("Tiered function " + fn->name + " was already added");
+            tfs.push_back(_declare(fn));
+            batch.insert({fn->name, tfs.back().get()});
+        }
+    }
+
+    for (auto &tf : tfs)
+        _compile(tf.get(), 0, &batch);
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    // Another thread might have added the same name in the meantime.
+    for (auto &tf : tfs) {
+        if (_byName.count(tf->name))
+            throw std::runtime_error("Tiered function " + tf->name + " was already added");
+    }
+    for (auto &tf : tfs) {
+        _byName.insert({tf->name, tf.get()});
+        _functions.push_back(std::move(tf));
+    }
+}
+
+// Called with _mutex held. Does not register the Function.
+std::unique_ptr<TieredRuntime::TieredFunction> TieredRuntime::_declare(Function *fn) {
+    if (_byName.count(fn->name))
+        throw std::runtime_error("Tiered function " + fn->name + " was already added");
+
+    if (!_stubPage || _stubsUsed == stubsPerPage) {
+        _stubPage = _allocatePages(2 * pageSize);
+        for (size_t i = 0; i < stubsPerPage; ++i) {
+            auto stub = _stubPage + i * stubSize;
+            auto slot = _stubPage + pageSize + i * sizeof(uint64_t);
+            const uint8_t jmp[] = {0xFF, 0x25};
+            auto disp = displacement(slot, stub + 6);
+            memset(stub, 0xCC, stubSize);
+            memcpy(stub, jmp, sizeof(jmp));
+            memcpy(stub + sizeof(jmp), &disp, sizeof(int32_t));
+        }
+        if (mprotect(_stubPage, pageSize, PROT_READ | PROT_EXEC))
+            throw std::runtime_error("Could not protect stubs of tiered runtime");
+        _stubsUsed = 0;
+    }
+
+    auto tf = std::make_unique<TieredFunction>();
+    tf->name = fn->name;
+    BinaryIrWriter writer{&tf->ir};
+    writer.writeFunction(fn);
+    tf->stub = _stubPage + _stubsUsed * stubSize;
+    tf->slot = reinterpret_cast<uint64_t *>(_stubPage + pageSize
+            + _stubsUsed * sizeof(uint64_t));
+    tf->counter = reinterpret_cast<uint64_t *>(_stubPage + pageSize + countersOffset
+            + _stubsUsed * sizeof(uint64_t));
+    ++_stubsUsed;
+    return tf;
+}
+
+// Called without _mutex held. Compiles a fresh copy of the IR and patches the slot.
+void TieredRuntime::_compile(TieredFunction *tf, int tier, const Batch *batch) {
+    TraceScope compileScope{"tiering", tier ? "tier1" : "tier0"};
+    BinaryIrReader reader{tf->ir.data(), tf->ir.size()};
+    auto fn = reader.readFunction();
+
+    auto code = compileFunction(fn.get(), tier ? tier1Pipeline : tier0Pipeline);
+    auto address = _load(&code, tier ? nullptr : tf->counter, batch);
+
+    // The stub reads the slot with a single 8-byte load; since the code was written
+    // (and protected) before the store, callers either see the old or the new code.
+    __atomic_store_n(tf->slot, reinterpret_cast<uint64_t>(address), __ATOMIC_RELEASE);
+    countStatistic("tiering", tier ? "tier1-compiles" : "tier0-compiles");
+}
+
+// Copies the code into fresh pages and returns its entry point. If counter is set,
+// the code is preceded by an increment of the counter. Calls to Functions of the batch
+// (if any) resolve to their stubs, too.
+uint8_t *TieredRuntime::_load(const FunctionCode *code, uint64_t *counter,
+        const Batch *batch) {
+    auto alignment = std::max(size_t{16}, code->alignment);
+    assert(alignment <= pageSize);
+    auto codeOffset = counter ? alignUp(prologueSize, alignment) : 0;
+    auto size = alignUp(codeOffset + code->text.size(), trampolineSize);
+
+    // Calls to Functions of the runtime go through their stubs. Other calls go through
+    // trampolines since the resolved address might not be within reach of a rel32.
+    std::unordered_map<std::string, uint8_t *> stubs;
+    std::unordered_map<std::string, std::pair<size_t, void *>> trampolines;
+    for (auto &relocation : code->relocations) {
+        if (relocation.kind != CodeRelocationKind::call
+                || stubs.count(relocation.function)
+                || trampolines.count(relocation.function))
+            continue;
+        if (batch) {
+            auto it = batch->find(relocation.function);
+            if (it != batch->end()) {
+                stubs.insert({relocation.function, it->second->stub});
+                continue;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            auto it = _byName.find(relocation.function);
+            if (it != _byName.end()) {
+                stubs.insert({relocation.function, it->second->stub});
+                continue;
+            }
+        }
+        auto address = _resolver ? _resolver(relocation.function.c_str()) : nullptr;
+        if (!address)
+            throw std::runtime_error("Unresolved function " + relocation.function);
+        trampolines.insert({relocation.function, {size, address}});
+        size += trampolineSize;
+    }
+
+    size = alignUp(size, pageSize);
+    auto pages = _allocatePages(size);
+    auto text = pages + codeOffset;
+    memset(pages, 0xCC, size);
+    memcpy(text, code->text.data(), code->text.size());
+
+    if (counter) {
+        auto prologue = text - prologueSize;
+        const uint8_t incq[] = {0x48, 0xFF, 0x05};
+        auto disp = displacement(reinterpret_cast<uint8_t *>(counter), text);
+        memcpy(prologue, incq, sizeof(incq));
+        memcpy(prologue + sizeof(incq), &disp, sizeof(int32_t));
+    }
+
+    for (auto &[name, trampoline] : trampolines) {
+        const uint8_t jmp[] = {0xFF, 0x25, 0x00, 0x00, 0x00, 0x00};
+        auto address = reinterpret_cast<uint64_t>(trampoline.second);
+        memcpy(pages + trampoline.first, jmp, sizeof(jmp));
+        memcpy(pages + trampoline.first + sizeof(jmp), &address, sizeof(uint64_t));
+    }
+
+    for (auto &relocation : code->relocations) {
+        const uint8_t *target;
+        if (relocation.kind == CodeRelocationKind::block) {
+            target = text + code->blockOffsets.at(relocation.block);
+        } else if (relocation.kind == CodeRelocationKind::call) {
+            auto it = stubs.find(relocation.function);
+            if (it != stubs.end()) {
+                target = it->second;
+            } else {
+                target = pages + trampolines.at(relocation.function).first;
+            }
+        } else {
+            assert(!"Unexpected CodeRelocationKind");
+        }
+        auto site = text + relocation.offset;
+        auto disp = displacement(target, site + 4);
+        memcpy(site, &disp, sizeof(int32_t));
+    }
+
+    if (mprotect(pages, size, PROT_READ | PROT_EXEC))
+        throw std::runtime_error("Could not protect code of tiered runtime");
+
+    if (profilingSink) {
+        std::lock_guard<std::mutex> lock{_mutex};
+        profilingSink->addCode(text, code);
+    }
+    return counter ? text - prologueSize : text;
+}
+
+// Returns read-write pages from the code region.
+uint8_t *TieredRuntime::_allocatePages(size_t size) {
+    std::lock_guard<std::mutex> lock{_regionMutex};
+    assert(!(size % pageSize));
+    if (size > _regionSize - _regionUsed)
+        throw std::runtime_error("Code region of tiered runtime is exhausted");
+    auto pages = _region + _regionUsed;
+    if (mprotect(pages, size, PROT_READ | PROT_WRITE))
+        throw std::runtime_error("Could not map code of tiered runtime");
+    _regionUsed += size;
+    countStatistic("tiering", "code-pages", size / pageSize);
+    return pages;
+}
+
+// Background thread. Polls the call counters and recompiles hot Functions at tier 1.
+void TieredRuntime::_work() {
+    std::unique_lock<std::mutex> lock{_mutex};
+    while (!_stopping) {
+        if (_queue.empty()) {
+            _workCv.wait_for(lock, pollInterval);
+            for (auto &tf : _functions) {
+                if (tf->tier || tf->queued)
+                    continue;
+                if (__atomic_load_n(tf->counter, __ATOMIC_RELAXED) < hotThreshold)
+                    continue;
+                tf->queued = true;
+                _queue.push_back(tf.get());
+            }
+            continue;
+        }
+
+        auto tf = _queue.front();
+        _queue.pop_front();
+        _busy = true;
+        lock.unlock();
+        bool success = true;
+        try {
+            _compile(tf, 1);
+        } catch (const std::exception &) {
+            // Keep running the tier-0 code. The Function stays marked as queued,
+            // so that it is not recompiled over and over again.
+            countStatistic("tiering", "tier1-failures");
+            success = false;
+        }
+        lock.lock();
+        if (success) {
+            tf->tier = 1;
+            tf->queued = false;
+        }
+        _busy = false;
+        _idleCv.notify_all();
+    }
+}
+
+} // namespace lewis::targets::x86_64
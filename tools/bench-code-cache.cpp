@@ -0,0 +1,96 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+// Measures compile latency of identical handlers with a cold and a warm CodeCache.
+// Usage: bench-code-cache [number of handlers] [cache directory]
+//
+// If a directory is given, a driver that uses the optimizing pipeline must not reuse
+// the code that the basic pipeline wrote to it.
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <lewis/ir-text.hpp>
+#include <lewis/elf/object.hpp>
+#include <lewis/target-x86_64/arch-text.hpp>
+#include <lewis/target-x86_64/compile-driver.hpp>
+#include "bench-handler.hpp"
+
+namespace {
+
+// Compiles numHandlers fresh copies of the handler. Returns the time per handler.
+double compileBatch(lewis::targets::x86_64::CodeCache *cache, size_t numHandlers,
+        bool optimize = false) {
+    std::string source;
+    for (size_t i = 0; i < numHandlers; ++i)
+        source += automateIrqSource("handler" + std::to_string(i));
+    lewis::Module mod;
+    lewis::IrParser parser{source.data(), source.size(),
+            lewis::targets::x86_64::textDialect()};
+    parser.parseModule(&mod);
+
+    auto start = std::chrono::steady_clock::now();
+    lewis::elf::Object elf;
+    lewis::targets::x86_64::CompileDriver driver{1};
+    driver.codeCache = cache;
+    if (optimize) {
+        driver.pipeline = lewis::targets::x86_64::addOptimizingPipeline;
+        driver.pipelineName = "optimizing";
+    }
+    driver.addModule(&mod);
+    driver.run(&elf);
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / numHandlers;
+}
+
+void printStatistics(lewis::targets::x86_64::CodeCache *cache) {
+    auto stats = cache->statistics();
+    std::cout << "    hits: " << stats.numHits << " (disk: " << stats.numDiskHits << ")"
+            << ", misses: " << stats.numMisses
+            << ", evictions: " << stats.numEvictions << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    size_t numHandlers = 1000;
+    std::string directory;
+    if (argc > 1)
+        numHandlers = std::stoul(argv[1]);
+    if (argc > 2)
+        directory = argv[2];
+
+    std::cout << "No cache: " << compileBatch(nullptr, numHandlers)
+            << " ns per handler" << std::endl;
+
+    // The first handler misses, all others hit.
+    lewis::targets::x86_64::CodeCache cache{64, directory};
+    std::cout << "Cold cache: " << compileBatch(&cache, numHandlers)
+            << " ns per handler" << std::endl;
+    printStatistics(&cache);
+
+    std::cout << "Warm cache: " << compileBatch(&cache, numHandlers)
+            << " ns per handler" << std::endl;
+    printStatistics(&cache);
+
+    if (!directory.empty()) {
+        // A fresh in-memory cache that is backed by the same directory.
+        lewis::targets::x86_64::CodeCache diskCache{64, directory};
+        std::cout << "Warm disk cache: " << compileBatch(&diskCache, numHandlers)
+                << " ns per handler" << std::endl;
+        printStatistics(&diskCache);
+
+        // The directory only holds code of the basic pipeline.
+        lewis::targets::x86_64::CodeCache optimizingCache{64, directory};
+        std::cout << "Optimizing pipeline, same directory: "
+                << compileBatch(&optimizingCache, numHandlers, true)
+                << " ns per handler" << std::endl;
+        printStatistics(&optimizingCache);
+        if (optimizingCache.statistics().numDiskHits) {
+            std::cerr << "bench-code-cache: code of the basic pipeline was reused"
+                    " by the optimizing pipeline" << std::endl;
+            return 1;
+        }
+    }
+}
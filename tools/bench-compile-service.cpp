@@ -0,0 +1,144 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+// Measures the latency of interactive jobs of a CompileService while it is busy with
+// prefetch work.
+// Usage: bench-compile-service [prefetch jobs] [interactive jobs] [threads]
+//
+// All prefetch jobs are submitted up front and every fourth of them is cancelled.
+// Interactive jobs are then submitted one at a time from a frontend thread.
+// Reports the percentiles of the submission time (which must never block), of the
+// time until a worker picks up each job and of the time until each job is done.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <lewis/ir-text.hpp>
+#include <lewis/statistics.hpp>
+#include <lewis/target-x86_64/arch-text.hpp>
+#include <lewis/target-x86_64/compile-service.hpp>
+#include "bench-handler.hpp"
+
+using lewis::targets::x86_64::CompileJob;
+using lewis::targets::x86_64::CompilePriority;
+
+namespace {
+
+std::vector<lewis::Function *> parseFunctions(lewis::Module *mod, const std::string &prefix,
+        size_t n) {
+    std::string source;
+    for (size_t i = 0; i < n; ++i)
+        source += automateIrqSource(prefix + std::to_string(i));
+    lewis::IrParser parser{source.data(), source.size(),
+            lewis::targets::x86_64::textDialect()};
+    parser.parseModule(mod);
+
+    std::vector<lewis::Function *> fns;
+    for (auto fn : mod->functions())
+        fns.push_back(fn);
+    return fns;
+}
+
+void check(bool condition, const char *message) {
+    if (!condition)
+        throw std::runtime_error(message);
+}
+
+void printDistribution(lewis::StatisticsCollector *collector, const char *name) {
+    auto distributions = collector->distributions();
+    auto &distribution = distributions[{"compile-service", name}];
+    std::cout << "    " << name << ": p50 " << distribution.percentile(50) / 1000.0
+            << " us, p99 " << distribution.percentile(99) / 1000.0
+            << " us, max " << distribution.percentile(100) / 1000.0 << " us" << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    size_t numPrefetch = 4000;
+    size_t numInteractive = 200;
+    size_t numThreads = 2;
+    if (argc > 1)
+        numPrefetch = std::strtoul(argv[1], nullptr, 0);
+    if (argc > 2)
+        numInteractive = std::strtoul(argv[2], nullptr, 0);
+    if (argc > 3)
+        numThreads = std::strtoul(argv[3], nullptr, 0);
+    if (!numInteractive || !numThreads) {
+        std::cerr << "usage: bench-compile-service [prefetch jobs] [interactive jobs]"
+                " [threads]" << std::endl;
+        return 1;
+    }
+    if (!lewis::statisticsEnabled) {
+        std::cerr << "bench-compile-service: statistics are disabled in this build"
+                << std::endl;
+        return 1;
+    }
+
+    lewis::Module prefetchModule;
+    lewis::Module interactiveModule;
+    auto prefetchFns = parseFunctions(&prefetchModule, "prefetch", numPrefetch);
+    auto interactiveFns = parseFunctions(&interactiveModule, "interactive", numInteractive);
+
+    lewis::StatisticsCollector collector;
+    collector.recordTraceEvents = false;
+    lewis::setStatisticsCollector(&collector);
+
+    size_t numCancelled = 0;
+    std::vector<lewis::PassStatistics> passStatistics;
+    std::vector<std::shared_ptr<CompileJob>> prefetchJobs;
+    std::vector<std::shared_ptr<CompileJob>> interactiveJobs;
+    {
+        lewis::targets::x86_64::CompileService service{numThreads, numPrefetch};
+        for (auto fn : prefetchFns) {
+            auto job = service.submit(fn, CompilePriority::prefetch);
+            check(job != nullptr, "Prefetch job was rejected");
+            prefetchJobs.push_back(job);
+        }
+        for (size_t i = 0; i < prefetchJobs.size(); i += 4) {
+            if (prefetchJobs[i]->cancel())
+                numCancelled++;
+        }
+
+        // Wait for each interactive job before submitting the next one.
+        for (auto fn : interactiveFns) {
+            auto start = std::chrono::steady_clock::now();
+            auto job = service.submit(fn, CompilePriority::interactive);
+            auto end = std::chrono::steady_clock::now();
+            check(job != nullptr, "Interactive job was rejected");
+            lewis::sampleStatistic("compile-service", "submit-time",
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+            check(!job->result.get().text.empty(), "Interactive job produced no code");
+            interactiveJobs.push_back(job);
+        }
+        passStatistics = service.passStatistics();
+    }
+    lewis::setStatisticsCollector(nullptr);
+
+    // The service cancels outstanding jobs on destruction, so all results are ready.
+    size_t numCompiled = 0;
+    for (auto &job : prefetchJobs) {
+        try {
+            job->result.get();
+            numCompiled++;
+        } catch (const std::runtime_error &) { }
+    }
+    check(numCompiled + collector.counter("compile-service", "cancelled") == numPrefetch,
+            "Prefetch job was neither compiled nor cancelled");
+
+    std::cout << numCancelled << " prefetch jobs cancelled explicitly, "
+            << numPrefetch - numCompiled - numCancelled << " on destruction, "
+            << numCompiled << " compiled" << std::endl;
+    printDistribution(&collector, "submit-time");
+    printDistribution(&collector, "interactive-wait-time");
+    printDistribution(&collector, "interactive-latency");
+    printDistribution(&collector, "prefetch-wait-time");
+    printDistribution(&collector, "prefetch-latency");
+    lewis::printPassStatistics(std::cout, passStatistics);
+}
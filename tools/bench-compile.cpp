@@ -0,0 +1,466 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+// Measures compile throughput on synthetic IR of growing size.
+// Usage: bench-compile [--quick] [--max-exponent=<e>]
+//
+// For each generator and size, every stage of the pipeline is timed (best of several runs)
+// and the number of heap allocations is counted. Afterwards, the growth of each stage is
+// fitted to time ~ size^e; the benchmark fails if e exceeds the given maximum (default 1.8,
+// the allocator is currently around 1.5 on multi-block functions).
+// Stages that take less than 100us even on the largest input are too noisy to be checked.
+//
+// The generators stay within the limits of the current register allocator:
+// at most six call arguments, few simultaneously live values (live ranges are never split),
+// data-flow edges that never permute values (move cycles are not implemented) and
+// conditional branches that pass values to at most one of their successors.
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include <lewis/ir.hpp>
+#include <lewis/elf/object.hpp>
+#include <lewis/elf/passes.hpp>
+#include <lewis/elf/file-emitter.hpp>
+#include <lewis/target-x86_64/arch-passes.hpp>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+
+//---------------------------------------------------------------------------------------
+// Allocation counting.
+//---------------------------------------------------------------------------------------
+
+namespace {
+    size_t numAllocations = 0;
+
+    void *allocateCounted(size_t size, size_t alignment) {
+        numAllocations++;
+        void *p = nullptr;
+        if (alignment <= alignof(std::max_align_t)) {
+            p = malloc(size ? size : 1);
+        } else if (posix_memalign(&p, alignment, size ? size : 1)) {
+            p = nullptr;
+        }
+        if (!p)
+            throw std::bad_alloc{};
+        return p;
+    }
+}
+
+// All throwing forms of operator new and all forms of operator delete are replaced, so that
+// every allocation is counted and all memory is released by free(). The nothrow forms
+// call the throwing ones.
+
+void *operator new(size_t size) {
+    return allocateCounted(size, 0);
+}
+
+void *operator new[](size_t size) {
+    return allocateCounted(size, 0);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    return allocateCounted(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return allocateCounted(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+    free(p);
+}
+
+namespace {
+
+//---------------------------------------------------------------------------------------
+// IR generators.
+//---------------------------------------------------------------------------------------
+
+lewis::Value *makeConst(lewis::BasicBlock *bb, uint64_t value) {
+    auto inst = bb->insertNewInstruction<lewis::LoadConstInstruction>(value);
+    auto v = inst->result.setNew<lewis::LocalValue>();
+    v->setType(lewis::globalInt32Type());
+    return v;
+}
+
+lewis::Value *makeLoad(lewis::BasicBlock *bb, lewis::Value *base, int64_t offset) {
+    auto inst = bb->insertNewInstruction<lewis::LoadOffsetInstruction>(base, offset);
+    auto v = inst->result.setNew<lewis::LocalValue>();
+    v->setType(lewis::globalInt32Type());
+    return v;
+}
+
+lewis::Value *makeBinary(lewis::BasicBlock *bb, lewis::BinaryMathOpcode opcode,
+        lewis::Value *left, lewis::Value *right) {
+    auto inst = bb->insertNewInstruction<lewis::BinaryMathInstruction>(opcode, left, right);
+    auto v = inst->result.setNew<lewis::LocalValue>();
+    v->setType(lewis::globalInt32Type());
+    return v;
+}
+
+lewis::Value *makeArgument(lewis::BasicBlock *bb) {
+    auto phi = bb->attachPhi(std::make_unique<lewis::ArgumentPhi>());
+    auto v = phi->value.setNew<lewis::LocalValue>();
+    v->setType(lewis::globalPointerType());
+    return v;
+}
+
+lewis::DataFlowPhi *makePhi(lewis::BasicBlock *bb) {
+    auto phi = bb->attachPhi(std::make_unique<lewis::DataFlowPhi>());
+    auto v = phi->value.setNew<lewis::LocalValue>();
+    v->setType(lewis::globalInt32Type());
+    return phi;
+}
+
+void makeEdge(lewis::BasicBlock *source, lewis::DataFlowPhi *sink, lewis::Value *alias) {
+    auto edge = lewis::DataFlowEdge::attach(std::make_unique<lewis::DataFlowEdge>(),
+            source->source, sink->sink);
+    edge->alias = alias;
+}
+
+void makeReturn(lewis::BasicBlock *bb, lewis::Value *v) {
+    auto branch = bb->setBranch(std::make_unique<lewis::FunctionReturnBranch>(1));
+    branch->operand(0) = v;
+}
+
+// A single block with a long chain of arithmetic.
+std::unique_ptr<lewis::Function> generateStraightLine(size_t n) {
+    auto fn = std::make_unique<lewis::Function>();
+    fn->name = "straight_line";
+    auto bb = fn->addBlock(std::make_unique<lewis::BasicBlock>());
+    auto arg = makeArgument(bb);
+
+    auto acc = makeLoad(bb, arg, 0);
+    for (size_t i = 0; i < n; ++i) {
+        auto c = makeConst(bb, i);
+        if (i % 3 == 2) {
+            auto x = makeLoad(bb, arg, 8 * (i % 16));
+            acc = makeBinary(bb, lewis::BinaryMathOpcode::bitwiseAnd,
+                    makeBinary(bb, lewis::BinaryMathOpcode::add, acc, c), x);
+        } else {
+            acc = makeBinary(bb, lewis::BinaryMathOpcode::add, acc, c);
+        }
+    }
+    makeReturn(bb, acc);
+    return fn;
+}
+
+// A single block that calls many different functions with one to six arguments.
+std::unique_ptr<lewis::Function> generateInvokeFanOut(size_t n) {
+    auto fn = std::make_unique<lewis::Function>();
+    fn->name = "invoke_fan_out";
+    auto bb = fn->addBlock(std::make_unique<lewis::BasicBlock>());
+    auto arg = makeArgument(bb);
+
+    auto acc = makeLoad(bb, arg, 0);
+    for (size_t i = 0; i < n; ++i) {
+        size_t numOperands = 1 + i % 6;
+        std::vector<lewis::Value *> operands;
+        for (size_t j = 0; j < numOperands; ++j)
+            operands.push_back(makeConst(bb, i + j));
+        auto invoke = bb->insertNewInstruction<lewis::InvokeInstruction>(
+                "callee_" + std::to_string(i % 64), numOperands, 1);
+        for (size_t j = 0; j < numOperands; ++j)
+            invoke->operand(j) = operands[j];
+        auto result = invoke->result(0).setNew<lewis::LocalValue>();
+        result->setType(lewis::globalInt32Type());
+        acc = makeBinary(bb, lewis::BinaryMathOpcode::add, acc, result);
+    }
+    makeReturn(bb, acc);
+    return fn;
+}
+
+// A chain of diamonds that carries several values through data-flow phis.
+// Only one successor of each conditional branch receives values via edges;
+// the other side recomputes them from constants.
+std::unique_ptr<lewis::Function> generatePhiWeb(size_t n) {
+    constexpr size_t width = 4;
+
+    auto fn = std::make_unique<lewis::Function>();
+    fn->name = "phi_web";
+    auto head = fn->addBlock(std::make_unique<lewis::BasicBlock>());
+    auto arg = makeArgument(head);
+
+    std::vector<lewis::Value *> values;
+    for (size_t k = 0; k < width; ++k)
+        values.push_back(makeLoad(head, arg, 8 * k));
+
+    for (size_t i = 0; i < n; ++i) {
+        auto left = fn->addBlock(std::make_unique<lewis::BasicBlock>());
+        auto right = fn->addBlock(std::make_unique<lewis::BasicBlock>());
+        auto join = fn->addBlock(std::make_unique<lewis::BasicBlock>());
+
+        auto cond = makeBinary(head, lewis::BinaryMathOpcode::bitwiseAnd,
+                values[i % width], makeConst(head, 1));
+        auto branch = head->setBranch(std::make_unique<lewis::ConditionalBranch>(left, right));
+        branch->operand = cond;
+
+        std::vector<lewis::DataFlowPhi *> joinPhis;
+        for (size_t k = 0; k < width; ++k)
+            joinPhis.push_back(makePhi(join));
+
+        // Edges always preserve the order of values.
+        std::vector<lewis::Value *> leftValues;
+        for (size_t k = 0; k < width; ++k) {
+            auto phi = makePhi(left);
+            makeEdge(head, phi, values[k]);
+            leftValues.push_back(phi->value.get());
+        }
+        leftValues[i % width] = makeBinary(left, lewis::BinaryMathOpcode::add,
+                leftValues[i % width], makeConst(left, i));
+        left->setBranch(std::make_unique<lewis::UnconditionalBranch>(join));
+        for (size_t k = 0; k < width; ++k)
+            makeEdge(left, joinPhis[k], leftValues[k]);
+
+        right->setBranch(std::make_unique<lewis::UnconditionalBranch>(join));
+        for (size_t k = 0; k < width; ++k)
+            makeEdge(right, joinPhis[k], makeConst(right, i + k));
+
+        head = join;
+        for (size_t k = 0; k < width; ++k)
+            values[k] = joinPhis[k]->value.get();
+    }
+
+    auto sum = values[0];
+    for (size_t k = 1; k < width; ++k)
+        sum = makeBinary(head, lewis::BinaryMathOpcode::add, sum, values[k]);
+    makeReturn(head, sum);
+    return fn;
+}
+
+// Many small blocks that pass a value along a chain.
+// Each block either continues the chain or branches to a shared exit block.
+std::unique_ptr<lewis::Function> generateManyBlocks(size_t n) {
+    auto fn = std::make_unique<lewis::Function>();
+    fn->name = "many_blocks";
+    std::vector<lewis::BasicBlock *> blocks;
+    for (size_t i = 0; i < n + 1; ++i)
+        blocks.push_back(fn->addBlock(std::make_unique<lewis::BasicBlock>()));
+    auto exit = fn->addBlock(std::make_unique<lewis::BasicBlock>());
+    makeReturn(exit, makeConst(exit, 0));
+
+    auto arg = makeArgument(blocks[0]);
+    auto acc = makeLoad(blocks[0], arg, 0);
+    for (size_t i = 0; i < n; ++i) {
+        auto bb = blocks[i];
+        auto cond = makeBinary(bb, lewis::BinaryMathOpcode::bitwiseAnd, acc,
+                makeConst(bb, 1 << (i % 31)));
+        auto branch = bb->setBranch(std::make_unique<lewis::ConditionalBranch>(
+                blocks[i + 1], exit));
+        branch->operand = cond;
+
+        auto phi = makePhi(blocks[i + 1]);
+        makeEdge(bb, phi, acc);
+        acc = makeBinary(blocks[i + 1], lewis::BinaryMathOpcode::add,
+                phi->value.get(), makeConst(blocks[i + 1], i));
+    }
+    makeReturn(blocks[n], acc);
+    return fn;
+}
+
+struct Generator {
+    const char *name;
+    std::function<std::unique_ptr<lewis::Function> (size_t)> generate;
+    std::vector<size_t> sizes;
+};
+
+//---------------------------------------------------------------------------------------
+// Measurement.
+//---------------------------------------------------------------------------------------
+
+const char *stageNames[] = {
+    "lower-code",
+    "allocate-registers",
+    "mc-emitter",
+    "create-headers",
+    "layout",
+    "internal-link",
+    "file-emitter"
+};
+
+constexpr size_t numStages = sizeof(stageNames) / sizeof(stageNames[0]);
+
+struct StageResult {
+    double nanoseconds = 0;
+    size_t allocations = 0;
+};
+
+struct RunResult {
+    size_t numInstructions = 0;
+    StageResult stages[numStages];
+};
+
+size_t countInstructions(lewis::Function *fn) {
+    size_t n = 0;
+    for (auto bb : fn->blocks())
+        n += bb->indexOfInstruction(nullptr);
+    return n;
+}
+
+RunResult compileOnce(const Generator &generator, size_t size) {
+    RunResult result;
+    auto fn = generator.generate(size);
+    result.numInstructions = countInstructions(fn.get());
+
+    size_t stage = 0;
+    auto measure = [&] (auto &&f) {
+        auto allocationsBefore = numAllocations;
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto end = std::chrono::steady_clock::now();
+        auto &r = result.stages[stage++];
+        r.nanoseconds = std::chrono::duration<double, std::nano>(end - start).count();
+        r.allocations = numAllocations - allocationsBefore;
+    };
+
+    lewis::elf::Object elf;
+    measure([&] {
+        for (auto bb : fn->blocks()) {
+            auto pass = lewis::targets::x86_64::LowerCodePass::create(bb);
+            pass->run();
+        }
+    });
+    measure([&] {
+        auto pass = lewis::targets::x86_64::AllocateRegistersPass::create(fn.get());
+        pass->run();
+    });
+    measure([&] {
+        lewis::targets::x86_64::MachineCodeEmitter mce{&elf};
+        mce.emit(fn.get());
+    });
+    measure([&] { lewis::elf::CreateHeadersPass::create(&elf)->run(); });
+    measure([&] { lewis::elf::LayoutPass::create(&elf)->run(); });
+    measure([&] { lewis::elf::InternalLinkPass::create(&elf)->run(); });
+    measure([&] { lewis::elf::FileEmitter::create(&elf)->run(); });
+    return result;
+}
+
+// Keeps the fastest run of each stage to suppress noise.
+RunResult compileBest(const Generator &generator, size_t size, int repetitions) {
+    auto best = compileOnce(generator, size);
+    for (int i = 1; i < repetitions; ++i) {
+        auto run = compileOnce(generator, size);
+        for (size_t s = 0; s < numStages; ++s)
+            best.stages[s].nanoseconds = std::min(best.stages[s].nanoseconds,
+                    run.stages[s].nanoseconds);
+    }
+    return best;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    bool quick = false;
+    double maxExponent = 1.8;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--quick")) {
+            quick = true;
+        } else if (!strncmp(argv[i], "--max-exponent=", 15)) {
+            maxExponent = std::atof(argv[i] + 15);
+        } else {
+            std::cerr << "usage: bench-compile [--quick] [--max-exponent=<e>]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Generator> generators{
+        {"straight-line", generateStraightLine, {250, 500, 1000, 2000, 4000}},
+        {"invoke-fan-out", generateInvokeFanOut, {100, 200, 400, 800, 1600}},
+        {"phi-web", generatePhiWeb, {50, 100, 200, 400, 800}},
+        {"many-blocks", generateManyBlocks, {125, 250, 500, 1000, 2000}}
+    };
+    int repetitions = quick ? 1 : 5;
+    if (quick) {
+        for (auto &generator : generators)
+            generator.sizes.resize(3);
+    }
+
+    bool superlinear = false;
+    for (auto &generator : generators) {
+        std::vector<RunResult> results;
+        for (auto size : generator.sizes) {
+            auto result = compileBest(generator, size, repetitions);
+            results.push_back(result);
+
+            std::cout << generator.name << " (size " << size << ", "
+                    << result.numInstructions << " instructions)" << std::endl;
+            double total = 0;
+            for (size_t s = 0; s < numStages; ++s) {
+                auto &stage = result.stages[s];
+                total += stage.nanoseconds;
+                std::cout << "    " << std::setw(20) << std::left << stageNames[s]
+                        << std::right << std::fixed << std::setprecision(1)
+                        << std::setw(12) << stage.nanoseconds / 1000 << " us"
+                        << std::setw(10) << stage.nanoseconds / result.numInstructions
+                        << " ns/inst" << std::setw(10) << stage.allocations << " allocs"
+                        << std::endl;
+            }
+            std::cout << "    " << std::setw(20) << std::left << "total" << std::right
+                    << std::setw(12) << total / 1000 << " us"
+                    << std::setw(10) << total / result.numInstructions << " ns/inst"
+                    << std::endl;
+        }
+
+        // Fit time ~ instructions^e between the smallest and the largest input.
+        auto &first = results.front();
+        auto &last = results.back();
+        auto sizeRatio = std::log(static_cast<double>(last.numInstructions)
+                / first.numInstructions);
+        std::cout << generator.name << " scaling exponents:";
+        for (size_t s = 0; s < numStages; ++s) {
+            auto exponent = std::log(last.stages[s].nanoseconds
+                    / first.stages[s].nanoseconds) / sizeRatio;
+            std::cout << " " << stageNames[s] << "=" << std::setprecision(2) << exponent;
+            if (last.stages[s].nanoseconds < 100000)
+                continue;
+            if (exponent > maxExponent) {
+                std::cout << " (superlinear!)";
+                superlinear = true;
+            }
+        }
+        std::cout << std::endl << std::endl;
+    }
+
+    if (superlinear) {
+        std::cout << "Some stages scale superlinearly (exponent > " << maxExponent << ")"
+                << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,103 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+// Reference implementations of the bench-exec kernels.
+// This file is always compiled with -O2, independently of the build type.
+
+#include <cstdint>
+
+extern "C" {
+
+uint32_t __mmio_read32(void *base, uint32_t offset);
+void __trigger_event(void *base, uint32_t value);
+
+struct IrqDevice {
+    void *mmio;
+    uint32_t offset;
+};
+
+struct StatusPacket {
+    uint8_t flags;
+    uint8_t reserved;
+    uint16_t length;
+    uint32_t status;
+};
+
+struct Division {
+    int32_t dividend;
+    int32_t divisor;
+    int64_t shifted;
+};
+
+uint64_t ref_empty(void *) {
+    return 0;
+}
+
+uint64_t ref_automate_irq(void *arg) {
+    auto device = static_cast<IrqDevice *>(arg);
+    auto status = __mmio_read32(device->mmio, device->offset + 4) & 23;
+    if (status) {
+        __trigger_event(device->mmio, status);
+        return 1;
+    }
+    return 0xFFFFFFFF;
+}
+
+uint64_t ref_sum_fields(void *arg) {
+    auto p = static_cast<uint64_t *>(arg);
+    return p[0] + p[1] + p[2] + p[3] + p[4] + p[5] + p[6] + p[7];
+}
+
+uint64_t ref_mask_fields(void *arg) {
+    auto p = static_cast<uint32_t *>(arg);
+    return uint32_t(-((p[0] & p[1]) + (p[2] & p[3])) + ((p[4] + p[5]) & (p[6] + p[7])));
+}
+
+uint64_t ref_poll_registers(void *arg) {
+    auto mmio = *static_cast<void **>(arg);
+    return uint32_t(__mmio_read32(mmio, 0) + __mmio_read32(mmio, 4)
+            + __mmio_read32(mmio, 8) + __mmio_read32(mmio, 12));
+}
+
+uint64_t ref_decode_status(void *arg) {
+    auto packet = static_cast<StatusPacket *>(arg);
+    uint32_t status = packet->status;
+    uint32_t code = (status >> 8) & 0xFF;
+    uint32_t mixed = code ^ ((status << 13) | (status >> 19));
+    uint32_t blocks = uint16_t(packet->length / 3);
+    return (mixed * blocks) | uint32_t(int32_t(int8_t(packet->flags)));
+}
+
+uint64_t ref_signed_divide(void *arg) {
+    auto division = static_cast<Division *>(arg);
+    int32_t quotient = division->dividend / division->divisor;
+    int32_t remainder = division->dividend % division->divisor;
+    auto difference = int32_t(uint32_t(quotient) - uint32_t(remainder));
+    return uint64_t(int64_t(difference) ^ (division->shifted >> 3));
+}
+
+uint64_t ref_hash_mix(void *arg) {
+    auto p = static_cast<uint64_t *>(arg);
+    uint64_t shifted = ((p[0] ^ 0x9E3779B97F4A7C15) % p[1]) << 5;
+    uint64_t inverted = ~((shifted >> 17) | (shifted << 47));
+    uint32_t low = uint32_t(inverted);
+    uint64_t mixed = inverted + 0x0123456789ABCDEF - low;
+    return mixed ^ uint32_t((low >> 7) | (low << 25));
+}
+
+uint64_t ref_shift_divide(void *arg) {
+    auto p = static_cast<uint64_t *>(arg);
+    uint64_t value = p[0], count = p[1], dividend = p[2], divisor = p[3], rotate = p[4];
+    uint64_t shifted = value << count;
+    uint64_t rotated = rotate ? (value >> rotate) | (value << (64 - rotate)) : value;
+    uint64_t quotient = uint64_t(int64_t(value) / int64_t(divisor));
+    return shifted + (dividend >> count) + rotated + shifted / divisor + dividend % divisor
+            + quotient + value + count + dividend + divisor + rotate;
+}
+
+uint64_t ref_truncate_flags(void *arg) {
+    auto p = static_cast<uint32_t *>(arg);
+    return uint8_t(p[0] & p[1]) ? 1 : 0;
+}
+
+} // extern "C"
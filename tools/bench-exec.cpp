@@ -0,0 +1,647 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+// Measures the speed of the code that lewis generates.
+// Usage: bench-exec [--perf-map] [--jitdump=<directory>] [iterations]
+//
+// Each kernel is compiled by lewis (by both the basic and the optimizing pipeline) and loaded
+// into an executable mapping of this process; calls to external functions are redirected
+// to local stubs. The kernel is then compared against a reference implementation that is
+// compiled with -O2 (see bench-exec-ref.cpp). For all of them, the code size, the number
+// of retired instructions (if perf_event_open() is available) and the number of TSC cycles
+// per call are reported. The cost of an empty call is subtracted from both numbers.
+//
+// With --perf-map or --jitdump, the loaded code is reported to perf (see jit-profiling.hpp).
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <dlfcn.h>
+#include <link.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#include <lewis/ir-text.hpp>
+#include <lewis/target-x86_64/arch-text.hpp>
+#include <lewis/target-x86_64/jit-profiling.hpp>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+#include <lewis/target-x86_64/pipeline.hpp>
+
+// The stubs below read from memory instead of returning constants.
+#define BENCH_HANDLER_CUSTOM_STUBS
+#include "bench-handler.hpp"
+
+using lewis::targets::x86_64::CodeRelocationKind;
+using lewis::targets::x86_64::FunctionCode;
+using lewis::targets::x86_64::JitProfilingSink;
+
+using KernelFunction = uint64_t (*)(void *);
+
+extern "C" {
+
+// Reference implementations from bench-exec-ref.cpp.
+uint64_t ref_empty(void *);
+uint64_t ref_automate_irq(void *);
+uint64_t ref_sum_fields(void *);
+uint64_t ref_mask_fields(void *);
+uint64_t ref_poll_registers(void *);
+uint64_t ref_decode_status(void *);
+uint64_t ref_signed_divide(void *);
+uint64_t ref_hash_mix(void *);
+uint64_t ref_shift_divide(void *);
+uint64_t ref_truncate_flags(void *);
+
+// Stubs for the external functions that the kernels call.
+uint64_t triggeredEvents = 0;
+
+[[gnu::noinline]] uint32_t __mmio_read32(void *base, uint32_t offset) {
+    uint32_t value;
+    memcpy(&value, static_cast<char *>(base) + offset, sizeof(uint32_t));
+    return value;
+}
+
+[[gnu::noinline]] void __trigger_event(void *, uint32_t value) {
+    triggeredEvents += value;
+}
+
+} // extern "C"
+
+namespace {
+
+const char *optimizedSuffix = ".opt";
+
+const char *kernelSource = R"(
+function "empty" {
+b0:
+    %0:pointer = argument
+    %1:int64 = const 0
+    return %1
+}
+
+function "sum_fields" {
+b0:
+    %0:pointer = argument
+    %1:int64 = loadOffset %0, 0
+    %2:int64 = loadOffset %0, 8
+    %3:int64 = add %1, %2
+    %4:int64 = loadOffset %0, 16
+    %5:int64 = add %3, %4
+    %6:int64 = loadOffset %0, 24
+    %7:int64 = add %5, %6
+    %8:int64 = loadOffset %0, 32
+    %9:int64 = add %7, %8
+    %10:int64 = loadOffset %0, 40
+    %11:int64 = add %9, %10
+    %12:int64 = loadOffset %0, 48
+    %13:int64 = add %11, %12
+    %14:int64 = loadOffset %0, 56
+    %15:int64 = add %13, %14
+    return %15
+}
+
+function "mask_fields" {
+b0:
+    %0:pointer = argument
+    %1:int32 = loadOffset %0, 0
+    %2:int32 = loadOffset %0, 4
+    %3:int32 = and %1, %2
+    %4:int32 = loadOffset %0, 8
+    %5:int32 = loadOffset %0, 12
+    %6:int32 = and %4, %5
+    %7:int32 = add %3, %6
+    %8:int32 = negate %7
+    %9:int32 = loadOffset %0, 16
+    %10:int32 = loadOffset %0, 20
+    %11:int32 = add %9, %10
+    %12:int32 = loadOffset %0, 24
+    %13:int32 = loadOffset %0, 28
+    %14:int32 = add %12, %13
+    %15:int32 = and %11, %14
+    %16:int32 = add %8, %15
+    return %16
+}
+
+function "poll_registers" {
+b0:
+    %0:pointer = argument
+    %1:pointer = loadOffset %0, 0
+    %2:int32 = const 0
+    %3:int32 = invoke "__mmio_read32"(%1, %2)
+    %4:int32 = const 4
+    %5:int32 = invoke "__mmio_read32"(%1, %4)
+    %6:int32 = add %3, %5
+    %7:int32 = const 8
+    %8:int32 = invoke "__mmio_read32"(%1, %7)
+    %9:int32 = add %6, %8
+    %10:int32 = const 12
+    %11:int32 = invoke "__mmio_read32"(%1, %10)
+    %12:int32 = add %9, %11
+    return %12
+}
+
+function "decode_status" {
+b0:
+    %0:pointer = argument
+    %1:int32 = loadOffset %0, 4
+    %2:int32 = const 8
+    %3:int32 = lshr %1, %2
+    %4:int32 = const 255
+    %5:int32 = and %3, %4
+    %6:int32 = const 13
+    %7:int32 = rotl %1, %6
+    %8:int32 = xor %5, %7
+    %9:int16 = loadOffset %0, 2
+    %10:int16 = const 3
+    %11:int16 = udiv %9, %10
+    %12:int32 = zext %11
+    %13:int32 = mul %8, %12
+    %14:int8 = loadOffset %0, 0
+    %15:int32 = sext %14
+    %16:int32 = or %13, %15
+    return %16
+}
+
+function "signed_divide" {
+b0:
+    %0:pointer = argument
+    %1:int32 = loadOffset %0, 0
+    %2:int32 = loadOffset %0, 4
+    %3:int32 = sdiv %1, %2
+    %4:int32 = srem %1, %2
+    %5:int32 = sub %3, %4
+    %6:int64 = sext %5
+    %7:int64 = loadOffset %0, 8
+    %8:int64 = const 3
+    %9:int64 = ashr %7, %8
+    %10:int64 = xor %6, %9
+    return %10
+}
+
+function "hash_mix" {
+b0:
+    %0:pointer = argument
+    %1:int64 = loadOffset %0, 0
+    %2:int64 = const 11400714819323198485
+    %3:int64 = xor %1, %2
+    %4:int64 = loadOffset %0, 8
+    %5:int64 = urem %3, %4
+    %6:int64 = const 5
+    %7:int64 = shl %5, %6
+    %8:int64 = const 17
+    %9:int64 = rotr %7, %8
+    %10:int64 = not %9
+    %11:int32 = trunc %10
+    %12:int64 = const 81985529216486895
+    %13:int64 = add %10, %12
+    %14:int64 = zext %11
+    %15:int64 = sub %13, %14
+    %16:int32 = const 7
+    %17:int32 = rotr %11, %16
+    %18:int64 = zext %17
+    %19:int64 = xor %15, %18
+    return %19
+}
+
+function "shift_divide" {
+b0:
+    %0:pointer = argument
+    %1:int64 = loadOffset %0, 0
+    %2:int64 = loadOffset %0, 8
+    %3:int64 = loadOffset %0, 16
+    %4:int64 = loadOffset %0, 24
+    %5:int64 = loadOffset %0, 32
+    %6:int64 = shl %1, %2
+    %7:int64 = lshr %3, %2
+    %8:int64 = rotr %1, %5
+    %9:int64 = udiv %6, %4
+    %10:int64 = urem %3, %4
+    %11:int64 = sdiv %1, %4
+    %12:int64 = add %6, %7
+    %13:int64 = add %12, %8
+    %14:int64 = add %13, %9
+    %15:int64 = add %14, %10
+    %16:int64 = add %15, %11
+    %17:int64 = add %16, %1
+    %18:int64 = add %17, %2
+    %19:int64 = add %18, %3
+    %20:int64 = add %19, %4
+    %21:int64 = add %20, %5
+    return %21
+}
+
+function "truncate_flags" {
+b0:
+    %0:pointer = argument
+    %1:int32 = loadOffset %0, 0
+    %2:int32 = loadOffset %0, 4
+    %3:int32 = and %1, %2
+    %4:int8 = trunc %3
+    branch %4, b1, b2
+b1:
+    %5:int32 = const 1
+    return %5
+b2:
+    %6:int32 = const 0
+    return %6
+}
+)";
+
+// Executable copy of a set of FunctionCode objects.
+// Calls between the loaded functions are direct. Calls to external functions go through
+// trampolines at the end of the mapping; those can reach any 64-bit address.
+struct LoadedCode {
+    LoadedCode(const std::vector<FunctionCode> &codes,
+            const std::unordered_map<std::string, void *> &externals,
+            const std::vector<JitProfilingSink *> &sinks) {
+        std::vector<size_t> offsets;
+        size_t size = 0;
+        for (auto &code : codes) {
+            auto alignment = std::max(size_t{16}, code.alignment);
+            size = (size + alignment - 1) & ~(alignment - 1);
+            offsets.push_back(size);
+            size += code.text.size();
+        }
+
+        for (size_t i = 0; i < codes.size(); ++i)
+            _entries.insert({codes[i].name, offsets[i]});
+
+        // Each trampoline is a jmp *0(%rip) followed by the absolute target address.
+        std::unordered_map<std::string, size_t> trampolines;
+        size = (size + 15) & ~size_t(15);
+        for (auto &code : codes) {
+            for (auto &relocation : code.relocations) {
+                if (relocation.kind != CodeRelocationKind::call
+                        || _entries.count(relocation.function)
+                        || trampolines.count(relocation.function))
+                    continue;
+                trampolines.insert({relocation.function, size});
+                size += 16;
+            }
+        }
+
+        _size = (size + 4095) & ~size_t(4095);
+        void *mapping = mmap(nullptr, _size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            throw std::runtime_error("Could not map memory for code");
+        _base = static_cast<uint8_t *>(mapping);
+        memset(_base, 0xCC, _size);
+
+        for (auto &[name, offset] : trampolines) {
+            auto it = externals.find(name);
+            if (it == externals.end())
+                throw std::runtime_error("Unresolved external function " + name);
+            const uint8_t jmp[] = {0xFF, 0x25, 0x00, 0x00, 0x00, 0x00};
+            auto address = reinterpret_cast<uint64_t>(it->second);
+            memcpy(_base + offset, jmp, sizeof(jmp));
+            memcpy(_base + offset + sizeof(jmp), &address, sizeof(uint64_t));
+        }
+
+        for (size_t i = 0; i < codes.size(); ++i) {
+            auto &code = codes[i];
+            memcpy(_base + offsets[i], code.text.data(), code.text.size());
+            for (auto &relocation : code.relocations) {
+                size_t target;
+                if (relocation.kind == CodeRelocationKind::block) {
+                    target = offsets[i] + code.blockOffsets.at(relocation.block);
+                } else if (relocation.kind == CodeRelocationKind::call) {
+                    auto it = _entries.find(relocation.function);
+                    if (it != _entries.end()) {
+                        target = it->second;
+                    } else {
+                        target = trampolines.at(relocation.function);
+                    }
+                } else {
+                    assert(!"Unexpected CodeRelocationKind");
+                }
+                auto site = offsets[i] + relocation.offset;
+                auto displacement = int32_t(int64_t(target) - int64_t(site + 4));
+                memcpy(_base + site, &displacement, sizeof(int32_t));
+            }
+        }
+
+        if (mprotect(_base, _size, PROT_READ | PROT_EXEC))
+            throw std::runtime_error("Could not make code executable");
+
+        for (auto sink : sinks) {
+            for (size_t i = 0; i < codes.size(); ++i)
+                sink->addCode(_base + offsets[i], &codes[i]);
+        }
+    }
+
+    LoadedCode(const LoadedCode &) = delete;
+
+    ~LoadedCode() {
+        munmap(_base, _size);
+    }
+
+    LoadedCode &operator= (const LoadedCode &) = delete;
+
+    void *entry(const std::string &name) {
+        auto it = _entries.find(name);
+        if (it == _entries.end())
+            throw std::runtime_error("No function named " + name);
+        return _base + it->second;
+    }
+
+private:
+    uint8_t *_base;
+    size_t _size;
+    std::unordered_map<std::string, size_t> _entries;
+};
+
+// Counts retired user-space instructions of this thread.
+struct InstructionCounter {
+    InstructionCounter() {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(perf_event_attr));
+        attr.size = sizeof(perf_event_attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    InstructionCounter(const InstructionCounter &) = delete;
+
+    ~InstructionCounter() {
+        if (_fd >= 0)
+            close(_fd);
+    }
+
+    InstructionCounter &operator= (const InstructionCounter &) = delete;
+
+    bool available() {
+        return _fd >= 0;
+    }
+
+    uint64_t read() {
+        uint64_t count = 0;
+        if (_fd >= 0 && ::read(_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+            count = 0;
+        return count;
+    }
+
+private:
+    int _fd;
+};
+
+struct Measurement {
+    double cycles = 0;
+    double instructions = 0;
+};
+
+Measurement measure(KernelFunction fn, void *arg, size_t iterations,
+        InstructionCounter &counter) {
+    Measurement best;
+    for (int r = 0; r < 10; ++r) {
+        auto instructionsBefore = counter.read();
+        _mm_lfence();
+        auto cyclesBefore = __rdtsc();
+        _mm_lfence();
+        for (size_t i = 0; i < iterations; ++i)
+            fn(arg);
+        _mm_lfence();
+        auto cyclesAfter = __rdtsc();
+        auto instructionsAfter = counter.read();
+
+        Measurement current;
+        current.cycles = double(cyclesAfter - cyclesBefore) / iterations;
+        current.instructions = double(instructionsAfter - instructionsBefore) / iterations;
+        if (!r || current.cycles < best.cycles)
+            best = current;
+    }
+    return best;
+}
+
+// Size of a function of this executable, taken from the dynamic symbol table.
+size_t symbolSize(void *function) {
+    Dl_info info;
+    ElfW(Sym) *symbol = nullptr;
+    if (!dladdr1(function, &info, reinterpret_cast<void **>(&symbol), RTLD_DL_SYMENT)
+            || !symbol)
+        return 0;
+    return symbol->st_size;
+}
+
+struct Kernel {
+    const char *name;
+    KernelFunction reference;
+    // Both implementations are checked against each other on all arguments.
+    // Only the first argument is timed.
+    std::vector<void *> arguments;
+    // Number of low bits of the result that are defined.
+    int resultBits;
+};
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    size_t iterations = 100000;
+    std::unique_ptr<JitProfilingSink> perfMap;
+    std::unique_ptr<JitProfilingSink> jitDump;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--perf-map")) {
+            perfMap = lewis::targets::x86_64::PerfMapSink::create();
+        } else if (!strncmp(argv[i], "--jitdump=", 10)) {
+            jitDump = lewis::targets::x86_64::JitDumpSink::create(argv[i] + 10);
+            jitDump->blockSymbols = true;
+        } else {
+            iterations = std::strtoul(argv[i], nullptr, 0);
+        }
+    }
+    if (!iterations) {
+        std::cerr << "usage: bench-exec [--perf-map] [--jitdump=<directory>] [iterations]"
+                << std::endl;
+        return 1;
+    }
+    std::vector<JitProfilingSink *> sinks;
+    if (perfMap)
+        sinks.push_back(perfMap.get());
+    if (jitDump)
+        sinks.push_back(jitDump.get());
+
+    // Compile all kernels, once by each pipeline. The names of the optimized kernels
+    // carry a suffix.
+    std::string source = automateIrqSource() + kernelSource;
+    std::vector<FunctionCode> codes;
+    auto compileKernels = [&] (const lewis::targets::x86_64::PipelineBuilder &pipeline,
+            const std::string &suffix) {
+        lewis::Module mod;
+        lewis::IrParser parser{source.data(), source.size(),
+                lewis::targets::x86_64::textDialect()};
+        parser.parseModule(&mod);
+        for (auto fn : mod.functions()) {
+            fn->name += suffix;
+            codes.push_back(lewis::targets::x86_64::compileFunction(fn, pipeline));
+        }
+    };
+    compileKernels(lewis::targets::x86_64::addBasicPipeline, "");
+    compileKernels(lewis::targets::x86_64::addOptimizingPipeline, optimizedSuffix);
+
+    LoadedCode loaded{codes, {
+        {"__mmio_read32", reinterpret_cast<void *>(&__mmio_read32)},
+        {"__trigger_event", reinterpret_cast<void *>(&__trigger_event)}
+    }, sinks};
+
+    // Inputs of the kernels.
+    uint32_t registers[4] = {0x17, 0x100, 0x2000, 0x30000};
+    struct {
+        void *mmio;
+        uint32_t offset;
+    } irqDevice{registers, 0};
+    uint64_t wideFields[8] = {1, 2, 3, 4, 5, 6, 7, 0x100000000};
+    uint32_t narrowFields[8] = {0xFF, 0x0F, 0xF0F0, 0xFFFF, 3, 4, 0x10, 0x20};
+    void *pollDevice = registers;
+    struct {
+        uint8_t flags;
+        uint8_t reserved;
+        uint16_t length;
+        uint32_t status;
+    } statusPacket{0x85, 0, 1000, 0xDEAD1234};
+    struct Division {
+        int32_t dividend;
+        int32_t divisor;
+        int64_t shifted;
+    } divisions[] = {
+        {-7, 2, -1000},
+        {7, -2, -0x123456789},
+        {-2147483647, -3, INT64_MAX},
+        {100, 7, -9}
+    };
+    uint64_t hashInputs[][2] = {
+        {0, 7},
+        {~uint64_t(0), 0x100000001},
+        {0x123456789, 3},
+        {42, ~uint64_t(0)}
+    };
+    // Value, shift count, dividend, divisor, rotate count. The shift and rotate counts
+    // are live across the divisions and the divisor is live across the shifts.
+    uint64_t shiftDivideInputs[][5] = {
+        {0x0123456789ABCDEF, 4, 0xFEDCBA9876543210, 7, 13},
+        {uint64_t(-5), 63, 1000, uint64_t(-3), 1},
+        {1, 0, 0, 1, 32},
+        {0x8000000000000001, 17, ~uint64_t(0), 0x100000000, 63}
+    };
+    // The low byte of the and decides the branch, the upper bits must not.
+    uint32_t truncateInputs[][2] = {
+        {0x100, 0xFFFFFFFF},
+        {0x1FF, 0xF00},
+        {0x1FF, 0xFF},
+        {0x80, 0x80}
+    };
+
+    Kernel kernels[] = {
+        {"automate_irq", &ref_automate_irq, {&irqDevice}, 32},
+        {"sum_fields", &ref_sum_fields, {wideFields}, 64},
+        {"mask_fields", &ref_mask_fields, {narrowFields}, 32},
+        {"poll_registers", &ref_poll_registers, {&pollDevice}, 32},
+        {"decode_status", &ref_decode_status, {&statusPacket}, 32},
+        {"signed_divide", &ref_signed_divide,
+                {&divisions[0], &divisions[1], &divisions[2], &divisions[3]}, 64},
+        {"hash_mix", &ref_hash_mix,
+                {hashInputs[0], hashInputs[1], hashInputs[2], hashInputs[3]}, 64},
+        {"shift_divide", &ref_shift_divide,
+                {shiftDivideInputs[0], shiftDivideInputs[1], shiftDivideInputs[2],
+                shiftDivideInputs[3]}, 64},
+        {"truncate_flags", &ref_truncate_flags,
+                {truncateInputs[0], truncateInputs[1], truncateInputs[2], truncateInputs[3]},
+                32}
+    };
+
+    InstructionCounter counter;
+    auto lewisEmpty = reinterpret_cast<KernelFunction>(loaded.entry("empty"));
+    auto lewisOverhead = measure(lewisEmpty, nullptr, iterations, counter);
+    auto referenceOverhead = measure(&ref_empty, nullptr, iterations, counter);
+
+    std::cout << std::left << std::setw(16) << "kernel" << std::setw(10) << "code"
+            << std::right << std::setw(8) << "bytes"
+            << std::setw(14) << "insts/call" << std::setw(14) << "cycles/call" << std::endl;
+
+    auto report = [&] (const char *name, const char *implementation, size_t bytes,
+            Measurement m, Measurement overhead) {
+        std::cout << std::left << std::setw(16) << name << std::setw(10) << implementation
+                << std::right << std::setw(8);
+        if (bytes) {
+            std::cout << bytes;
+        } else {
+            std::cout << "-";
+        }
+        std::cout << std::setw(14) << std::fixed << std::setprecision(1);
+        if (counter.available()) {
+            std::cout << (m.instructions - overhead.instructions);
+        } else {
+            std::cout << "-";
+        }
+        std::cout << std::setw(14) << (m.cycles - overhead.cycles) << std::endl;
+    };
+
+    auto codeSize = [&] (const std::string &name) {
+        auto code = std::find_if(codes.begin(), codes.end(), [&] (const FunctionCode &c) {
+            return c.name == name;
+        });
+        assert(code != codes.end());
+        return code->text.size();
+    };
+
+    // Checks that a kernel agrees with the reference on all arguments.
+    auto check = [&] (const Kernel &kernel, const std::string &name, KernelFunction fn) {
+        auto mask = kernel.resultBits < 64 ? (uint64_t(1) << kernel.resultBits) - 1 : ~uint64_t(0);
+        bool agree = true;
+        for (size_t i = 0; i < kernel.arguments.size(); ++i) {
+            triggeredEvents = 0;
+            auto result = fn(kernel.arguments[i]) & mask;
+            auto events = triggeredEvents;
+            triggeredEvents = 0;
+            auto expected = kernel.reference(kernel.arguments[i]) & mask;
+            if (result != expected || events != triggeredEvents) {
+                std::cout << name << ": result " << std::hex << result
+                        << " does not match the reference " << expected << std::dec
+                        << " on input " << i << std::endl;
+                agree = false;
+            }
+        }
+        return agree;
+    };
+
+    bool mismatch = false;
+    for (auto &kernel : kernels) {
+        std::string optimizedName = std::string{kernel.name} + optimizedSuffix;
+        auto fn = reinterpret_cast<KernelFunction>(loaded.entry(kernel.name));
+        auto optimizedFn = reinterpret_cast<KernelFunction>(loaded.entry(optimizedName));
+
+        // Check that all implementations agree before timing them.
+        bool agree = check(kernel, kernel.name, fn);
+        agree = check(kernel, optimizedName, optimizedFn) && agree;
+        if (!agree) {
+            mismatch = true;
+            continue;
+        }
+
+        auto argument = kernel.arguments.front();
+        report(kernel.name, "lewis", codeSize(kernel.name),
+                measure(fn, argument, iterations, counter), lewisOverhead);
+        report(kernel.name, "lewis-opt", codeSize(optimizedName),
+                measure(optimizedFn, argument, iterations, counter), lewisOverhead);
+        report(kernel.name, "-O2", symbolSize(reinterpret_cast<void *>(kernel.reference)),
+                measure(kernel.reference, argument, iterations, counter),
+                referenceOverhead);
+    }
+    if (!counter.available())
+        std::cout << "(perf_event_open() is not available; instructions are not counted)"
+                << std::endl;
+
+    return mismatch ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+// The interrupt handler of tools/ir/automate-irq.lir, shared by the benchmarks.
+// Each benchmark is a single translation unit that includes this header once.
+//
+// Unless BENCH_HANDLER_CUSTOM_STUBS is defined, this header also defines trivial versions
+// of the external functions that the handler calls.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#ifndef BENCH_HANDLER_CUSTOM_STUBS
+
+extern "C" {
+
+// Exported (through -rdynamic), so that dlopen() can resolve them.
+[[gnu::noinline]] uint32_t __mmio_read32(void *, uint32_t offset) {
+    return offset;
+}
+
+[[gnu::noinline]] void __trigger_event(void *, uint32_t) { }
+
+} // extern "C"
+
+#endif // BENCH_HANDLER_CUSTOM_STUBS
+
+// Returns the IR text of the handler. Except for the name of the function and the value
+// that it returns after triggering the event, it is the same as tools/ir/automate-irq.lir.
+inline std::string automateIrqSource(const std::string &name = "automate_irq",
+        uint64_t result = 1) {
+    return R"(
+function ")" + name + R"(" {
+b0:
+    %0:pointer = argument
+    %1:pointer = loadOffset %0, 0
+    %2:int32 = loadOffset %0, 8
+    %3:int32 = const 4
+    %4:int32 = add %2, %3
+    %5:int32 = invoke "__mmio_read32"(%1, %4)
+    %6:int32 = const 23
+    %7:int32 = and %5, %6
+    branch %7, b1, b2
+    edge %8 <- %1
+    edge %9 <- %7
+b1:
+    %8:pointer = phi
+    %9:int32 = phi
+    invoke "__trigger_event"(%8, %9)
+    %10:int32 = const )" + std::to_string(result) + R"(
+    return %10
+b2:
+    %11:int32 = const 18446744073709551615
+    return %11
+}
+)";
+}
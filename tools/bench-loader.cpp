@@ -0,0 +1,164 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+// Compares the time that it takes to load, call and unload a small module through
+// elf::LoadedImage and through dlopen().
+// Usage: bench-loader [iterations] [threads]
+//
+// Each thread loads its own copy of the module, so that dlopen() cannot simply
+// bump the reference count of an already loaded object.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <lewis/ir-text.hpp>
+#include <lewis/pass-manager.hpp>
+#include <lewis/elf/file-emitter.hpp>
+#include <lewis/elf/loader.hpp>
+#include <lewis/elf/object.hpp>
+#include <lewis/elf/passes.hpp>
+#include <lewis/target-x86_64/arch-passes.hpp>
+#include <lewis/target-x86_64/arch-text.hpp>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+#include "bench-handler.hpp"
+
+using HandlerFunction = int32_t (*)(void *);
+
+namespace {
+
+std::vector<uint8_t> compileHandler() {
+    auto source = automateIrqSource();
+    lewis::Module mod;
+    lewis::IrParser parser{source.data(), source.size(),
+            lewis::targets::x86_64::textDialect()};
+    parser.parseModule(&mod);
+
+    lewis::PassManager pm;
+    pm.addBlockPass("lower-code", lewis::targets::x86_64::LowerCodePass::create);
+    pm.addFunctionPass("allocate-registers",
+            lewis::targets::x86_64::AllocateRegistersPass::create);
+    pm.run(&mod);
+
+    lewis::elf::Object elf;
+    lewis::targets::x86_64::MachineCodeEmitter mce{&elf};
+    mce.emit(&mod);
+    lewis::elf::CreateHeadersPass::create(&elf)->run();
+    lewis::elf::LayoutPass::create(&elf)->run();
+    lewis::elf::InternalLinkPass::create(&elf)->run();
+    auto emitter = lewis::elf::FileEmitter::create(&elf);
+    emitter->run();
+    return std::move(emitter->buffer);
+}
+
+void *resolve(const char *name) {
+    if (std::string{name} == "__mmio_read32")
+        return reinterpret_cast<void *>(&__mmio_read32);
+    if (std::string{name} == "__trigger_event")
+        return reinterpret_cast<void *>(&__trigger_event);
+    return nullptr;
+}
+
+// The handler returns 1 since (8 + 4) & 23 is non-zero.
+void checkResult(HandlerFunction fn) {
+    struct {
+        void *mmio;
+        uint32_t offset;
+    } device{nullptr, 8};
+    if (fn(&device) != 1)
+        throw std::runtime_error("Loaded handler returned a wrong result");
+}
+
+enum class Method {
+    buffer,
+    file,
+    dlopen
+};
+
+void loadRepeatedly(Method method, const std::vector<uint8_t> *image,
+        const std::string &path, size_t iterations) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Could not open " + path);
+    for (size_t i = 0; i < iterations; ++i) {
+        if (method == Method::buffer) {
+            auto loaded = lewis::elf::LoadedImage::load(image->data(), image->size(),
+                    resolve);
+            checkResult(reinterpret_cast<HandlerFunction>(loaded->lookup("automate_irq")));
+        } else if (method == Method::file) {
+            auto loaded = lewis::elf::LoadedImage::loadFromFile(fd, resolve);
+            checkResult(reinterpret_cast<HandlerFunction>(loaded->lookup("automate_irq")));
+        } else {
+            auto handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+            if (!handle)
+                throw std::runtime_error(std::string{"dlopen() failed: "} + dlerror());
+            checkResult(reinterpret_cast<HandlerFunction>(dlsym(handle, "automate_irq")));
+            dlclose(handle);
+        }
+    }
+    close(fd);
+}
+
+// Returns the time per load in nanoseconds.
+double measure(Method method, const std::vector<uint8_t> &image,
+        const std::vector<std::string> &paths, size_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto &path : paths)
+        threads.emplace_back(loadRepeatedly, method, &image, path, iterations);
+    for (auto &thread : threads)
+        thread.join();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count()
+            / (iterations * paths.size());
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    size_t iterations = 2000;
+    size_t numThreads = 4;
+    if (argc > 1)
+        iterations = std::strtoul(argv[1], nullptr, 0);
+    if (argc > 2)
+        numThreads = std::strtoul(argv[2], nullptr, 0);
+    if (!iterations || !numThreads) {
+        std::cerr << "usage: bench-loader [iterations] [threads]" << std::endl;
+        return 1;
+    }
+
+    auto image = compileHandler();
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < numThreads; ++i) {
+        char path[] = "/tmp/lewis-bench-loader-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0 || write(fd, image.data(), image.size()) != ssize_t(image.size()))
+            throw std::runtime_error("Could not write temporary file");
+        close(fd);
+        paths.push_back(path);
+    }
+
+    for (size_t n : {size_t(1), numThreads}) {
+        std::vector<std::string> threadPaths{paths.begin(), paths.begin() + n};
+        std::cout << n << " thread(s):" << std::endl;
+        std::cout << "    LoadedImage::load():         "
+                << measure(Method::buffer, image, threadPaths, iterations)
+                << " ns per load" << std::endl;
+        std::cout << "    LoadedImage::loadFromFile(): "
+                << measure(Method::file, image, threadPaths, iterations)
+                << " ns per load" << std::endl;
+        std::cout << "    dlopen():                    "
+                << measure(Method::dlopen, image, threadPaths, iterations)
+                << " ns per load" << std::endl;
+    }
+
+    for (auto &path : paths)
+        unlink(path.c_str());
+}
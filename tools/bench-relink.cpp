@@ -0,0 +1,218 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+// Compares the latency of swapping the code of a single handler by re-running
+// the whole ELF pipeline against MachineCodeEmitter::replace() plus the incremental
+// InternalLinkPass::update() and FileEmitter::update().
+// Usage: bench-relink [number of handlers] [iterations]
+//
+// Afterwards, the incrementally updated file is compared against a file that is emitted
+// from scratch and the handlers are called through elf::LoadedImage.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <lewis/ir-text.hpp>
+#include <lewis/pass-manager.hpp>
+#include <lewis/elf/file-emitter.hpp>
+#include <lewis/elf/loader.hpp>
+#include <lewis/elf/object.hpp>
+#include <lewis/elf/passes.hpp>
+#include <lewis/target-x86_64/arch-passes.hpp>
+#include <lewis/target-x86_64/arch-text.hpp>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+#include "bench-handler.hpp"
+
+using lewis::targets::x86_64::FunctionCode;
+using HandlerFunction = int32_t (*)(void *);
+
+namespace {
+
+// A larger handler that does not fit into the slack of the original one.
+const char *largeHandlerSource = R"(
+function "handler" {
+b0:
+    %0:pointer = argument
+    %1:pointer = loadOffset %0, 0
+    %2:int32 = loadOffset %0, 8
+    %3:int32 = invoke "__mmio_read32"(%1, %2)
+    %4:int32 = loadOffset %0, 8
+    %5:int32 = invoke "__mmio_read32"(%1, %4)
+    %6:int32 = add %3, %5
+    %7:int32 = loadOffset %0, 8
+    %8:int32 = invoke "__mmio_read32"(%1, %7)
+    %9:int32 = add %6, %8
+    %10:int32 = loadOffset %0, 8
+    %11:int32 = invoke "__mmio_read32"(%1, %10)
+    %12:int32 = add %9, %11
+    %13:int32 = loadOffset %0, 8
+    %14:int32 = invoke "__mmio_read32"(%1, %13)
+    %15:int32 = add %12, %14
+    return %15
+}
+)";
+
+FunctionCode compileHandler(const std::string &source, const std::string &name) {
+    lewis::Module mod;
+    lewis::IrParser parser{source.data(), source.size(),
+            lewis::targets::x86_64::textDialect()};
+    parser.parseModule(&mod);
+
+    lewis::PassManager pm;
+    pm.addBlockPass("lower-code", lewis::targets::x86_64::LowerCodePass::create);
+    pm.addFunctionPass("allocate-registers",
+            lewis::targets::x86_64::AllocateRegistersPass::create);
+    pm.run(&mod);
+
+    FunctionCode code;
+    for (auto fn : mod.functions()) {
+        lewis::targets::x86_64::MachineCodeEncoder encoder{fn};
+        encoder.run();
+        code = std::move(encoder.code);
+    }
+    code.name = name;
+    return code;
+}
+
+// An Object together with the passes that keep it up to date.
+struct Image {
+    Image(const std::vector<FunctionCode> &codes, int fd, size_t slack, size_t reserve)
+    : mce{&elf} {
+        mce.functionSlack = slack;
+        mce.textReserve = reserve;
+        for (auto &code : codes)
+            mce.emit(&code);
+        lewis::elf::CreateHeadersPass::create(&elf)->run();
+        lewis::elf::LayoutPass::create(&elf)->run();
+        link = lewis::elf::InternalLinkPass::create(&elf);
+        link->run();
+        emitter = lewis::elf::FileEmitter::createForFile(&elf, fd);
+        emitter->run();
+    }
+
+    void replace(const FunctionCode *code) {
+        if (!mce.replace(code))
+            throw std::runtime_error("Could not replace " + code->name + " in place");
+        link->update();
+        emitter->update();
+    }
+
+    lewis::elf::Object elf;
+    lewis::targets::x86_64::MachineCodeEmitter mce;
+    std::unique_ptr<lewis::elf::InternalLinkPass> link;
+    std::unique_ptr<lewis::elf::FileEmitter> emitter;
+};
+
+std::vector<uint8_t> readFile(int fd) {
+    std::vector<uint8_t> contents(lseek(fd, 0, SEEK_END));
+    if (pread(fd, contents.data(), contents.size(), 0) != ssize_t(contents.size()))
+        throw std::runtime_error("Could not read ELF file");
+    return contents;
+}
+
+void *resolve(const char *name) {
+    if (std::string{name} == "__mmio_read32")
+        return reinterpret_cast<void *>(&__mmio_read32);
+    if (std::string{name} == "__trigger_event")
+        return reinterpret_cast<void *>(&__trigger_event);
+    return nullptr;
+}
+
+int32_t callHandler(lewis::elf::LoadedImage *image, const std::string &name) {
+    struct {
+        void *mmio;
+        uint32_t offset;
+    } device{nullptr, 8};
+    auto fn = reinterpret_cast<HandlerFunction>(image->lookup(name.c_str()));
+    if (!fn)
+        throw std::runtime_error("Handler " + name + " is missing");
+    return fn(&device);
+}
+
+void check(bool condition, const char *message) {
+    if (!condition)
+        throw std::runtime_error(message);
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    size_t numHandlers = 1000;
+    size_t iterations = 1000;
+    if (argc > 1)
+        numHandlers = std::strtoul(argv[1], nullptr, 0);
+    if (argc > 2)
+        iterations = std::strtoul(argv[2], nullptr, 0);
+    if (numHandlers < 2 || !iterations) {
+        std::cerr << "usage: bench-relink [number of handlers] [iterations]" << std::endl;
+        return 1;
+    }
+
+    std::vector<FunctionCode> codes;
+    auto tier1 = compileHandler(automateIrqSource("handler", 1), "handler");
+    for (size_t i = 0; i < numHandlers; ++i) {
+        codes.push_back(tier1);
+        codes.back().name = "handler" + std::to_string(i);
+    }
+    auto hot = "handler" + std::to_string(numHandlers / 2);
+    auto tier2 = compileHandler(automateIrqSource("handler", 2), hot);
+    auto large = compileHandler(largeHandlerSource, hot);
+
+    char path[] = "/tmp/lewis-bench-relink-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        throw std::runtime_error("Could not create temporary file");
+    unlink(path);
+
+    // Relink everything after each swap.
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations / 10 + 1; ++i) {
+        codes[numHandlers / 2] = (i & 1) ? tier1 : tier2;
+        codes[numHandlers / 2].name = hot;
+        Image image{codes, fd, 0, 0};
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Full relink: " << std::chrono::duration<double, std::micro>(end - start).count()
+            / (iterations / 10 + 1) << " us per swap" << std::endl;
+
+    // Only update the swapped handler.
+    codes[numHandlers / 2] = tier1;
+    codes[numHandlers / 2].name = hot;
+    Image image{codes, fd, 25, 4096};
+    auto original = tier1;
+    original.name = hot;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        image.replace((i & 1) ? &original : &tier2);
+    end = std::chrono::steady_clock::now();
+    std::cout << "Incremental relink: "
+            << std::chrono::duration<double, std::micro>(end - start).count() / iterations
+            << " us per swap" << std::endl;
+
+    // The incremental updates must produce the same file as a full emission.
+    auto checkConsistency = [&] {
+        auto fresh = lewis::elf::FileEmitter::create(&image.elf);
+        fresh->run();
+        check(readFile(fd) == fresh->buffer, "Incremental update differs from full emission");
+    };
+    image.replace(&tier2);
+    checkConsistency();
+    auto loaded = lewis::elf::LoadedImage::loadFromFile(fd, resolve);
+    check(callHandler(loaded.get(), hot) == 2, "Replaced handler returns a wrong result");
+    check(callHandler(loaded.get(), "handler0") == 1, "Other handler returns a wrong result");
+
+    // The large handler is moved into the reserve at the end of .text.
+    image.replace(&large);
+    checkConsistency();
+    loaded = lewis::elf::LoadedImage::loadFromFile(fd, resolve);
+    check(callHandler(loaded.get(), hot) == 40, "Moved handler returns a wrong result");
+    check(callHandler(loaded.get(), "handler0") == 1, "Other handler returns a wrong result");
+    std::cout << "Incremental updates are consistent" << std::endl;
+    close(fd);
+}
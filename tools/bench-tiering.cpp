@@ -0,0 +1,160 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+// Exercises TieredRuntime: handlers are called from several threads while the
+// background thread recompiles them and patches their slots.
+// Usage: bench-tiering [number of handlers] [threads]
+//
+// Reports the time to add the handlers at tier 0, the time until all of them are
+// promoted to tier 1 and the cost of a call through the entry stub at both tiers.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <lewis/ir-text.hpp>
+#include <lewis/target-x86_64/arch-text.hpp>
+#include <lewis/target-x86_64/tiering.hpp>
+#include "bench-handler.hpp"
+
+using HandlerFunction = int32_t (*)(void *);
+
+namespace {
+
+// Calls back into another handler of the runtime, i.e., through its stub.
+const char *dispatchSource = R"(
+function "dispatch" {
+b0:
+    %0:pointer = argument
+    %1:int32 = invoke "handler0"(%0)
+    %2:int32 = const 1
+    %3:int32 = add %1, %2
+    return %3
+}
+)";
+
+void *resolve(const char *name) {
+    if (std::string{name} == "__mmio_read32")
+        return reinterpret_cast<void *>(&__mmio_read32);
+    if (std::string{name} == "__trigger_event")
+        return reinterpret_cast<void *>(&__trigger_event);
+    return nullptr;
+}
+
+struct Device {
+    void *mmio;
+    uint32_t offset;
+};
+
+void check(bool condition, const char *message) {
+    if (!condition)
+        throw std::runtime_error(message);
+}
+
+// Returns the time per call in nanoseconds.
+double timeCalls(HandlerFunction fn, size_t iterations) {
+    Device device{nullptr, 8};
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        check(fn(&device) == 1, "Handler returned a wrong result");
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    size_t numHandlers = 100;
+    size_t numThreads = 4;
+    if (argc > 1)
+        numHandlers = std::strtoul(argv[1], nullptr, 0);
+    if (argc > 2)
+        numThreads = std::strtoul(argv[2], nullptr, 0);
+    if (!numHandlers || !numThreads) {
+        std::cerr << "usage: bench-tiering [number of handlers] [threads]" << std::endl;
+        return 1;
+    }
+
+    std::string source;
+    for (size_t i = 0; i < numHandlers; ++i)
+        source += automateIrqSource("handler" + std::to_string(i));
+    source += dispatchSource;
+
+    lewis::Module mod;
+    lewis::IrParser parser{source.data(), source.size(),
+            lewis::targets::x86_64::textDialect()};
+    parser.parseModule(&mod);
+
+    lewis::targets::x86_64::TieredRuntime runtime{resolve};
+    runtime.hotThreshold = 100000;
+    runtime.pollInterval = std::chrono::microseconds{100};
+
+    auto start = std::chrono::steady_clock::now();
+    runtime.addModule(&mod);
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Tier-0 compilation: "
+            << std::chrono::duration<double, std::micro>(end - start).count()
+                    / (numHandlers + 1) << " us per handler" << std::endl;
+
+    std::vector<HandlerFunction> handlers;
+    for (size_t i = 0; i < numHandlers; ++i) {
+        auto entry = runtime.entry("handler" + std::to_string(i));
+        handlers.push_back(reinterpret_cast<HandlerFunction>(entry));
+    }
+    auto dispatch = reinterpret_cast<HandlerFunction>(runtime.entry("dispatch"));
+    Device device{nullptr, 8};
+    check(dispatch(&device) == 2, "Dispatcher returned a wrong result");
+
+    // Stay below the threshold, so that handler0 is not promoted yet.
+    auto tier0Time = timeCalls(handlers[0], runtime.hotThreshold / 2);
+    check(runtime.callCount("handler0") > runtime.hotThreshold / 2,
+            "Calls were not counted");
+
+    // Keep calling all handlers until they are promoted. Calls must return the right
+    // result regardless of whether they observe the old or the new slot.
+    start = std::chrono::steady_clock::now();
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&] {
+            Device device{nullptr, 8};
+            while (!done.load(std::memory_order_relaxed)) {
+                for (auto handler : handlers)
+                    check(handler(&device) == 1, "Handler returned a wrong result");
+            }
+        });
+    }
+    while (true) {
+        bool promoted = true;
+        for (size_t i = 0; i < numHandlers; ++i)
+            promoted = promoted && runtime.tier("handler" + std::to_string(i)) == 1;
+        if (promoted)
+            break;
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+    }
+    end = std::chrono::steady_clock::now();
+    done = true;
+    for (auto &thread : threads)
+        thread.join();
+    std::cout << "Promotion of all handlers: "
+            << std::chrono::duration<double, std::milli>(end - start).count()
+            << " ms" << std::endl;
+
+    auto tier1Time = timeCalls(handlers[0], 1000000);
+    std::cout << "Call through stub: " << tier0Time << " ns at tier 0, "
+            << tier1Time << " ns at tier 1" << std::endl;
+
+    // The dispatcher is still at tier 0 but now calls the tier-1 code of handler0.
+    check(runtime.tier("dispatch") == 0, "Dispatcher was promoted too early");
+    check(dispatch(&device) == 2, "Dispatcher returned a wrong result");
+    runtime.requestRecompile("dispatch");
+    runtime.drain();
+    check(runtime.tier("dispatch") == 1, "Dispatcher was not promoted");
+    check(dispatch(&device) == 2, "Dispatcher returned a wrong result");
+    std::cout << "All calls returned the right result" << std::endl;
+}
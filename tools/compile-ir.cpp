@@ -0,0 +1,121 @@
+// Copyright the lewis authors (AUTHORS.md) 2018
+// SPDX-License-Identifier: MIT
+
+// Compiles a file in the textual IR syntax to an ELF object.
+// Usage: compile-ir [--print-after=<pass>|--print-after-all] [--stats] [--trace=<file>]
+//         [--relocatable] [--optimize] <input> [output]
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <lewis/ir-text.hpp>
+#include <lewis/opt-passes.hpp>
+#include <lewis/pass-manager.hpp>
+#include <lewis/statistics.hpp>
+#include <lewis/elf/object.hpp>
+#include <lewis/elf/passes.hpp>
+#include <lewis/elf/file-emitter.hpp>
+#include <lewis/target-x86_64/arch-passes.hpp>
+#include <lewis/target-x86_64/arch-text.hpp>
+#include <lewis/target-x86_64/mc-emitter.hpp>
+
+int main(int argc, char **argv) {
+    const char *input = nullptr;
+    const char *output = "a.out";
+    bool printAfter = false;
+    std::string printPassName;
+    bool printStats = false;
+    const char *traceFile = nullptr;
+    bool relocatable = false;
+    bool optimize = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--print-after-all")) {
+            printAfter = true;
+        } else if (!strncmp(argv[i], "--print-after=", 14)) {
+            printAfter = true;
+            printPassName = argv[i] + 14;
+        } else if (!strcmp(argv[i], "--stats")) {
+            printStats = true;
+        } else if (!strncmp(argv[i], "--trace=", 8)) {
+            traceFile = argv[i] + 8;
+        } else if (!strcmp(argv[i], "--relocatable")) {
+            relocatable = true;
+        } else if (!strcmp(argv[i], "--optimize")) {
+            optimize = true;
+        } else if (!input) {
+            input = argv[i];
+        } else {
+            output = argv[i];
+        }
+    }
+    if (!input) {
+        std::cerr << "usage: compile-ir [--print-after=<pass>|--print-after-all]"
+                " [--stats] [--trace=<file>] [--relocatable] [--optimize] <input> [output]"
+                << std::endl;
+        return 1;
+    }
+
+    if ((printStats || traceFile) && !lewis::statisticsEnabled)
+        std::cerr << "compile-ir: statistics are disabled in this build" << std::endl;
+    lewis::StatisticsCollector collector;
+    if (printStats || traceFile)
+        lewis::setStatisticsCollector(&collector);
+
+    std::ifstream in{input};
+    if (!in)
+        throw std::runtime_error("Could not open input file");
+    std::stringstream text;
+    text << in.rdbuf();
+    auto source = text.str();
+
+    lewis::Module mod;
+    lewis::IrParser parser{source.data(), source.size(),
+            lewis::targets::x86_64::textDialect()};
+    parser.parseModule(&mod);
+
+    lewis::PassManager pm;
+    if (optimize)
+        pm.addFunctionPass("licm", lewis::LoopInvariantCodeMotionPass::create);
+    pm.addBlockPass("lower-code", lewis::targets::x86_64::LowerCodePass::create);
+    pm.addFunctionPass("allocate-registers",
+            lewis::targets::x86_64::AllocateRegistersPass::create);
+    if (optimize)
+        pm.addBlockPass("peephole", lewis::targets::x86_64::PeepholePass::create);
+    if (printAfter)
+        pm.printAfter(&std::cout, lewis::targets::x86_64::textDialect(), printPassName);
+    pm.run(&mod);
+
+    lewis::elf::Object elf;
+    if (relocatable)
+        elf.fileType = lewis::elf::FileType::relocatable;
+    lewis::targets::x86_64::MachineCodeEmitter mce{&elf};
+    mce.emit(&mod);
+
+    auto headers_pass = lewis::elf::CreateHeadersPass::create(&elf);
+    auto layout_pass = lewis::elf::LayoutPass::create(&elf);
+    auto link_pass = lewis::elf::InternalLinkPass::create(&elf);
+    headers_pass->run();
+    layout_pass->run();
+    link_pass->run();
+
+    int fd = open(output, O_WRONLY | O_CREAT, 0755);
+    if (fd < 0)
+        throw std::runtime_error("Could not open output file");
+    auto file_emitter = lewis::elf::FileEmitter::createForFile(&elf, fd);
+    file_emitter->run();
+    close(fd);
+
+    if (printStats)
+        collector.print(std::cout);
+    if (traceFile) {
+        std::ofstream trace{traceFile};
+        collector.writeChromeTrace(trace);
+        if (!trace)
+            throw std::runtime_error("Could not write trace file");
+    }
+    lewis::setStatisticsCollector(nullptr);
+}
@@ -1,7 +1,11 @@
 // Copyright the lewis authors (AUTHORS.md) 2018
 // SPDX-License-Identifier: MIT
 
+#include <iostream>
 #include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <lewis/pass-manager.hpp>
 #include <lewis/elf/object.hpp>
 #include <lewis/elf/passes.hpp>
 #include <lewis/elf/file-emitter.hpp>
@@ -90,16 +94,16 @@ int main() {
     auto br2 = b2->setBranch(std::make_unique<lewis::FunctionReturnBranch>(1));
     br2->operand(0) = v9;
 
-    for (auto bb : f0.blocks()) {
-        auto lo = lewis::targets::x86_64::LowerCodePass::create(bb);
-        lo->run();
-    }
-    auto ra = lewis::targets::x86_64::AllocateRegistersPass::create(&f0);
-    ra->run();
+    lewis::PassManager pm;
+    pm.addBlockPass("lower-code", lewis::targets::x86_64::LowerCodePass::create);
+    pm.addFunctionPass("allocate-registers",
+            lewis::targets::x86_64::AllocateRegistersPass::create);
+    pm.run(&f0);
+    pm.printStatistics(std::cout);
 
     lewis::elf::Object elf;
-    lewis::targets::x86_64::MachineCodeEmitter mce{&f0, &elf};
-    mce.run();
+    lewis::targets::x86_64::MachineCodeEmitter mce{&elf};
+    mce.emit(&f0);
 
     // Create headers and layout the file.
     auto headers_pass = lewis::elf::CreateHeadersPass::create(&elf);
@@ -109,18 +113,11 @@ int main() {
     layout_pass->run();
     link_pass->run();
 
-    // Compose the output file.
-    auto file_emitter = lewis::elf::FileEmitter::create(&elf);
-    file_emitter->run();
-
     // Write the output file.
-    FILE *stream;
-    if(!(stream = fopen("a.out", "wb")))
+    int fd = open("a.out", O_WRONLY | O_CREAT, 0755);
+    if(fd < 0)
         throw std::runtime_error("Could not open output file");
-    auto written = fwrite(file_emitter->buffer.data(), sizeof(uint8_t),
-        file_emitter->buffer.size(), stream);
-    if(written != file_emitter->buffer.size())
-        throw std::runtime_error("Could not write buffer to FILE");
-
-    fclose(stream);
+    auto file_emitter = lewis::elf::FileEmitter::createForFile(&elf, fd);
+    file_emitter->run();
+    close(fd);
 }